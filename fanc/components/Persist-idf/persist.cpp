@@ -0,0 +1,182 @@
+/* Persist-idf write-behind settings
+
+   Copywrite Brian Bulkowski, 2020
+
+   See persist.h. No ESP-IDF in here, it builds anywhere: the store is
+   whatever's in the persist_store_t.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "persist.h"
+
+void persist_init(persist_t *p, persist_entry_t *entries, int max_entries, uint32_t debounce_ms, uint32_t max_delay_ms) {
+  memset(p, 0, sizeof(persist_t));
+  p->entries = entries;
+  p->max_entries = max_entries;
+  p->debounce_ms = debounce_ms;
+  p->max_delay_ms = max_delay_ms < debounce_ms ? debounce_ms : max_delay_ms;
+}
+
+int persist_add(persist_t *p, const char *key, int32_t dflt) {
+  if (p->n_entries == p->max_entries) return(-1);
+  if (strlen(key) >= PERSIST_KEY_MAX) return(-1);
+  persist_entry_t *e = &p->entries[p->n_entries];
+  memset(e, 0, sizeof(persist_entry_t));
+  strcpy(e->key, key);
+  e->value = dflt;
+  e->stored = dflt;
+  return(p->n_entries++);
+}
+
+int persist_find(const persist_t *p, const char *key) {
+  for (int i = 0; i < p->n_entries; i++) {
+    if (strcmp(p->entries[i].key, key) == 0) return(i);
+  }
+  return(-1);
+}
+
+int persist_load(persist_t *p, const persist_store_t *store) {
+
+  if (store->begin && !store->begin(store->ctx, false)) return(0);
+
+  int found = 0;
+  for (int i = 0; i < p->n_entries; i++) {
+    persist_entry_t *e = &p->entries[i];
+    int32_t v;
+    if (!store->get(store->ctx, e->key, &v)) continue;
+    e->value = v;
+    e->stored = v;
+    e->present = true;
+    found++;
+  }
+
+  int32_t lw;
+  if (store->get(store->ctx, PERSIST_WRITES_KEY, &lw)) p->lifetime_writes = (uint32_t) lw;
+
+  if (store->end) store->end(store->ctx);
+  return(found);
+}
+
+int32_t persist_get(const persist_t *p, int idx) {
+  if (idx < 0 || idx >= p->n_entries) return(0);
+  return(p->entries[idx].value);
+}
+
+bool persist_present(const persist_t *p, int idx) {
+  if (idx < 0 || idx >= p->n_entries) return(false);
+  return(p->entries[idx].present);
+}
+
+void persist_set(persist_t *p, int idx, int32_t v, uint32_t now_ms) {
+
+  if (idx < 0 || idx >= p->n_entries) return;
+  persist_entry_t *e = &p->entries[idx];
+
+  if (e->value == v) {
+    p->unchanged++;
+    return;
+  }
+  // the value first, then pending: see persist.h
+  e->value = v;
+  p->sets++;
+  p->last_ms = now_ms;
+  if (!p->pending) {
+    p->first_ms = now_ms;
+    p->pending = true;
+  }
+}
+
+bool persist_due(const persist_t *p, uint32_t now_ms) {
+  if (!p->pending) return(false);
+  // unsigned, so it's right across the wrap
+  if (now_ms - p->last_ms >= p->debounce_ms) return(true);
+  if (now_ms - p->first_ms >= p->max_delay_ms) return(true);
+  return(false);
+}
+
+static bool persist_changed(const persist_t *p) {
+  for (int i = 0; i < p->n_entries; i++) {
+    if (p->entries[i].value != p->entries[i].stored) return(true);
+  }
+  return(false);
+}
+
+int persist_flush(persist_t *p, const persist_store_t *store, uint32_t now_ms) {
+
+  // before looking, so a set from now on marks the next one
+  p->pending = false;
+
+  // dragged away and back again is nothing to write, don't even open it
+  if (!persist_changed(p)) return(0);
+
+  // a store that didn't open isn't closed either
+  bool opened = !store->begin || store->begin(store->ctx, true);
+  bool ok = opened;
+
+  // remember what went out, so a set while we're at it isn't lost
+  int n = 0;
+  for (int i = 0; ok && i < p->n_entries; i++) {
+    persist_entry_t *e = &p->entries[i];
+    int32_t v = e->value;
+    e->flushing = v;
+    if (v == e->stored) continue;
+    if (!store->set(store->ctx, e->key, v)) {
+      ok = false;
+      break;
+    }
+    n++;
+  }
+
+  // the count is a write too, and it counts itself
+  if (ok) ok = store->set(store->ctx, PERSIST_WRITES_KEY, (int32_t) (p->lifetime_writes + n + 1));
+  if (ok) ok = store->commit(store->ctx);
+  if (opened && store->end) store->end(store->ctx);
+
+  if (!ok) {
+    // try again once it's been quiet, not on every poll
+    p->fails++;
+    p->first_ms = now_ms;
+    p->last_ms = now_ms;
+    p->pending = true;
+    return(-1);
+  }
+
+  for (int i = 0; i < p->n_entries; i++) {
+    persist_entry_t *e = &p->entries[i];
+    if (e->flushing == e->stored) continue;
+    e->stored = e->flushing;
+    e->present = true;
+    e->writes++;
+  }
+  p->writes += n + 1;
+  p->lifetime_writes += n + 1;
+  p->flushes++;
+
+  // something that came in while we were writing
+  if (persist_changed(p) && !p->pending) {
+    p->first_ms = now_ms;
+    p->last_ms = now_ms;
+    p->pending = true;
+  }
+  return(n);
+}
+
+int persist_poll(persist_t *p, const persist_store_t *store, uint32_t now_ms) {
+  if (!persist_due(p, now_ms)) return(0);
+  return( persist_flush(p, store, now_ms) );
+}
+
+void persist_stats_get(const persist_t *p, persist_stats_t *st) {
+  st->sets = p->sets;
+  st->unchanged = p->unchanged;
+  st->flushes = p->flushes;
+  st->writes = p->writes;
+  st->fails = p->fails;
+  st->lifetime_writes = p->lifetime_writes;
+  st->pending = p->pending;
+}
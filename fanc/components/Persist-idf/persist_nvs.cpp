@@ -0,0 +1,93 @@
+/* Persist-idf NVS store
+
+   Copywrite Brian Bulkowski, 2020
+
+   persist_store_t on an NVS namespace. Opened for each load or flush and
+   closed after, a handle costs RAM and there's nothing to gain keeping it.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_err.h"
+
+#include "esp_log.h"
+static const char *TAG = "persist";
+
+#include "persist.h"
+
+static bool persist_nvs_begin(void *ctx, bool write) {
+  persist_nvs_t *nvs = (persist_nvs_t *) ctx;
+  nvs_handle_t h;
+  esp_err_t err = nvs_open(nvs->ns, write ? NVS_READWRITE : NVS_READONLY, &h);
+  if (err != ESP_OK) {
+    // not there yet is normal on a fresh board, the first write makes it
+    if (err == ESP_ERR_NVS_NOT_FOUND && !write) ESP_LOGI(TAG, "%s: nothing saved yet", nvs->ns);
+    else ESP_LOGW(TAG, "%s: Error (%s) opening NVS handle!", nvs->ns, esp_err_to_name(err));
+    return(false);
+  }
+  nvs->handle = h;
+  return(true);
+}
+
+static bool persist_nvs_get(void *ctx, const char *key, int32_t *v) {
+  persist_nvs_t *nvs = (persist_nvs_t *) ctx;
+  esp_err_t err = nvs_get_i32(nvs->handle, key, v);
+  if (err == ESP_OK) {
+    ESP_LOGD(TAG, "Retrieved: %s is %d", key, *v);
+    return(true);
+  }
+  if (err != ESP_ERR_NVS_NOT_FOUND) ESP_LOGW(TAG, "Error (%s) reading %s!", esp_err_to_name(err), key);
+  return(false);
+}
+
+static bool persist_nvs_set(void *ctx, const char *key, int32_t v) {
+  persist_nvs_t *nvs = (persist_nvs_t *) ctx;
+  esp_err_t err = nvs_set_i32(nvs->handle, key, v);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error (%s) writing %s!", esp_err_to_name(err), key);
+    return(false);
+  }
+  return(true);
+}
+
+static bool persist_nvs_commit(void *ctx) {
+  persist_nvs_t *nvs = (persist_nvs_t *) ctx;
+  esp_err_t err = nvs_commit(nvs->handle);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "%s: NVS Commit failed!", nvs->ns);
+    return(false);
+  }
+  ESP_LOGD(TAG, "%s: NVS commit done", nvs->ns);
+  return(true);
+}
+
+static void persist_nvs_end(void *ctx) {
+  persist_nvs_t *nvs = (persist_nvs_t *) ctx;
+  nvs_close(nvs->handle);
+}
+
+void persist_nvs_store(persist_store_t *store, persist_nvs_t *nvs, const char *ns) {
+  nvs->ns = ns;
+  nvs->handle = 0;
+  store->begin = persist_nvs_begin;
+  store->get = persist_nvs_get;
+  store->set = persist_nvs_set;
+  store->commit = persist_nvs_commit;
+  store->end = persist_nvs_end;
+  store->ctx = nvs;
+}
+
+bool persist_nvs_usage_get(persist_nvs_usage_t *u) {
+  nvs_stats_t st;
+  if (nvs_get_stats(NULL, &st) != ESP_OK) return(false);
+  u->used = st.used_entries;
+  u->free = st.free_entries;
+  u->total = st.total_entries;
+  return(true);
+}
@@ -0,0 +1,179 @@
+/* RestRouter-idf
+
+** The handler for /rest/ that every one of these little servers had a copy of.
+**
+** An application describes its endpoints in a table: the name ( the last
+** part of the path ), a type, a range, and a getter and setter. GET sends
+** the value as text, POST takes {"name":value}, checks the type and range,
+** and calls the setter. Anything that doesn't fit gets a custom handler.
+**
+** Lookup is by hash, built once when the router is initialized. Request
+** bodies have a size limit and are read into one shared buffer: the httpd
+** task runs one request at a time, so nothing is malloc'd per request.
+**
+** Copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#include "rest_json.h"
+
+// largest request body we'll take
+#define REST_CONTENT_MAX 1024
+// tokens for parsing one body
+#define REST_TOKENS_MAX 128
+// routes in one router
+#define REST_ROUTES_MAX 32
+
+typedef enum {
+  REST_INT,
+  REST_BOOL,    // int getter / setter, 0 or 1, true / false in JSON
+  REST_ENUM,    // int getter / setter, posted as a name from enum_names or its index
+  REST_FLOAT,
+  REST_CUSTOM   // handler does everything
+} rest_type_t;
+
+// content is the NUL terminated body, or NULL if there wasn't one
+typedef esp_err_t (*rest_handler_fn)(httpd_req_t *req, const char *content);
+
+typedef struct {
+  const char *name;
+  rest_type_t type;
+  int min;                      // INT range, inclusive. ENUM and BOOL work it out.
+  int max;
+  int (*get_int)(void);         // INT, BOOL, ENUM
+  esp_err_t (*set_int)(int);    // NULL: read only
+  float (*get_float)(void);     // FLOAT
+  esp_err_t (*set_float)(float);
+  int decimals;                 // FLOAT, when sent
+  const char * const *enum_names; // ENUM, NULL terminated
+  rest_handler_fn handler;      // CUSTOM
+} rest_route_t;
+
+// so tables read well
+#define REST_ROUTE_INT(name, min, max, get, set) \
+  { name, REST_INT, min, max, get, set, NULL, NULL, 0, NULL, NULL }
+#define REST_ROUTE_BOOL(name, get, set) \
+  { name, REST_BOOL, 0, 1, get, set, NULL, NULL, 0, NULL, NULL }
+#define REST_ROUTE_ENUM(name, names, get, set) \
+  { name, REST_ENUM, 0, 0, get, set, NULL, NULL, 0, names, NULL }
+#define REST_ROUTE_FLOAT(name, decimals, get, set) \
+  { name, REST_FLOAT, 0, 0, NULL, NULL, get, set, decimals, NULL, NULL }
+#define REST_ROUTE_CUSTOM(name, handler) \
+  { name, REST_CUSTOM, 0, 0, NULL, NULL, NULL, NULL, 0, NULL, handler }
+
+#define REST_ROUTER_SLOTS (REST_ROUTES_MAX * 2)
+
+typedef struct {
+  const rest_route_t *routes;
+  int n_routes;
+  uint8_t slots[REST_ROUTER_SLOTS];  // route index + 1, 0 is empty
+} rest_router_t;
+
+esp_err_t rest_router_init(rest_router_t *r, const rest_route_t *routes, int n_routes);
+
+// the route for a name, or NULL
+const rest_route_t *rest_router_find(const rest_router_t *r, const char *name);
+
+// register this as the handler for /rest/ URIs, with user_ctx pointing at the router
+esp_err_t rest_router_handler(httpd_req_t *req);
+
+// custom handlers can parse their body with the shared tokens. Returns the
+// number of tokens or a JSON_ERR.
+int rest_parse(const char *content, const json_tok_t **toks);
+
+// the int value of field in the root object of content
+esp_err_t rest_json_int(const char *content, const char *field, int *val);
+
+// the ones every app has
+esp_err_t rest_uptime_handler(httpd_req_t *req, const char *content);
+esp_err_t rest_epoch_handler(httpd_req_t *req, const char *content);
+
+/*
+** Server setup and metrics
+**
+** Connections are kept alive, so a dashboard polling or fetching assets
+** doesn't pay for a TCP setup every time. When all the sockets are in use,
+** the least recently used one is closed to make room for a new client
+** ( lru_purge ), rather than the new client waiting in the backlog.
+**
+** Websockets are open for as long as the page is, and mostly idle from
+** the browser's side. So they don't get purged before a keep-alive
+** connection nobody's using, whoever pushes to them calls
+** rest_server_keep() as they do, which keeps them the most recently used.
+** A server holds at most REST_MAX_OPEN_SOCKETS - REST_HTTP_SOCKETS of them,
+** so there are always sockets to purge for ordinary requests.
+*/
+
+// httpd takes 3 more for itself, and lwip only has CONFIG_LWIP_MAX_SOCKETS
+#ifndef REST_MAX_OPEN_SOCKETS
+#define REST_MAX_OPEN_SOCKETS 9
+#endif
+#define REST_BACKLOG 8
+
+// sockets never held by websockets: a page load, a REST call, one to purge
+#define REST_HTTP_SOCKETS 3
+#define REST_WS_MAX_CLIENTS (REST_MAX_OPEN_SOCKETS - REST_HTTP_SOCKETS)
+
+typedef struct {
+  uint32_t requests;
+  uint32_t response_us_avg;   // moving average
+  uint32_t response_us_max;
+  uint32_t sockets_open;
+  uint32_t sockets_peak;
+  uint32_t sockets_total;     // opened since boot
+} rest_server_stats_t;
+
+// call on the config before httpd_start
+void rest_server_config(httpd_config_t *config);
+
+// handlers outside the router call this when they're done, with esp_timer_get_time() from the start
+void rest_server_request_done(int64_t start);
+
+void rest_server_stats_get(rest_server_stats_t *stats);
+
+// a long lived connection was just used, purge others before it
+void rest_server_keep(httpd_handle_t hd, int sockfd);
+
+// stats as JSON
+esp_err_t rest_server_stats_handler(httpd_req_t *req, const char *content);
+
+/*
+** Static files
+**
+** The pages and scripts the app embeds, each with an optional gzipped copy
+** the build makes, sent to browsers that take gzip. Each copy has its own
+** strong ETag, the hash of its own bytes: with Vary: Accept-Encoding a cache
+** keeps the two apart, and revalidating one must never get a 304 for the
+** other. If-None-Match is checked against the copy that would be sent.
+** Bodies go out in REST_STATIC_CHUNK pieces, so the socket doesn't have to
+** take it all at once.
+*/
+
+#define REST_STATIC_CHUNK 4096
+
+typedef struct {
+  const char *name;
+  const char *content_type;
+  const uint8_t *buf;
+  ssize_t buf_len;
+  const uint8_t *gz_buf;   // NULL if there's no gzipped copy
+  ssize_t gz_len;
+  const char *etag;        // quoted
+  const char *gz_etag;
+} rest_static_t;
+
+// a 304 if the browser has the copy it would get, otherwise that copy
+esp_err_t rest_static_send(httpd_req_t *req, const rest_static_t *content);
@@ -0,0 +1,312 @@
+/* RestRouter-idf JSON writer and tokenizer
+
+   Copywrite Brian Bulkowski, 2020
+
+   See rest_json.h. cJSON builds a tree of mallocs for every request just to
+   pull out one int; this reads the text where it lies, and writes straight
+   into the response.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "rest_json.h"
+
+/*
+** writer
+*/
+
+void json_writer_init(json_writer_t *w, char *buf, size_t buf_len, json_flush_fn flush, void *flush_ctx) {
+  w->buf = buf;
+  w->buf_len = buf_len;
+  w->off = 0;
+  w->flush = flush;
+  w->flush_ctx = flush_ctx;
+  w->error = false;
+  w->depth = 0;
+  w->has_items = 0;
+}
+
+static void json_putc(json_writer_t *w, char c) {
+  if (w->error) return;
+  if (w->off == w->buf_len) {
+    if (!w->flush || !w->flush(w->flush_ctx, w->buf, w->off)) {
+      w->error = true;
+      return;
+    }
+    w->off = 0;
+  }
+  w->buf[w->off++] = c;
+}
+
+static void json_puts(json_writer_t *w, const char *s) {
+  while (*s) json_putc(w, *s++);
+}
+
+static void json_put_escaped(json_writer_t *w, const char *s) {
+  static const char hex[] = "0123456789abcdef";
+  json_putc(w, '"');
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      json_putc(w, '\\');
+      json_putc(w, c);
+    }
+    else if (c < 0x20) {
+      json_puts(w, "\\u00");
+      json_putc(w, hex[c >> 4]);
+      json_putc(w, hex[c & 0xf]);
+    }
+    else {
+      json_putc(w, c);
+    }
+  }
+  json_putc(w, '"');
+}
+
+// comma if needed, then "key":
+static void json_prefix(json_writer_t *w, const char *key) {
+  uint32_t bit = 1u << w->depth;
+  if (w->has_items & bit) json_putc(w, ',');
+  w->has_items |= bit;
+  if (key) {
+    json_put_escaped(w, key);
+    json_putc(w, ':');
+  }
+}
+
+static void json_open(json_writer_t *w, const char *key, char c) {
+  json_prefix(w, key);
+  json_putc(w, c);
+  if (w->depth + 1 >= JSON_MAX_DEPTH) {
+    w->error = true;
+    return;
+  }
+  w->depth++;
+  w->has_items &= ~(1u << w->depth);
+}
+
+static void json_close(json_writer_t *w, char c) {
+  if (w->depth == 0) {
+    w->error = true;
+    return;
+  }
+  w->depth--;
+  json_putc(w, c);
+}
+
+void json_obj_begin(json_writer_t *w, const char *key) { json_open(w, key, '{'); }
+void json_obj_end(json_writer_t *w) { json_close(w, '}'); }
+void json_arr_begin(json_writer_t *w, const char *key) { json_open(w, key, '['); }
+void json_arr_end(json_writer_t *w) { json_close(w, ']'); }
+
+void json_int(json_writer_t *w, const char *key, int64_t value) {
+  char num[24];
+  snprintf(num, sizeof(num), "%" PRId64, value);
+  json_prefix(w, key);
+  json_puts(w, num);
+}
+
+void json_bool(json_writer_t *w, const char *key, bool value) {
+  json_prefix(w, key);
+  json_puts(w, value ? "true" : "false");
+}
+
+void json_str(json_writer_t *w, const char *key, const char *value) {
+  json_prefix(w, key);
+  json_put_escaped(w, value);
+}
+
+int json_writer_finish(json_writer_t *w) {
+  if (w->error || w->depth != 0) return(-1);
+  if (w->flush && w->off > 0) {
+    if (!w->flush(w->flush_ctx, w->buf, w->off)) return(-1);
+    w->off = 0;
+  }
+  return((int) w->off);
+}
+
+/*
+** tokenizer
+*/
+
+static int json_tok_new(json_tok_t *toks, int max_toks, int *n, json_type_t type, int start, int end) {
+  if (*n >= max_toks) return(JSON_ERR_NOMEM);
+  json_tok_t *t = &toks[*n];
+  t->type = type;
+  t->start = start;
+  t->end = end;
+  t->size = 0;
+  return((*n)++);
+}
+
+int json_parse(const char *js, size_t len, json_tok_t *toks, int max_toks) {
+
+  int n = 0;
+  // open containers
+  int stack[JSON_MAX_DEPTH];
+  int depth = 0;
+  // a value is allowed here ( as opposed to , : or a close )
+  bool want_value = true;
+  bool done = false;
+
+  for (size_t pos = 0; pos < len; pos++) {
+    char c = js[pos];
+
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+    if (done) return(JSON_ERR_INVAL);
+
+    json_tok_t *parent = depth ? &toks[stack[depth - 1]] : NULL;
+    // inside an object, even children are keys, which must be strings
+    bool want_key = parent && parent->type == JSON_OBJECT && (parent->size % 2) == 0;
+
+    switch (c) {
+
+      case '{':
+      case '[': {
+        if (!want_value || want_key) return(JSON_ERR_INVAL);
+        if (depth == JSON_MAX_DEPTH) return(JSON_ERR_NOMEM);
+        int t = json_tok_new(toks, max_toks, &n, c == '{' ? JSON_OBJECT : JSON_ARRAY, pos, -1);
+        if (t < 0) return(t);
+        if (parent) parent->size++;
+        stack[depth++] = t;
+        want_value = true;
+        break;
+      }
+
+      case '}':
+      case ']': {
+        if (!parent) return(JSON_ERR_INVAL);
+        if (parent->type != (c == '}' ? JSON_OBJECT : JSON_ARRAY)) return(JSON_ERR_INVAL);
+        // no dangling key, and no trailing comma
+        if (parent->type == JSON_OBJECT && (parent->size % 2) != 0) return(JSON_ERR_INVAL);
+        if (want_value && parent->size > 0) return(JSON_ERR_INVAL);
+        parent->end = pos + 1;
+        depth--;
+        want_value = false;
+        if (depth == 0) done = true;
+        break;
+      }
+
+      case ':':
+        if (want_value || !parent || parent->type != JSON_OBJECT || (parent->size % 2) != 1) return(JSON_ERR_INVAL);
+        want_value = true;
+        break;
+
+      case ',':
+        // only after a value - in an object, not after a key
+        if (want_value || !parent) return(JSON_ERR_INVAL);
+        if (parent->type == JSON_OBJECT && (parent->size % 2) != 0) return(JSON_ERR_INVAL);
+        want_value = true;
+        break;
+
+      case '"': {
+        if (!want_value) return(JSON_ERR_INVAL);
+        size_t start = pos + 1;
+        for (pos = start; pos < len && js[pos] != '"'; pos++) {
+          if (js[pos] == '\\') pos++;
+          else if ((unsigned char) js[pos] < 0x20) return(JSON_ERR_INVAL);
+        }
+        if (pos >= len) return(JSON_ERR_PART);
+        int t = json_tok_new(toks, max_toks, &n, JSON_STRING, start, pos);
+        if (t < 0) return(t);
+        if (parent) parent->size++;
+        // a key wants a ':' next, which checks want_value is false
+        want_value = false;
+        if (!parent) done = true;
+        break;
+      }
+
+      default: {
+        if (!want_value || want_key) return(JSON_ERR_INVAL);
+        if (!(c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n')) return(JSON_ERR_INVAL);
+        size_t start = pos;
+        for (; pos < len; pos++) {
+          char p = js[pos];
+          if (p == ',' || p == ']' || p == '}' || p == ':' ||
+              p == ' ' || p == '\t' || p == '\r' || p == '\n') break;
+          if ((unsigned char) p < 0x20 || (unsigned char) p >= 0x7f) return(JSON_ERR_INVAL);
+        }
+        int t = json_tok_new(toks, max_toks, &n, JSON_PRIMITIVE, start, pos);
+        if (t < 0) return(t);
+        if (parent) parent->size++;
+        want_value = false;
+        if (!parent) done = true;
+        pos--; // the loop steps past the delimiter otherwise
+        break;
+      }
+    }
+  }
+
+  if (depth != 0 || n == 0) return(JSON_ERR_PART);
+  return(n);
+}
+
+int json_skip(const json_tok_t *toks, int n_toks, int i) {
+  int end = toks[i].end;
+  for (i++; i < n_toks && toks[i].start < end; i++) ;
+  return(i);
+}
+
+int json_obj_get(const char *js, const json_tok_t *toks, int n_toks, int obj, const char *key) {
+  if (obj < 0 || obj >= n_toks || toks[obj].type != JSON_OBJECT) return(-1);
+  int i = obj + 1;
+  for (int child = 0; child + 1 < toks[obj].size; child += 2) {
+    int value = i + 1;
+    if (value >= n_toks) return(-1);
+    if (json_tok_eq(js, &toks[i], key)) return(value);
+    i = json_skip(toks, n_toks, value);
+  }
+  return(-1);
+}
+
+bool json_tok_eq(const char *js, const json_tok_t *tok, const char *s) {
+  size_t len = tok->end - tok->start;
+  return( tok->type == JSON_STRING && strlen(s) == len && strncmp(js + tok->start, s, len) == 0 );
+}
+
+bool json_tok_int(const char *js, const json_tok_t *tok, int *value) {
+  if (tok->type != JSON_PRIMITIVE) return(false);
+  int i = tok->start;
+  bool neg = false;
+  if (js[i] == '-') {
+    neg = true;
+    i++;
+  }
+  if (i >= tok->end) return(false);
+  int64_t v = 0;
+  for (; i < tok->end; i++) {
+    if (js[i] < '0' || js[i] > '9') return(false);
+    v = v * 10 + (js[i] - '0');
+    if (v > INT32_MAX) return(false);
+  }
+  *value = (int) (neg ? -v : v);
+  return(true);
+}
+
+bool json_tok_bool(const char *js, const json_tok_t *tok, bool *value) {
+  if (tok->type != JSON_PRIMITIVE) return(false);
+  size_t len = tok->end - tok->start;
+  if (len == 4 && strncmp(js + tok->start, "true", 4) == 0) *value = true;
+  else if (len == 5 && strncmp(js + tok->start, "false", 5) == 0) *value = false;
+  else return(false);
+  return(true);
+}
+
+bool json_tok_float(const char *js, const json_tok_t *tok, float *value) {
+  if (tok->type != JSON_PRIMITIVE) return(false);
+  // the token isn't terminated, and strtof wants it to be
+  char num[32];
+  size_t len = tok->end - tok->start;
+  if (len == 0 || len >= sizeof(num)) return(false);
+  memcpy(num, js + tok->start, len);
+  num[len] = 0;
+  char *end;
+  *value = strtof(num, &end);
+  return( end == num + len );
+}
@@ -0,0 +1,286 @@
+/* RestRouter-idf
+
+   Copyright Brian Bulkowski, (c) 2020
+
+   See rest_router.h.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+
+#include "esp_log.h"
+static const char *TAG = "rest_router";
+
+#include "rest_router.h"
+
+// one request at a time on the httpd task, so these are shared by all of them
+static char g_rest_content[REST_CONTENT_MAX + 1];
+static json_tok_t g_rest_toks[REST_TOKENS_MAX];
+
+// FNV-1a
+static uint32_t rest_hash(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s) {
+    h ^= (uint8_t) *s++;
+    h *= 16777619u;
+  }
+  return(h);
+}
+
+esp_err_t rest_router_init(rest_router_t *r, const rest_route_t *routes, int n_routes) {
+
+  if (n_routes > REST_ROUTES_MAX) {
+    ESP_LOGE(TAG, "too many routes %d, max %d", n_routes, REST_ROUTES_MAX);
+    return(ESP_FAIL);
+  }
+
+  r->routes = routes;
+  r->n_routes = n_routes;
+  memset(r->slots, 0, sizeof(r->slots));
+
+  // open addressing, the table is never more than half full
+  for (int i = 0; i < n_routes; i++) {
+    if (rest_router_find(r, routes[i].name)) {
+      ESP_LOGE(TAG, "route %s is in the table twice", routes[i].name);
+      return(ESP_FAIL);
+    }
+    uint32_t slot = rest_hash(routes[i].name) % REST_ROUTER_SLOTS;
+    while (r->slots[slot]) slot = (slot + 1) % REST_ROUTER_SLOTS;
+    r->slots[slot] = i + 1;
+  }
+  return(ESP_OK);
+}
+
+const rest_route_t *rest_router_find(const rest_router_t *r, const char *name) {
+  uint32_t slot = rest_hash(name) % REST_ROUTER_SLOTS;
+  while (r->slots[slot]) {
+    const rest_route_t *route = &r->routes[r->slots[slot] - 1];
+    if (strcmp(route->name, name) == 0) return(route);
+    slot = (slot + 1) % REST_ROUTER_SLOTS;
+  }
+  return(NULL);
+}
+
+int rest_parse(const char *content, const json_tok_t **toks) {
+  *toks = g_rest_toks;
+  if (!content) return(JSON_ERR_PART);
+  return( json_parse(content, strlen(content), g_rest_toks, REST_TOKENS_MAX) );
+}
+
+esp_err_t rest_json_int(const char *content, const char *field, int *val) {
+  const json_tok_t *toks;
+  int n_toks = rest_parse(content, &toks);
+  if (n_toks < 0) return(ESP_FAIL);
+  int t = json_obj_get(content, toks, n_toks, 0, field);
+  if (t < 0 || !json_tok_int(content, &toks[t], val)) return(ESP_FAIL);
+  return(ESP_OK);
+}
+
+static int rest_enum_count(const rest_route_t *route) {
+  int n = 0;
+  while (route->enum_names[n]) n++;
+  return(n);
+}
+
+static esp_err_t rest_get(httpd_req_t *req, const rest_route_t *route) {
+
+  char value[24];
+
+  switch (route->type) {
+    case REST_INT:
+      snprintf(value, sizeof(value), "%d", route->get_int());
+      break;
+    case REST_BOOL:
+      snprintf(value, sizeof(value), "%s", route->get_int() ? "true" : "false");
+      break;
+    case REST_ENUM: {
+      int v = route->get_int();
+      if (v < 0 || v >= rest_enum_count(route)) return( httpd_resp_send_500(req) );
+      snprintf(value, sizeof(value), "%s", route->enum_names[v]);
+      break;
+    }
+    case REST_FLOAT:
+      snprintf(value, sizeof(value), "%.*f", route->decimals, route->get_float());
+      break;
+    default:
+      return( httpd_resp_send_500(req) );
+  }
+
+  ESP_LOGD(TAG, "rest: sending %s %s", route->name, value);
+
+  httpd_resp_set_type(req, "text/plain");
+  return( httpd_resp_sendstr(req, value) );
+}
+
+// {"name":value}, checked against the route
+static esp_err_t rest_post(httpd_req_t *req, const rest_route_t *route, const char *content) {
+
+  const json_tok_t *toks;
+  int n_toks = rest_parse(content, &toks);
+  int t = n_toks > 0 ? json_obj_get(content, toks, n_toks, 0, route->name) : -1;
+  bool ok = false;
+  esp_err_t err = ESP_FAIL;
+
+  if (t >= 0) {
+    const json_tok_t *tok = &toks[t];
+    switch (route->type) {
+      case REST_INT: {
+        int v;
+        ok = json_tok_int(content, tok, &v) && v >= route->min && v <= route->max;
+        if (ok && route->set_int) err = route->set_int(v);
+        break;
+      }
+      case REST_BOOL: {
+        bool b;
+        int v;
+        if (json_tok_bool(content, tok, &b)) {
+          v = b ? 1 : 0;
+          ok = true;
+        }
+        else {
+          ok = json_tok_int(content, tok, &v) && (v == 0 || v == 1);
+        }
+        if (ok && route->set_int) err = route->set_int(v);
+        break;
+      }
+      case REST_ENUM: {
+        int n = rest_enum_count(route);
+        int v = -1;
+        if (tok->type == JSON_STRING) {
+          for (int i = 0; i < n; i++) {
+            if (json_tok_eq(content, tok, route->enum_names[i])) v = i;
+          }
+        }
+        else if (!json_tok_int(content, tok, &v)) {
+          v = -1;
+        }
+        ok = v >= 0 && v < n;
+        if (ok && route->set_int) err = route->set_int(v);
+        break;
+      }
+      case REST_FLOAT: {
+        float f;
+        ok = json_tok_float(content, tok, &f);
+        if (ok && route->set_float) err = route->set_float(f);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  if (!ok || err != ESP_OK) {
+    ESP_LOGW(TAG, "rest: posted a bad value for %s", route->name);
+    return( httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "illegal value") );
+  }
+
+  ESP_LOGI(TAG, "rest: set %s", route->name);
+
+  // easiest way to say OK?
+  return( httpd_resp_sendstr(req, "") );
+}
+
+static esp_err_t rest_router_dispatch(httpd_req_t *req) {
+
+  rest_router_t *r = (rest_router_t *) req->user_ctx;
+
+  ESP_LOGD(TAG, " received rest URI request for %s method %d", req->uri, req->method);
+
+  // did I get content?
+  char *content = NULL;
+  if (req->content_len > REST_CONTENT_MAX) {
+    ESP_LOGW(TAG, " content length %d too long", req->content_len);
+    httpd_resp_set_status(req, "413 Payload Too Large");
+    httpd_resp_sendstr(req, "content too long");
+    // the rest of the body is still on the socket, don't read it as a request
+    return(ESP_FAIL);
+  }
+  if (req->content_len > 0) {
+    content = g_rest_content;
+    size_t off = 0;
+    while (off < req->content_len) {
+      int sz = httpd_req_recv(req, content + off, req->content_len - off);
+      if (sz == HTTPD_SOCK_ERR_TIMEOUT) continue;
+      if (sz <= 0) {
+        httpd_resp_send_500(req);
+        // the connection is in an unknown state, close it
+        return(ESP_FAIL);
+      }
+      off += sz;
+    }
+    content[req->content_len] = 0;
+  }
+
+  // the last part of the path is the name, ignoring a query
+  const char *name = strrchr(req->uri, '/');
+  name = name ? name + 1 : req->uri;
+  char name_buf[32];
+  size_t name_len = strcspn(name, "?");
+  if (name_len >= sizeof(name_buf)) {
+    return( httpd_resp_send_404(req) );
+  }
+  memcpy(name_buf, name, name_len);
+  name_buf[name_len] = 0;
+
+  const rest_route_t *route = rest_router_find(r, name_buf);
+  if (!route) {
+    ESP_LOGI(TAG, "rest: unknown endpoint: %s", name_buf);
+    return( httpd_resp_send_404(req) );
+  }
+
+  if (route->type == REST_CUSTOM) {
+    return( route->handler(req, content) );
+  }
+
+  if (req->method == HTTP_GET) {
+    return( rest_get(req, route) );
+  }
+  if (req->method == HTTP_POST && (route->set_int || route->set_float)) {
+    return( rest_post(req, route, content) );
+  }
+  return( httpd_resp_send_err(req, HTTPD_405_METHOD_NOT_ALLOWED, "read only") );
+}
+
+esp_err_t rest_router_handler(httpd_req_t *req) {
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = rest_router_dispatch(req);
+  rest_server_request_done(start);
+  return(err);
+}
+
+esp_err_t rest_uptime_handler(httpd_req_t *req, const char *content) {
+
+  clock_t cl = clock();
+  uint64_t uptime_sec = cl / CLOCKS_PER_SEC;
+  char uptime_str[20];
+  snprintf(uptime_str, sizeof(uptime_str), "%" PRIu64, uptime_sec);
+
+  ESP_LOGD(TAG, "rest: sending uptime %s", uptime_str);
+
+  httpd_resp_set_type(req, "text/plain");
+  return( httpd_resp_sendstr(req, uptime_str) );
+}
+
+esp_err_t rest_epoch_handler(httpd_req_t *req, const char *content) {
+
+  // this might be correct, if the app has sntp enabled
+  time_t secs = time(NULL);
+  char secs_str[30];
+  // depending on config, time might be 64 bits, or 32.... play it safe
+  snprintf(secs_str, sizeof(secs_str), "%" PRIu64, (uint64_t) secs);
+
+  ESP_LOGD(TAG, "rest: sending epoch %s", secs_str);
+
+  httpd_resp_set_type(req, "text/plain");
+  return( httpd_resp_sendstr(req, secs_str) );
+}
@@ -28,10 +28,17 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_idf_version.h"  // several bits of code depend on version :-(
+#include "esp_attr.h"
+#include "nvs.h"
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
+#include "WiFiMulti-idf.h"
+#include "wifi_fast.h"
+#include "wifi_score.h"
+#include "wifi_reg.h"
+
 #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4,1,0)
     This file uses the new ESP-IDF networking system, so only supports ESP-IDF 4.1 and later.
 #endif
@@ -101,21 +108,16 @@ static bool g_is_connected = false;
 static bool g_is_connecting = false;
 static bool g_is_scanning = false;
 
-// using a microsecond timer, make it ten seconds?
-#define WIFI_STALE_TIME (20L * 1000L * 1000L)
-
 
 ///
 /// local structures
 //
 
-#define SSID_LEN 32
 #define PASSWORD_LEN 64
 
 // this will hold the different APs the client might want to connect to
 typedef struct wifi_ap_info_s {
-    struct wifi_ap_info_s *next; // single linked list null at end, fairly memory efficient
-    uint8_t ssid[SSID_LEN]; // chars are more normal than uint8 which esp-idf uses, null terminated
+    const uint8_t *ssid; // the registry's copy, null terminated, see wifi_reg.h
     uint8_t password[PASSWORD_LEN]; // again, chars
     wifi_auth_mode_t authmode; // should be set by a scan?
         // WIFI_AUTH_OPEN, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WAP_WAP@_PSK
@@ -124,11 +126,29 @@ typedef struct wifi_ap_info_s {
     int   fails;
     wifi_err_reason_t wifi_err; // if failed, last error set here - don't keep trying if wrong password
                                 // it turns out that password is "4th handshake" usually.
-    int             last_rssi;
-    int64_t         last_seen; // microsec ticks since last seen
+    wifi_score_t    score;      // smoothed signal, decaying history, see wifi_score.h
 } wifi_ap_info_t;
 
-static wifi_ap_info_t *g_wifi_ap_info_head = NULL;
+// by slot in the registry, which hands them out in order and never takes one back,
+// so these can be pointed at. Zeroed is empty.
+static wifi_reg_t g_wifi_reg;
+static wifi_ap_info_t g_wifi_ap_pool[WIFI_REG_MAX];
+
+// scan results are copied here, up to WIFI_SCAN_RECORDS_MAX of them,
+// so a scan doesn't malloc. Only touched holding the scan mutex. It's how
+// many APs are heard, not how many are registered, so it has its own limit:
+// somewhere busy a scan hears more than any list of ours.
+#ifdef CONFIG_WIFI_MULTI_SCAN_RECORDS_MAX
+#define WIFI_SCAN_RECORDS_MAX CONFIG_WIFI_MULTI_SCAN_RECORDS_MAX
+#else
+#define WIFI_SCAN_RECORDS_MAX 48
+#endif
+static wifi_ap_record_t g_wifi_scan_records[WIFI_SCAN_RECORDS_MAX];
+static uint32_t g_wifi_scan_dropped = 0;
+// by registry slot, which were in the records kept
+static uint8_t g_wifi_scan_seen[WIFI_REG_MAX];
+// warned about drops hiding registered APs, until a scan that fits
+static bool g_wifi_scan_warned = false;
 
 SemaphoreHandle_t g_wifi_ap_info_mutex;
 
@@ -137,11 +157,25 @@ SemaphoreHandle_t g_wifi_ap_info_mutex;
 // implies they are not. Create a mutex.
 SemaphoreHandle_t g_wifi_scan_mutex;
 
+static TaskHandle_t g_xScanTask;
+static TaskHandle_t g_xConnectTask;
+
+// the last AP that got us an address, tried first, see wifi_fast.h
+static wifi_fast_t g_wifi_fast;
+static const wifi_fast_store_t g_wifi_fast_store;
+
+// the AP we're on, and whether to leave it, see wifi_score.h
+static wifi_ap_info_t *g_wifi_current = NULL;
+static wifi_roam_t g_wifi_roam;
+static bool g_wifi_roam_scanned = false;
+
 //
 /// forward references
 //
 
 static wifi_ap_info_t *wifi_multi_find(const uint8_t *ssid);
+static wifi_ap_info_t *wifi_multi_find_locked(const uint8_t *ssid);
+static wifi_ap_info_t *wifi_multi_find_best(const wifi_ap_info_t *skip);
 
 
 static const char *get_authmode_str(int authmode_id) {
@@ -170,8 +204,9 @@ static const char *get_authmode_str(int authmode_id) {
 static void wifi_scan_update(bool doprint)
 {
     uint16_t ap_count = 0;
-    wifi_ap_record_t *ap_list;
-    uint8_t i;
+    uint16_t dropped = 0;
+    wifi_ap_record_t *ap_list = g_wifi_scan_records;
+    uint16_t i;
 
     int64_t now = esp_timer_get_time(); // time in microseconds since boot
 
@@ -191,19 +226,20 @@ static void wifi_scan_update(bool doprint)
         return; 
     }
 
-    //malloc every time??? really??? are you just looking for fragmentation trouble?
-    ap_list = (wifi_ap_record_t *)malloc(ap_count * sizeof(wifi_ap_record_t));
-    if (ap_list == NULL) {
-    	ESP_LOGW(TAG," scan: malloc failed, ap_count %d try later ",(int)ap_count);
-        xSemaphoreGive(g_wifi_scan_mutex);
-    	return;
+    // the one buffer, not a malloc every scan. More than fits and the rest
+    // are dropped, get_ap_records frees them either way.
+    if (ap_count > WIFI_SCAN_RECORDS_MAX) {
+        ESP_LOGD(TAG," scan: %d APs, keeping %d",(int)ap_count, WIFI_SCAN_RECORDS_MAX);
+        dropped = ap_count - WIFI_SCAN_RECORDS_MAX;
+        g_wifi_scan_dropped += dropped;
+        ap_count = WIFI_SCAN_RECORDS_MAX;
     }
     // this might not be the best idea, aren't there
     // cases you'd just like to continue? Throws if error.
     ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_list));  
 
-    // don't need to hold the mutex while copying
-    xSemaphoreGive(g_wifi_scan_mutex);
+    // the records are ours until the next scan, and that can't start until we're
+    // done, it's the scan task that takes this mutex
 
     // regarding the best one, this can get tricky, because there might be
     // multiple APs with the same name. To handle this, if the time is the same,
@@ -215,6 +251,14 @@ static void wifi_scan_update(bool doprint)
         printf("======================================================================\n");
     }
 
+    // once for the lot, lookups are a hash away
+    if( pdFALSE == xSemaphoreTake(g_wifi_ap_info_mutex, 1000 / portTICK_PERIOD_MS)) {
+        ESP_LOGW(TAG," scan: could not take ap info mutex, skipping update");
+        xSemaphoreGive(g_wifi_scan_mutex);
+        return;
+    }
+
+    memset(g_wifi_scan_seen, 0, sizeof(g_wifi_scan_seen));
     for (i = 0; i < ap_count; i++) 
     {
         if (doprint) {
@@ -223,29 +267,61 @@ static void wifi_scan_update(bool doprint)
 
         // update the stats we have about this ap
         ESP_LOGV(TAG," scan: updating stats for ssid %s",ap_list[i].ssid);
-        wifi_ap_info_t *ap_info = wifi_multi_find(ap_list[i].ssid);
+        wifi_ap_info_t *ap_info = wifi_multi_find_locked(ap_list[i].ssid);
         if (ap_info) {
+            g_wifi_scan_seen[ap_info - g_wifi_ap_pool] = 1;
             ap_info->authmode = ap_list[i].authmode;
-            if (ap_info->last_seen < now) {
-                ap_info->last_rssi = ap_list[i].rssi;
-                ap_info->last_seen = now;
-                ESP_LOGV(TAG," scan: updated stats for ssid %s seen %lld rssi %d",
-                    ap_list[i].ssid,ap_info->last_seen,ap_info->last_rssi);
-            }
-            // multiple APs with same name, take best RSSI
-            else {
-                ESP_LOGV(TAG," scan: last seen is now? only update RSSI: ssid %s",ap_list[i].ssid);
-                if (ap_info->last_rssi < ap_list[i].rssi) {
-                    ap_info->last_rssi = ap_list[i].rssi;
-                }
-            }
+            // smoothed. Multiple APs with same name, the best RSSI counts.
+            wifi_score_rssi(&ap_info->score, ap_list[i].rssi, now);
+            ESP_LOGV(TAG," scan: updated stats for ssid %s rssi %d smoothed %d",
+                ap_list[i].ssid, ap_list[i].rssi, ap_info->score.rssi / WIFI_SCORE_ONE);
         }
         else {
             ESP_LOGV(TAG," scan: can't update ssid %s not found",(const char *)ap_list[i].ssid);
         }
     }
 
-    free(ap_list);
+    // The records don't say which were dropped, they're freed. A registered
+    // AP that isn't in what was kept might be one of them, and then it's
+    // never picked however close it is. Once, until a scan fits again.
+    if (dropped) {
+        int missed = 0, first = -1;
+        for (int s = 0; s < g_wifi_reg.n; s++) {
+            if (g_wifi_scan_seen[s]) continue;
+            if (first < 0) first = s;
+            missed++;
+        }
+        if (missed && !g_wifi_scan_warned) {
+            ESP_LOGW(TAG," scan: %d APs heard, %d dropped, %d registered not in the rest ( %s ... ): may be dropped, raise WIFI_MULTI_SCAN_RECORDS_MAX",
+                (int)(ap_count + dropped), (int)dropped, missed, (const char *)g_wifi_reg.ssid[first]);
+            g_wifi_scan_warned = true;
+        }
+    }
+    else {
+        g_wifi_scan_warned = false;
+    }
+
+    xSemaphoreGive(g_wifi_ap_info_mutex);
+    xSemaphoreGive(g_wifi_scan_mutex);
+}
+
+// what a disconnect says about the AP, for choosing next time
+static wifi_score_reason_t wifi_reason_class(int reason) {
+    switch (reason) {
+        case WIFI_REASON_ASSOC_LEAVE:
+        case WIFI_REASON_AUTH_LEAVE:
+            return( WIFI_SCORE_LEFT );
+        case WIFI_REASON_BEACON_TIMEOUT:
+            return( WIFI_SCORE_LOST );
+        case WIFI_REASON_NO_AP_FOUND:
+            return( WIFI_SCORE_NOT_FOUND );
+        case WIFI_REASON_AUTH_FAIL:
+        case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+        case WIFI_REASON_HANDSHAKE_TIMEOUT:
+        case WIFI_REASON_802_1X_AUTH_FAILED:
+            return( WIFI_SCORE_AUTH );
+    }
+    return( WIFI_SCORE_OTHER );
 }
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base, 
@@ -267,7 +343,13 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                 wifi_ap_info_t *ap = wifi_multi_find( ev_conn->ssid );
                 if (ap) {
                     ap->successes++;
+                    wifi_score_success(&ap->score, esp_timer_get_time());
                 }
+                g_wifi_current = ap;
+                wifi_roam_reset(&g_wifi_roam, esp_timer_get_time());
+                // remembered if we get an address
+                wifi_fast_connected(&g_wifi_fast, ev_conn->ssid, ev_conn->ssid_len, ev_conn->bssid,
+                    ev_conn->channel, ev_conn->authmode);
 
                 g_is_connected = true;
                 g_is_connecting = false;
@@ -281,16 +363,26 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                 if (ev_dis->reason == WIFI_REASON_AUTH_FAIL) {
                     ESP_LOGI(TAG, "EVENT_STA_DISCONNECTED: reason %d: auth fail, not likely!",ev_dis->reason);
                 }
-                // Look up ssid, mark as failed
+                // Look up ssid, mark as failed, unless we left
+                wifi_score_reason_t why = wifi_reason_class(ev_dis->reason);
                 wifi_ap_info_t *ap = wifi_multi_find( ev_dis->ssid );
-                if (ap) {
+                if (ap && why != WIFI_SCORE_LEFT) {
                     ap->fails++;
+                    ap->wifi_err = ev_dis->reason;
+                    wifi_score_fail(&ap->score, why, esp_timer_get_time());
                 }
+                g_wifi_current = NULL;
+                wifi_roam_reset(&g_wifi_roam, 0);
+
+                wifi_fast_disconnected(&g_wifi_fast, esp_timer_get_time());
 
                 // TODO: signal for a new scan
                 g_is_connected = false;
                 g_is_connecting = false;
 
+                // try again now rather than on the next poll
+                if (g_xConnectTask) xTaskNotifyGive(g_xConnectTask);
+
                 break;
             }
             case WIFI_EVENT_SCAN_DONE:
@@ -301,6 +393,9 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                 if (ev_sc->status == 0) { // 0 is success
                     // should do something fancier --- look at the log level???
                     wifi_scan_update(false/*print*/);
+                    // something to pick from, or to roam to, don't wait for the next poll
+                    if (g_is_connected) g_wifi_roam_scanned = true;
+                    if (g_xConnectTask) xTaskNotifyGive(g_xConnectTask);
                 }
                 break;
             }
@@ -320,8 +415,22 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
         switch ( event_id ) {
             case IP_EVENT_STA_GOT_IP:
                 event = (ip_event_got_ip_t*) event_data;
-                ESP_LOGI(TAG, "got ip:" IPSTR,
-                         IP2STR(&event->ip_info.ip));
+                {
+                    // how long it was down, and what got it back
+                    wifi_fast_via_t via = g_wifi_fast.attempt;
+                    int64_t down_us = g_wifi_fast.down_us;
+                    int64_t now = esp_timer_get_time();
+                    wifi_fast_got_ip(&g_wifi_fast, &g_wifi_fast_store, now);
+                    if (down_us >= 0) {
+                        ESP_LOGI(TAG, "got ip:" IPSTR " in %lld ms, %s",
+                                 IP2STR(&event->ip_info.ip), (now - down_us) / 1000,
+                                 wifi_fast_via_name(via));
+                    }
+                    else {
+                        ESP_LOGI(TAG, "got ip:" IPSTR,
+                                 IP2STR(&event->ip_info.ip));
+                    }
+                }
                 s_retry_num = 0;
                 xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
                 break;
@@ -352,8 +461,18 @@ static void wifi_scan_task(void *pvParameters) {
             .show_hidden = 1,
             .scan_type = WIFI_SCAN_TYPE_PASSIVE,   // active scans beacon out and cause network traffic.
                                                     // in most environments, you probably want a passive scan
-            .scan_time.active.min = 80,
-            .scan_time.active.max = 120,
+    };
+
+    // connected, the radio's away from the AP for the whole scan: a short
+    // active one, see wifi_score.h
+    wifi_scan_config_t roam_config = {
+            .ssid = 0,
+            .bssid = 0,
+            .channel = 0,
+            .show_hidden = 1,
+            .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+            .scan_time.active.min = WIFI_ROAM_SCAN_MIN_MS,
+            .scan_time.active.max = WIFI_ROAM_SCAN_MAX_MS,
     };
 
     while (1)
@@ -361,12 +480,20 @@ static void wifi_scan_task(void *pvParameters) {
 
         // I am worried this is not thread safe, so protect
         if( pdTRUE == xSemaphoreTake(g_wifi_scan_mutex, 1000 / portTICK_PERIOD_MS)) {
-            // I read you should not scan while connecting
-            if ((g_is_connected) == false && (g_is_connecting == false)) {
-                ESP_LOGD(TAG, "scan started: ");
-                esp_err_t err = esp_wifi_scan_start(&scan_config, true);
+            // I read you should not scan while connecting. Nor while there's a
+            // direct try to come, that's what gets it up without the scan.
+            // Connected, only when the signal's weak, now and then, to see
+            // if there's better.
+            int64_t now = esp_timer_get_time();
+            bool roam = g_is_connected && wifi_roam_scan_due(&g_wifi_roam, now);
+            if (roam ||
+                ((g_is_connected) == false && (g_is_connecting == false) &&
+                 (wifi_fast_scan_hold(&g_wifi_fast) == false))) {
+                ESP_LOGD(TAG, "scan started: %s", roam ? "roaming" : "");
+                esp_err_t err = esp_wifi_scan_start(roam ? &roam_config : &scan_config, true);
                 if (err == ESP_OK) {
                     g_is_scanning = true;
+                    if (roam) wifi_roam_scanned(&g_wifi_roam, now);
                 }
             }
             else {
@@ -381,40 +508,32 @@ static void wifi_scan_task(void *pvParameters) {
 }
 
 // functions for SSID, which are defined as unsigned chars not signed chars
-// returns size copied
-static inline int u8cmp( const uint8_t *s1, const uint8_t *s2) {
-    return( strcmp( (const char *)s1, (const char *) s2));
-}
-
 // returns pointer to destination
 static inline char *u8cpy( uint8_t *dst, const uint8_t *src) {
     return( strcpy( (char *)dst, (const char *) src));
 }
 
-// Finds an AP in the list
-// not yet thread safe and we're using threads! Assumes all are registered
-// forever --- fixme, make that structure reference counted
+// Finds an AP in the registry. Entries are never freed, so the pointer is
+// good forever, though what's in it changes under you.
 //
 // INTERNAL
+static wifi_ap_info_t *
+wifi_multi_find_locked(const uint8_t *ssid)
+{
+    int slot = wifi_reg_find(&g_wifi_reg, ssid);
+    if (slot < 0) return( NULL );
+    return( &g_wifi_ap_pool[slot] );
+}
+
 static wifi_ap_info_t *
 wifi_multi_find(const uint8_t *ssid)
 {
     wifi_ap_info_t *r = 0;
 
-    // quickly rip through the datastructure, all in memory access, ok to hold mutex
+    // a hash and a compare or two, ok to hold mutex
     if( pdTRUE == xSemaphoreTake(g_wifi_ap_info_mutex, 1000 / portTICK_PERIOD_MS)) {
 
-        wifi_ap_info_t *c = g_wifi_ap_info_head;
-
-        while (c) {
-            if (u8cmp( c->ssid, ssid ) == 0 ) {
-                r = c;
-                break;
-            }
-            else {
-                c = c->next;
-            }
-        }
+        r = wifi_multi_find_locked(ssid);
 
         xSemaphoreGive(g_wifi_ap_info_mutex);
     }
@@ -428,105 +547,69 @@ wifi_multi_find(const uint8_t *ssid)
 }
 
 
-// 0 is success, others are failure
+// 0 is success, others are failure. Adding one that's there already changes
+// its password and keeps what's known about it.
 esp_err_t wifi_multi_ap_add(const char* ssid, const char *password) {
 
 	if (ssid == NULL)	return(-1);
-	if (strlen(ssid) + 1 > SSID_LEN) return(ESP_ERR_INVALID_ARG);
+	if (strlen(ssid) > WIFI_REG_SSID_MAX) return(ESP_ERR_INVALID_ARG);
 	// password allowed to be null for open APs
 	if (password && ( strlen(password) + 1 > PASSWORD_LEN ) ) return(ESP_ERR_INVALID_ARG);
 
-	wifi_ap_info_t *ap_info = malloc(sizeof(wifi_ap_info_t));
-	if (ap_info == 0) return(ESP_ERR_NO_MEM);
+	// need a mutex here -- shouldn't contend much?
+	if( pdFALSE == xSemaphoreTake(g_wifi_ap_info_mutex, 1000 / portTICK_PERIOD_MS)) {
+        return(ESP_FAIL); // no obvious case here, should almost throw error
+    }
 
-	u8cpy(ap_info->ssid, (const uint8_t *) ssid);
+	bool added;
+	int slot = wifi_reg_add(&g_wifi_reg, (const uint8_t *) ssid, &added);
+	if (slot < 0) {
+		xSemaphoreGive(g_wifi_ap_info_mutex);
+		ESP_LOGW(TAG, "can't add %s, all %d taken", ssid, WIFI_REG_MAX);
+		return(ESP_ERR_NO_MEM);
+	}
+
+	wifi_ap_info_t *ap_info = &g_wifi_ap_pool[slot];
 
 	if (password)      u8cpy(ap_info->password, (const uint8_t *) password);
 	else               ap_info->password[0] = 0;
 
-	ap_info->authmode = 0;
-	ap_info->successes = 0;
-	ap_info->fails = 0;
-	ap_info->wifi_err = 0;
-	ap_info->last_rssi = -1000; //??? what is a "invalid" value for rssi? something very negative?
-    ap_info->last_seen = 0;
-
-	// need a mutex here -- shouldn't contend much?
-	if( pdFALSE == xSemaphoreTake(g_wifi_ap_info_mutex, 1000 / portTICK_PERIOD_MS)) {
-        free(ap_info);
-        return(ESP_FAIL); // no obvious case here, should almost throw error
-    }
+	if (added) {
+		ap_info->ssid = g_wifi_reg.ssid[slot];
+		ap_info->authmode = 0;
+		ap_info->successes = 0;
+		ap_info->fails = 0;
+		ap_info->wifi_err = 0;
+		wifi_score_init(&ap_info->score);
+	}
 
-	ap_info->next = g_wifi_ap_info_head;
-	g_wifi_ap_info_head = ap_info;
 	xSemaphoreGive(g_wifi_ap_info_mutex);
 
+	// might be the one we remembered
+	if (g_xConnectTask) xTaskNotifyGive(g_xConnectTask);
+
 	return(0);
 
 }
 
+// Entries are handed around by pointer without a care in the world, so
+// one can't go away without a reference count, and a tombstone in the
+// registry. Can add that if the code gets a little more complex.
 esp_err_t wifi_multi_ap_remove(const char *ssid) {
-    ESP_LOGW(TAG, "wifi_multi_ap_remove not supported, leaking memory");
+    ESP_LOGW(TAG, "wifi_multi_ap_remove not supported");
     return(ESP_OK);
 }
 
-// right now, I don't properly protect this data structure.
-// I hand around the allocated SSID structures without a care in the world
-// There fore I can't really remove one .... can only add this
-// if the code gets a little more complex
-#if 0
-int wifi_multi_ap_remove(const char *ssid) {
-
-	bool found = false;
-
-	// quickly rip through the datastructure, all in memory access, ok to hold mutex
-	if( pdTRUE == xSemaphoreTake(g_wifi_ap_info_mutex, 1000 / portTICK_PERIOD_MS)) {
-
-		wifi_ap_info_t *c = g_wifi_ap_info_head;
-		wifi_ap_info_t *prev;
-
-		while (c) {
-			if (u8cmp( c->ssid, (const uint8_t *) ssid ) == 0 ) {
-				if ( c == g_wifi_ap_info_head ) {
-					g_wifi_ap_info_head = c->next;
-				}
-				else {
-					c->next = prev;
-				}
-				free(c);
-				found = true;
-				break;
-			}
-			else {
-				prev = c;
-				c = c->next;
-			}
-		}
-
-		xSemaphoreGive(g_wifi_ap_info_mutex);
-	}
-	else {
-		ESP_LOGI(TAG, "wifi_multi_ap_remove: could not take mutex");
-		return(-1);
-	}
-	if ( !found ) {
-		ESP_LOGI(TAG, "wifi_multi_ap_remove: could not find ssid %s",ssid);
-		return(-1);
-	}
-
-
-	return(0);
-}
-#endif // ap_remove
-
 //
 // This has the magic because it'll look through and find the best combination of 
-// signal strength and recent. Eventually also avoid ones that you've failed with.
+// signal strength and recent, and avoid ones that you've failed with lately.
+// See wifi_score.h. skip is the one we're on, when looking to roam.
 
 static wifi_ap_info_t *
-wifi_multi_find_best()
+wifi_multi_find_best(const wifi_ap_info_t *skip)
 {
     wifi_ap_info_t *r = 0;
+    int32_t r_score = 0;
     int64_t now = esp_timer_get_time();
 
     if( pdFALSE == xSemaphoreTake(g_wifi_ap_info_mutex, 1000 / portTICK_PERIOD_MS)) {
@@ -534,13 +617,16 @@ wifi_multi_find_best()
         return(0);
     }
 
-    // quickly rip through the datastructure, all in memory access, ok to hold mutex
-    wifi_ap_info_t *c = g_wifi_ap_info_head;
+    // quickly rip through the pool, all in memory access, ok to hold mutex
+    wifi_ap_info_t *c = g_wifi_ap_pool;
+    const wifi_ap_info_t *end = g_wifi_ap_pool + g_wifi_reg.n;
+
+    while (c < end) {
+        if (c == skip) goto NEXT;
 
-    while (c) {
-        // make sure I've seen it at least once before
-        if (c->last_seen == 0) {
-            ESP_LOGV(TAG," ssid %s: skipping not seen yet",(const char *)c->ssid);
+        // make sure I've seen it, and not too long ago
+        if (wifi_score_fresh(&c->score, now) == false) {
+            ESP_LOGV(TAG," ssid %s: skipping, not seen lately",(const char *)c->ssid);
             goto NEXT;
         }
         // make sure if its encrypted I have the username and password
@@ -550,61 +636,188 @@ wifi_multi_find_best()
             goto NEXT;
         }
 
-#if 0 // skip this heuristic for now.... 
-        // if I tried and failed, skip? unless maybe it's the only one left?
-        if ( c->failed ) {
-            print(" ssid %s: failed before, skipping\n",(const char *)c->ssid);
-            break;
-        }
-#endif
-        // make sure it's not stale
-        if ( now > ( c->last_seen + WIFI_STALE_TIME ) ) {
-//          not sure how to log int64_t ??? 
-            ESP_LOGV(TAG, " ssid %s: seems stale, last seen %lld, now %lld skipping",
-                (const char *)c->ssid,c->last_seen, now);
-            goto NEXT;
-        }
+        // failures cost it, but they wear off, and anything's better than nothing
+        int32_t c_score = wifi_score_get(&c->score, now);
+        ESP_LOGV(TAG," ssid %s: suc %d fail %d rssi %d last %s score %d",(const char *)c->ssid,
+            c->successes, c->fails, c->score.rssi / WIFI_SCORE_ONE,
+            wifi_score_reason_name(c->score.reason), c_score / WIFI_SCORE_ONE);
 
-        // this is better than nothing!
-        if (r == 0) {
-            ESP_LOGV(TAG," ssid %s: selecting because nothing else",(const char *)c->ssid);
+        if (r == 0 || c_score > r_score) {
             r = c;
-            goto NEXT;
-        }
-
-        ESP_LOGV(TAG," ssid best %s: suc %d fail %d rssi %d",(const char *)r->ssid,r->successes,r->fails,r->last_rssi);
-
-        // Heuristic. Want fails to count for something, and successes
-        int c_factor = (c->successes * 2) - c->fails;
-        int r_factor = (r->successes * 2) - r->fails;
-        if (c_factor > r_factor) {
-            ESP_LOGV(TAG," ssid %s: selecting because factors: r: %d vs c: %d ",(const char *)c->ssid,r_factor,c_factor);
-            r = c;
-            goto NEXT;
-        }   
-
-        // now let's go for RSSI
-        if (c->last_rssi > r->last_rssi) {
-            ESP_LOGV(TAG," ssid %s: selecting because better rssi: %d vs %d ",(const char *)c->ssid,r->last_rssi,c->last_rssi);
-            r = c;
-            goto NEXT;
+            r_score = c_score;
         }
 
 NEXT:
-        c = c->next;
+        c++;
 
     } /* end while */
 
 
     xSemaphoreGive(g_wifi_ap_info_mutex);
 
+    if (r) ESP_LOGD(TAG," best is %s, score %d",(const char *)r->ssid, r_score / WIFI_SCORE_ONE);
+
     return(r);
 
 }
 
 
-// This task attempts to connect to the current best if disconnected only.
-// The list of passwords is taken from the registered set
+/*
+** What wifi_fast drives, and where it keeps what it remembers
+*/
+
+// RTC memory survives deep sleep and resets, not power. Checked before it's believed.
+static RTC_NOINIT_ATTR wifi_fast_cache_t g_wifi_fast_rtc;
+
+#define WIFI_FAST_NVS_NAMESPACE "wifimulti"
+#define WIFI_FAST_NVS_KEY "fast"
+
+static bool wifi_fast_load(void *ctx, wifi_fast_cache_t *c) {
+
+    if (wifi_fast_cache_check(&g_wifi_fast_rtc)) {
+        *c = g_wifi_fast_rtc;
+        ESP_LOGD(TAG, "fast reconnect: %s from RTC memory", (const char *) c->ssid);
+        return(true);
+    }
+
+    // cold boot. The app has done nvs_flash_init.
+    nvs_handle_t h;
+    if (nvs_open(WIFI_FAST_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) return(false);
+    size_t len = sizeof(wifi_fast_cache_t);
+    esp_err_t err = nvs_get_blob(h, WIFI_FAST_NVS_KEY, c, &len);
+    nvs_close(h);
+    if (err != ESP_OK || len != sizeof(wifi_fast_cache_t)) return(false);
+    ESP_LOGD(TAG, "fast reconnect: %s from NVS", (const char *) c->ssid);
+    return(true);
+}
+
+// only called when it changed, so flash isn't written every reconnect
+static void wifi_fast_save(void *ctx, const wifi_fast_cache_t *c) {
+
+    g_wifi_fast_rtc = *c;
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(WIFI_FAST_NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "fast reconnect: could not open NVS: error %d", err);
+        return;
+    }
+    err = nvs_set_blob(h, WIFI_FAST_NVS_KEY, c, sizeof(wifi_fast_cache_t));
+    if (err == ESP_OK) err = nvs_commit(h);
+    if (err != ESP_OK) ESP_LOGW(TAG, "fast reconnect: could not save: error %d", err);
+    nvs_close(h);
+}
+
+static const wifi_fast_store_t g_wifi_fast_store = {
+    .load = wifi_fast_load,
+    .save = wifi_fast_save,
+    .ctx = NULL,
+};
+
+static bool wifi_fast_password(void *ctx, const uint8_t *ssid, uint8_t *password) {
+    wifi_ap_info_t *ap = wifi_multi_find(ssid);
+    if (ap == NULL) return(false);
+    u8cpy(password, ap->password);
+    return(true);
+}
+
+static bool wifi_fast_best(void *ctx, wifi_fast_target_t *t) {
+    wifi_ap_info_t *ap = wifi_multi_find_best(NULL);
+    if (ap == NULL) return(false);
+    u8cpy(t->ssid, ap->ssid);
+    u8cpy(t->password, ap->password);
+    t->authmode = ap->authmode;
+    return(true);
+}
+
+static int wifi_fast_connect(void *ctx, const wifi_fast_target_t *t) {
+
+    wifi_config_t wifi_config = {
+        .sta = {
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+            .threshold.rssi = 0, // default?
+            .threshold.authmode = (wifi_auth_mode_t) t->authmode,
+        },
+    };
+    u8cpy(wifi_config.sta.ssid, t->ssid);
+    u8cpy(wifi_config.sta.password, t->password);
+
+    // straight to the one we know. Fast scan on a channel only listens on that one.
+    if (t->direct) {
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, t->bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = t->channel;
+    }
+
+    // this is how we set the SSID and password to use
+    // note, the interface type being STA is not documented, it seems
+    // when you set a config, you might end up cancelling a scan
+    esp_err_t err = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, " could not set config for %s, error %d", (const char *) t->ssid, err);
+        return(err);
+    }
+
+    if (t->direct) {
+        ESP_LOGI(TAG, "CONNECT TO ap SSID:%s bssid " MACSTR " channel %d, no scan",
+                 (const char *) t->ssid, MAC2STR(t->bssid), t->channel);
+    }
+    else {
+        ESP_LOGI(TAG, "CONNECT TO ap SSID:%s password:%s",
+                 (const char *) t->ssid, (const char *) t->password);
+    }
+
+    g_is_connecting = true;
+    err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        g_is_connecting = false;
+        ESP_LOGW(TAG, " attempted to connect, couldn't, error %d",err);
+    }
+    return(err);
+}
+
+static const wifi_fast_driver_t g_wifi_fast_drv = {
+    .password = wifi_fast_password,
+    .best = wifi_fast_best,
+    .connect = wifi_fast_connect,
+    .ctx = NULL,
+};
+
+// Connected, keep an eye on the signal. If it's weak the scan task looks
+// around now and then, and after each of those, see if it's time to go.
+
+static void wifi_roam_poll(void) {
+
+    wifi_ap_record_t info;
+    if (esp_wifi_sta_get_ap_info(&info) == ESP_OK) wifi_roam_rssi(&g_wifi_roam, info.rssi);
+
+    if (g_wifi_roam_scanned == false) return;
+    g_wifi_roam_scanned = false;
+
+    wifi_ap_info_t *cur = g_wifi_current;
+    if (cur == NULL) return;
+
+    int64_t now = esp_timer_get_time();
+    wifi_ap_info_t *best = wifi_multi_find_best(cur);
+    // the one we're on goes by what the radio says, not the scan
+    int32_t cur_score = g_wifi_roam.rssi + wifi_score_history(&cur->score, now);
+    int32_t best_score = best ? wifi_score_get(&best->score, now) : 0;
+
+    if (wifi_roam_check(&g_wifi_roam, cur_score, best != NULL, best_score, now) == false) return;
+
+    ESP_LOGI(TAG, "roaming from %s ( score %d ) to %s ( score %d )",
+        (const char *) cur->ssid, cur_score / WIFI_SCORE_ONE,
+        (const char *) best->ssid, best_score / WIFI_SCORE_ONE);
+    // not straight back to this one
+    wifi_fast_roam(&g_wifi_fast);
+    esp_wifi_disconnect();
+}
+
+// This task attempts to connect if disconnected only: to the AP from last
+// time if there is one, otherwise the current best. The list of passwords is
+// taken from the registered set. Events wake it, the poll is in case.
 
 void wifi_connect_task(void *pvParameters) {
 
@@ -613,46 +826,45 @@ void wifi_connect_task(void *pvParameters) {
 	    // What state am I in? if disconnected, start a connect
 	    if ((g_is_connected == false) && (g_is_connecting == false)) {
 
-            wifi_ap_info_t *ap = wifi_multi_find_best();
-            if (ap) {
-
-                wifi_config_t wifi_config = {
-                    .sta = {
-                        .scan_method = WIFI_ALL_CHANNEL_SCAN,
-                        .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
-                        .threshold.rssi = 0, // default?
-                        .threshold.authmode = ap->authmode,
-                    },
-                };
-                u8cpy(wifi_config.sta.ssid, ap->ssid);
-                u8cpy(wifi_config.sta.password, ap->password);
-
-                // this is how we set the SSID and password to use
-                // note, the interface type being STA is not documented, it seems
-                // when you set a config, you might end up cancelling a scan
-                ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
-
-                ESP_LOGI(TAG, "CONNECT TO ap SSID:%s password:%s",
-                         (const char *) ap->ssid, (const char *) ap->password);
-                
-                g_is_connecting = true;
-                esp_err_t err = esp_wifi_connect();
-                if (err != ESP_OK) {
-                    g_is_connecting = false;
-                    ESP_LOGW(TAG, " attempted to connect, couldn't, error %d",err);
-                }
-            }
+            wifi_fast_step(&g_wifi_fast, &g_wifi_fast_drv, esp_timer_get_time());
 
 		}
+        else if (g_is_connected) {
 
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
+            wifi_roam_poll();
+
+        }
+
+		ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
 
     }
 
 }
 
-static TaskHandle_t g_xScanTask;
-static TaskHandle_t g_xConnectTask;
+void wifi_multi_stats_get(wifi_multi_stats_t *st) {
+
+    const wifi_fast_t *f = &g_wifi_fast;
+    const wifi_fast_time_t *src[2] = { &f->t_direct, &f->t_scan };
+    wifi_multi_time_t *dst[2] = { &st->ip_direct, &st->ip_scan };
+
+    st->connected = g_is_connected;
+    st->via = wifi_fast_via_name(f->up);
+    st->cached = f->cache_valid;
+    st->n_direct = f->n_direct;
+    st->n_direct_fails = f->n_direct_fails;
+    st->n_scan = f->n_scan;
+    st->n_saves = f->n_saves;
+    st->n_roams = g_wifi_roam.n_roams;
+    st->n_aps = g_wifi_reg.n;
+    st->scan_dropped = g_wifi_scan_dropped;
+    for (int i = 0; i < 2; i++) {
+        dst[i]->n = src[i]->n;
+        dst[i]->last_ms = (int) (src[i]->last_us / 1000);
+        dst[i]->min_ms = (int) (src[i]->min_us / 1000);
+        dst[i]->max_ms = (int) (src[i]->max_us / 1000);
+        dst[i]->avg_ms = src[i]->n ? (int) (src[i]->sum_us / src[i]->n / 1000) : 0;
+    }
+}
 
 // Initis the wifi units, sets up the event loops, and kicks
 // off the scanning task and the connecting task
@@ -715,13 +927,20 @@ void wifi_multi_start()
     // check here?
     ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE) );
 
-    // kick off scan and connect tasks
-    xTaskCreate(wifi_scan_task, "wifi_scan_task",4096/*stacksizewords*/, 
-                (void *) NULL/*param*/, 5 /*pri*/, &g_xScanTask/*createdtask*/);
+    // the AP from last time, if there was one
+    wifi_fast_init(&g_wifi_fast, &g_wifi_fast_store, esp_timer_get_time());
+    if (g_wifi_fast.cache_valid) {
+        ESP_LOGI(TAG, "will try %s on channel %d first",
+            (const char *) g_wifi_fast.cache.ssid, g_wifi_fast.cache.channel);
+    }
 
+    // kick off connect and scan tasks, connect first so a direct try isn't behind a scan
     xTaskCreate(wifi_connect_task, "connect",4096/*stacksizewords*/, 
                 (void *) NULL/*param*/, 5 /*pri*/, &g_xConnectTask/*createdtask*/);
 
+    xTaskCreate(wifi_scan_task, "wifi_scan_task",4096/*stacksizewords*/, 
+                (void *) NULL/*param*/, 5 /*pri*/, &g_xScanTask/*createdtask*/);
+
     ESP_LOGD(TAG, "wifi_init_multi finished.");
 
 }
@@ -0,0 +1,70 @@
+/* WiFiMulti-idf AP registry
+
+** Where the registered APs live: a fixed number of slots, handed out in
+** order and never taken back, and an open addressed table from a hash of
+** the SSID to the slot. No malloc, so registering dozens of APs and
+** looking each scan record up costs no heap and no walk down a list.
+**
+** The registry keeps its own copy of each SSID, null terminated. SSIDs
+** handed in can be the 32 bytes the radio uses with no null, so nothing
+** past 32 is looked at.
+**
+** The caller keeps whatever it knows about an AP in its own array, by slot,
+** and does the locking.
+**
+** No ESP-IDF in here, it builds anywhere.
+**
+** Copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// how many APs can be registered. Define it bigger in the build if you have
+// more; a power of two.
+#ifndef WIFI_REG_MAX
+#define WIFI_REG_MAX 32
+#endif
+
+// twice the slots, so probes stay short when it's full
+#define WIFI_REG_BUCKETS (WIFI_REG_MAX * 2)
+
+#define WIFI_REG_SSID_MAX 32
+#define WIFI_REG_SSID_LEN (WIFI_REG_SSID_MAX + 1)
+
+typedef struct {
+    int n;                                          // slots used, 0 .. n-1
+    uint8_t ssid[WIFI_REG_MAX][WIFI_REG_SSID_LEN];
+    uint32_t hash[WIFI_REG_MAX];
+    uint8_t bucket[WIFI_REG_BUCKETS];               // slot + 1, 0 empty
+    // stats
+    uint32_t n_finds;
+    uint32_t n_probes;                              // buckets looked at, over all finds
+} wifi_reg_t;
+
+void wifi_reg_init(wifi_reg_t *r);
+
+// FNV-1a, up to the null or WIFI_REG_SSID_MAX
+uint32_t wifi_reg_hash(const uint8_t *ssid);
+
+// the slot with this SSID, -1 if it isn't registered
+int wifi_reg_find(wifi_reg_t *r, const uint8_t *ssid);
+
+// the slot with this SSID, a new one if it wasn't there ( *added says which ).
+// -1 if it's full, or the SSID is empty or too long.
+int wifi_reg_add(wifi_reg_t *r, const uint8_t *ssid, bool *added);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
@@ -0,0 +1,134 @@
+/* WiFiMulti-idf AP scoring
+
+** Which AP to connect to, and when to leave the one we're on.
+**
+** Each AP keeps:
+**   - its signal, smoothed ( EWMA, a quarter of each new scan ), so one
+**     good or bad sample doesn't swing the choice
+**   - successes and failures as weights that decay away with time, so an
+**     AP that failed an hour ago isn't held against today, and one that's
+**     failing now is
+**   - a penalty for how it last failed, which also decays: a wrong
+**     password sits it out for a good while, a lost beacon not long
+**
+** The score is all of that in dB, on top of the signal. Any AP is still
+** better than none, so a penalized one comes back when it's all there is.
+**
+** Roaming: connected to an AP whose signal has gone weak, scan now and
+** then, and only leave for one that's been better by WIFI_ROAM_MARGIN
+** for WIFI_ROAM_CHECKS scans in a row, and never within WIFI_ROAM_DWELL_US
+** of getting there, so it doesn't flap between two.
+**
+** A roaming scan is active, and short on each channel. The radio's off the
+** AP's channel for all of it, and a passive scan listens the IDF's default
+** 360ms on each of 13 - deaf for nearly 5s of every WIFI_ROAM_SCAN_US. An
+** active one sends a probe on each channel, a little traffic, and is done
+** in WIFI_ROAM_SCAN_MAX_MS; an AP that misses the probe is missed by that
+** scan, and found by one of the next WIFI_ROAM_CHECKS.
+**
+** No ESP-IDF in here, it builds anywhere, so scan and connect traces can
+** be run through it on a desktop.
+**
+** Copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// scores and signals are in sixteenths of a dB
+#define WIFI_SCORE_ONE 16
+
+// not seen in a scan for this long and it's not a candidate
+#define WIFI_SCORE_STALE_US (20LL * 1000 * 1000)
+
+// a connect, worth this much, up to the cap
+#define WIFI_SCORE_OK_DB 2
+#define WIFI_SCORE_OK_MAX_DB 10
+#define WIFI_SCORE_OK_HALF_US (30LL * 60 * 1000 * 1000)
+// a failure costs this much, up to the cap
+#define WIFI_SCORE_FAIL_DB 5
+#define WIFI_SCORE_FAIL_MAX_DB 30
+#define WIFI_SCORE_FAIL_HALF_US (5LL * 60 * 1000 * 1000)
+
+// roaming
+#define WIFI_ROAM_WEAK_DBM (-72)
+#define WIFI_ROAM_MARGIN_DB 8
+#define WIFI_ROAM_CHECKS 3
+#define WIFI_ROAM_DWELL_US (60LL * 1000 * 1000)
+#define WIFI_ROAM_SCAN_US (15LL * 1000 * 1000)
+// per channel, a roaming scan is active for this long
+#define WIFI_ROAM_SCAN_MIN_MS 20
+#define WIFI_ROAM_SCAN_MAX_MS 40
+
+// why it went, as far as choosing goes
+typedef enum {
+    WIFI_SCORE_LEFT = 0,        // we left, or were told to nicely: nothing against it
+    WIFI_SCORE_LOST = 1,        // beacons stopped, out of range
+    WIFI_SCORE_NOT_FOUND = 2,
+    WIFI_SCORE_AUTH = 3,        // wrong password, most likely
+    WIFI_SCORE_OTHER = 4
+} wifi_score_reason_t;
+
+typedef struct {
+    int32_t rssi;               // smoothed, sixteenths of a dBm
+    int32_t rssi_prev;          // before this scan, another AP with the name might do better
+    int64_t seen_us;            // last scan it was in, 0 never
+    uint32_t ok_w;              // decaying, 256 is one
+    uint32_t fail_w;
+    int64_t w_us;               // when the weights were last decayed
+    wifi_score_reason_t reason; // the last failure
+    int64_t reason_us;
+} wifi_score_t;
+
+typedef struct {
+    int64_t since_us;           // connected, 0 if not
+    int32_t rssi;               // the AP we're on, sixteenths of a dBm
+    bool has_rssi;
+    int better;                 // scans in a row something's been better by the margin
+    int64_t scan_us;            // last roaming scan
+    uint32_t n_roams;
+} wifi_roam_t;
+
+void wifi_score_init(wifi_score_t *s);
+
+// a scan saw it. Several APs with one name in a scan, the best counts.
+void wifi_score_rssi(wifi_score_t *s, int rssi, int64_t now_us);
+void wifi_score_success(wifi_score_t *s, int64_t now_us);
+void wifi_score_fail(wifi_score_t *s, wifi_score_reason_t reason, int64_t now_us);
+
+// seen recently enough to try
+bool wifi_score_fresh(const wifi_score_t *s, int64_t now_us);
+
+// sixteenths of a dB, higher is better
+int32_t wifi_score_get(const wifi_score_t *s, int64_t now_us);
+// just the history: what's added to the signal. For the AP we're on, whose
+// signal comes from the radio, not scans.
+int32_t wifi_score_history(const wifi_score_t *s, int64_t now_us);
+
+const char *wifi_score_reason_name(wifi_score_reason_t r);
+
+// connected, or not
+void wifi_roam_reset(wifi_roam_t *r, int64_t now_us);
+// the AP we're on, from the radio rather than a scan
+void wifi_roam_rssi(wifi_roam_t *r, int rssi);
+// weak enough, and long enough since the last, to scan while connected
+bool wifi_roam_scan_due(const wifi_roam_t *r, int64_t now_us);
+void wifi_roam_scanned(wifi_roam_t *r, int64_t now_us);
+// after a scan: the score of the AP we're on, and of the best other if
+// there is one. True to leave for it.
+bool wifi_roam_check(wifi_roam_t *r, int32_t cur_score, bool have_best, int32_t best_score, int64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
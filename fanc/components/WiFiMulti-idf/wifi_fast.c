@@ -0,0 +1,173 @@
+/* WiFiMulti-idf fast reconnect
+
+** See wifi_fast.h. Kept free of ESP-IDF so the decisions can be run against
+** a fake radio on a desktop.
+**
+** Portions copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include <stddef.h>
+
+#include "wifi_fast.h"
+
+static const char *via_names[] = { "none", "direct", "scan" };
+
+const char *wifi_fast_via_name(wifi_fast_via_t k) {
+    if (k < WIFI_FAST_VIA_NONE || k > WIFI_FAST_VIA_SCAN) return("unknown");
+    return(via_names[k]);
+}
+
+// FNV-1a, over everything ahead of the check
+static uint32_t cache_hash(const wifi_fast_cache_t *c) {
+    const uint8_t *b = (const uint8_t *) c;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < offsetof(wifi_fast_cache_t, check); i++) {
+        h ^= b[i];
+        h *= 16777619u;
+    }
+    return(h);
+}
+
+void wifi_fast_seal(wifi_fast_cache_t *c) {
+    c->magic = WIFI_FAST_MAGIC;
+    c->check = cache_hash(c);
+}
+
+bool wifi_fast_cache_check(const wifi_fast_cache_t *c) {
+    if (c->magic != WIFI_FAST_MAGIC) return(false);
+    if (c->check != cache_hash(c)) return(false);
+    if (c->ssid[WIFI_FAST_SSID_LEN - 1] != 0 || c->ssid[0] == 0) return(false);
+    if (c->channel < 1 || c->channel > 14) return(false);
+    return(true);
+}
+
+static bool cache_same(const wifi_fast_cache_t *a, const wifi_fast_cache_t *b) {
+    return( strcmp((const char *) a->ssid, (const char *) b->ssid) == 0 &&
+        memcmp(a->bssid, b->bssid, sizeof(a->bssid)) == 0 &&
+        a->channel == b->channel &&
+        a->authmode == b->authmode );
+}
+
+void wifi_fast_init(wifi_fast_t *f, const wifi_fast_store_t *store, int64_t now_us) {
+
+    memset(f, 0, sizeof(wifi_fast_t));
+    f->down_us = now_us;
+    f->start_us = now_us;
+
+    if (store && store->load && store->load(store->ctx, &f->cache)) {
+        f->cache_valid = wifi_fast_cache_check(&f->cache);
+    }
+    if (!f->cache_valid) memset(&f->cache, 0, sizeof(f->cache));
+}
+
+static bool direct_next(const wifi_fast_t *f) {
+    return( f->cache_valid && f->direct_fails < WIFI_FAST_DIRECT_MAX );
+}
+
+bool wifi_fast_scan_hold(const wifi_fast_t *f) {
+    return( f->attempt == WIFI_FAST_VIA_DIRECT || (f->up == WIFI_FAST_VIA_NONE && direct_next(f)) );
+}
+
+void wifi_fast_roam(wifi_fast_t *f) {
+    f->direct_fails = WIFI_FAST_DIRECT_MAX;
+}
+
+wifi_fast_via_t wifi_fast_step(wifi_fast_t *f, const wifi_fast_driver_t *drv, int64_t now_us) {
+
+    wifi_fast_target_t t;
+    memset(&t, 0, sizeof(t));
+
+    // the last AP, straight to it
+    if (direct_next(f)) {
+        if (drv->password(drv->ctx, f->cache.ssid, t.password)) {
+            memcpy(t.ssid, f->cache.ssid, sizeof(t.ssid));
+            memcpy(t.bssid, f->cache.bssid, sizeof(t.bssid));
+            t.channel = f->cache.channel;
+            t.authmode = f->cache.authmode;
+            t.direct = true;
+            f->n_direct++;
+            f->attempt = WIFI_FAST_VIA_DIRECT;
+            if (drv->connect(drv->ctx, &t) == 0) return(WIFI_FAST_VIA_DIRECT);
+            // as good as failing
+            f->attempt = WIFI_FAST_VIA_NONE;
+            f->direct_fails++;
+            f->n_direct_fails++;
+            return(WIFI_FAST_VIA_NONE);
+        }
+        // not registered, yet or any more
+        if (now_us - f->start_us < WIFI_FAST_REGISTER_US) return(WIFI_FAST_VIA_NONE);
+        f->direct_fails = WIFI_FAST_DIRECT_MAX;
+    }
+
+    // scan and pick, the way it always was
+    if (!drv->best(drv->ctx, &t)) return(WIFI_FAST_VIA_NONE);
+    t.direct = false;
+    f->n_scan++;
+    f->attempt = WIFI_FAST_VIA_SCAN;
+    if (drv->connect(drv->ctx, &t) == 0) return(WIFI_FAST_VIA_SCAN);
+    f->attempt = WIFI_FAST_VIA_NONE;
+    return(WIFI_FAST_VIA_NONE);
+}
+
+void wifi_fast_connected(wifi_fast_t *f, const uint8_t *ssid, int ssid_len, const uint8_t *bssid,
+    int channel, int authmode) {
+
+    wifi_fast_cache_t *j = &f->joined;
+    memset(j, 0, sizeof(wifi_fast_cache_t));
+    if (ssid_len < 0) ssid_len = 0;
+    if (ssid_len > WIFI_FAST_SSID_LEN - 1) ssid_len = WIFI_FAST_SSID_LEN - 1;
+    memcpy(j->ssid, ssid, ssid_len);
+    memcpy(j->bssid, bssid, sizeof(j->bssid));
+    j->channel = (uint8_t) channel;
+    j->authmode = authmode;
+    wifi_fast_seal(j);
+    f->joined_valid = wifi_fast_cache_check(j);
+}
+
+static void time_add(wifi_fast_time_t *t, int64_t us) {
+    if (t->n == 0 || us < t->min_us) t->min_us = us;
+    if (us > t->max_us) t->max_us = us;
+    t->last_us = us;
+    t->sum_us += us;
+    t->n++;
+}
+
+void wifi_fast_got_ip(wifi_fast_t *f, const wifi_fast_store_t *store, int64_t now_us) {
+
+    // an address renewed on a link that's up isn't a reconnect
+    if (f->down_us >= 0) {
+        int64_t us = now_us - f->down_us;
+        if (f->attempt == WIFI_FAST_VIA_DIRECT) time_add(&f->t_direct, us);
+        else time_add(&f->t_scan, us);
+    }
+
+    if (f->joined_valid && (!f->cache_valid || !cache_same(&f->joined, &f->cache))) {
+        f->cache = f->joined;
+        f->cache_valid = true;
+        if (store && store->save) store->save(store->ctx, &f->cache);
+        f->n_saves++;
+    }
+    f->joined_valid = false;
+
+    if (f->attempt != WIFI_FAST_VIA_NONE) f->up = f->attempt;
+    f->attempt = WIFI_FAST_VIA_NONE;
+    f->direct_fails = 0;
+    f->down_us = -1;
+}
+
+void wifi_fast_disconnected(wifi_fast_t *f, int64_t now_us) {
+
+    if (f->attempt == WIFI_FAST_VIA_DIRECT) {
+        f->direct_fails++;
+        f->n_direct_fails++;
+    }
+    f->attempt = WIFI_FAST_VIA_NONE;
+    f->up = WIFI_FAST_VIA_NONE;
+    f->joined_valid = false;
+    if (f->down_us < 0) f->down_us = now_us;
+}
@@ -0,0 +1,165 @@
+/* WiFiMulti-idf AP scoring
+
+** See wifi_score.h. Kept free of ESP-IDF so traces can be run through it
+** on a desktop.
+**
+** Portions copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "wifi_score.h"
+
+#define W_ONE 256
+
+// what the last failure costs, in dB, and how fast that goes
+static const struct {
+    const char *name;
+    int db;
+    int64_t half_us;
+} reasons[] = {
+    [WIFI_SCORE_LEFT] = { "left", 0, 1 },
+    [WIFI_SCORE_LOST] = { "lost", 10, 2LL * 60 * 1000 * 1000 },
+    [WIFI_SCORE_NOT_FOUND] = { "not_found", 15, 1LL * 60 * 1000 * 1000 },
+    [WIFI_SCORE_AUTH] = { "auth", 40, 10LL * 60 * 1000 * 1000 },
+    [WIFI_SCORE_OTHER] = { "other", 6, 2LL * 60 * 1000 * 1000 },
+};
+
+const char *wifi_score_reason_name(wifi_score_reason_t r) {
+    if (r < WIFI_SCORE_LEFT || r > WIFI_SCORE_OTHER) return("unknown");
+    return(reasons[r].name);
+}
+
+// v halved every half_us. Whole halvings are a shift, the rest of one is
+// the straight line, which is within 6% of the curve.
+static uint32_t decay(uint32_t v, int64_t dt_us, int64_t half_us) {
+    if (dt_us <= 0 || v == 0) return(v);
+    int64_t n = dt_us / half_us;
+    if (n >= 31) return(0);
+    v >>= n;
+    int64_t rem = dt_us % half_us;
+    return( (uint32_t) (v - (uint32_t) ((int64_t) v * rem / (2 * half_us))) );
+}
+
+static void weights_decay(wifi_score_t *s, int64_t now_us) {
+    if (s->w_us == 0) {
+        s->w_us = now_us;
+        return;
+    }
+    s->ok_w = decay(s->ok_w, now_us - s->w_us, WIFI_SCORE_OK_HALF_US);
+    s->fail_w = decay(s->fail_w, now_us - s->w_us, WIFI_SCORE_FAIL_HALF_US);
+    s->w_us = now_us;
+}
+
+void wifi_score_init(wifi_score_t *s) {
+    memset(s, 0, sizeof(wifi_score_t));
+    s->reason = WIFI_SCORE_LEFT;
+}
+
+void wifi_score_rssi(wifi_score_t *s, int rssi, int64_t now_us) {
+
+    int32_t x = rssi * WIFI_SCORE_ONE;
+
+    // another with the same name in the same scan, keep the better
+    if (s->seen_us == now_us && s->seen_us != 0) {
+        int32_t alt = s->rssi_prev + (x - s->rssi_prev) / 4;
+        if (alt > s->rssi) s->rssi = alt;
+        return;
+    }
+
+    // the first sample is all there is. One gone stale is as good as none.
+    if (s->seen_us == 0 || now_us - s->seen_us > WIFI_SCORE_STALE_US) {
+        s->rssi_prev = x;
+        s->rssi = x;
+    }
+    else {
+        s->rssi_prev = s->rssi;
+        s->rssi += (x - s->rssi) / 4;
+    }
+    s->seen_us = now_us;
+}
+
+void wifi_score_success(wifi_score_t *s, int64_t now_us) {
+    weights_decay(s, now_us);
+    s->ok_w += W_ONE;
+}
+
+void wifi_score_fail(wifi_score_t *s, wifi_score_reason_t reason, int64_t now_us) {
+    if (reason == WIFI_SCORE_LEFT) return;
+    weights_decay(s, now_us);
+    s->fail_w += W_ONE;
+    s->reason = reason;
+    s->reason_us = now_us;
+}
+
+bool wifi_score_fresh(const wifi_score_t *s, int64_t now_us) {
+    return( s->seen_us != 0 && now_us - s->seen_us <= WIFI_SCORE_STALE_US );
+}
+
+int32_t wifi_score_history(const wifi_score_t *s, int64_t now_us) {
+
+    int64_t dt = s->w_us ? now_us - s->w_us : 0;
+    int64_t ok = (int64_t) decay(s->ok_w, dt, WIFI_SCORE_OK_HALF_US) * WIFI_SCORE_OK_DB * WIFI_SCORE_ONE / W_ONE;
+    int64_t fail = (int64_t) decay(s->fail_w, dt, WIFI_SCORE_FAIL_HALF_US) * WIFI_SCORE_FAIL_DB * WIFI_SCORE_ONE / W_ONE;
+    if (ok > WIFI_SCORE_OK_MAX_DB * WIFI_SCORE_ONE) ok = WIFI_SCORE_OK_MAX_DB * WIFI_SCORE_ONE;
+    if (fail > WIFI_SCORE_FAIL_MAX_DB * WIFI_SCORE_ONE) fail = WIFI_SCORE_FAIL_MAX_DB * WIFI_SCORE_ONE;
+
+    int64_t why = 0;
+    if (s->reason_us != 0 && s->reason != WIFI_SCORE_LEFT) {
+        why = decay(reasons[s->reason].db * WIFI_SCORE_ONE, now_us - s->reason_us, reasons[s->reason].half_us);
+    }
+
+    return( (int32_t) (ok - fail - why) );
+}
+
+int32_t wifi_score_get(const wifi_score_t *s, int64_t now_us) {
+    return( s->rssi + wifi_score_history(s, now_us) );
+}
+
+void wifi_roam_reset(wifi_roam_t *r, int64_t now_us) {
+    uint32_t n = r->n_roams;
+    memset(r, 0, sizeof(wifi_roam_t));
+    r->since_us = now_us;
+    r->n_roams = n;
+}
+
+void wifi_roam_rssi(wifi_roam_t *r, int rssi) {
+    int32_t x = rssi * WIFI_SCORE_ONE;
+    if (!r->has_rssi) r->rssi = x;
+    else r->rssi += (x - r->rssi) / 4;
+    r->has_rssi = true;
+}
+
+static bool roam_weak(const wifi_roam_t *r) {
+    return( r->has_rssi && r->rssi < WIFI_ROAM_WEAK_DBM * WIFI_SCORE_ONE );
+}
+
+bool wifi_roam_scan_due(const wifi_roam_t *r, int64_t now_us) {
+    if (r->since_us == 0 || !roam_weak(r)) return(false);
+    return( r->scan_us == 0 || now_us - r->scan_us >= WIFI_ROAM_SCAN_US );
+}
+
+void wifi_roam_scanned(wifi_roam_t *r, int64_t now_us) {
+    r->scan_us = now_us;
+}
+
+bool wifi_roam_check(wifi_roam_t *r, int32_t cur_score, bool have_best, int32_t best_score, int64_t now_us) {
+
+    if (r->since_us == 0) return(false);
+
+    if (!roam_weak(r) || !have_best || best_score < cur_score + WIFI_ROAM_MARGIN_DB * WIFI_SCORE_ONE) {
+        r->better = 0;
+        return(false);
+    }
+    r->better++;
+    if (r->better < WIFI_ROAM_CHECKS) return(false);
+    if (now_us - r->since_us < WIFI_ROAM_DWELL_US) return(false);
+
+    r->better = 0;
+    r->n_roams++;
+    return(true);
+}
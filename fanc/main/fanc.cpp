@@ -1,4 +1,4 @@
-/* FANC 
+/* FANC
 
    Fan controller. Uses a very basic web plus rest system to do something basic.
 
@@ -20,6 +20,7 @@
 #include "driver/ledc.h"
 #include "driver/gpio.h"
 #include "nvs_flash.h"
+#include "esp_timer.h"
 
 #include "WiFiMulti-idf.h"
 
@@ -29,219 +30,485 @@
 static const char *TAG = "fanc";
 
 #include "fanc.h"
+#include "fanc_sched.h"
 
 
 //
-// These pins and values are for generating a PWM code 
-// for driving a "intel format" PWM fan.
+// The fans. Each is a PWM output, which is an LEDC channel on a timer, and
+// maybe a tach input. These are "intel format" PWM fans.
+//
+// Connect the PWM to the signal, which is the "outer" pin that's away from
+// the power pins. The tach needs a small resistor as a pullup, see the readme.
+//
+// Fans on one timer share its frequency. There are four timers and eight
+// channels, all low speed mode here. A tach of -1 means there isn't one.
 //
 
-#define LEDC_FANC_TIMER                LEDC_TIMER_0
 #define LEDC_FANC_SPEED_MODE           LEDC_LOW_SPEED_MODE
-#define LEDC_FANC_TIMER_HZ             24000
-#define LEDC_FANC_TIMER_RESOLUTION      LEDC_TIMER_8_BIT
 
-// This controls the fan. Connect it to the signal, which is the "outer"
-// pin that's away from the power pins.
-#define LEDC_FANC_GPIO              (18)
-#define LEDC_FANC_CHANNEL            LEDC_CHANNEL_0
+static const fanc_fan_cfg_t g_fanc_fans[] = {
+    // name     pwm  tach  channel         timer         hz     pulses/rev
+    { "fan0",   18,  19,   LEDC_CHANNEL_0, LEDC_TIMER_0, 24000, 2 },
+    // { "fan1",   17,  16,   LEDC_CHANNEL_1, LEDC_TIMER_0, 24000, 2 },
+    // { "fan2",   4,   5,    LEDC_CHANNEL_2, LEDC_TIMER_0, 24000, 2 },
+    // { "fan3",   25,  26,   LEDC_CHANNEL_3, LEDC_TIMER_0, 24000, 2 },
+};
 
-//
-// These values are for measuring the speed of the fan. A small resistor
-// has to be used as a pullup. See the readme.
-//
-#define FANC_PULSE_COUNT_GPIO       (GPIO_NUM_19)
-#define FANC_PULSE_COUNT_PIN_SEL  (1ULL << FANC_PULSE_COUNT_GPIO)
+#define FANC_N_FANS ((int) (sizeof(g_fanc_fans) / sizeof(fanc_fan_cfg_t)))
 
+// the PID's gains assume this period
+#define FANC_CTRL_PERIOD_MS 250
 
+static fanc_ctrl_t g_fanc_ctrl;
 
-//
-// The percentage currently set for the configured fan
-//
+// what wakes the task when, see fanc_sched.h
+static fanc_sched_t g_fanc_sched;
+static TaskHandle_t g_fancTask = NULL;
+static esp_timer_handle_t g_fanc_tick_timer = NULL;
+
+// the first fan's speed history. A day of it is 11K, so just the one.
+static fanc_hist_t g_fanc_hist;
+static uint32_t g_fanc_hist_us_max = 0;
+static_assert(FANC_CTRL_PERIOD_MS == FANC_HIST_RAW_MS, "the raw history is a sample a control period");
+static_assert(sizeof(fanc_hist_t) < 16 * 1024, "history over budget");
 
-static int g_fanc_percentage = 100; // start at full-on
+// duty resolution each fan's timer ended up with
+static ledc_timer_bit_t g_fanc_duty_bits[FANC_FANS_MAX];
 
+// something that's saved in NVS changed, a bit per fan
+static portMUX_TYPE g_fanc_dirty_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t g_fanc_dirty = 0;
 
-int fanc_percentage_get(void) {
-    return(g_fanc_percentage);
+static void fanc_dirty_set(uint32_t mask) {
+    portENTER_CRITICAL(&g_fanc_dirty_mux);
+    g_fanc_dirty |= mask;
+    portEXIT_CRITICAL(&g_fanc_dirty_mux);
 }
 
+static uint32_t fanc_dirty_take(void) {
+    portENTER_CRITICAL(&g_fanc_dirty_mux);
+    uint32_t d = g_fanc_dirty;
+    g_fanc_dirty = 0;
+    portEXIT_CRITICAL(&g_fanc_dirty_mux);
+    return(d);
+}
 
-esp_err_t fanc_percentage_set(int p) {
-    if (p > 100 || p < 0) return(ESP_FAIL);
-    g_fanc_percentage = p;
-    // update everything
-    return(ESP_OK);
+// something changed on a fan, wake the task to put it out
+static void fanc_wake(int fan) {
+    fanc_sched_request(&g_fanc_sched, fan, esp_timer_get_time());
+    if (g_fancTask) xTaskNotify(g_fancTask, 1 << fan, eSetBits);
 }
 
+// and if it's a setting, save it too
+static void fanc_changed(int fan) {
+    fanc_dirty_set(1 << fan);
+    fanc_wake(fan);
+}
+
+int fanc_fan_count(void) {
+    return(FANC_N_FANS);
+}
+
+const fanc_fan_cfg_t *fanc_fan_cfg(int fan) {
+    if (fan < 0 || fan >= FANC_N_FANS) return(NULL);
+    return(&g_fanc_fans[fan]);
+}
+
+static fanc_fan_settings_t *fanc_settings(int fan) {
+    if (fan < 0 || fan >= FANC_N_FANS) return(NULL);
+    return(&g_fanc_ctrl.fans[fan].set);
+}
 
 /*
-** use the NVS module to store a value, and get the persistant value on restart
-** will simply opulate the global. No point in paying attention to an error
+** Settings, a fan at a time. The task is woken to pick them up: open loop
+** goes straight out, closed loop on the next control period.
+** Gains are in thousandths, output ( duty in tenths of a percent ) per RPM
+** or per milli-degree, and are for the loop the fan's in: RPM's when open.
 */
 
-static void fanc_persist_restore(void) {
+int fanc_fan_percentage_get(int fan) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    return( s ? s->percentage : 0 );
+}
 
-    nvs_handle_t nvs_h;
-    esp_err_t err = nvs_open("fanc", NVS_READONLY, &nvs_h);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        return;
+esp_err_t fanc_fan_percentage_set(int fan, int p) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s || p > 100 || p < 0) return(ESP_FAIL);
+    s->percentage = p;
+    fanc_changed(fan);
+    return(ESP_OK);
+}
+
+int fanc_fan_mode_get(int fan) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    return( s ? s->mode : FANC_MODE_OPEN );
+}
+
+esp_err_t fanc_fan_mode_set(int fan, int m) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s || m < FANC_MODE_OPEN || m > FANC_MODE_TEMP) return(ESP_FAIL);
+    s->mode = m;
+    fanc_changed(fan);
+    return(ESP_OK);
+}
+
+int fanc_fan_rpm_target_get(int fan) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    return( s ? s->rpm_target : 0 );
+}
+
+esp_err_t fanc_fan_rpm_target_set(int fan, int rpm) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s || rpm < 0 || rpm > FANC_RPM_TARGET_MAX) return(ESP_FAIL);
+    s->rpm_target = rpm;
+    fanc_changed(fan);
+    return(ESP_OK);
+}
+
+int fanc_fan_temp_target_get(int fan) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    return( s ? s->temp_target : 0 );
+}
+
+esp_err_t fanc_fan_temp_target_set(int fan, int mc) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s || mc < 0 || mc > FANC_TEMP_MAX) return(ESP_FAIL);
+    s->temp_target = mc;
+    fanc_changed(fan);
+    return(ESP_OK);
+}
+
+static int fanc_loop(const fanc_fan_settings_t *s) {
+    return( s->mode == FANC_MODE_TEMP ? FANC_LOOP_TEMP : FANC_LOOP_RPM );
+}
+
+int fanc_fan_gain_get(int fan, int which) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s || which < 0 || which > 2) return(0);
+    return(s->gains[fanc_loop(s)][which]);
+}
+
+esp_err_t fanc_fan_gain_set(int fan, int which, int milli) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s || which < 0 || which > 2 || milli < 0) return(ESP_FAIL);
+    s->gains[fanc_loop(s)][which] = milli;
+    fanc_changed(fan);
+    return(ESP_OK);
+}
+
+int fanc_fan_autotune_get(int fan) {
+    if (fan < 0 || fan >= FANC_N_FANS) return(0);
+    fanc_fan_t *f = &g_fanc_ctrl.fans[fan];
+    return(f->tune_request || f->tune.state == FANC_TUNE_RUNNING);
+}
+
+esp_err_t fanc_fan_autotune_set(int fan, int on) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s) return(ESP_FAIL);
+    fanc_fan_t *f = &g_fanc_ctrl.fans[fan];
+    if (on) {
+        if (s->mode == FANC_MODE_OPEN) return(ESP_FAIL);
+        f->tune_request = true;
+    }
+    else {
+        f->tune_cancel = true;
     }
+    fanc_wake(fan);
+    return(ESP_OK);
+}
 
-    // Read
-    ESP_LOGD(TAG, "Reading persitant values  ... ");
-    int32_t fan_pct = 100; // value will default to 0, if not set yet in NVS
-    err = nvs_get_i32(nvs_h, "fan_pct", &fan_pct);
-    switch (err) {
-        case ESP_OK:
-            ESP_LOGD(TAG, "Retrieved: value is %d",fan_pct);
-            g_fanc_percentage = fan_pct;
-            break;
-        case ESP_ERR_NVS_NOT_FOUND:
-            ESP_LOGI(TAG, "The value is not initialized yet!");
-            break;
-        default :
-            ESP_LOGW(TAG, "Error (%s) reading NVS!", esp_err_to_name(err));
-            break;
+// sweep the fan's curve, see fanc_cal.h. It needs a tach.
+int fanc_fan_calibrate_get(int fan) {
+    if (fan < 0 || fan >= FANC_N_FANS) return(0);
+    fanc_fan_t *f = &g_fanc_ctrl.fans[fan];
+    return(f->cal_request || f->cal.state == FANC_CAL_RUNNING);
+}
+
+esp_err_t fanc_fan_calibrate_set(int fan, int on) {
+    if (fan < 0 || fan >= FANC_N_FANS) return(ESP_FAIL);
+    fanc_fan_t *f = &g_fanc_ctrl.fans[fan];
+    if (on) {
+        if (!f->has_tach) return(ESP_FAIL);
+        f->cal_request = true;
     }
+    else {
+        f->cal_cancel = true;
+    }
+    fanc_wake(fan);
+    return(ESP_OK);
+}
 
-    // Close
-    nvs_close(nvs_h);
+esp_err_t fanc_fan_cal_get(int fan, fanc_cal_lut_t *lut) {
+    if (fan < 0 || fan >= FANC_N_FANS) return(ESP_FAIL);
+    *lut = g_fanc_ctrl.fans[fan].lut;
+    return(ESP_OK);
+}
 
-    return;
+int fanc_fan_rpm_get(int fan) {
+    if (fan < 0 || fan >= FANC_N_FANS || g_fanc_fans[fan].tach_gpio < 0) return(0);
+    return( fanc_tach_rpm_get(fan) );
+}
+
+esp_err_t fanc_fan_status_get(int fan, fanc_ctrl_status_t *st) {
+    fanc_fan_settings_t *s = fanc_settings(fan);
+    if (!s) return(ESP_FAIL);
+    const fanc_fan_t *f = &g_fanc_ctrl.fans[fan];
+    int loop = fanc_loop(s);
+    st->name = g_fanc_fans[fan].name;
+    st->mode = s->mode;
+    st->setpoint = s->mode == FANC_MODE_OPEN ? s->percentage :
+        loop == FANC_LOOP_TEMP ? s->temp_target : s->rpm_target;
+    st->measured = f->measured;
+    st->rpm = fanc_fan_rpm_get(fan);
+    st->duty = f->duty < 0 ? 0 : f->duty;
+    st->kp = s->gains[loop][0];
+    st->ki = s->gains[loop][1];
+    st->kd = s->gains[loop][2];
+    st->tune = fanc_tune_state_name(f->tune.state);
+    st->ku = (int) ((int64_t) f->tune.ku * 1000 / FANC_PID_ONE);
+    st->tu_ms = f->tune.tu_ms;
+    st->temp_stale = f->temp_stale;
+    st->cal = fanc_cal_state_name(f->cal.state);
+    st->linear = f->lut.valid;
+    st->stall = fanc_stall_state_name(f->stall.state);
+    st->kicks = f->stall.n_kicks;
+    st->faults = f->stall.n_faults;
+    return(ESP_OK);
+}
+
+void fanc_ctrl_stats_get(fanc_ctrl_stats_t *st) {
+    st->n_fans = FANC_N_FANS;
+    st->steps = g_fanc_ctrl.n_steps;
+    st->commits = g_fanc_ctrl.n_commits;
+    st->duty_sets = g_fanc_ctrl.n_duty_sets;
+    st->period_ms = FANC_CTRL_PERIOD_MS;
+    const fanc_sched_t *s = &g_fanc_sched;
+    st->ticks = s->n_ticks;
+    st->tick_late_max_us = (uint32_t) s->tick_late_max_us;
+    st->applied = s->n_applied;
+    st->deferred = s->n_deferred;
+    st->apply_us_last = (uint32_t) s->lat_last_us;
+    st->apply_us_max = (uint32_t) s->lat_max_us;
+    st->apply_us_avg = s->n_applied ? (uint32_t) (s->lat_sum_us / s->n_applied) : 0;
 }
 
 /*
-** use the NVS module to store a value, and get the persistant value on restart
-** will simply opulate the global. No point in paying attention to an error
+** The first fan, for the REST calls that were here before there were more
 */
 
-static void fanc_persist_update(void) {
+int fanc_percentage_get(void) { return( fanc_fan_percentage_get(0) ); }
+esp_err_t fanc_percentage_set(int p) { return( fanc_fan_percentage_set(0, p) ); }
+int fanc_mode_get(void) { return( fanc_fan_mode_get(0) ); }
+esp_err_t fanc_mode_set(int m) { return( fanc_fan_mode_set(0, m) ); }
+int fanc_rpm_target_get(void) { return( fanc_fan_rpm_target_get(0) ); }
+esp_err_t fanc_rpm_target_set(int rpm) { return( fanc_fan_rpm_target_set(0, rpm) ); }
+int fanc_temp_target_get(void) { return( fanc_fan_temp_target_get(0) ); }
+esp_err_t fanc_temp_target_set(int mc) { return( fanc_fan_temp_target_set(0, mc) ); }
+int fanc_gain_get(int which) { return( fanc_fan_gain_get(0, which) ); }
+esp_err_t fanc_gain_set(int which, int milli) { return( fanc_fan_gain_set(0, which, milli) ); }
+int fanc_autotune_get(void) { return( fanc_fan_autotune_get(0) ); }
+esp_err_t fanc_autotune_set(int on) { return( fanc_fan_autotune_set(0, on) ); }
+int fanc_calibrate_get(void) { return( fanc_fan_calibrate_get(0) ); }
+esp_err_t fanc_calibrate_set(int on) { return( fanc_fan_calibrate_set(0, on) ); }
+int fanc_rpm_get(void) { return( fanc_fan_rpm_get(0) ); }
+
+void fanc_ctrl_status_get(fanc_ctrl_status_t *st) {
+    fanc_fan_status_get(0, st);
+}
 
-    nvs_handle_t nvs_h;
-    esp_err_t err = nvs_open("fanc", NVS_READWRITE, &nvs_h);
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG,"Error (%s) opening NVS handle!", (esp_err_to_name(err)));
-        return;
-    }
+const fanc_hist_t *fanc_hist_get(void) {
+    return(&g_fanc_hist);
+}
 
-    // Write
-    ESP_LOGI(TAG,"Writing value to NVS ... ");
-    int32_t fan_pct = g_fanc_percentage; // value will default to 0, if not set yet in NVS
-    err = nvs_set_i32(nvs_h, "fan_pct", fan_pct);
-    switch (err) {
-        case ESP_OK:
-            ESP_LOGD(TAG, "set: value is %d",fan_pct);
-            break;
-        case ESP_ERR_NVS_NOT_FOUND:
-            ESP_LOGI(TAG,"The value is not initialized yet!");
-            break;
-        default :
-            ESP_LOGE(TAG,"Error (%s) reading!", (esp_err_to_name(err)) );
-            break;
-    }
+uint32_t fanc_hist_add_us_max(void) {
+    return(g_fanc_hist_us_max);
+}
 
-    ESP_LOGD(TAG,"Committing updates in NVS ... ");
-    err = nvs_commit(nvs_h);
-    if (err != ESP_OK) { ESP_LOGW(TAG,"NVS Commit failed!"); }
-    else {    ESP_LOGI(TAG, "NVS commit done"); }
+// revolutions per second
+float fanc_speed_get(void) {
+    fanc_tach_stats_t st;
+    if (fanc_tach_stats_get(0, &st) != ESP_OK) return(0.0);
+    return ( st.mrps / 1000.0 );
+}
 
-    // Close
-    nvs_close(nvs_h);
+/*
+** The temperature all the fans holding one go by
+*/
 
-    return;
+int fanc_temp_get(void) {
+    return(g_fanc_ctrl.temp);
+}
+
+// whatever reads the sensor calls this, or posts to /rest/temp
+esp_err_t fanc_temp_set(int mc) {
+    if (mc < FANC_TEMP_MIN || mc > FANC_TEMP_MAX) return(ESP_FAIL);
+    fanc_ctrl_temp_set(&g_fanc_ctrl, mc, esp_timer_get_time() / 1000);
+    return(ESP_OK);
 }
 
+
 /*
-** reading the speed of a fan
-**
-** esp_err_t gpio_intr_enable(gpio_num_t gpio_num) --- enables interrupts?
-**    get the current value
-** int gpio_get_level(gpio_num_t gpio_num)
-**    set direction to input
-** esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
-**    allocate an interrupt handler for the GPIO in question?
-
-** esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
-**     remove the handler?
-** esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
-
-**    set the interrupt type, that's how you get notified on rise, fall, etc
-**    GPIO_INTR_POSEDGE , ANYEDGE, etc
-** esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+** use the NVS module to store a value, and get the persistant value on restart
+** will simply opulate the global. No point in paying attention to an error
 **
-** thus - pick a pin. Register a handler. Set the interrupt type.
-**   increment a global when called and returned, that simple, now you have a counter
-**   every time a rising edge happens
+** Each fan's settings are under its own keys, "f0_pct" and so on. Changes
+** are written behind by Persist-idf: a slider being dragged is one commit
+** once it stops, not one per step.
+*/
 
- https://www.lucadentella.it/en/2017/02/25/esp32-12-io-e-interrupts/
- */
+// quiet this long before writing, but never hold a change longer than the max
+#define FANC_PERSIST_DEBOUNCE_MS 2000
+#define FANC_PERSIST_MAX_DELAY_MS 15000
+
+typedef struct {
+    const char *key;
+    size_t offset;      // of the int in fanc_fan_settings_t
+} fanc_persist_t;
+
+static const fanc_persist_t fanc_persist[] = {
+    { "pct", offsetof(fanc_fan_settings_t, percentage) },
+    { "mode", offsetof(fanc_fan_settings_t, mode) },
+    { "rpm_sp", offsetof(fanc_fan_settings_t, rpm_target) },
+    { "temp_sp", offsetof(fanc_fan_settings_t, temp_target) },
+    { "rpm_kp", offsetof(fanc_fan_settings_t, gains[FANC_LOOP_RPM][0]) },
+    { "rpm_ki", offsetof(fanc_fan_settings_t, gains[FANC_LOOP_RPM][1]) },
+    { "rpm_kd", offsetof(fanc_fan_settings_t, gains[FANC_LOOP_RPM][2]) },
+    { "temp_kp", offsetof(fanc_fan_settings_t, gains[FANC_LOOP_TEMP][0]) },
+    { "temp_ki", offsetof(fanc_fan_settings_t, gains[FANC_LOOP_TEMP][1]) },
+    { "temp_kd", offsetof(fanc_fan_settings_t, gains[FANC_LOOP_TEMP][2]) },
+};
 
-// This global will be incremented when the interrupt fires
-static uint32_t g_fanc_pulse_count = 0;
-static uint32_t g_fanc_previous_pulse_count = 0;
-static int64_t  g_fanc_previous_time = 0;
-static float g_fanc_rps = 0.0;
+#define FANC_PERSIST_N (sizeof(fanc_persist) / sizeof(fanc_persist_t))
 
+// every fan's keys, and the one from before there were several fans
+static persist_entry_t g_fanc_persist_entries[FANC_FANS_MAX * FANC_PERSIST_N + 1];
+static persist_t g_fanc_persist;
+static persist_nvs_t g_fanc_nvs;
+static persist_store_t g_fanc_store;
 
-static void IRAM_ATTR fanc_pulse_count_isr(void *p) {
-    g_fanc_pulse_count++;
+static int *fanc_persist_val(fanc_fan_settings_t *s, const fanc_persist_t *p) {
+    return( (int *) ((char *) s + p->offset) );
 }
 
-// somewhat annoyingly, this will measure the 
+static int fanc_persist_idx(int fan, size_t i) {
+    return( fan * FANC_PERSIST_N + i );
+}
 
-float fanc_speed_get(void) {
+static void fanc_persist_restore(void) {
 
-	if (g_fanc_previous_time == 0) return(0.0);
+    persist_nvs_store(&g_fanc_store, &g_fanc_nvs, "fanc");
+    persist_init(&g_fanc_persist, g_fanc_persist_entries, sizeof(g_fanc_persist_entries) / sizeof(persist_entry_t),
+        FANC_PERSIST_DEBOUNCE_MS, FANC_PERSIST_MAX_DELAY_MS);
+
+    // in index order, see fanc_persist_idx()
+    for (int fan = 0; fan < FANC_N_FANS; fan++) {
+        fanc_fan_settings_t *s = fanc_settings(fan);
+        for (size_t i = 0; i < FANC_PERSIST_N; i++) {
+            char key[PERSIST_KEY_MAX];
+            snprintf(key, sizeof(key), "f%d_%s", fan, fanc_persist[i].key);
+            persist_add(&g_fanc_persist, key, *fanc_persist_val(s, &fanc_persist[i]));
+        }
+    }
+    int legacy = persist_add(&g_fanc_persist, "fan_pct", 0);
 
-	return (g_fanc_rps);
-}
+    // Read
+    ESP_LOGD(TAG, "Reading persitant values  ... ");
+    int found = persist_load(&g_fanc_persist, &g_fanc_store);
+    ESP_LOGI(TAG, "%d persistant values found", found);
 
-// so annoying these must be the same order as the struct definition
+    for (int fan = 0; fan < FANC_N_FANS; fan++) {
+        fanc_fan_settings_t *s = fanc_settings(fan);
+        for (size_t i = 0; i < FANC_PERSIST_N; i++) {
+            *fanc_persist_val(s, &fanc_persist[i]) = persist_get(&g_fanc_persist, fanc_persist_idx(fan, i));
+        }
+        // from before there were several fans, written under the new key next time
+        if (fan == 0 && !persist_present(&g_fanc_persist, fanc_persist_idx(0, 0)) && persist_present(&g_fanc_persist, legacy)) {
+            s->percentage = persist_get(&g_fanc_persist, legacy);
+        }
+        fanc_fan_settings_check(s);
+    }
 
-static gpio_config_t pulse_count_gpio = {
-    .pin_bit_mask = FANC_PULSE_COUNT_PIN_SEL,
-    .mode = GPIO_MODE_INPUT,
-    .pull_up_en = GPIO_PULLUP_DISABLE,
-    .pull_down_en = GPIO_PULLDOWN_DISABLE,
-    .intr_type = GPIO_INTR_POSEDGE,
-};
+    // anything the checks or the old key changed gets written back
+    for (int fan = 0; fan < FANC_N_FANS; fan++) fanc_dirty_set(1 << fan);
 
-static esp_err_t fanc_pulse_count_init(void) {
+    return;
+}
 
-    esp_err_t   err;
+/*
+** Each fan's curve, from calibrating it, is a blob of its own: "f0_cal". It's
+** only written when a sweep finishes, so straight to NVS.
+*/
 
-    err = gpio_config(&pulse_count_gpio);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, " fanc_pluse_count: could not configure gpio config (%s)",esp_err_to_name(err));
-        return(err);
-    }
+static void fanc_cal_key(char *key, size_t key_len, int fan) {
+    snprintf(key, key_len, "f%d_cal", fan);
+}
 
-    //gpio_set_direction(FANC_PULSE_COUNT_GPIO, GPIO_MODE_INPUT);
-    //gpio_set_intr_type(FANC_PULSE_COUNT_GPIO, GPIO_INTR_POSEDGE);
+static void fanc_cal_restore(void) {
 
-    // example does not, a bit odd?
-    err = gpio_install_isr_service(0 /* default */);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG,"could not install isr service (%s)",esp_err_to_name(err));
-        return(err);
+    nvs_handle_t nvs_h;
+    if (nvs_open("fanc", NVS_READONLY, &nvs_h) != ESP_OK) return;
+
+    for (int fan = 0; fan < FANC_N_FANS; fan++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        fanc_cal_key(key, sizeof(key), fan);
+        fanc_cal_lut_t lut;
+        size_t len = sizeof(lut);
+        if (nvs_get_blob(nvs_h, key, &lut, &len) != ESP_OK) continue;
+        if (len != sizeof(lut) || !fanc_cal_lut_check(&lut)) {
+            ESP_LOGW(TAG, "%s: curve from another version, ignored", key);
+            continue;
+        }
+        g_fanc_ctrl.fans[fan].lut = lut;
+        ESP_LOGI(TAG, "%s: calibrated, turns from %d", key, lut.min_duty);
     }
 
-    err = gpio_isr_handler_add(FANC_PULSE_COUNT_GPIO, fanc_pulse_count_isr, 0 /* param for isr */);
+    nvs_close(nvs_h);
+}
+
+static void fanc_cal_save(int fan) {
+
+    nvs_handle_t nvs_h;
+    esp_err_t err = nvs_open("fanc", NVS_READWRITE, &nvs_h);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG,"could not add isr handler (%s)",esp_err_to_name(err) );
-        return(err);
+        ESP_LOGW(TAG,"Error (%s) opening NVS handle!", (esp_err_to_name(err)));
+        return;
     }
 
-    err = gpio_intr_enable(FANC_PULSE_COUNT_GPIO);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG,"could not enable inter (%s)",esp_err_to_name(err) );
-        return(err);
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    fanc_cal_key(key, sizeof(key), fan);
+    const fanc_cal_lut_t *lut = &g_fanc_ctrl.fans[fan].lut;
+    err = nvs_set_blob(nvs_h, key, lut, sizeof(fanc_cal_lut_t));
+    if (err == ESP_OK) err = nvs_commit(nvs_h);
+    if (err != ESP_OK) ESP_LOGE(TAG,"Error (%s) writing %s!", esp_err_to_name(err), key);
+    else ESP_LOGI(TAG, "%s: new curve saved, turns from %d", key, lut->min_duty);
+
+    nvs_close(nvs_h);
+}
+
+/*
+** the fans that changed hand their settings over, which only writes the ones
+** that differ, later. Called from the fan task.
+*/
+
+static void fanc_persist_update(uint32_t fans, uint32_t now_ms) {
+
+    for (int fan = 0; fan < FANC_N_FANS; fan++) {
+        if (!(fans & (1 << fan))) continue;
+        fanc_fan_settings_t *s = fanc_settings(fan);
+        for (size_t i = 0; i < FANC_PERSIST_N; i++) {
+            persist_set(&g_fanc_persist, fanc_persist_idx(fan, i), *fanc_persist_val(s, &fanc_persist[i]), now_ms);
+        }
     }
 
-    ESP_LOGI(TAG," fanc_pulse: successful init");
-    return(ESP_OK);
+    // Write, if it's been quiet long enough
+    int n = persist_poll(&g_fanc_persist, &g_fanc_store, now_ms);
+    if (n > 0) ESP_LOGI(TAG, "wrote %d values to NVS", n);
+
+    return;
+}
+
+const persist_t *fanc_persist_get(void) {
+    return(&g_fanc_persist);
 }
 
 
@@ -280,10 +547,8 @@ Might be nice to have a function that maps percents based on the duty resolution
 
 // Only have an esp32, not a S2, so I'm removing the defines for the S2
 
-// pick some values for the example
-
 // I have the suspicion that there is one set of channels for high speed, and one set
-// for low speed. 
+// for low speed.
 
 /* this interface works the following way:
 ** there are several timer channels.
@@ -292,6 +557,24 @@ Might be nice to have a function that maps percents based on the duty resolution
 ** It somewhat seems you might be able to use a single channel to drive multiple GPIO, hard to say
 */
 
+// The timer divides down from the 80Mhz APB clock, so the faster the PWM the
+// fewer bits of duty. 10 is plenty, the PID only puts out tenths of a percent.
+static ledc_timer_bit_t fanc_duty_bits(uint32_t hz) {
+    int bits = 10;
+    while (bits > 1 && ((uint64_t) hz << bits) > 80000000ULL) bits--;
+    return( (ledc_timer_bit_t) bits );
+}
+
+// in tenths of a percent, which is what the PID puts out
+static uint32_t duty_cycle_calculate( ledc_timer_bit_t duty_resolution, int permille) {
+    if (permille <= 0) return(0); // accuracy
+    if (permille >= 1000) return (1 << duty_resolution); // might be -1,
+    uint32_t r = 1 << duty_resolution;
+    r = (r * permille) / 1000; // safe because maximum resolution is 13 bits and we have a lot more
+    //printf(" dr %u permille %d is %u\n",duty_resolution,permille,r);
+    return (r);
+}
+
 /*
  * Prepare individual configuration
  * for each channel of LED Controller
@@ -305,105 +588,197 @@ Might be nice to have a function that maps percents based on the duty resolution
  *         then frequency and bit_num of these channels
  *         will be the same
  */
-static ledc_channel_config_t ledc_fanc_channel = {
-        .gpio_num   = LEDC_FANC_GPIO,
-        .speed_mode = LEDC_FANC_SPEED_MODE,
-        .channel    = LEDC_FANC_CHANNEL,
-        .intr_type  = LEDC_INTR_DISABLE, // unclear if this is the fade interrupt or what
-        .timer_sel  = LEDC_FANC_TIMER,      // choose a value you already configured
-        .duty       = 0, /* starting duty? */
-        .hpoint     = 0, /* no idea what this is for */
-};
-
-/* the example had the ordering wrong, but the example was C, which doesn't reorder.
-*/
+static esp_err_t fanc_pwm_init(void) {
 
-static ledc_timer_config_t ledc_fanc_timer = {
-    .speed_mode = LEDC_FANC_SPEED_MODE,          // low speed or high speed
-    .duty_resolution = LEDC_FANC_TIMER_RESOLUTION, // resolution of PWM duty
-    .timer_num = LEDC_FANC_TIMER,        // there are 4, let's use channel 0
-    .freq_hz = LEDC_FANC_TIMER_HZ,                     // frequency of PWM signal - happen to need 24k for fan control
-    .clk_cfg = LEDC_AUTO_CLK            // auto select the source clock
-};
+    esp_err_t err;
+    uint32_t timer_hz[LEDC_TIMER_MAX] = { 0 };
+    bool ok = true;
+
+    for (int i = 0; i < FANC_N_FANS; i++) {
+        const fanc_fan_cfg_t *cfg = &g_fanc_fans[i];
+
+        if (timer_hz[cfg->timer] == 0) {
+
+            /* the example had the ordering wrong, but the example was C, which doesn't reorder.
+            */
+            ledc_timer_config_t ledc_fanc_timer = {
+                .speed_mode = LEDC_FANC_SPEED_MODE,          // low speed or high speed
+                .duty_resolution = fanc_duty_bits(cfg->pwm_hz), // resolution of PWM duty
+                .timer_num = (ledc_timer_t) cfg->timer,
+                .freq_hz = cfg->pwm_hz,                     // frequency of PWM signal - happen to need 24k for fan control
+                .clk_cfg = LEDC_AUTO_CLK            // auto select the source clock
+            };
+            err = ledc_timer_config(&ledc_fanc_timer);
+            if (err == ESP_OK) { ESP_LOGD(TAG, " succeeded configing timer %d", cfg->timer); }
+            else { ESP_LOGE(TAG," could not configure timer %d: error %d", cfg->timer, err); ok = false; continue; }
+            timer_hz[cfg->timer] = cfg->pwm_hz;
+        }
+        else if (timer_hz[cfg->timer] != cfg->pwm_hz) {
+            ESP_LOGE(TAG, " %s wants %u hz but timer %d is already %u, skipping it",
+                cfg->name, cfg->pwm_hz, cfg->timer, timer_hz[cfg->timer]);
+            ok = false;
+            continue;
+        }
+        g_fanc_duty_bits[i] = fanc_duty_bits(cfg->pwm_hz);
+
+        // which will start the pin outputting to level 0
+        ledc_channel_config_t ledc_fanc_channel = {
+            .gpio_num   = cfg->pwm_gpio,
+            .speed_mode = LEDC_FANC_SPEED_MODE,
+            .channel    = (ledc_channel_t) cfg->channel,
+            .intr_type  = LEDC_INTR_DISABLE, // unclear if this is the fade interrupt or what
+            .timer_sel  = (ledc_timer_t) cfg->timer,
+            .duty       = 0, /* starting duty? */
+            .hpoint     = 0, /* no idea what this is for */
+        };
+        err = ledc_channel_config(&ledc_fanc_channel);
+        if (err == ESP_OK) { ESP_LOGD(TAG," succeeded configing channel %d", cfg->channel); }
+        else { ESP_LOGE(TAG, " could not configure channel %d: error %d", cfg->channel, err); ok = false; }
+    }
 
+    // duty changes go out as fades, see fanc_sched.h
+    err = ledc_fade_func_install(0);
+    if (err != ESP_OK) { ESP_LOGE(TAG, " could not install the fade service: error %d", err); ok = false; }
 
-static uint32_t duty_cycle_calculate( ledc_timer_bit_t duty_resolution, int percent) {
-    if (percent <= 0) return(0); // accuracy
-    if (percent >= 100) return (1 << duty_resolution); // might be -1, 
-    uint32_t r = 1 << duty_resolution;
-    r = (r * percent) / 100; // safe because maximum resolution is 13 bits and we have a lot more
-    //printf(" dr %u percent %d is %u\n",duty_resolution,percent,r);
-    return (r); 
+    return( ok ? ESP_OK : ESP_FAIL );
 }
 
-static TaskHandle_t g_fancTask = NULL;
-static bool fanc_live = true;
+/*
+** What the control loop drives. Duties are staged as they come and go out
+** together in the commit, each as a fade short enough to be over before the
+** next period: the IDF won't change a channel that's still fading.
+*/
 
-static void fanc_task(void *pvParameters)
-{
+static uint32_t g_fanc_staged = 0;
+static uint32_t g_fanc_staged_duty[FANC_FANS_MAX];
 
-    esp_err_t err;
+static int fanc_hw_rpm_get(void *ctx, int fan) {
+    return( fanc_fan_rpm_get(fan) );
+}
 
-    // get prior value from NVS
-    fanc_persist_restore();
+static void fanc_hw_duty_set(void *ctx, int fan, int permille) {
+    ESP_LOGD(TAG, " %s duty will be %d", g_fanc_fans[fan].name, permille);
+    g_fanc_staged_duty[fan] = duty_cycle_calculate(g_fanc_duty_bits[fan], permille);
+    g_fanc_staged |= 1 << fan;
+}
+
+static void fanc_hw_duty_commit(void *ctx) {
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < FANC_N_FANS; i++) {
+        if (!(g_fanc_staged & (1 << i))) continue;
+        ledc_channel_t ch = (ledc_channel_t) g_fanc_fans[i].channel;
+        int fade_ms = fanc_sched_fade_ms(&g_fanc_sched, i, now);
+        esp_err_t err;
+        if (fade_ms > 0) {
+            err = ledc_set_fade_with_time(LEDC_FANC_SPEED_MODE, ch, g_fanc_staged_duty[i], fade_ms);
+            if (err == ESP_OK) err = ledc_fade_start(LEDC_FANC_SPEED_MODE, ch, LEDC_FADE_NO_WAIT);
+        }
+        else {
+            err = ledc_set_duty(LEDC_FANC_SPEED_MODE, ch, g_fanc_staged_duty[i]);
+            if (err == ESP_OK) err = ledc_update_duty(LEDC_FANC_SPEED_MODE, ch);
+        }
+        if (err != ESP_OK) ESP_LOGW(TAG, " %s failed setting duty: error %d", g_fanc_fans[i].name, err);
+    }
+    g_fanc_staged = 0;
+}
 
-    // set up timer0
-    err = ledc_timer_config(&ledc_fanc_timer);
-    if (err == ESP_OK) { ESP_LOGD(TAG, " succeeded configing timer"); }
-    else { ESP_LOGE(TAG," could not configure timer: error %d",err); }
+static const fanc_hw_t g_fanc_hw = {
+    .rpm_get = fanc_hw_rpm_get,
+    .duty_set = fanc_hw_duty_set,
+    .duty_commit = fanc_hw_duty_commit,
+    .ctx = NULL,
+};
+
+static bool fanc_live = true;
 
-    // Set up controller 0, which will start the pin outputting to level 0-
-    err = ledc_channel_config(&ledc_fanc_channel);
-    if (err == ESP_OK) { ESP_LOGD(TAG," succeeded configing channel"); }
-    else { ESP_LOGE(TAG, " could not configure channel: error %d",err); }
+// the timer keeps the period, the task only has to wake for it
+static void fanc_tick(void *arg) {
+    if (g_fancTask) xTaskNotify(g_fancTask, FANC_SCHED_TICK, eSetBits);
+}
 
-    // don't want the ledc service yet
-    // Initialize fade service.--- let's not get too fancy yet
-    //ledc_fade_func_install(0);
+static esp_err_t fanc_tick_start(void) {
+    const esp_timer_create_args_t args = {
+        .callback = fanc_tick,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "fanc_tick",
+    };
+    esp_err_t err = esp_timer_create(&args, &g_fanc_tick_timer);
+    if (err == ESP_OK) err = esp_timer_start_periodic(g_fanc_tick_timer, FANC_CTRL_PERIOD_MS * 1000);
+    if (err != ESP_OK) ESP_LOGE(TAG, " could not start the control timer: error %d", err);
+    return(err);
+}
 
-    int last_value = -1;
+// the settings changed on these fans, put out what can go out now
+static void fanc_apply(uint32_t fans) {
+    uint32_t done = fanc_ctrl_apply(&g_fanc_ctrl, &g_fanc_hw, fans);
+    fanc_sched_done(&g_fanc_sched, done, esp_timer_get_time());
+    fanc_sched_hold(&g_fanc_sched, fans & ~done);
+}
 
-    while (fanc_live) {
+// one control period, all the fans at once
+static void fanc_period(void) {
 
+    // fold the hardware pulse counts in, the speed itself comes from edge times
+    for (int i = 0; i < FANC_N_FANS; i++) {
+        if (g_fanc_fans[i].tach_gpio >= 0) fanc_tach_poll(i);
+    }
 
-        if (last_value != g_fanc_percentage) {
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    uint32_t tuned = fanc_ctrl_step(&g_fanc_ctrl, &g_fanc_hw, now_ms);
+    // which took everything that was waiting
+    fanc_sched_done(&g_fanc_sched, g_fanc_sched.pending, esp_timer_get_time());
 
-            ESP_LOGI(TAG, " changing fan duty cycle: old value was %d new will be %d",last_value,g_fanc_percentage);
+    if (g_fanc_fans[0].tach_gpio >= 0) {
+        int64_t start = esp_timer_get_time();
+        fanc_hist_add(&g_fanc_hist, fanc_tach_mrps_get(0), now_ms);
+        uint32_t us = (uint32_t) (esp_timer_get_time() - start);
+        if (us > g_fanc_hist_us_max) g_fanc_hist_us_max = us;
+    }
+    if (tuned) {
+        ESP_LOGI(TAG, "tune or calibration finished for fans 0x%x", tuned);
+        fanc_dirty_set(tuned);
+        for (int i = 0; i < FANC_N_FANS; i++) {
+            if (!g_fanc_ctrl.fans[i].cal_new) continue;
+            g_fanc_ctrl.fans[i].cal_new = false;
+            fanc_cal_save(i);
+        }
+    }
 
-            // use the most recent value
-            err = ledc_set_duty(LEDC_FANC_SPEED_MODE, LEDC_FANC_CHANNEL, 
-                duty_cycle_calculate(LEDC_FANC_TIMER_RESOLUTION, g_fanc_percentage ));
-            //if (err == ESP_OK) ESP_LOGD(TAG, " succeeded setting duty");
-            //else ESP_LOGW(TAG," failed setting duty: error %d",err);
+    // new values, written once they settle
+    fanc_persist_update(fanc_dirty_take(), (uint32_t) now_ms);
+}
 
-            err = ledc_update_duty(LEDC_FANC_SPEED_MODE, LEDC_FANC_CHANNEL);
-            //if (err == ESP_OK) ESP_LOGD(TAG," succeeded updating duty");
-            //else ESP_LOGW(TAG," failed updating duty: error %d",err);
+static void fanc_task(void *pvParameters)
+{
 
-            // write new value
-            fanc_persist_update();
-            last_value = g_fanc_percentage;
+    // get prior values from NVS
+    fanc_persist_restore();
+    fanc_cal_restore();
 
-        }
+    fanc_pwm_init();
 
-        // interesting thing here is the number of pulses seems wrong by almost
-        // every measure... is 37 revs per second a reasonable number? 
+    fanc_sched_init(&g_fanc_sched, FANC_CTRL_PERIOD_MS, esp_timer_get_time());
+    fanc_tick_start();
 
-        // how fast am I spinning?
-        uint32_t pulse_count = g_fanc_pulse_count;
-        int64_t  now = esp_timer_get_time(); // microseconds?
+    // the first period now, rather than one in
+    uint32_t bits = FANC_SCHED_TICK;
 
+    while (fanc_live) {
 
-		ESP_LOGD(TAG,"pulse counter change: %u was %u now %u", pulse_count - g_fanc_previous_pulse_count, g_fanc_previous_pulse_count, pulse_count);
-		g_fanc_rps = ((float)(pulse_count - g_fanc_previous_pulse_count)) / ((now - g_fanc_previous_time) / 1000000.0);
-		ESP_LOGD(TAG, " revs per second: %f",g_fanc_rps);
-        g_fanc_previous_pulse_count = pulse_count;
-        g_fanc_previous_time = now;
+        fanc_sched_due_t due;
+        fanc_sched_wake(&g_fanc_sched, bits, esp_timer_get_time(), &due);
 
-        // If you go too fast, the measurement will be poor, and we'll have to skip. Similarly,
-        // updating the fan speed too often's probably bad. I like a third of a second.
-        vTaskDelay(480 / portTICK_PERIOD_MS);
+        if (due.apply) fanc_apply(due.apply);
+        if (due.tick) fanc_period();
 
+        // sleep until something's changed, the timer, or a change that was
+        // waiting on a fade can go
+        TickType_t wait = portMAX_DELAY;
+        int64_t wait_us = fanc_sched_wait_us(&g_fanc_sched, esp_timer_get_time());
+        if (wait_us >= 0) wait = (wait_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+        bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, wait);
 
 #if 0
         ESP_LOGI(TAG,"LEDC increase duty without fade");
@@ -430,11 +805,21 @@ static void fanc_task(void *pvParameters)
 
 esp_err_t fanc_init(void) {
 
-    // input to grab sense pulses so we know how fast it's going
-    fanc_pulse_count_init();
+    fanc_ctrl_init(&g_fanc_ctrl, FANC_N_FANS, FANC_CTRL_PERIOD_MS);
+    fanc_hist_init(&g_fanc_hist);
+
+    // inputs to grab sense pulses so we know how fast they're going. A tach
+    // uses the PCNT unit with the fan's index.
+    for (int i = 0; i < FANC_N_FANS; i++) {
+        const fanc_fan_cfg_t *cfg = &g_fanc_fans[i];
+        if (cfg->tach_gpio >= 0) {
+            fanc_tach_init(i, cfg->tach_gpio, cfg->pulses_per_rev);
+            g_fanc_ctrl.fans[i].has_tach = true;
+        }
+    }
 
     // kick off scan and connect tasks
-    xTaskCreate(fanc_task, "fanc_task",4096/*stacksizewords*/, 
+    xTaskCreate(fanc_task, "fanc_task",4096/*stacksizewords*/,
                 (void *) NULL/*param*/, 5 /*pri*/, &g_fancTask/*createdtask*/);
 
 
@@ -445,4 +830,3 @@ esp_err_t fanc_init(void) {
 void fanc_destroy(void) {
     fanc_live = false;
 }
-
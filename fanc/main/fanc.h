@@ -12,11 +12,134 @@
 esp_err_t fanc_init(void);
 void fanc_destroy(void);
 
+/*
+** The fans, see fanc.cpp for the table and fanc_ctrl.h for the loop
+*/
+
+#include "fanc_ctrl.h"
+
+typedef struct {
+    const char *name;
+    int pwm_gpio;
+    int tach_gpio;      // -1 if there isn't one
+    int channel;        // LEDC channel
+    int timer;          // LEDC timer, fans on one share its frequency
+    uint32_t pwm_hz;
+    int pulses_per_rev;
+} fanc_fan_cfg_t;
+
+int fanc_fan_count(void);
+const fanc_fan_cfg_t *fanc_fan_cfg(int fan);
+
+int fanc_fan_percentage_get(int fan);
+esp_err_t fanc_fan_percentage_set(int fan, int p);
+int fanc_fan_mode_get(int fan);
+esp_err_t fanc_fan_mode_set(int fan, int m);
+int fanc_fan_rpm_target_get(int fan);
+esp_err_t fanc_fan_rpm_target_set(int fan, int rpm);
+int fanc_fan_temp_target_get(int fan);
+esp_err_t fanc_fan_temp_target_set(int fan, int mc);
+// 0 kp, 1 ki, 2 kd, in thousandths, for the loop in use
+int fanc_fan_gain_get(int fan, int which);
+esp_err_t fanc_fan_gain_set(int fan, int which, int milli);
+int fanc_fan_autotune_get(int fan);
+esp_err_t fanc_fan_autotune_set(int fan, int on);
+// sweeping the duty to learn the fan's curve, see fanc_cal.h
+int fanc_fan_calibrate_get(int fan);
+esp_err_t fanc_fan_calibrate_set(int fan, int on);
+esp_err_t fanc_fan_cal_get(int fan, fanc_cal_lut_t *lut);
+int fanc_fan_rpm_get(int fan);
+
+typedef struct {
+    const char *name;
+    int mode;
+    int setpoint;       // percent when open
+    int measured;
+    int rpm;
+    int duty;           // tenths of a percent
+    int kp, ki, kd;     // thousandths
+    const char *tune;   // idle, running, done, failed
+    int ku;             // thousandths, from the last tune
+    int tu_ms;
+    bool temp_stale;
+    const char *cal;    // idle, running, done, failed
+    bool linear;        // has a curve, the output is a speed
+    const char *stall;  // ok, kick, fault
+    uint32_t kicks;
+    uint32_t faults;
+} fanc_ctrl_status_t;
+
+esp_err_t fanc_fan_status_get(int fan, fanc_ctrl_status_t *st);
+
+typedef struct {
+    int n_fans;
+    int period_ms;
+    uint32_t steps;
+    uint32_t commits;   // times duties were latched
+    uint32_t duty_sets; // duties that changed
+    uint32_t ticks;     // periods the timer woke the task for
+    uint32_t tick_late_max_us;
+    uint32_t applied;   // changes put out, and how long after they were asked for
+    uint32_t deferred;  // waited on a fade first
+    uint32_t apply_us_last;
+    uint32_t apply_us_max;
+    uint32_t apply_us_avg;
+} fanc_ctrl_stats_t;
+
+void fanc_ctrl_stats_get(fanc_ctrl_stats_t *st);
+
+// settings are written behind to NVS, see Persist-idf
+#include "persist.h"
+const persist_t *fanc_persist_get(void);
+
+// the temperature, shared by every fan holding one
+int fanc_temp_get(void);
+esp_err_t fanc_temp_set(int mc);
+
+// the first fan, as the REST interface had it before there were more
 int fanc_percentage_get(void);
 esp_err_t fanc_percentage_set(int p);
+int fanc_mode_get(void);
+esp_err_t fanc_mode_set(int m);
+int fanc_rpm_target_get(void);
+esp_err_t fanc_rpm_target_set(int rpm);
+int fanc_temp_target_get(void);
+esp_err_t fanc_temp_target_set(int mc);
+int fanc_gain_get(int which);
+esp_err_t fanc_gain_set(int which, int milli);
+int fanc_autotune_get(void);
+esp_err_t fanc_autotune_set(int on);
+int fanc_calibrate_get(void);
+esp_err_t fanc_calibrate_set(int on);
+void fanc_ctrl_status_get(fanc_ctrl_status_t *st);
 
-// attempting to be revolutions per second.
+// revolutions per second, from the tach
 float fanc_speed_get(void);
+int fanc_rpm_get(void);
+
+// the first fan's speed over the last day, see fanc_hist.h
+#include "fanc_hist.h"
+const fanc_hist_t *fanc_hist_get(void);
+uint32_t fanc_hist_add_us_max(void);
+
+// tach, see fanc_tach.cpp. One per PCNT unit.
+#define FANC_TACH_MAX FANC_FANS_MAX
+
+typedef struct {
+    int rpm;
+    int mrps;           // milli-revolutions per second
+    int count_rpm;      // from the pulse count between the last two polls, a cross check
+    uint32_t pulses;    // counted by PCNT since boot
+    uint32_t edges;     // timed by the interrupt
+    uint32_t glitches;  // edges too close together to be real
+    uint32_t period_us; // smoothed edge period
+} fanc_tach_stats_t;
+
+esp_err_t fanc_tach_init(int idx, int gpio, int pulses_per_rev);
+void fanc_tach_poll(int idx);
+int fanc_tach_rpm_get(int idx);
+int fanc_tach_mrps_get(int idx);
+esp_err_t fanc_tach_stats_get(int idx, fanc_tach_stats_t *st);
 
 esp_err_t webserver_init(void);
 void webserver_destroy();
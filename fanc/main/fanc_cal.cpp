@@ -0,0 +1,202 @@
+/* FANC fan curve and stalls
+
+   Copywrite Brian Bulkowski, 2020
+
+   See fanc_cal.h. Kept free of ESP-IDF so it can be run against a
+   simulated fan on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "fanc_cal.h"
+
+static const char *cal_state_names[] = { "idle", "running", "done", "failed" };
+static const char *stall_state_names[] = { "ok", "kick", "fault" };
+
+const char *fanc_cal_state_name(fanc_cal_state_t s) {
+  if (s < FANC_CAL_IDLE || s > FANC_CAL_FAILED) return("");
+  return(cal_state_names[s]);
+}
+
+const char *fanc_stall_state_name(fanc_stall_state_t s) {
+  if (s < FANC_STALL_OK || s > FANC_STALL_FAULT) return("");
+  return(stall_state_names[s]);
+}
+
+/*
+** calibration
+*/
+
+static void cal_point_begin(fanc_cal_sweep_t *s, int64_t now_ms) {
+  s->point_ms = now_ms;
+  s->window_ms = now_ms + FANC_CAL_SETTLE_MS;
+  s->sum = 0;
+  s->n = 0;
+  s->prev_avg = -1;
+}
+
+void fanc_cal_start(fanc_cal_sweep_t *s, int64_t now_ms) {
+  memset(s, 0, sizeof(fanc_cal_sweep_t));
+  s->state = FANC_CAL_RUNNING;
+  s->lut.version = FANC_CAL_VERSION;
+  s->point = FANC_CAL_POINTS - 1;
+  cal_point_begin(s, now_ms);
+}
+
+// the sweep's done, down to and including point. Tidy the table up.
+static void cal_finish(fanc_cal_sweep_t *s) {
+
+  fanc_cal_lut_t *l = &s->lut;
+
+  // stopped below where it stopped
+  for (int i = s->point - 1; i >= 0; i--) l->rpm[i] = 0;
+
+  l->min_duty = 0;
+  for (int i = 0; i < FANC_CAL_POINTS; i++) {
+    if (l->rpm[i] >= FANC_STALL_RPM) {
+      l->min_duty = i * FANC_CAL_STEP;
+      break;
+    }
+  }
+  // more duty is never less speed, whatever the noise said
+  for (int i = 1; i < FANC_CAL_POINTS; i++) {
+    if (l->rpm[i] < l->rpm[i - 1]) l->rpm[i] = l->rpm[i - 1];
+  }
+
+  l->valid = fanc_cal_lut_check(l) ? 1 : 0;
+  s->state = l->valid ? FANC_CAL_DONE : FANC_CAL_FAILED;
+}
+
+int fanc_cal_step(fanc_cal_sweep_t *s, int rpm, int64_t now_ms) {
+
+  if (s->state != FANC_CAL_RUNNING) return(0);
+
+  if (now_ms >= s->window_ms) {
+    s->sum += rpm;
+    s->n++;
+  }
+
+  if (s->n && now_ms - s->window_ms >= FANC_CAL_WINDOW_MS) {
+
+    int avg = s->sum / s->n;
+    int diff = avg > s->prev_avg ? avg - s->prev_avg : s->prev_avg - avg;
+    bool stable = s->prev_avg >= 0 && diff * 100 <= avg * FANC_CAL_STABLE_PCT;
+    bool stopped = s->prev_avg >= 0 && avg < FANC_STALL_RPM && s->prev_avg < FANC_STALL_RPM;
+
+    if (stable || stopped || now_ms - s->point_ms >= FANC_CAL_POINT_MS) {
+      s->lut.rpm[s->point] = avg > 0xFFFF ? 0xFFFF : avg;
+
+      // once it's stopped, nothing below will start it
+      if (avg < FANC_STALL_RPM || s->point == 0) {
+        cal_finish(s);
+        return(0);
+      }
+      s->point--;
+      cal_point_begin(s, now_ms);
+    }
+    else {
+      s->prev_avg = avg;
+      s->window_ms = now_ms;
+      s->sum = 0;
+      s->n = 0;
+    }
+  }
+  return(s->point * FANC_CAL_STEP);
+}
+
+bool fanc_cal_lut_check(const fanc_cal_lut_t *l) {
+  if (l->version != FANC_CAL_VERSION) return(false);
+  if (l->rpm[FANC_CAL_POINTS - 1] < FANC_STALL_RPM) return(false);
+  if (l->min_duty > FANC_PID_OUT_MAX || l->min_duty % FANC_CAL_STEP) return(false);
+  for (int i = 1; i < FANC_CAL_POINTS; i++) {
+    if (l->rpm[i] < l->rpm[i - 1]) return(false);
+  }
+  return(true);
+}
+
+int fanc_cal_duty(const fanc_cal_lut_t *l, int cmd) {
+
+  if (cmd <= 0) return(0);
+  if (cmd >= FANC_PID_OUT_MAX) return(FANC_PID_OUT_MAX);
+
+  int lo = l->min_duty / FANC_CAL_STEP;
+  int target = (int) ((int32_t) cmd * l->rpm[FANC_CAL_POINTS - 1] / FANC_PID_OUT_MAX);
+  if (target <= l->rpm[lo]) return(l->min_duty);
+
+  // the step that brackets it, and in between is close enough to a line
+  for (int i = lo; i < FANC_CAL_POINTS - 1; i++) {
+    int r0 = l->rpm[i];
+    int r1 = l->rpm[i + 1];
+    if (target > r1) continue;
+    if (r1 == r0) return(i * FANC_CAL_STEP);
+    return( i * FANC_CAL_STEP + (target - r0) * FANC_CAL_STEP / (r1 - r0) );
+  }
+  return(FANC_PID_OUT_MAX);
+}
+
+/*
+** stalls
+*/
+
+void fanc_stall_init(fanc_stall_t *s) {
+  memset(s, 0, sizeof(fanc_stall_t));
+}
+
+int fanc_stall_step(fanc_stall_t *s, int duty, int rpm, int64_t now_ms) {
+
+  // not meant to be turning, nothing to see
+  if (duty <= 0) {
+    s->low_ms = 0;
+    if (s->state == FANC_STALL_KICK) s->state = FANC_STALL_OK;
+    return(duty);
+  }
+
+  switch (s->state) {
+
+  case FANC_STALL_KICK:
+    if (now_ms < s->until_ms) return(FANC_PID_OUT_MAX);
+    // give it the full wait to show it's going
+    s->state = FANC_STALL_OK;
+    s->low_ms = 0;
+    s->ok_ms = 0;
+    break;
+
+  case FANC_STALL_FAULT:
+    if (now_ms < s->until_ms) return(duty);
+    s->state = FANC_STALL_OK;
+    s->kicks = 0;
+    s->low_ms = 0;
+    break;
+
+  default:
+    break;
+  }
+
+  if (rpm >= FANC_STALL_RPM) {
+    s->low_ms = 0;
+    if (s->ok_ms == 0) s->ok_ms = now_ms;
+    if (s->kicks && now_ms - s->ok_ms >= FANC_KICK_RESET_MS) s->kicks = 0;
+    return(duty);
+  }
+
+  s->ok_ms = 0;
+  if (s->low_ms == 0) s->low_ms = now_ms;
+  if (now_ms - s->low_ms < FANC_STALL_MS) return(duty);
+
+  if (s->kicks >= FANC_KICK_MAX) {
+    s->state = FANC_STALL_FAULT;
+    s->until_ms = now_ms + FANC_FAULT_RETRY_MS;
+    s->n_faults++;
+    return(duty);
+  }
+
+  s->state = FANC_STALL_KICK;
+  s->until_ms = now_ms + FANC_KICK_MS;
+  s->kicks++;
+  s->n_kicks++;
+  return(FANC_PID_OUT_MAX);
+}
@@ -0,0 +1,121 @@
+/*
+ * fanc_cal.h
+ * What a fan actually does with a duty. No ESP-IDF in here, it builds
+ * anywhere, so it can be run against a simulated fan on a desktop.
+ *
+ * PWM fans aren't linear. There's a dead zone at the bottom where they
+ * don't turn at all - or turn if they were already going, and don't start
+ * if they weren't - and the curve above it bends. So 20% on the slider can
+ * be a stopped fan, and 50% most of full speed.
+ *
+ * Calibration sweeps the duty from full down in FANC_CAL_STEP steps, waits
+ * for the speed to settle at each, and keeps what it settled at. Where it
+ * stops turning is the bottom: min_duty is the last step it was still going.
+ * That's a lookup table of a few dozen bytes, saved per fan.
+ *
+ * With a table, what the loop asks for is a speed - permille of the fan's top
+ * speed - rather than a duty, and the table turns it into the duty that gives
+ * it. Anything above 0 is at least min_duty, so the fan never sits in the
+ * dead zone looking like it's running.
+ *
+ * Separately, stall detection: a fan with duty but no speed for
+ * FANC_STALL_MS gets a kick - full duty for FANC_KICK_MS - which is what
+ * gets one started from rest. If FANC_KICK_MAX kicks in a row don't get it
+ * going it's a fault ( seized, unplugged, tach gone ), reported, and tried
+ * again every FANC_FAULT_RETRY_MS.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fanc_pid.h"
+
+// every 5%
+#define FANC_CAL_POINTS 21
+#define FANC_CAL_STEP (FANC_PID_OUT_MAX / (FANC_CAL_POINTS - 1))
+
+// at each step: wait this long, then average windows until two agree, or give up and take the last
+#define FANC_CAL_SETTLE_MS 2000
+#define FANC_CAL_WINDOW_MS 1000
+#define FANC_CAL_STABLE_PCT 2
+#define FANC_CAL_POINT_MS 15000
+
+// slower than this is stopped
+#define FANC_STALL_RPM 100
+
+#define FANC_STALL_MS 3000
+#define FANC_KICK_MS 1000
+#define FANC_KICK_MAX 3
+// turning this long after a kick and the kicks start over
+#define FANC_KICK_RESET_MS 30000
+#define FANC_FAULT_RETRY_MS 60000
+
+#define FANC_CAL_VERSION 1
+
+// what's saved, as a blob
+typedef struct {
+  uint8_t version;
+  uint8_t valid;
+  uint16_t min_duty;                // lowest step it kept turning at
+  uint16_t rpm[FANC_CAL_POINTS];    // at duty i * FANC_CAL_STEP
+} fanc_cal_lut_t;
+
+typedef enum {
+  FANC_CAL_IDLE = 0,
+  FANC_CAL_RUNNING = 1,
+  FANC_CAL_DONE = 2,
+  FANC_CAL_FAILED = 3
+} fanc_cal_state_t;
+
+typedef struct {
+  fanc_cal_state_t state;
+  fanc_cal_lut_t lut;       // being filled in
+  int point;                // counting down
+  int64_t point_ms;         // when this duty went out
+  int64_t window_ms;        // when this window started
+  int32_t sum;
+  int n;
+  int prev_avg;             // the last window, -1 none yet
+} fanc_cal_sweep_t;
+
+void fanc_cal_start(fanc_cal_sweep_t *s, int64_t now_ms);
+
+// once a period while it's running. Returns the duty to put out.
+int fanc_cal_step(fanc_cal_sweep_t *s, int rpm, int64_t now_ms);
+
+bool fanc_cal_lut_check(const fanc_cal_lut_t *l);
+
+// speed, permille of the top, to duty
+int fanc_cal_duty(const fanc_cal_lut_t *l, int cmd);
+
+const char *fanc_cal_state_name(fanc_cal_state_t s);
+
+typedef enum {
+  FANC_STALL_OK = 0,
+  FANC_STALL_KICK = 1,
+  FANC_STALL_FAULT = 2
+} fanc_stall_state_t;
+
+typedef struct {
+  fanc_stall_state_t state;
+  int64_t low_ms;           // since when it's had duty and no speed, 0 it hasn't
+  int64_t ok_ms;            // since when it's been turning
+  int64_t until_ms;         // end of the kick, or when to try after a fault
+  int kicks;                // in a row
+  uint32_t n_kicks;
+  uint32_t n_faults;
+} fanc_stall_t;
+
+void fanc_stall_init(fanc_stall_t *s);
+
+// the duty wanted, and the speed. Returns the duty to put out.
+int fanc_stall_step(fanc_stall_t *s, int duty, int rpm, int64_t now_ms);
+
+const char *fanc_stall_state_name(fanc_stall_state_t s);
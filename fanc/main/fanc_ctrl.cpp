@@ -0,0 +1,264 @@
+/* FANC control loop
+
+   Copywrite Brian Bulkowski, 2020
+
+   See fanc_ctrl.h. Kept free of ESP-IDF so a table of fans can be run
+   against simulated ones on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "fanc_ctrl.h"
+
+static const char *tune_state_names[] = { "idle", "running", "done", "failed" };
+
+const char *fanc_tune_state_name(fanc_tune_state_t s) {
+  if (s < FANC_TUNE_IDLE || s > FANC_TUNE_FAILED) return("");
+  return(tune_state_names[s]);
+}
+
+void fanc_fan_settings_default(fanc_fan_settings_t *s) {
+  s->mode = FANC_MODE_OPEN;
+  s->percentage = 100;    // start at full-on
+  s->rpm_target = 1500;
+  s->temp_target = 45000;
+  s->gains[FANC_LOOP_RPM][0] = 250;
+  s->gains[FANC_LOOP_RPM][1] = 250;
+  s->gains[FANC_LOOP_RPM][2] = 0;
+  s->gains[FANC_LOOP_TEMP][0] = 200;
+  s->gains[FANC_LOOP_TEMP][1] = 20;
+  s->gains[FANC_LOOP_TEMP][2] = 0;
+}
+
+void fanc_fan_settings_check(fanc_fan_settings_t *s) {
+  fanc_fan_settings_t d;
+  fanc_fan_settings_default(&d);
+  if (s->mode < FANC_MODE_OPEN || s->mode > FANC_MODE_TEMP) s->mode = d.mode;
+  if (s->percentage < 0 || s->percentage > 100) s->percentage = d.percentage;
+  if (s->rpm_target < 0 || s->rpm_target > FANC_RPM_TARGET_MAX) s->rpm_target = d.rpm_target;
+  if (s->temp_target < 0 || s->temp_target > FANC_TEMP_MAX) s->temp_target = d.temp_target;
+  for (int l = 0; l < 2; l++) {
+    for (int k = 0; k < 3; k++) {
+      if (s->gains[l][k] < 0) s->gains[l][k] = d.gains[l][k];
+    }
+  }
+}
+
+void fanc_ctrl_init(fanc_ctrl_t *c, int n_fans, int period_ms) {
+  memset(c, 0, sizeof(fanc_ctrl_t));
+  if (n_fans > FANC_FANS_MAX) n_fans = FANC_FANS_MAX;
+  c->n_fans = n_fans;
+  c->period_ms = period_ms;
+  for (int i = 0; i < n_fans; i++) {
+    fanc_fan_settings_default(&c->fans[i].set);
+    c->fans[i].last_mode = -1;
+    c->fans[i].duty = -1;   // nothing set yet
+  }
+}
+
+void fanc_ctrl_temp_set(fanc_ctrl_t *c, int mc, uint32_t now_ms) {
+  c->temp = mc;
+  c->temp_ms = now_ms ? now_ms : 1;
+}
+
+static int ctrl_loop(int mode) {
+  return( mode == FANC_MODE_TEMP ? FANC_LOOP_TEMP : FANC_LOOP_RPM );
+}
+
+static void ctrl_gains_q16(const fanc_fan_settings_t *s, int loop, fanc_pid_gains_t *g) {
+  g->kp = (int32_t) ((int64_t) s->gains[loop][0] * FANC_PID_ONE / 1000);
+  g->ki = (int32_t) ((int64_t) s->gains[loop][1] * FANC_PID_ONE / 1000);
+  g->kd = (int32_t) ((int64_t) s->gains[loop][2] * FANC_PID_ONE / 1000);
+}
+
+// the duty this fan should have now. Sets *changed if a tune rewrote its gains.
+static int ctrl_fan_step(fanc_ctrl_t *c, fanc_fan_t *f, int rpm, int64_t now_ms, bool *changed) {
+
+  fanc_fan_settings_t *s = &f->set;
+  int mode = s->mode;
+  int loop = ctrl_loop(mode);
+  int cur = f->cmd;
+  int out;
+
+  if (mode != f->last_mode) {
+    // a tune's only good for the loop it started in
+    if (f->tune.state == FANC_TUNE_RUNNING) f->tune.state = FANC_TUNE_IDLE;
+    if (mode != FANC_MODE_OPEN) {
+      fanc_pid_gains_t g;
+      ctrl_gains_q16(s, loop, &g);
+      fanc_pid_init(&f->pid, &g, c->period_ms, loop == FANC_LOOP_TEMP /*reverse*/);
+      f->pid.slew = FANC_CTRL_SLEW;
+      // no bump: carry on from where it was
+      fanc_pid_reset(&f->pid, cur);
+    }
+    f->last_mode = mode;
+  }
+
+  if (f->tune_cancel) {
+    f->tune_cancel = false;
+    f->tune_request = false;
+    if (f->tune.state == FANC_TUNE_RUNNING) {
+      f->tune.state = FANC_TUNE_IDLE;
+      fanc_pid_reset(&f->pid, cur);
+    }
+  }
+
+  f->temp_stale = false;
+  switch (mode) {
+
+  case FANC_MODE_OPEN:
+  default:
+    f->measured = rpm;
+    f->tune_request = false;
+    return(s->percentage * 10);
+
+  case FANC_MODE_RPM:
+    f->measured = rpm;
+    break;
+
+  case FANC_MODE_TEMP:
+    if (c->temp_ms == 0 || (uint32_t) now_ms - c->temp_ms > FANC_TEMP_STALE_MS) {
+      // can't see, so cool
+      f->temp_stale = true;
+      fanc_pid_reset(&f->pid, FANC_PID_OUT_MAX);
+      return(FANC_PID_OUT_MAX);
+    }
+    f->measured = c->temp;
+    break;
+  }
+
+  int setpoint = loop == FANC_LOOP_TEMP ? s->temp_target : s->rpm_target;
+
+  if (f->tune_request) {
+    f->tune_request = false;
+    int lo = cur - FANC_TUNE_SWING;
+    int hi = cur + FANC_TUNE_SWING;
+    if (lo < 0) { hi -= lo; lo = 0; }
+    if (hi > FANC_PID_OUT_MAX) { lo -= hi - FANC_PID_OUT_MAX; hi = FANC_PID_OUT_MAX; }
+    fanc_tune_start(&f->tune, setpoint, lo, hi, loop == FANC_LOOP_TEMP ? FANC_TUNE_HYST_TEMP : FANC_TUNE_HYST_RPM,
+      loop == FANC_LOOP_TEMP, now_ms, FANC_TUNE_TIMEOUT_MS);
+  }
+
+  if (f->tune.state == FANC_TUNE_RUNNING) {
+    out = fanc_tune_step(&f->tune, f->measured, now_ms);
+    if (f->tune.state == FANC_TUNE_DONE) {
+      fanc_pid_gains_t g;
+      fanc_tune_gains(&f->tune, &g);
+      s->gains[loop][0] = (int) ((int64_t) g.kp * 1000 / FANC_PID_ONE);
+      s->gains[loop][1] = (int) ((int64_t) g.ki * 1000 / FANC_PID_ONE);
+      s->gains[loop][2] = (int) ((int64_t) g.kd * 1000 / FANC_PID_ONE);
+      *changed = true;
+    }
+    if (f->tune.state != FANC_TUNE_RUNNING) fanc_pid_reset(&f->pid, out);
+    return(out);
+  }
+
+  // gains might have been changed over REST
+  ctrl_gains_q16(s, loop, &f->pid.gains);
+  return( fanc_pid_step(&f->pid, setpoint, f->measured) );
+}
+
+// a calibration sweep has the fan to itself. Returns true while it does.
+static bool ctrl_cal_step(fanc_fan_t *f, int rpm, int64_t now_ms, int *duty, bool *changed) {
+
+  if (f->cal_cancel) {
+    f->cal_cancel = false;
+    f->cal_request = false;
+    if (f->cal.state == FANC_CAL_RUNNING) f->cal.state = FANC_CAL_IDLE;
+  }
+
+  if (f->cal_request) {
+    f->cal_request = false;
+    if (!f->has_tach) {
+      // nothing to measure it with
+      f->cal.state = FANC_CAL_FAILED;
+    }
+    else {
+      if (f->tune.state == FANC_TUNE_RUNNING) f->tune.state = FANC_TUNE_IDLE;
+      fanc_cal_start(&f->cal, now_ms);
+    }
+  }
+
+  if (f->cal.state != FANC_CAL_RUNNING) return(false);
+
+  *duty = fanc_cal_step(&f->cal, rpm, now_ms);
+
+  if (f->cal.state == FANC_CAL_DONE) {
+    f->lut = f->cal.lut;
+    f->cal_new = true;
+    *changed = true;
+    // the loop starts over on the new curve, from where it was
+    f->last_mode = -1;
+    f->stall.state = FANC_STALL_OK;
+    f->stall.kicks = 0;
+    f->stall.low_ms = 0;
+  }
+  return(true);
+}
+
+uint32_t fanc_ctrl_step(fanc_ctrl_t *c, const fanc_hw_t *hw, int64_t now_ms) {
+
+  uint32_t changed_mask = 0;
+  bool staged = false;
+
+  for (int i = 0; i < c->n_fans; i++) {
+    fanc_fan_t *f = &c->fans[i];
+    bool changed = false;
+    int rpm = hw->rpm_get(hw->ctx, i);
+    int duty;
+    if (!ctrl_cal_step(f, rpm, now_ms, &duty, &changed)) {
+      f->cmd = ctrl_fan_step(c, f, rpm, now_ms, &changed);
+      duty = f->lut.valid ? fanc_cal_duty(&f->lut, f->cmd) : f->cmd;
+      if (f->has_tach) duty = fanc_stall_step(&f->stall, duty, rpm, now_ms);
+    }
+    if (changed) changed_mask |= 1 << i;
+    if (duty != f->duty) {
+      hw->duty_set(hw->ctx, i, duty);
+      f->duty = duty;
+      staged = true;
+      c->n_duty_sets++;
+    }
+  }
+
+  if (staged) {
+    hw->duty_commit(hw->ctx);
+    c->n_commits++;
+  }
+  c->n_steps++;
+  return(changed_mask);
+}
+
+uint32_t fanc_ctrl_apply(fanc_ctrl_t *c, const fanc_hw_t *hw, uint32_t fans) {
+
+  uint32_t done = 0;
+  bool staged = false;
+
+  for (int i = 0; i < c->n_fans; i++) {
+    if (!(fans & (1u << i))) continue;
+    fanc_fan_t *f = &c->fans[i];
+    // a mode change, a sweep, a kick: the loop has to see those
+    if (f->set.mode != FANC_MODE_OPEN || f->last_mode != FANC_MODE_OPEN) continue;
+    if (f->cal.state == FANC_CAL_RUNNING || f->cal_request || f->cal_cancel) continue;
+    if (f->stall.state == FANC_STALL_KICK) continue;
+
+    f->cmd = f->set.percentage * 10;
+    int duty = f->lut.valid ? fanc_cal_duty(&f->lut, f->cmd) : f->cmd;
+    if (duty != f->duty) {
+      hw->duty_set(hw->ctx, i, duty);
+      f->duty = duty;
+      staged = true;
+      c->n_duty_sets++;
+    }
+    done |= 1u << i;
+  }
+
+  if (staged) {
+    hw->duty_commit(hw->ctx);
+    c->n_commits++;
+  }
+  return(done);
+}
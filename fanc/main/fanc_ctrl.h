@@ -0,0 +1,138 @@
+/*
+ * fanc_ctrl.h
+ * The control loop for a table of fans. No ESP-IDF in here, it builds
+ * anywhere: the PWM and the tach are reached through fanc_hw_t, which
+ * fanc.cpp fills in with LEDC and PCNT, and a desktop can fill in with a
+ * simulated fan.
+ *
+ * Each fan has its own settings - open loop percentage, or an RPM or a
+ * temperature to hold with its own PID and gains. There's one temperature,
+ * from whatever sensor feeds it, shared by all of them.
+ *
+ * Every period the loop works out all the duties, stages the ones that
+ * changed, and commits them together, so the fans move on the same PWM
+ * cycle rather than one after another.
+ *
+ * A fan that's been calibrated ( fanc_cal.h ) has what the loop works out -
+ * open loop percentage, the PID's output - taken as a speed and put through
+ * its table to get the duty. One with a tach is watched for stalls.
+ *
+ * Settings are plain ints written by whoever ( the REST handlers ) and read
+ * by the loop each period. An int write is atomic on anything we run on.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fanc_pid.h"
+#include "fanc_cal.h"
+
+// there are eight LEDC channels in a speed mode, and eight PCNT units
+#define FANC_FANS_MAX 8
+
+typedef enum {
+  FANC_MODE_OPEN = 0,     // percentage, as it always was
+  FANC_MODE_RPM = 1,      // hold rpm_target
+  FANC_MODE_TEMP = 2      // hold temp_target
+} fanc_mode_t;
+
+#define FANC_RPM_TARGET_MAX 10000
+// milli-degrees C
+#define FANC_TEMP_MIN (-40000)
+#define FANC_TEMP_MAX 150000
+
+// which gains
+#define FANC_LOOP_RPM 0
+#define FANC_LOOP_TEMP 1
+
+// a tenth of full scale per period
+#define FANC_CTRL_SLEW 100
+
+// the relay swings this far either side of where the output was
+#define FANC_TUNE_SWING 150
+#define FANC_TUNE_TIMEOUT_MS (10 * 60 * 1000)
+// and switches this far past the setpoint, above the noise
+#define FANC_TUNE_HYST_RPM 30
+#define FANC_TUNE_HYST_TEMP 100
+
+// a temperature older than this is no reading at all, and fans holding one go full on
+#define FANC_TEMP_STALE_MS (30 * 1000)
+
+// what's saved, and set over REST
+typedef struct {
+  int mode;
+  int percentage;
+  int rpm_target;
+  int temp_target;        // milli-degrees C
+  int gains[2][3];        // [ rpm, temp ][ kp, ki, kd ], thousandths
+} fanc_fan_settings_t;
+
+typedef struct {
+  fanc_fan_settings_t set;
+  bool has_tach;
+  volatile bool tune_request;
+  volatile bool tune_cancel;
+  volatile bool cal_request;
+  volatile bool cal_cancel;
+  fanc_cal_lut_t lut;     // valid if it's been calibrated
+  // the loop's
+  int last_mode;
+  fanc_pid_t pid;
+  fanc_tune_t tune;
+  fanc_cal_sweep_t cal;
+  bool cal_new;           // a sweep finished and lut is new, save it
+  fanc_stall_t stall;
+  int cmd;                // what the loop wants, before the table and stalls
+  int duty;               // tenths of a percent
+  int measured;           // RPM, or milli-degrees
+  bool temp_stale;
+} fanc_fan_t;
+
+typedef struct {
+  int (*rpm_get)(void *ctx, int fan);
+  void (*duty_set)(void *ctx, int fan, int permille);   // staged
+  void (*duty_commit)(void *ctx);                       // everything staged, at once
+  void *ctx;
+} fanc_hw_t;
+
+typedef struct {
+  int n_fans;
+  int period_ms;
+  fanc_fan_t fans[FANC_FANS_MAX];
+  volatile int temp;
+  volatile uint32_t temp_ms;      // when it came, 0 never
+  // stats
+  uint32_t n_steps;
+  uint32_t n_commits;
+  uint32_t n_duty_sets;
+} fanc_ctrl_t;
+
+void fanc_ctrl_init(fanc_ctrl_t *c, int n_fans, int period_ms);
+
+// defaults for a fan's settings
+void fanc_fan_settings_default(fanc_fan_settings_t *s);
+
+// anything out of range back to its default, say after reading from flash
+void fanc_fan_settings_check(fanc_fan_settings_t *s);
+
+void fanc_ctrl_temp_set(fanc_ctrl_t *c, int mc, uint32_t now_ms);
+
+// one period. Returns a bit per fan whose settings the loop changed - a tune
+// finished and put in new gains, or a calibration a new table ( cal_new ) -
+// so they can be saved.
+uint32_t fanc_ctrl_step(fanc_ctrl_t *c, const fanc_hw_t *hw, int64_t now_ms);
+
+// settings on these fans just changed: put out what they mean now, between
+// periods, for the fans where that doesn't need the loop - open, and not
+// sweeping or being kicked. Returns the fans it did, the rest wait for the
+// next step.
+uint32_t fanc_ctrl_apply(fanc_ctrl_t *c, const fanc_hw_t *hw, uint32_t fans);
+
+const char *fanc_tune_state_name(fanc_tune_state_t s);
@@ -0,0 +1,183 @@
+/* FANC speed history
+
+   Copywrite Brian Bulkowski, 2020
+
+   See fanc_hist.h. Kept free of ESP-IDF so the rollups can be checked, and
+   timed, on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "fanc_hist.h"
+
+static const char *res_names[FANC_HIST_RES_N] = { "raw", "10s", "1m" };
+static const uint32_t res_ms[FANC_HIST_RES_N] = { FANC_HIST_RAW_MS, FANC_HIST_10S_MS, FANC_HIST_1M_MS };
+static const uint32_t res_n[FANC_HIST_RES_N] = { FANC_HIST_RAW_N, FANC_HIST_10S_N, FANC_HIST_1M_N };
+
+const char *fanc_hist_res_name(int res) {
+  if (res < 0 || res >= FANC_HIST_RES_N) return("");
+  return(res_names[res]);
+}
+
+int fanc_hist_res_parse(const char *s) {
+  for (int i = 0; i < FANC_HIST_RES_N; i++) {
+    if (strcmp(s, res_names[i]) == 0) return(i);
+  }
+  return(-1);
+}
+
+uint32_t fanc_hist_period_ms(int res) {
+  if (res < 0 || res >= FANC_HIST_RES_N) return(0);
+  return(res_ms[res]);
+}
+
+void fanc_hist_init(fanc_hist_t *h) {
+  memset(h, 0, sizeof(fanc_hist_t));
+  for (int i = 0; i < FANC_HIST_RES_N; i++) h->acc[i].period_ms = res_ms[i];
+}
+
+int fanc_hist_len(const fanc_hist_t *h, int res) {
+  if (res < 0 || res >= FANC_HIST_RES_N) return(0);
+  uint32_t t = h->total[res];
+  return( (int) (t < res_n[res] ? t : res_n[res]) );
+}
+
+static uint16_t hist_q(int mrps) {
+  if (mrps <= 0) return(0);
+  uint64_t q = (((uint64_t) mrps << FANC_HIST_FRAC_BITS) + 500) / 1000;
+  return( q > FANC_HIST_Q_MAX ? FANC_HIST_Q_MAX : (uint16_t) q );
+}
+
+static fanc_hist_roll_t *hist_roll_slot(fanc_hist_t *h, int res, uint32_t t) {
+  if (res == FANC_HIST_10S) return(&h->r10s[t % FANC_HIST_10S_N]);
+  return(&h->r1m[t % FANC_HIST_1M_N]);
+}
+
+// claim the slot, fill it, then count it - see fanc_hist_next()
+static void hist_begin(fanc_hist_t *h, int res, uint32_t t) {
+  h->writing[res] = t + 1;
+  __sync_synchronize();
+}
+
+static void hist_end(fanc_hist_t *h, int res, uint32_t t, int64_t end_ms) {
+  h->newest_ms[res] = end_ms;
+  __sync_synchronize();
+  h->total[res] = t + 1;
+}
+
+static void hist_roll_push(fanc_hist_t *h, int res, const fanc_hist_roll_t *r, int64_t end_ms) {
+  uint32_t t = h->total[res];
+  hist_begin(h, res, t);
+  *hist_roll_slot(h, res, t) = *r;
+  hist_end(h, res, t, end_ms);
+}
+
+static void hist_acc_reset(fanc_hist_acc_t *a, uint32_t bucket) {
+  a->bucket = bucket;
+  a->sum = 0;
+  a->n = 0;
+  a->min = FANC_HIST_Q_MAX;
+  a->max = 0;
+}
+
+static void hist_acc_add(fanc_hist_t *h, int res, uint16_t q, int64_t now_ms) {
+
+  fanc_hist_acc_t *a = &h->acc[res];
+  uint32_t b = (uint32_t) (now_ms / a->period_ms);
+
+  if (!a->started) {
+    a->started = true;
+    hist_acc_reset(a, b);
+  }
+  else if (b != a->bucket) {
+    fanc_hist_roll_t r;
+    if (a->n) {
+      r.min = a->min;
+      r.max = a->max;
+      r.avg = (uint16_t) ((a->sum + a->n / 2) / a->n);
+    }
+    else {
+      r.min = FANC_HIST_Q_MAX;
+      r.avg = 0;
+      r.max = 0;
+    }
+    hist_roll_push(h, res, &r, (int64_t) (a->bucket + 1) * a->period_ms);
+
+    // the ones nothing came in for; more than fit would all be overwritten anyway
+    uint32_t gap = b > a->bucket ? b - a->bucket - 1 : 0;
+    if (gap > res_n[res]) gap = res_n[res];
+    fanc_hist_roll_t empty = { FANC_HIST_Q_MAX, 0, 0 };
+    for (uint32_t i = 0; i < gap; i++) {
+      hist_roll_push(h, res, &empty, (int64_t) (b - gap + i + 1) * a->period_ms);
+      h->n_fill++;
+    }
+    hist_acc_reset(a, b);
+  }
+
+  a->sum += q;
+  a->n++;
+  if (q < a->min) a->min = q;
+  if (q > a->max) a->max = q;
+}
+
+void fanc_hist_add(fanc_hist_t *h, int mrps, int64_t now_ms) {
+
+  uint16_t q = hist_q(mrps);
+
+  uint32_t t = h->total[FANC_HIST_RAW];
+  hist_begin(h, FANC_HIST_RAW, t);
+  h->raw[t % FANC_HIST_RAW_N] = q;
+  hist_end(h, FANC_HIST_RAW, t, now_ms);
+
+  hist_acc_add(h, FANC_HIST_10S, q, now_ms);
+  hist_acc_add(h, FANC_HIST_1M, q, now_ms);
+}
+
+void fanc_hist_cursor(fanc_hist_cursor_t *c, const fanc_hist_t *h, int res, uint32_t max_n) {
+  c->h = h;
+  c->res = res;
+  c->i = 0;
+  if (res < 0 || res >= FANC_HIST_RES_N) {
+    c->total = 0;
+    c->n = 0;
+    return;
+  }
+  c->total = h->total[res];
+  __sync_synchronize();
+  uint32_t len = c->total < res_n[res] ? c->total : res_n[res];
+  c->n = (max_n && max_n < len) ? max_n : len;
+}
+
+bool fanc_hist_next(fanc_hist_cursor_t *c, fanc_hist_roll_t *p) {
+
+  if (c->i >= c->n) return(false);
+
+  const fanc_hist_t *h = c->h;
+  uint32_t N = res_n[c->res];
+  uint32_t pos = c->total - 1 - c->i;
+
+  if (c->res == FANC_HIST_RAW) {
+    uint16_t q = h->raw[pos % N];
+    p->min = p->avg = p->max = q;
+  }
+  else if (c->res == FANC_HIST_10S) {
+    *p = h->r10s[pos % N];
+  }
+  else {
+    *p = h->r1m[pos % N];
+  }
+
+  // after reading: if the writer has got round to this slot ( or is in it ) it's gone
+  __sync_synchronize();
+  uint32_t age = h->writing[c->res] - 1 - pos;
+  if (age >= N) {
+    c->n = c->i;
+    return(false);
+  }
+  c->i++;
+  return(true);
+}
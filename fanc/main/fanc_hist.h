@@ -0,0 +1,116 @@
+/*
+ * fanc_hist.h
+ * A fan's speed history, in fixed memory. No ESP-IDF in here, it builds
+ * anywhere.
+ *
+ * A bearing going doesn't show in one reading, it shows as the speed at a
+ * given duty creeping down over hours, or getting ragged. So we keep:
+ *
+ *   raw    every sample, the last minute
+ *   10s    min / avg / max of each 10 seconds, the last hour
+ *   1m     min / avg / max of each minute, the last day
+ *
+ * Speeds are revolutions per second in unsigned 9.7 fixed point - to 511
+ * rps ( 30000 RPM ) in steps of half an RPM - so a rollup is six bytes and
+ * the whole thing is about 11K.
+ *
+ * The rollups are both taken from the raw samples, not from each other, so
+ * an average is of the samples in it whatever the tier. Buckets are on
+ * whole periods of the clock; one the task missed goes in empty, rather
+ * than squeezing the rest together.
+ *
+ * One task adds, others read. A reader takes a cursor, and walks back from
+ * the newest; if adds catch up with where it's reading ( it's been that
+ * slow ), it stops rather than hand back newer points as old ones.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FANC_HIST_FRAC_BITS 7
+#define FANC_HIST_Q_MAX 0xFFFF
+
+// the raw tier is a minute of samples at this period
+#define FANC_HIST_RAW_MS 250
+#define FANC_HIST_RAW_N (60 * 1000 / FANC_HIST_RAW_MS)
+
+#define FANC_HIST_10S_MS (10 * 1000)
+#define FANC_HIST_10S_N (60 * 60 * 1000 / FANC_HIST_10S_MS)
+
+#define FANC_HIST_1M_MS (60 * 1000)
+#define FANC_HIST_1M_N (24 * 60 * 60 * 1000 / FANC_HIST_1M_MS)
+
+typedef enum {
+  FANC_HIST_RAW = 0,
+  FANC_HIST_10S = 1,
+  FANC_HIST_1M = 2,
+  FANC_HIST_RES_N = 3
+} fanc_hist_res_t;
+
+// a bucket with nothing in it has min > max
+typedef struct {
+  uint16_t min;
+  uint16_t avg;
+  uint16_t max;
+} fanc_hist_roll_t;
+
+typedef struct {
+  uint32_t period_ms;
+  uint32_t bucket;      // the one accumulating, in periods since boot
+  bool started;
+  uint32_t sum;
+  uint16_t n;
+  uint16_t min;
+  uint16_t max;
+} fanc_hist_acc_t;
+
+typedef struct {
+  uint16_t raw[FANC_HIST_RAW_N];
+  fanc_hist_roll_t r10s[FANC_HIST_10S_N];
+  fanc_hist_roll_t r1m[FANC_HIST_1M_N];
+  // how many have ever gone in each, the newest is at ( total - 1 ) % N.
+  // writing is one ahead of total while an entry is going in.
+  volatile uint32_t total[FANC_HIST_RES_N];
+  volatile uint32_t writing[FANC_HIST_RES_N];
+  int64_t newest_ms[FANC_HIST_RES_N];             // when the newest one ended
+  fanc_hist_acc_t acc[FANC_HIST_RES_N];           // [ FANC_HIST_RAW ] unused
+  uint32_t n_fill;                                // empty buckets put in
+} fanc_hist_t;
+
+typedef struct {
+  const fanc_hist_t *h;
+  int res;
+  uint32_t total;       // when it started
+  uint32_t i;           // back from the newest
+  uint32_t n;           // at most this many
+} fanc_hist_cursor_t;
+
+void fanc_hist_init(fanc_hist_t *h);
+
+// a sample, milli-revolutions per second, now_ms on a clock that doesn't go back
+void fanc_hist_add(fanc_hist_t *h, int mrps, int64_t now_ms);
+
+int fanc_hist_len(const fanc_hist_t *h, int res);
+uint32_t fanc_hist_period_ms(int res);
+const char *fanc_hist_res_name(int res);
+int fanc_hist_res_parse(const char *s);    // -1 if it's none of them
+
+// newest first, up to max_n ( 0 is all there is )
+void fanc_hist_cursor(fanc_hist_cursor_t *c, const fanc_hist_t *h, int res, uint32_t max_n);
+// false when there are no more. A raw point has min == avg == max.
+bool fanc_hist_next(fanc_hist_cursor_t *c, fanc_hist_roll_t *p);
+
+static inline int fanc_hist_q_rpm(uint16_t q) {
+  return( (int) (((uint32_t) q * 60 + (1 << (FANC_HIST_FRAC_BITS - 1))) >> FANC_HIST_FRAC_BITS) );
+}
+
+static inline bool fanc_hist_empty(const fanc_hist_roll_t *p) {
+  return( p->min > p->max );
+}
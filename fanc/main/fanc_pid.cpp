@@ -0,0 +1,174 @@
+/* FANC PID
+
+   Copywrite Brian Bulkowski, 2020
+
+   See fanc_pid.h. Kept free of ESP-IDF so it can be tuned and checked
+   against a simulated fan on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "fanc_pid.h"
+
+void fanc_pid_init(fanc_pid_t *pid, const fanc_pid_gains_t *gains, int32_t period_ms, bool reverse) {
+  memset(pid, 0, sizeof(fanc_pid_t));
+  pid->gains = *gains;
+  pid->out_min = 0;
+  pid->out_max = FANC_PID_OUT_MAX;
+  pid->slew = 0;
+  pid->period_ms = period_ms > 0 ? period_ms : 1;
+  pid->reverse = reverse;
+  pid->primed = false;
+}
+
+static int32_t pid_clamp(const fanc_pid_t *pid, int64_t v) {
+  if (v < pid->out_min) return(pid->out_min);
+  if (v > pid->out_max) return(pid->out_max);
+  return((int32_t) v);
+}
+
+void fanc_pid_reset(fanc_pid_t *pid, int32_t out) {
+  pid->out = pid_clamp(pid, out);
+  pid->integ = (int64_t) pid->out * FANC_PID_ONE;
+  pid->primed = false;
+}
+
+int32_t fanc_pid_step(fanc_pid_t *pid, int32_t setpoint, int32_t meas) {
+
+  const fanc_pid_gains_t *g = &pid->gains;
+
+  int64_t err = pid->reverse ? (int64_t) meas - setpoint : (int64_t) setpoint - meas;
+  // on the measurement: the error's rate of change, less the setpoint's
+  int64_t derr = 0;
+  if (pid->primed) {
+    derr = (int64_t) meas - pid->prev_meas;
+    if (!pid->reverse) derr = -derr;
+  }
+
+  int64_t p = g->kp * err;
+  int64_t d = g->kd * derr * 1000 / pid->period_ms;
+  int64_t di = g->ki * err * pid->period_ms / 1000;
+
+  // don't integrate further into a limit, but do integrate up to it: dropping
+  // the whole step when it would go over leaves the output stuck short
+  int64_t room_hi = (int64_t) pid->out_max * FANC_PID_ONE - (p + pid->integ + d);
+  int64_t room_lo = (int64_t) pid->out_min * FANC_PID_ONE - (p + pid->integ + d);
+  if (di > 0 && di > room_hi) di = room_hi > 0 ? room_hi : 0;
+  if (di < 0 && di < room_lo) di = room_lo < 0 ? room_lo : 0;
+
+  pid->integ += di;
+  int64_t lo = (int64_t) pid->out_min * FANC_PID_ONE;
+  int64_t hi = (int64_t) pid->out_max * FANC_PID_ONE;
+  if (pid->integ < lo) pid->integ = lo;
+  if (pid->integ > hi) pid->integ = hi;
+
+  int64_t v = p + pid->integ + d;
+  // round to nearest, either sign
+  v = v >= 0 ? (v + FANC_PID_ONE / 2) / FANC_PID_ONE : (v - FANC_PID_ONE / 2) / FANC_PID_ONE;
+  int32_t out = pid_clamp(pid, v);
+
+  if (pid->slew > 0 && pid->primed) {
+    if (out > pid->out + pid->slew) out = pid->out + pid->slew;
+    if (out < pid->out - pid->slew) out = pid->out - pid->slew;
+  }
+
+  pid->out = out;
+  pid->prev_meas = meas;
+  pid->primed = true;
+  return(out);
+}
+
+/*
+** Auto-tune
+*/
+
+void fanc_tune_start(fanc_tune_t *t, int32_t setpoint, int32_t out_lo, int32_t out_hi,
+    int32_t hyst, bool reverse, int64_t now_ms, int64_t timeout_ms) {
+  memset(t, 0, sizeof(fanc_tune_t));
+  t->state = FANC_TUNE_RUNNING;
+  t->setpoint = setpoint;
+  t->out_lo = out_lo;
+  t->out_hi = out_hi;
+  t->hyst = hyst;
+  t->reverse = reverse;
+  t->timeout_ms = timeout_ms;
+  t->started = now_ms;
+  t->cycles = -1;       // the first step decides which way to go
+}
+
+int32_t fanc_tune_step(fanc_tune_t *t, int32_t meas, int64_t now_ms) {
+
+  int32_t mid = (t->out_lo + t->out_hi) / 2;
+  if (t->state != FANC_TUNE_RUNNING) return(mid);
+
+  if (now_ms - t->started > t->timeout_ms) {
+    t->state = FANC_TUNE_FAILED;
+    return(mid);
+  }
+
+  // "up" is whatever raises the process
+  bool above = meas > t->setpoint + t->hyst;
+  bool below = meas < t->setpoint - t->hyst;
+  bool raise_out = !t->reverse;
+
+  if (t->cycles < 0) {
+    t->high = (meas < t->setpoint) == raise_out;
+    t->cycles = 0;
+    t->peak_max = t->peak_min = meas;
+    return( t->high ? t->out_hi : t->out_lo );
+  }
+
+  if (meas > t->peak_max) t->peak_max = meas;
+  if (meas < t->peak_min) t->peak_min = meas;
+
+  bool pushing_up = t->high == raise_out;
+  if (pushing_up && above) {
+    t->high = !t->high;
+  }
+  else if (!pushing_up && below) {
+    t->high = !t->high;
+    // a full cycle is from one push up to the next
+    if (t->last_switch_up != 0) {
+      t->cycles++;
+      if (t->cycles > FANC_TUNE_SKIP) {
+        t->sum_period += now_ms - t->last_switch_up;
+        t->sum_amp += t->peak_max - t->peak_min;
+        t->n_sum++;
+      }
+    }
+    t->last_switch_up = now_ms;
+    t->peak_max = t->peak_min = meas;
+
+    if (t->n_sum >= FANC_TUNE_CYCLES) {
+      int64_t amp = t->sum_amp / t->n_sum;
+      t->tu_ms = (int32_t) (t->sum_period / t->n_sum);
+      if (amp <= 0 || t->tu_ms <= 0) {
+        t->state = FANC_TUNE_FAILED;
+        return(mid);
+      }
+      // ku = 4d / ( pi a ), d half the output swing, a half the process swing
+      int64_t swing = t->out_hi - t->out_lo;
+      t->ku = (int32_t) (4 * swing * FANC_PID_ONE * 1000 / (3142 * amp));
+      t->state = FANC_TUNE_DONE;
+      return(mid);
+    }
+  }
+
+  return( t->high ? t->out_hi : t->out_lo );
+}
+
+// kp = ku / 3.2 as Tyreus-Luyben has it, but ti = tu rather than their 2.2 tu.
+// Ziegler-Nichols overshot the simulated fan by 15%, Tyreus-Luyben took
+// twice as long to settle as this. No kd, the tach's too noisy for it.
+bool fanc_tune_gains(const fanc_tune_t *t, fanc_pid_gains_t *gains) {
+  if (t->state != FANC_TUNE_DONE) return(false);
+  int64_t kp = (int64_t) t->ku * 10 / 32;
+  gains->kp = (int32_t) kp;
+  gains->ki = (int32_t) (kp * 1000 / t->tu_ms);
+  gains->kd = 0;
+  return(true);
+}
@@ -0,0 +1,109 @@
+/*
+ * fanc_pid.h
+ * Closing the loop: a PID controller, and a relay auto-tune to find its
+ * gains. No ESP-IDF in here, it builds anywhere, so it can be run against a
+ * simulated fan on a desktop.
+ *
+ * Fixed point throughout. The process value is whatever's being held - RPM,
+ * or milli-degrees C - and the output is duty in tenths of a percent,
+ * 0 - 1000. Gains are Q16: output units per process unit, and for ki per
+ * second, for kd times seconds. Everything runs once per period_ms.
+ *
+ * The integral can't wind up: it doesn't grow while the output's pinned at a
+ * limit in the direction the error pushes, and it's clamped to the output
+ * range. The derivative is on the measurement, not the error, so a setpoint
+ * change doesn't kick. The output can only move slew per step, a fan
+ * doesn't like being slammed.
+ *
+ * Reverse acting is for temperature: too hot means more fan.
+ *
+ * The auto-tune is Astrom-Hagglund: drive the output bang-bang around the
+ * setpoint, the process oscillates, and the size and period of that gives
+ * the ultimate gain and period. Gains come from those.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FANC_PID_OUT_MAX 1000
+
+// Q16
+#define FANC_PID_ONE 65536
+
+typedef struct {
+  int32_t kp;           // Q16
+  int32_t ki;           // Q16, per second
+  int32_t kd;           // Q16, seconds
+} fanc_pid_gains_t;
+
+typedef struct {
+  fanc_pid_gains_t gains;
+  int32_t out_min;
+  int32_t out_max;
+  int32_t slew;         // most the output moves in a step, 0 for no limit
+  int32_t period_ms;
+  bool reverse;
+  // state
+  bool primed;          // have a previous measurement
+  int64_t integ;        // Q16, output units
+  int32_t prev_meas;
+  int32_t out;
+} fanc_pid_t;
+
+void fanc_pid_init(fanc_pid_t *pid, const fanc_pid_gains_t *gains, int32_t period_ms, bool reverse);
+
+// start from this output with no bump, say when switching from open loop
+void fanc_pid_reset(fanc_pid_t *pid, int32_t out);
+
+// one period. Returns the new output.
+int32_t fanc_pid_step(fanc_pid_t *pid, int32_t setpoint, int32_t meas);
+
+typedef enum {
+  FANC_TUNE_IDLE,
+  FANC_TUNE_RUNNING,
+  FANC_TUNE_DONE,
+  FANC_TUNE_FAILED      // never oscillated, or never settled into it
+} fanc_tune_state_t;
+
+// cycles to throw away while it gets going, and to average over
+#define FANC_TUNE_SKIP 2
+#define FANC_TUNE_CYCLES 4
+
+typedef struct {
+  fanc_tune_state_t state;
+  int32_t setpoint;
+  int32_t out_lo;
+  int32_t out_hi;
+  int32_t hyst;         // process units either side of setpoint before switching
+  bool reverse;
+  int64_t timeout_ms;
+  // running
+  int64_t started;
+  bool high;            // output is out_hi
+  int cycles;
+  int64_t last_switch_up;
+  int32_t peak_max;
+  int32_t peak_min;
+  int64_t sum_period;   // ms
+  int64_t sum_amp;      // peak to peak
+  int n_sum;
+  // result
+  int32_t ku;           // Q16
+  int32_t tu_ms;
+} fanc_tune_t;
+
+void fanc_tune_start(fanc_tune_t *t, int32_t setpoint, int32_t out_lo, int32_t out_hi,
+    int32_t hyst, bool reverse, int64_t now_ms, int64_t timeout_ms);
+
+// once a period, while RUNNING. Returns the output to use.
+int32_t fanc_tune_step(fanc_tune_t *t, int32_t meas, int64_t now_ms);
+
+// PI gains from a DONE tune
+bool fanc_tune_gains(const fanc_tune_t *t, fanc_pid_gains_t *gains);
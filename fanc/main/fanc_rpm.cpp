@@ -0,0 +1,122 @@
+/* FANC tach estimator
+
+   Copywrite Brian Bulkowski, 2020
+
+   See fanc_rpm.h. Kept free of ESP-IDF so recorded tach timestamps can be
+   replayed through it on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "fanc_rpm.h"
+
+void fanc_rpm_init(fanc_rpm_t *r, int pulses_per_rev) {
+  memset(r, 0, sizeof(fanc_rpm_t));
+  if (pulses_per_rev <= 0) pulses_per_rev = FANC_RPM_PULSES_PER_REV;
+  r->pulses_per_rev = pulses_per_rev;
+  r->min_period = 60000000 / (FANC_RPM_MAX * pulses_per_rev);
+  r->have_edge = false;
+}
+
+static uint32_t rpm_median(const fanc_rpm_t *r) {
+  uint32_t s[FANC_RPM_MEDIAN];
+  int n = r->n_periods;
+  // insertion sort, there are five of them
+  for (int i = 0; i < n; i++) {
+    uint32_t v = r->periods[i];
+    int j = i;
+    for (; j > 0 && s[j - 1] > v; j--) s[j] = s[j - 1];
+    s[j] = v;
+  }
+  return(s[n / 2]);
+}
+
+bool fanc_rpm_edge(fanc_rpm_t *r, int64_t t) {
+
+  if (!r->have_edge) {
+    r->have_edge = true;
+    r->last_edge = t;
+    r->n_edges++;
+    return(true);
+  }
+
+  int64_t d = t - r->last_edge;
+  if (d < r->min_period) {
+    r->n_glitches++;
+    return(false);
+  }
+  r->last_edge = t;
+  r->n_edges++;
+
+  // first edge after a stop: the gap isn't a period
+  if (d > FANC_RPM_STALL_US) {
+    r->n_periods = 0;
+    r->next = 0;
+    r->period = 0;
+    r->last_period = 0;
+    return(true);
+  }
+  r->last_period = (uint32_t) d;
+
+  r->periods[r->next] = (uint32_t) d;
+  r->next = (r->next + 1) % FANC_RPM_MEDIAN;
+  if (r->n_periods < FANC_RPM_MEDIAN) r->n_periods++;
+
+  // two in a row, agreeing with each other and well away from what we had:
+  // the speed changed. Don't wait for the median to come round.
+  if (r->period != 0 && r->n_periods >= 2) {
+    uint32_t prev = r->periods[(r->next + FANC_RPM_MEDIAN - 2) % FANC_RPM_MEDIAN];
+    uint32_t cur = (uint32_t) d;
+    uint32_t q = r->period / 4;
+    bool slower = cur > r->period + q && prev > r->period + q;
+    // two halves that add up to one old period is a spurious edge between
+    bool split = cur + prev > r->period - q && cur + prev < r->period + q;
+    bool faster = cur + q < r->period && prev + q < r->period && !split;
+    uint32_t diff = cur > prev ? cur - prev : prev - cur;
+    if ((slower || faster) && diff < cur / 4) {
+      r->period = (cur + prev) / 2;
+      return(true);
+    }
+  }
+
+  uint32_t m = rpm_median(r);
+  int32_t err = (int32_t) m - (int32_t) r->period;
+  // the median moved a long way, go there
+  if (r->period == 0 || err > (int32_t) (r->period / 4) || -err > (int32_t) (r->period / 4)) {
+    r->period = m;
+  }
+  else {
+    r->period += err / (1 << FANC_RPM_EWMA_SHIFT);
+  }
+  return(true);
+}
+
+// the period to believe right now. If it's been well over that since the
+// last edge, or the last period was, the fan is slowing and the gap is the
+// better bound. Well over: a missed edge is only a blip.
+static uint32_t rpm_period(const fanc_rpm_t *r, int64_t now) {
+  if (r->period == 0) return(0);
+  int64_t since = now - r->last_edge;
+  if (since > FANC_RPM_STALL_US) return(0);
+  int64_t gap = since > r->last_period ? since : r->last_period;
+  if (gap > (int64_t) r->period * 5 / 2) return((uint32_t) gap);
+  return(r->period);
+}
+
+int fanc_rpm_get(const fanc_rpm_t *r, int64_t now) {
+  uint32_t p = rpm_period(r, now);
+  if (p == 0) return(0);
+  uint64_t d = (uint64_t) p * r->pulses_per_rev;
+  return( (int) ((60000000ULL + d / 2) / d) );
+}
+
+int fanc_rpm_mrps_get(const fanc_rpm_t *r, int64_t now) {
+  uint32_t p = rpm_period(r, now);
+  if (p == 0) return(0);
+  uint64_t d = (uint64_t) p * r->pulses_per_rev;
+  return( (int) ((1000000000ULL + d / 2) / d) );
+}
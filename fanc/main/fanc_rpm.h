@@ -0,0 +1,74 @@
+/*
+ * fanc_rpm.h
+ * Turning tach edge times into a speed. No ESP-IDF in here, it builds
+ * anywhere, so recorded pulse trains can be replayed through it on a desktop.
+ *
+ * A PC fan's tach pulls low twice a revolution. Counting pulses over half a
+ * second gives a number that's only good to a couple of RPM per pulse and half
+ * a second late, so instead we keep the time between edges. One period is a
+ * reading, and at 600 RPM one arrives every 50ms.
+ *
+ * Single periods are noisy - a missed edge doubles one, a bit of ringing
+ * halves one - so each reading is the median of the last few periods, then
+ * smoothed with an EWMA. Two periods in a row that agree with each other and
+ * not with the estimate ( the duty changed ) skip all that and go straight
+ * there, so a change shows within two edges - 100ms at 600 RPM.
+ *
+ * Edges closer together than a fan could make them are glitches and dropped.
+ * When edges stop the reading falls, bounded by the time since the last one,
+ * and goes to 0 after FANC_RPM_STALL_US. Until the estimate catches up with
+ * a slow down, a last period well over it is the bound instead.
+ *
+ * All times are microseconds.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// intel spec fans
+#define FANC_RPM_PULSES_PER_REV 2
+
+// periods in the median, odd
+#define FANC_RPM_MEDIAN 5
+
+// nothing we drive spins faster than this, closer edges are noise
+#define FANC_RPM_MAX 20000
+// no edge for this long and it's stopped
+#define FANC_RPM_STALL_US 1000000
+
+// EWMA weight is 1 / ( 1 << this )
+#define FANC_RPM_EWMA_SHIFT 2
+
+typedef struct {
+  int pulses_per_rev;
+  uint32_t min_period;      // shorter than this is a glitch
+  uint32_t periods[FANC_RPM_MEDIAN];
+  int n_periods;
+  int next;
+  bool have_edge;
+  int64_t last_edge;
+  uint32_t period;          // the smoothed estimate, 0 if none yet
+  uint32_t last_period;     // the latest, as it came
+  // stats
+  uint32_t n_edges;
+  uint32_t n_glitches;
+} fanc_rpm_t;
+
+void fanc_rpm_init(fanc_rpm_t *r, int pulses_per_rev);
+
+// an edge was seen at t. Cheap enough for an ISR, the median's only a
+// handful of compares. Returns false if it was thrown out as a glitch.
+bool fanc_rpm_edge(fanc_rpm_t *r, int64_t t);
+
+// the estimate as of now, 0 if stopped
+int fanc_rpm_get(const fanc_rpm_t *r, int64_t now);
+
+// the same in milli-revolutions per second, for those who want a fraction
+int fanc_rpm_mrps_get(const fanc_rpm_t *r, int64_t now);
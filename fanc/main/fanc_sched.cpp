@@ -0,0 +1,109 @@
+/* FANC task scheduling
+
+   Copywrite Brian Bulkowski, 2020
+
+   See fanc_sched.h. Kept free of ESP-IDF so it can be run through on a
+   desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "fanc_sched.h"
+
+void fanc_sched_init(fanc_sched_t *s, int period_ms, int64_t now_us) {
+  memset(s, 0, sizeof(fanc_sched_t));
+  s->period_us = (int64_t) period_ms * 1000;
+  s->next_tick_us = now_us + s->period_us;
+}
+
+void fanc_sched_request(fanc_sched_t *s, int fan, int64_t now_us) {
+  if (fan < 0 || fan >= FANC_FANS_MAX) return;
+  s->req_us[fan] = now_us;
+}
+
+static bool sched_fading(const fanc_sched_t *s, int fan, int64_t now_us) {
+  return( s->fade_end_us[fan] > now_us );
+}
+
+void fanc_sched_wake(fanc_sched_t *s, uint32_t bits, int64_t now_us, fanc_sched_due_t *due) {
+
+  due->tick = false;
+  due->apply = 0;
+
+  if (bits & FANC_SCHED_TICK) {
+    int64_t late = now_us - s->next_tick_us;
+    if (late < 0) late = -late;
+    // one missed altogether isn't jitter, start counting again
+    if (late < s->period_us && late > s->tick_late_max_us) s->tick_late_max_us = late;
+    s->next_tick_us = now_us + s->period_us;
+    s->n_ticks++;
+    due->tick = true;
+  }
+
+  uint32_t fresh = bits & FANC_SCHED_FANS;
+  s->pending |= fresh;
+  // something new on a fan waiting for the tick: it might not be for the PID now
+  s->at_tick &= ~fresh;
+
+  for (int i = 0; i < FANC_FANS_MAX; i++) {
+    uint32_t bit = 1u << i;
+    if (!(s->pending & bit) || (s->at_tick & bit)) continue;
+    if (sched_fading(s, i, now_us)) {
+      if (fresh & bit) s->n_deferred++;
+      continue;
+    }
+    due->apply |= bit;
+  }
+}
+
+void fanc_sched_done(fanc_sched_t *s, uint32_t fans, int64_t now_us) {
+
+  fans &= s->pending;
+  for (int i = 0; i < FANC_FANS_MAX; i++) {
+    if (!(fans & (1u << i))) continue;
+    int64_t lat = now_us - s->req_us[i];
+    if (lat < 0) lat = 0;
+    s->lat_last_us = lat;
+    if (lat > s->lat_max_us) s->lat_max_us = lat;
+    s->lat_sum_us += lat;
+    s->n_applied++;
+  }
+  s->pending &= ~fans;
+  s->at_tick &= ~fans;
+}
+
+void fanc_sched_hold(fanc_sched_t *s, uint32_t fans) {
+  s->at_tick |= fans & s->pending;
+}
+
+int fanc_sched_fade_ms(fanc_sched_t *s, int fan, int64_t now_us) {
+
+  if (fan < 0 || fan >= FANC_FANS_MAX) return(0);
+
+  int64_t room_us = s->next_tick_us - (int64_t) FANC_SCHED_GUARD_MS * 1000 - now_us;
+  int64_t fade_us = (int64_t) FANC_SCHED_FADE_MS * 1000;
+  if (fade_us > room_us) fade_us = room_us;
+  if (fade_us < (int64_t) FANC_SCHED_FADE_MIN_MS * 1000) {
+    s->fade_end_us[fan] = 0;
+    return(0);
+  }
+  s->fade_end_us[fan] = now_us + fade_us;
+  return( (int) (fade_us / 1000) );
+}
+
+int64_t fanc_sched_wait_us(const fanc_sched_t *s, int64_t now_us) {
+
+  int64_t wait = -1;
+  for (int i = 0; i < FANC_FANS_MAX; i++) {
+    uint32_t bit = 1u << i;
+    if (!(s->pending & bit) || (s->at_tick & bit)) continue;
+    int64_t w = s->fade_end_us[i] - now_us;
+    if (w < 0) w = 0;
+    if (wait < 0 || w < wait) wait = w;
+  }
+  return(wait);
+}
@@ -0,0 +1,89 @@
+/*
+ * fanc_sched.h
+ * When the fan task does what. No ESP-IDF in here, it builds anywhere, so
+ * the timing can be run through on a desktop.
+ *
+ * The task sleeps on its notification bits. Two things wake it:
+ *
+ *   FANC_SCHED_TICK  from a periodic esp_timer: poll the tachs, run the
+ *                    control step for every fan. The timer keeps the period
+ *                    to the microsecond, where a task delay is to the tick.
+ *   1 << fan         a setter changed something on that fan. Open loop, the
+ *                    new duty goes out right then; closed loop, the PID has
+ *                    its period and picks the change up on the next tick.
+ *
+ * Duty changes go out as hardware fades, so the PID's steps become ramps.
+ * The IDF blocks a duty change on a channel until its fade is over, so a
+ * fade always ends FANC_SCHED_GUARD_MS before the next tick, and a change
+ * that comes in while one is running waits for it ( deferred ) instead of
+ * blocking the task.
+ *
+ * Every change is timed from the setter to the duty going out. That's the
+ * latency REST shows.
+ *
+ * All times are microseconds.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fanc_ctrl.h"
+
+#define FANC_SCHED_TICK (1u << 31)
+#define FANC_SCHED_FANS ((1u << FANC_FANS_MAX) - 1)
+
+// a change is spread over this much
+#define FANC_SCHED_FADE_MS 150
+// and has to be done this long before the next tick
+#define FANC_SCHED_GUARD_MS 20
+// shorter than this, just set it
+#define FANC_SCHED_FADE_MIN_MS 10
+
+typedef struct {
+  int64_t period_us;
+  int64_t next_tick_us;             // when the timer should fire next
+  uint32_t pending;                 // fans with a change that isn't out
+  uint32_t at_tick;                 // of those, the ones waiting for the control step
+  volatile int64_t req_us[FANC_FANS_MAX];   // when the last change was asked for
+  int64_t fade_end_us[FANC_FANS_MAX];
+  // stats
+  uint32_t n_ticks;
+  int64_t tick_late_max_us;         // timer jitter
+  uint32_t n_applied;
+  uint32_t n_deferred;              // had to wait for a fade
+  int64_t lat_last_us;
+  int64_t lat_max_us;
+  int64_t lat_sum_us;
+} fanc_sched_t;
+
+typedef struct {
+  bool tick;            // run the control step
+  uint32_t apply;       // fans whose change can go out now
+} fanc_sched_due_t;
+
+void fanc_sched_init(fanc_sched_t *s, int period_ms, int64_t now_us);
+
+// a setter, on its own task, before it notifies
+void fanc_sched_request(fanc_sched_t *s, int fan, int64_t now_us);
+
+// the task woke, with these notification bits ( 0 if it timed out )
+void fanc_sched_wake(fanc_sched_t *s, uint32_t bits, int64_t now_us, fanc_sched_due_t *due);
+
+// the duties for these fans are out. After a tick, that's everything pending.
+void fanc_sched_done(fanc_sched_t *s, uint32_t fans, int64_t now_us);
+
+// these fans' changes are for the PID, leave them to the next tick
+void fanc_sched_hold(fanc_sched_t *s, uint32_t fans);
+
+// a duty's going out on fan now: how long to fade it over, 0 to just set it
+int fanc_sched_fade_ms(fanc_sched_t *s, int fan, int64_t now_us);
+
+// how long to sleep before a deferred change is due, -1 until something happens
+int64_t fanc_sched_wait_us(const fanc_sched_t *s, int64_t now_us);
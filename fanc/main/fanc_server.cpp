@@ -16,6 +16,7 @@
 */
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <inttypes.h>
@@ -28,187 +29,455 @@
 #include "freertos/task.h"
 
 #include "nvs_flash.h"
-#include "cJSON.h"
 
 #include "esp_http_server.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 
 #include "esp_log.h"
 static const char *TAG = "fanc";
 
 #include "fanc.h"
+#include "rest_router.h"
 
 
 
-// return the integer value of a json element which is in the root
-// Extensions: get a subitem with cJSON_GetObjectItem(parentCJson,child-string)
-//             set values cJSON_GetObjectItem(format,"frame rate")->valueint=25;
-// deleting the root deletes all the things
-// https://github.com/espressif/esp-idf/tree/master/components/json
-// not sure what happens when we can't get the string, though
-static esp_err_t get_json_value_int(const char *json_str, const char *field, int *val) {
+static bool resp_flush(void *ctx, const char *buf, size_t len) {
+    return( httpd_resp_send_chunk((httpd_req_t *) ctx, buf, len) == ESP_OK );
+}
 
-    ESP_LOGV(TAG," getjsonvalueint: json %s field %s",json_str,field);
-    const char *err_loc = 0;
-    cJSON *root = cJSON_ParseWithOpts(json_str, &err_loc, false);
-    ESP_LOGV(TAG," cjson parse: root is %p",root);
-    if (! root) {
-        ESP_LOGV(TAG,"could not parse json, error at postition: %d",(int)(err_loc - json_str) );
-        return(ESP_FAIL);
+// these must be in fanc_mode_t order
+static const char * const fan_mode_names[] = { "open", "rpm", "temp", NULL };
+
+// one fan as an object. The tach's counters only when asked, they're for debugging.
+static void fan_write(json_writer_t *w, int fan, bool tach) {
+
+    fanc_ctrl_status_t st;
+    if (fanc_fan_status_get(fan, &st) != ESP_OK) return;
+
+    json_obj_begin(w, NULL);
+    json_int(w, "id", fan);
+    json_str(w, "name", st.name);
+    json_str(w, "mode", fan_mode_names[st.mode]);
+    json_int(w, "setpoint", st.setpoint);
+    json_int(w, "measured", st.measured);
+    json_int(w, "rpm", st.rpm);
+    json_int(w, "duty", st.duty);
+    json_int(w, "kp", st.kp);
+    json_int(w, "ki", st.ki);
+    json_int(w, "kd", st.kd);
+    json_str(w, "tune", st.tune);
+    json_int(w, "ku", st.ku);
+    json_int(w, "tu_ms", st.tu_ms);
+    if (st.mode == FANC_MODE_TEMP) json_bool(w, "temp_stale", st.temp_stale);
+    json_str(w, "cal", st.cal);
+    json_bool(w, "linear", st.linear);
+    json_str(w, "stall", st.stall);
+    json_int(w, "kicks", st.kicks);
+    json_int(w, "faults", st.faults);
+
+    fanc_tach_stats_t ts;
+    if (tach && fanc_tach_stats_get(fan, &ts) == ESP_OK) {
+        json_obj_begin(w, "tach");
+        json_int(w, "rpm", ts.rpm);
+        json_int(w, "count_rpm", ts.count_rpm);
+        json_int(w, "period_us", ts.period_us);
+        json_int(w, "pulses", ts.pulses);
+        json_int(w, "edges", ts.edges);
+        json_int(w, "glitches", ts.glitches);
+        json_obj_end(w);
     }
 
-    cJSON *field_object = cJSON_GetObjectItem(root,field);
-    if (! field_object) {
-        ESP_LOGD(TAG, " JSON parse could not find %s in %s",field,json_str);
-        cJSON_Delete(root);
-        return(ESP_FAIL);
+    // the curve, RPM at every FANC_CAL_STEP of duty
+    fanc_cal_lut_t lut;
+    if (tach && st.linear && fanc_fan_cal_get(fan, &lut) == ESP_OK) {
+        json_obj_begin(w, "curve");
+        json_int(w, "step", FANC_CAL_STEP);
+        json_int(w, "min_duty", lut.min_duty);
+        json_arr_begin(w, "rpm");
+        for (int i = 0; i < FANC_CAL_POINTS; i++) json_int(w, NULL, lut.rpm[i]);
+        json_arr_end(w);
+        json_obj_end(w);
     }
-    if (! cJSON_IsNumber(field_object)) {
-        ESP_LOGD(TAG, " JSON did not find a number %s in %s",field,json_str);
-        cJSON_Delete(root);
-        return(ESP_FAIL);
+    json_obj_end(w);
+}
+
+static esp_err_t fan_send(httpd_req_t *req, int fan, bool tach) {
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), resp_flush, req);
+    fan_write(&w, fan, tach);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
+
+// one value from the query string, false if it isn't there
+static bool query_get(httpd_req_t *req, const char *key, char *val, size_t val_len) {
+
+    char query[48];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) return(false);
+    return( httpd_query_key_value(query, key, val, val_len) == ESP_OK );
+}
+
+// a non-negative int from the query, or -1
+static int query_int(httpd_req_t *req, const char *key) {
+
+    char val[12];
+    if (!query_get(req, key, val, sizeof(val))) return(-1);
+    char *end;
+    long v = strtol(val, &end, 10);
+    if (end == val || *end != 0 || v < 0 || v > INT32_MAX) return(-1);
+    return( (int) v );
+}
+
+// ?id=N, or -1
+static int fan_query_id(httpd_req_t *req) {
+    return( query_int(req, "id") );
+}
+
+static esp_err_t tach_handler(httpd_req_t *req, const char *content) {
+
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
     }
 
-    // NB. This library has a strange idea that number is both double and integer.
-    // in this case I want the closest int.
+    fanc_tach_stats_t st;
+    if (fanc_tach_stats_get(0, &st) != ESP_OK) {
+        return( httpd_resp_send_err(req,HTTPD_500_INTERNAL_SERVER_ERROR,"no tach") );
+    }
 
-    *val = field_object->valueint;
-    cJSON_Delete(root);
-    return(ESP_OK);
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[192];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), resp_flush, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "rpm", st.rpm);
+    json_int(&w, "count_rpm", st.count_rpm);
+    json_int(&w, "period_us", st.period_us);
+    json_int(&w, "pulses", st.pulses);
+    json_int(&w, "edges", st.edges);
+    json_int(&w, "glitches", st.glitches);
+    json_obj_end(&w);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
 }
 
-// rest get calls will come here
-//
+/*
+** /rest/fan_history?res=raw|10s|1m&n=N
+**
+** The first fan's speed, newest first, in RPM. raw is a number a sample,
+** the others are [min,avg,max] a bucket, or [] if it missed one. Streamed
+** from the rings where they are through the one buffer on the stack.
+*/
 
-esp_err_t rest_uri_handler(httpd_req_t *req) {
+static esp_err_t fan_history_handler(httpd_req_t *req, const char *content) {
 
-    ESP_LOGD(TAG," received rest URI request for %s method %d",req->uri,req->method);
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
+    }
 
-    // did I get content?
+    int64_t start = esp_timer_get_time();
 
-    char *content = 0;
-    if (req->content_len > 0) {
-        //ESP_LOGD(TAG," content length is: %d",req->content_len);
-        content =(char *)malloc(req->content_len + 1);
-        int sz = httpd_req_recv(req, content, req->content_len);
-        //ESP_LOGD(TAG," content sz is: %d",sz);
-        if (sz != req->content_len) {
-            //ESP_LOGD(TAG," could not retrieve content: %d",sz);
-            httpd_resp_send_500(req);
-            free(content);
-            return(ESP_OK);
+    int res = FANC_HIST_10S;
+    char val[8];
+    if (query_get(req, "res", val, sizeof(val))) {
+        res = fanc_hist_res_parse(val);
+        if (res < 0) return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"res is raw, 10s or 1m") );
+    }
+    int n = query_int(req, "n");
+
+    const fanc_hist_t *h = fanc_hist_get();
+    fanc_hist_cursor_t c;
+    fanc_hist_cursor(&c, h, res, n > 0 ? n : 0);
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), resp_flush, req);
+    json_obj_begin(&w, NULL);
+    json_str(&w, "res", fanc_hist_res_name(res));
+    json_int(&w, "period_ms", fanc_hist_period_ms(res));
+    json_int(&w, "age_ms", fanc_hist_len(h, res) ? start / 1000 - h->newest_ms[res] : 0);
+    json_arr_begin(&w, "rpm");
+    fanc_hist_roll_t p;
+    int n_points = 0;
+    while (fanc_hist_next(&c, &p)) {
+        if (res == FANC_HIST_RAW) {
+            json_int(&w, NULL, fanc_hist_q_rpm(p.avg));
+        }
+        else {
+            json_arr_begin(&w, NULL);
+            if (!fanc_hist_empty(&p)) {
+                json_int(&w, NULL, fanc_hist_q_rpm(p.min));
+                json_int(&w, NULL, fanc_hist_q_rpm(p.avg));
+                json_int(&w, NULL, fanc_hist_q_rpm(p.max));
+            }
+            json_arr_end(&w);
         }
-        content[req->content_len] = 0;
-        //ESP_LOGD(TAG," content is: %s",content);
+        n_points++;
     }
-    
-// going to ignore accept headers...
-#if 0
-    // what is the accept string?
-    size_t hdr_value_len = httpd_req_get_hdr_value_len(req, "Accept");
-    if (hdr_value_len) {
-        char *value =(char *)malloc(hdr_value_len+1);
-        httpd_req_get_hdr_value_str(req, "Accept", value, hdr_value_len );
-        ESP_LOGD(TAG," got accept header: %s",value);
-        free(value);
+    json_arr_end(&w);
+    json_int(&w, "points", n_points);
+    json_int(&w, "add_us_max", fanc_hist_add_us_max());
+    json_int(&w, "query_us", esp_timer_get_time() - start);
+    json_obj_end(&w);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
+
+/*
+** /rest/persist: how much the settings have been written to flash, and how
+** full it's getting. Keys only show once they've been written.
+*/
+
+static esp_err_t persist_handler(httpd_req_t *req, const char *content) {
+
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
     }
 
-    // what is the Connection string?
-    size_t hdr_value_len = httpd_req_get_hdr_value_len(req, "Connection");
-    if (hdr_value_len) {
-        char *value =(char *)malloc(hdr_value_len+1);
-        httpd_req_get_hdr_value_str(req, "Connection", value, hdr_value_len );
-        ESP_LOGD(TAG," got connection header: %s",value);
-        free(value);
+    const persist_t *p = fanc_persist_get();
+    persist_stats_t st;
+    persist_stats_get(p, &st);
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), resp_flush, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "sets", st.sets);
+    json_int(&w, "unchanged", st.unchanged);
+    json_int(&w, "flushes", st.flushes);
+    json_int(&w, "writes", st.writes);
+    json_int(&w, "fails", st.fails);
+    json_int(&w, "lifetime_writes", st.lifetime_writes);
+    json_bool(&w, "pending", st.pending);
+    persist_nvs_usage_t u;
+    if (persist_nvs_usage_get(&u)) {
+        json_int(&w, "nvs_used", u.used);
+        json_int(&w, "nvs_free", u.free);
     }
-#endif
+    json_obj_begin(&w, "key_writes");
+    for (int i = 0; i < p->n_entries; i++) {
+        if (p->entries[i].writes) json_int(&w, p->entries[i].key, p->entries[i].writes);
+    }
+    json_obj_end(&w);
+    json_obj_end(&w);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
 
-    // doing this up here will set it for everything
-    httpd_resp_set_hdr(req,"Connection","close");
+// the router wants a function each
+static int pid_kp_get(void) { return( fanc_gain_get(0) ); }
+static int pid_ki_get(void) { return( fanc_gain_get(1) ); }
+static int pid_kd_get(void) { return( fanc_gain_get(2) ); }
+static esp_err_t pid_kp_set(int v) { return( fanc_gain_set(0, v) ); }
+static esp_err_t pid_ki_set(int v) { return( fanc_gain_set(1, v) ); }
+static esp_err_t pid_kd_set(int v) { return( fanc_gain_set(2, v) ); }
 
-    // parse the URI so I can sub-dispatch?
-    const char *last_slash = strrchr(req->uri, '/');
-    last_slash++;
+static esp_err_t pid_handler(httpd_req_t *req, const char *content) {
 
-    if ( strcmp(last_slash, "fan_pct") == 0) {
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
+    }
+    return( fan_send(req, 0, false) );
+}
 
-        if (req->method == HTTP_GET) {
+/*
+** /rest/fan?id=N is one fan. Post {"id":N, ...} with any of mode ( a name or
+** its number ), fan_pct, rpm_target, temp_target, kp, ki, kd, autotune,
+** calibrate.
+** It's all checked before any of it is applied.
+*/
 
-            char fan_pct_str[20];
-            snprintf(fan_pct_str, sizeof(fan_pct_str),"%d",fanc_percentage_get() );
+// an int in the object at obj, if it's there. False if it's there but out of range.
+static bool fan_int(const char *js, const json_tok_t *toks, int n_toks, const char *key, int min, int max, int *val, bool *present) {
+    *present = false;
+    int t = json_obj_get(js, toks, n_toks, 0, key);
+    if (t < 0) return(true);
+    if (!json_tok_int(js, &toks[t], val) || *val < min || *val > max) {
+        ESP_LOGD(TAG,"rest: fan %s out of range",key);
+        return(false);
+    }
+    *present = true;
+    return(true);
+}
 
-            ESP_LOGI(TAG,"rest: sending fan percentage %s",fan_pct_str);
+// run through the patch; when apply is false only check it
+static esp_err_t fan_patch_walk(const char *js, const json_tok_t *toks, int n_toks, bool apply) {
 
-            httpd_resp_set_type(req, "text/plain");
-            httpd_resp_sendstr(req, fan_pct_str);
-        }
-        else if (req->method == HTTP_POST) {
+    int fan, val;
+    bool present;
 
-            int new_fan_pct = 0;
-            if (ESP_OK == get_json_value_int(content, "fan_pct",&new_fan_pct)) {
-                ESP_LOGI(TAG,"rest: posted, a fan pct to set: %d",new_fan_pct);
+    if (toks[0].type != JSON_OBJECT) return(ESP_FAIL);
 
-                fanc_percentage_set(new_fan_pct);
+    if (!fan_int(js, toks, n_toks, "id", 0, fanc_fan_count() - 1, &fan, &present) || !present) return(ESP_FAIL);
 
-                // easiest way to say OK?
-                httpd_resp_sendstr(req,"");
-            }
-            else {
-                ESP_LOGW(TAG," posted, a json with a bad value fan pct");
-                httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value");
+    // the mode the patch leaves it in, for what depends on it
+    int mode = fanc_fan_mode_get(fan);
+
+    int t = json_obj_get(js, toks, n_toks, 0, "mode");
+    if (t >= 0) {
+        int m = -1;
+        if (toks[t].type == JSON_STRING) {
+            for (int i = 0; fan_mode_names[i]; i++) {
+                if (json_tok_eq(js, &toks[t], fan_mode_names[i])) m = i;
             }
         }
+        else if (!json_tok_int(js, &toks[t], &m)) {
+            m = -1;
+        }
+        if (m < FANC_MODE_OPEN || m > FANC_MODE_TEMP) return(ESP_FAIL);
+        mode = m;
+        if (apply) fanc_fan_mode_set(fan, m);
+    }
+
+    if (!fan_int(js, toks, n_toks, "fan_pct", 0, 100, &val, &present)) return(ESP_FAIL);
+    if (present && apply) fanc_fan_percentage_set(fan, val);
 
+    if (!fan_int(js, toks, n_toks, "rpm_target", 0, FANC_RPM_TARGET_MAX, &val, &present)) return(ESP_FAIL);
+    if (present && apply) fanc_fan_rpm_target_set(fan, val);
+
+    if (!fan_int(js, toks, n_toks, "temp_target", 0, FANC_TEMP_MAX, &val, &present)) return(ESP_FAIL);
+    if (present && apply) fanc_fan_temp_target_set(fan, val);
+
+    // after the mode, they're the gains of the loop it's now in
+    static const char *gain_names[] = { "kp", "ki", "kd" };
+    for (int g = 0; g < 3; g++) {
+        if (!fan_int(js, toks, n_toks, gain_names[g], 0, 1000000, &val, &present)) return(ESP_FAIL);
+        if (present && apply) fanc_fan_gain_set(fan, g, val);
     }
-    else if ( strcmp(last_slash, "fan_speed") == 0) {
 
-        if (req->method == HTTP_GET) {
+    t = json_obj_get(js, toks, n_toks, 0, "autotune");
+    if (t >= 0) {
+        bool b;
+        if (!json_tok_bool(js, &toks[t], &b)) return(ESP_FAIL);
+        // there's no loop to tune open: refuse it now, not halfway through applying
+        if (b && mode == FANC_MODE_OPEN) return(ESP_FAIL);
+        if (apply && fanc_fan_autotune_set(fan, b) != ESP_OK) return(ESP_FAIL);
+    }
 
-            char fan_speed_str[20];
-            snprintf(fan_speed_str, sizeof(fan_speed_str),"%.1f",fanc_speed_get() );
+    t = json_obj_get(js, toks, n_toks, 0, "calibrate");
+    if (t >= 0) {
+        bool b;
+        if (!json_tok_bool(js, &toks[t], &b)) return(ESP_FAIL);
+        if (b && fanc_fan_cfg(fan)->tach_gpio < 0) return(ESP_FAIL);
+        if (apply && fanc_fan_calibrate_set(fan, b) != ESP_OK) return(ESP_FAIL);
+    }
 
-            ESP_LOGI(TAG,"rest: sending fan speed %s",fan_speed_str);
+    return(ESP_OK);
+}
+
+static esp_err_t fan_handler(httpd_req_t *req, const char *content) {
 
-            httpd_resp_set_type(req, "text/plain");
-            httpd_resp_sendstr(req, fan_speed_str);
+    if (req->method == HTTP_GET) {
+        int fan = fan_query_id(req);
+        if (fan < 0 || fan >= fanc_fan_count()) {
+            return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"no such fan") );
         }
+        return( fan_send(req, fan, true) );
     }
-    else if ( strcmp(last_slash, "uptime") == 0) {
 
-        clock_t cl = clock();
-        uint64_t uptime_sec = cl / CLOCKS_PER_SEC;
-        char uptime_str[20];
-        snprintf(uptime_str, sizeof(uptime_str),"%" PRIu64,uptime_sec);
-
-        ESP_LOGI(TAG,"rest: sending uptime %s",uptime_str);
+    if (req->method != HTTP_POST) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"get or post") );
+    }
 
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_sendstr(req, uptime_str);
+    const json_tok_t *toks;
+    int n_toks = rest_parse(content, &toks);
+    if (n_toks < 0 || fan_patch_walk(content, toks, n_toks, false) != ESP_OK ||
+            fan_patch_walk(content, toks, n_toks, true) != ESP_OK) {
+        ESP_LOGW(TAG,"rest: bad fan patch");
+        return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value") );
     }
-    else if ( strcmp(last_slash, "epoch") == 0) {
 
-        // this might be correct, because we have sntp enabled
-        time_t secs = time(NULL);
-        char secs_str[30];
-        // depending on config, time might be 64 bits, or 32.... play it safe
-        snprintf(secs_str, sizeof(secs_str),"%" PRIu64,(uint64_t) secs);
+    int fan;
+    rest_json_int(content, "id", &fan);
+    return( fan_send(req, fan, false) );
+}
 
-        ESP_LOGI(TAG,"rest: sending epoch %s",secs_str);
+// all of them, and how the loop's doing
+static esp_err_t fans_handler(httpd_req_t *req, const char *content) {
 
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_sendstr(req, secs_str);
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
     }
 
-    else {
-        ESP_LOGI(TAG,"rest: unknown endpoint: %s",last_slash);
-        httpd_resp_send_404(req);
+    fanc_ctrl_stats_t cs;
+    fanc_ctrl_stats_get(&cs);
+
+    int rpm_min = 0, rpm_max = 0, rpm_sum = 0, n_tach = 0;
+    for (int i = 0; i < cs.n_fans; i++) {
+        if (fanc_fan_cfg(i)->tach_gpio < 0) continue;
+        int rpm = fanc_fan_rpm_get(i);
+        if (n_tach == 0 || rpm < rpm_min) rpm_min = rpm;
+        if (n_tach == 0 || rpm > rpm_max) rpm_max = rpm;
+        rpm_sum += rpm;
+        n_tach++;
     }
 
-    if (content) free(content);
-
-    return(ESP_OK);
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), resp_flush, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "n_fans", cs.n_fans);
+    json_int(&w, "rpm_min", rpm_min);
+    json_int(&w, "rpm_max", rpm_max);
+    json_int(&w, "rpm_avg", n_tach ? rpm_sum / n_tach : 0);
+    json_int(&w, "temp", fanc_temp_get());
+    json_int(&w, "period_ms", cs.period_ms);
+    json_int(&w, "steps", cs.steps);
+    json_int(&w, "commits", cs.commits);
+    json_int(&w, "duty_sets", cs.duty_sets);
+    json_int(&w, "ticks", cs.ticks);
+    json_int(&w, "tick_late_max_us", cs.tick_late_max_us);
+    json_int(&w, "applied", cs.applied);
+    json_int(&w, "deferred", cs.deferred);
+    json_int(&w, "apply_us_last", cs.apply_us_last);
+    json_int(&w, "apply_us_max", cs.apply_us_max);
+    json_int(&w, "apply_us_avg", cs.apply_us_avg);
+    json_arr_begin(&w, "fans");
+    for (int i = 0; i < cs.n_fans; i++) fan_write(&w, i, false);
+    json_arr_end(&w);
+    json_obj_end(&w);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
 }
 
+// rest calls come here, through the router
+static const rest_route_t rest_routes[] = {
+    REST_ROUTE_INT("fan_pct", 0, 100, fanc_percentage_get, fanc_percentage_set),
+    REST_ROUTE_FLOAT("fan_speed", 1, fanc_speed_get, NULL),
+    REST_ROUTE_INT("fan_rpm", 0, 0, fanc_rpm_get, NULL),
+    REST_ROUTE_CUSTOM("tach", tach_handler),
+    REST_ROUTE_ENUM("fan_mode", fan_mode_names, fanc_mode_get, fanc_mode_set),
+    REST_ROUTE_INT("rpm_target", 0, FANC_RPM_TARGET_MAX, fanc_rpm_target_get, fanc_rpm_target_set),
+    REST_ROUTE_INT("temp_target", 0, FANC_TEMP_MAX, fanc_temp_target_get, fanc_temp_target_set),
+    REST_ROUTE_INT("temp", FANC_TEMP_MIN, FANC_TEMP_MAX, fanc_temp_get, fanc_temp_set),
+    REST_ROUTE_INT("pid_kp", 0, 1000000, pid_kp_get, pid_kp_set),
+    REST_ROUTE_INT("pid_ki", 0, 1000000, pid_ki_get, pid_ki_set),
+    REST_ROUTE_INT("pid_kd", 0, 1000000, pid_kd_get, pid_kd_set),
+    REST_ROUTE_BOOL("pid_autotune", fanc_autotune_get, fanc_autotune_set),
+    REST_ROUTE_BOOL("fan_calibrate", fanc_calibrate_get, fanc_calibrate_set),
+    REST_ROUTE_CUSTOM("pid", pid_handler),
+    REST_ROUTE_CUSTOM("fan", fan_handler),
+    REST_ROUTE_CUSTOM("fans", fans_handler),
+    REST_ROUTE_CUSTOM("persist", persist_handler),
+    REST_ROUTE_CUSTOM("fan_history", fan_history_handler),
+    REST_ROUTE_CUSTOM("uptime", rest_uptime_handler),
+    REST_ROUTE_CUSTOM("epoch", rest_epoch_handler),
+    REST_ROUTE_CUSTOM("server", rest_server_stats_handler),
+};
+
+static rest_router_t g_rest_router;
+
 
 //
 // I have used 'embed files' in the build system to include a small test jpeg
@@ -222,13 +491,15 @@ extern const uint8_t server_index_html_end[] asm("_binary_index_html_end");
 extern const uint8_t server_jquery_min_js_start[] asm("_binary_jquery_min_js_start");
 extern const uint8_t server_jquery_min_js_end[] asm("_binary_jquery_min_js_end");
 
+// gzipped copies and ETags are made by the build, see main/CMakeLists.txt
+#include "static_assets.h"
+
+extern const uint8_t server_index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t server_index_html_gz_end[] asm("_binary_index_html_gz_end");
+
+extern const uint8_t server_jquery_min_js_gz_start[] asm("_binary_jquery_min_js_gz_start");
+extern const uint8_t server_jquery_min_js_gz_end[] asm("_binary_jquery_min_js_gz_end");
 
-typedef struct static_content_s {
-    const char *name;
-    const char *content_type;
-    const uint8_t *buf;
-    ssize_t  buf_len;
-} static_content_t;
 
 // C doesn't in any way have the ability yet to iterate
 // over a defined list without having the size of the list.
@@ -240,29 +511,41 @@ typedef struct static_content_s {
 // I'm going to mandate that "index.html", ie, what you want served out of the
 // root, will always be first
 
-static std::array<static_content_t, 3> static_contents = { {
+static std::array<rest_static_t, 3> static_contents = { {
     {
     "index.html", "text/html", 
-        server_index_html_start, ( server_index_html_end - server_index_html_start)
+        server_index_html_start, ( server_index_html_end - server_index_html_start),
+        server_index_html_gz_start, ( server_index_html_gz_end - server_index_html_gz_start),
+        ETAG_INDEX_HTML, ETAG_INDEX_HTML_GZ
     },    {
     "cheese.jpg", "image/jpg", 
-        server_cheese_jpg_start, ( server_cheese_jpg_end - server_cheese_jpg_start)
+        server_cheese_jpg_start, ( server_cheese_jpg_end - server_cheese_jpg_start),
+        NULL, 0, // already compressed
+        ETAG_CHEESE_JPG, NULL
     },
     {
     "jquery.min.js", "text/javascript", 
-        server_jquery_min_js_start, ( server_jquery_min_js_end - server_jquery_min_js_start)
+        server_jquery_min_js_start, ( server_jquery_min_js_end - server_jquery_min_js_start),
+        server_jquery_min_js_gz_start, ( server_jquery_min_js_gz_end - server_jquery_min_js_gz_start),
+        ETAG_JQUERY_MIN_JS, ETAG_JQUERY_MIN_JS_GZ
     }
 } };
 
 
+// a 304, the gzipped copy or the plain one, see rest_router.h
+static esp_err_t static_send(httpd_req_t *req, const rest_static_t *content) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = rest_static_send(req, content);
+    rest_server_request_done(start);
+    return(err);
+}
+
 esp_err_t static_uri_handler(httpd_req_t *req) {
 
     esp_err_t err;
 
     ESP_LOGD(TAG," received static URI request for %s",req->uri);
 
-    // short lived connections
-    httpd_resp_set_hdr(req,"Connection","close");
     httpd_resp_set_hdr(req,"Cache-Control","max-age=99999");
 
     size_t query_len = httpd_req_get_url_query_len(req);
@@ -288,8 +571,7 @@ esp_err_t static_uri_handler(httpd_req_t *req) {
         for (auto& static_content : static_contents) {
             if (strcmp(static_content.name, query) == 0) {
                 ESP_LOGD(TAG,"static_http: sending %s response",query);
-                httpd_resp_set_type(req, static_content.content_type);
-                httpd_resp_send(req, (const char *) static_content.buf, static_content.buf_len);
+                static_send(req, &static_content);
                 found = true;
                 break;
             }
@@ -314,15 +596,12 @@ esp_err_t root_uri_handler(httpd_req_t *req) {
 
     ESP_LOGI(TAG," received root URI request for %s",req->uri);
 
-    // short lived connections
-    httpd_resp_set_hdr(req,"Connection","close");
     httpd_resp_set_hdr(req,"Cache-Control","max-age=99999");
 
     // by convention, whatever is 0 will be served out of root
-    static_content_t *root = &static_contents[0];
+    rest_static_t *root = &static_contents[0];
 
-    httpd_resp_set_type(req, root->content_type);
-    httpd_resp_send(req, (const char *) root->buf, root->buf_len);
+    static_send(req, root);
 
     return( ESP_OK );
 }
@@ -344,15 +623,15 @@ httpd_uri_t uri_root {
 httpd_uri_t uri_rest_get {
     .uri = "/rest/*",
     .method = HTTP_GET,
-    .handler = rest_uri_handler,
-    .user_ctx = NULL
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
 };
 
 httpd_uri_t uri_rest_post {
     .uri = "/rest/*",
     .method = HTTP_POST,
-    .handler = rest_uri_handler,
-    .user_ctx = NULL
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
 };
 
 
@@ -369,6 +648,8 @@ esp_err_t webserver_init(void) {
     config.server_port = 80;
      // this server does match wildcards if you use a fancier function
     config.uri_match_fn = httpd_uri_match_wildcard;
+    // keep-alive, LRU purge, socket counts
+    rest_server_config(&config);
     // there's a globaluserctx that gets passed on responses
 
 
@@ -392,6 +673,12 @@ esp_err_t webserver_init(void) {
         return(ESP_FAIL);
     }
 
+    err = rest_router_init(&g_rest_router, rest_routes, sizeof(rest_routes) / sizeof(rest_routes[0]));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "webserver_init: could not build rest routes");
+        return(ESP_FAIL);
+    }
+
     // rest get URI
     err = httpd_register_uri_handler(g_httpserver, &uri_rest_get);
     if (err != ESP_OK) { 
@@ -0,0 +1,205 @@
+/* FANC tach
+
+   Copywrite Brian Bulkowski, 2020
+
+   Reading how fast a fan turns. Two things watch the tach pin:
+
+   The PCNT peripheral counts rising edges, in hardware, through its glitch
+   filter. That never misses, whatever the CPU is up to, and is the count
+   of record.
+
+   A GPIO interrupt on the same pin notes when each edge came, and hands the
+   time to fanc_rpm ( see fanc_rpm.h ), which makes a speed out of the periods.
+   That's what gets reported: it's good to an RPM or so and follows a change
+   within a few edges, where counting over half a second was neither.
+   The interrupt isn't IRAM, so edges during a flash write are missed - that's
+   one long period, which the median throws out.
+
+   Each tach gets a PCNT unit, so there can be eight.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/pcnt.h"
+#include "esp_timer.h"
+
+#include "esp_err.h"
+
+#include "esp_log.h"
+static const char *TAG = "fanc_tach";
+
+#include "fanc.h"
+#include "fanc_rpm.h"
+
+// APB cycles, 1023 is the most it takes: pulses under 12.8us don't count
+#define FANC_TACH_FILTER 1023
+// the counter goes back to 0 here. Polled every half second, a fan would
+// need to turn at two million RPM to get round twice.
+#define FANC_TACH_H_LIM 32000
+
+typedef struct {
+    bool live;
+    gpio_num_t gpio;
+    pcnt_unit_t unit;
+    portMUX_TYPE mux;       // rpm is shared with the ISR
+    fanc_rpm_t rpm;
+    // pulse counting, only touched under mux too
+    int16_t last_count;
+    uint32_t pulses;
+    int64_t last_poll;
+    int count_rpm;
+} fanc_tach_t;
+
+static fanc_tach_t g_tach[FANC_TACH_MAX];
+
+static void fanc_tach_isr(void *p) {
+    fanc_tach_t *t = (fanc_tach_t *) p;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&t->mux);
+    fanc_rpm_edge(&t->rpm, now);
+    portEXIT_CRITICAL_ISR(&t->mux);
+}
+
+esp_err_t fanc_tach_init(int idx, int gpio, int pulses_per_rev) {
+
+    esp_err_t err;
+
+    if (idx < 0 || idx >= FANC_TACH_MAX) return(ESP_ERR_INVALID_ARG);
+    fanc_tach_t *t = &g_tach[idx];
+
+    memset(t, 0, sizeof(fanc_tach_t));
+    t->gpio = (gpio_num_t) gpio;
+    t->unit = (pcnt_unit_t) (PCNT_UNIT_0 + idx);
+    t->mux = portMUX_INITIALIZER_UNLOCKED;
+    fanc_rpm_init(&t->rpm, pulses_per_rev);
+
+    // so annoying these must be the same order as the struct definition
+    pcnt_config_t pcnt_config = {
+        .pulse_gpio_num = gpio,
+        .ctrl_gpio_num = PCNT_PIN_NOT_USED,
+        .lctrl_mode = PCNT_MODE_KEEP,
+        .hctrl_mode = PCNT_MODE_KEEP,
+        .pos_mode = PCNT_COUNT_INC,
+        .neg_mode = PCNT_COUNT_DIS,
+        .counter_h_lim = FANC_TACH_H_LIM,
+        .counter_l_lim = 0,
+        .unit = t->unit,
+        .channel = PCNT_CHANNEL_0,
+    };
+
+    err = pcnt_unit_config(&pcnt_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "could not configure pcnt unit %d (%s)", idx, esp_err_to_name(err));
+        return(err);
+    }
+    pcnt_set_filter_value(t->unit, FANC_TACH_FILTER);
+    pcnt_filter_enable(t->unit);
+    pcnt_counter_pause(t->unit);
+    pcnt_counter_clear(t->unit);
+    pcnt_counter_resume(t->unit);
+
+    // the PCNT config set the pin up as an input. The edge times come from
+    // an interrupt on it as well.
+    gpio_set_intr_type(t->gpio, GPIO_INTR_POSEDGE);
+
+    // the second tach finds it there already
+    err = gpio_install_isr_service(0 /* default */);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "could not install isr service (%s)", esp_err_to_name(err));
+        return(err);
+    }
+
+    err = gpio_isr_handler_add(t->gpio, fanc_tach_isr, t);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "could not add isr handler (%s)", esp_err_to_name(err));
+        return(err);
+    }
+
+    err = gpio_intr_enable(t->gpio);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "could not enable interrupt (%s)", esp_err_to_name(err));
+        return(err);
+    }
+
+    t->last_poll = esp_timer_get_time();
+    t->live = true;
+
+    ESP_LOGI(TAG, "tach %d on gpio %d, pcnt unit %d", idx, gpio, t->unit);
+    return(ESP_OK);
+}
+
+// read the counter and fold it into the total. Call at least a few times a
+// minute so it can't go round twice.
+void fanc_tach_poll(int idx) {
+
+    if (idx < 0 || idx >= FANC_TACH_MAX) return;
+    fanc_tach_t *t = &g_tach[idx];
+    if (!t->live) return;
+
+    int16_t count;
+    if (pcnt_get_counter_value(t->unit, &count) != ESP_OK) return;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&t->mux);
+    int d = count - t->last_count;
+    if (d < 0) d += FANC_TACH_H_LIM;
+    t->last_count = count;
+    t->pulses += d;
+    int64_t elapsed = now - t->last_poll;
+    if (elapsed > 0) {
+        t->count_rpm = (int) ((int64_t) d * 60000000LL / (elapsed * t->rpm.pulses_per_rev));
+    }
+    t->last_poll = now;
+    portEXIT_CRITICAL(&t->mux);
+}
+
+int fanc_tach_rpm_get(int idx) {
+
+    if (idx < 0 || idx >= FANC_TACH_MAX) return(0);
+    fanc_tach_t *t = &g_tach[idx];
+    if (!t->live) return(0);
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&t->mux);
+    int rpm = fanc_rpm_get(&t->rpm, now);
+    portEXIT_CRITICAL(&t->mux);
+    return(rpm);
+}
+
+int fanc_tach_mrps_get(int idx) {
+
+    if (idx < 0 || idx >= FANC_TACH_MAX) return(0);
+    fanc_tach_t *t = &g_tach[idx];
+    if (!t->live) return(0);
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&t->mux);
+    int mrps = fanc_rpm_mrps_get(&t->rpm, now);
+    portEXIT_CRITICAL(&t->mux);
+    return(mrps);
+}
+
+esp_err_t fanc_tach_stats_get(int idx, fanc_tach_stats_t *st) {
+
+    if (idx < 0 || idx >= FANC_TACH_MAX) return(ESP_ERR_INVALID_ARG);
+    fanc_tach_t *t = &g_tach[idx];
+    if (!t->live) return(ESP_ERR_INVALID_STATE);
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&t->mux);
+    st->rpm = fanc_rpm_get(&t->rpm, now);
+    st->mrps = fanc_rpm_mrps_get(&t->rpm, now);
+    st->count_rpm = t->count_rpm;
+    st->pulses = t->pulses;
+    st->edges = t->rpm.n_edges;
+    st->glitches = t->rpm.n_glitches;
+    st->period_us = t->rpm.period;
+    portEXIT_CRITICAL(&t->mux);
+    return(ESP_OK);
+}
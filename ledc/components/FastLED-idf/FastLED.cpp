@@ -14,7 +14,6 @@ CFastLED FastLED;
 
 CLEDController *CLEDController::m_pHead = NULL;
 CLEDController *CLEDController::m_pTail = NULL;
-static uint32_t lastshow = 0;
 
 uint32_t _frame_cnt=0;
 uint32_t _retry_cnt=0;
@@ -25,7 +24,6 @@ CFastLED::CFastLED() {
 	// clear out the array of led controllers
 	// m_nControllers = 0;
 	m_Scale = 255;
-	m_nFPS = 0;
 	m_pPowerFunc = NULL;
 	m_nPowerData = 0xFFFFFFFF;
 }
@@ -43,9 +41,8 @@ CLEDController &CFastLED::addLeds(CLEDController *pLed,
 }
 
 void CFastLED::show(uint8_t scale) {
-	// guard against showing too rapidly
-	while(m_nMinMicros && ((micros()-lastshow) < m_nMinMicros));
-	lastshow = micros();
+	// guard against showing too rapidly: sleeps until the next frame slot
+	m_Governor.claimSlot();
 
 	// If we have a function for computing power, use it!
 	if(m_pPowerFunc) {
@@ -55,12 +52,12 @@ void CFastLED::show(uint8_t scale) {
 	CLEDController *pCur = CLEDController::head();
 	while(pCur) {
 		uint8_t d = pCur->getDither();
-		if(m_nFPS < 100) { pCur->setDither(0); }
+		// binary dithering flickers visibly under 100fps, error diffusion doesn't
+		if(getFPS() < 100 && d == BINARY_DITHER) { pCur->setDither(0); }
 		pCur->showLeds(scale);
 		pCur->setDither(d);
 		pCur = pCur->next();
 	}
-	countFPS();
 }
 
 int CFastLED::count() {
@@ -86,8 +83,7 @@ CLEDController & CFastLED::operator[](int x) {
 }
 
 void CFastLED::showColor(const struct CRGB & color, uint8_t scale) {
-	while(m_nMinMicros && ((micros()-lastshow) < m_nMinMicros));
-	lastshow = micros();
+	m_Governor.claimSlot();
 
 	// If we have a function for computing power, use it!
 	if(m_pPowerFunc) {
@@ -97,12 +93,12 @@ void CFastLED::showColor(const struct CRGB & color, uint8_t scale) {
 	CLEDController *pCur = CLEDController::head();
 	while(pCur) {
 		uint8_t d = pCur->getDither();
-		if(m_nFPS < 100) { pCur->setDither(0); }
+		// binary dithering flickers visibly under 100fps, error diffusion doesn't
+		if(getFPS() < 100 && d == BINARY_DITHER) { pCur->setDither(0); }
 		pCur->showColor(color, scale);
 		pCur->setDither(d);
 		pCur = pCur->next();
 	}
-	countFPS();
 }
 
 void CFastLED::clear(bool writeData) {
@@ -203,22 +199,6 @@ void CFastLED::setDither(uint8_t ditherMode)  {
 extern int noise_min;
 extern int noise_max;
 
-void CFastLED::countFPS(int nFrames) {
-  static int br = 0;
-  static uint32_t lastframe = 0; // millis();
-
-  if(br++ >= nFrames) {
-      uint32_t now = millis();
-      now -= lastframe;
-      if( now == 0 ) {
-          now = 1; // prevent division by zero below
-      }
-      m_nFPS = (br * 1000) / now;
-    br = 0;
-    lastframe = millis();
-  }
-}
-
 void CFastLED::setMaxRefreshRate(uint16_t refresh, bool constrain) {
   if(constrain) {
     // if we're constraining, the new value of m_nMinMicros _must_ be higher than previously (because we're only
@@ -231,6 +211,7 @@ void CFastLED::setMaxRefreshRate(uint16_t refresh, bool constrain) {
   } else {
     m_nMinMicros = 0;
   }
+  m_Governor.setPeriod(m_nMinMicros);
 }
 
 extern "C" int atexit(void (* /*func*/ )()) { return 0; }
@@ -73,6 +73,7 @@
 
 #include "noise.h"
 #include "power_mgt.h"
+#include "frame_governor.h"
 
 #include "fastspi.h"
 #include "chipsets.h"
@@ -190,8 +191,8 @@ typedef uint8_t (*power_func)(uint8_t scale, uint32_t data);
 class CFastLED {
 	// int m_nControllers;
 	uint8_t  m_Scale; 				///< The current global brightness scale setting
-	uint16_t m_nFPS;					///< Tracking for current FPS value
 	uint32_t m_nMinMicros;		///< minimum µs between frames, used for capping frame rates.
+	CFrameGovernor m_Governor;	///< paces show() to m_nMinMicros without spinning
 	uint32_t m_nPowerData;		///< max power use parameter
 	power_func m_pPowerFunc;	///< function for overriding brightness when using FastLED.show();
 
@@ -545,7 +546,7 @@ public:
 
 	/// Set the dithering mode.  Sets the dithering mode for all added led strips, overriding
 	/// whatever previous dithering option those controllers may have had.
-	/// @param ditherMode - what type of dithering to use, either BINARY_DITHER or DISABLE_DITHER
+	/// @param ditherMode - what type of dithering to use, either BINARY_DITHER, ERROR_DIFFUSION_DITHER or DISABLE_DITHER
 	void setDither(uint8_t ditherMode = BINARY_DITHER);
 
 	/// Set the maximum refresh rate.  This is global for all leds.  Attempts to
@@ -557,15 +558,17 @@ public:
 	/// @param constrain - constrain refresh rate to the slowest speed yet set
 	void setMaxRefreshRate(uint16_t refresh, bool constrain=false);
 
-	/// for debugging, will keep track of time between calls to countFPS, and every
-	/// nFrames calls, it will update an internal counter for the current FPS.
-	/// @todo make this a rolling counter
-	/// @param nFrames - how many frames to time for determining FPS
-	void countFPS(int nFrames=25);
-
 	/// Get the number of frames/second being written out
-	/// @returns the most recently computed FPS value
-	uint16_t getFPS() { return m_nFPS; }
+	/// @returns the frame rate measured by the frame governor, smoothed over the last few frames
+	uint16_t getFPS() { return m_Governor.getFPS(); }
+
+	/// Get how late frames go out against their slot
+	/// @returns the smoothed lateness in microseconds
+	uint32_t getFrameJitter() { return m_Governor.getJitter(); }
+
+	/// Block until the next frame slot, for render loops that don't call show() every time around.
+	/// The next show() uses that slot instead of waiting again.
+	void waitForFrame() { m_Governor.waitForSlot(); }
 
 	/// Get how many controllers have been registered
   /// @returns the number of controllers (strips) that have been added with addLeds
@@ -8,7 +8,9 @@
 #include "led_sysdefs.h"
 #include "pixeltypes.h"
 #include "color.h"
+#include "dither_diffuse.h"
 #include <stddef.h>
+#include <stdlib.h>
 
 FASTLED_NAMESPACE_BEGIN
 
@@ -23,6 +25,8 @@ FASTLED_NAMESPACE_BEGIN
 
 #define DISABLE_DITHER 0x00
 #define BINARY_DITHER 0x01
+// per-pixel sigma-delta: the fraction scale8 would drop is carried to the next frame
+#define ERROR_DIFFUSION_DITHER 0x02
 typedef uint8_t EDitherMode;
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -183,6 +187,7 @@ struct PixelController {
         CRGB mScale;
         int8_t mAdvance;
         int mOffsets[LANES];
+        uint8_t *mResidual;
 
         PixelController(const PixelController & other) {
             d[0] = other.d[0];
@@ -194,6 +199,7 @@ struct PixelController {
             mData = other.mData;
             mScale = other.mScale;
             mAdvance = other.mAdvance;
+            mResidual = other.mResidual;
             mLenRemaining = mLen = other.mLen;
             for(int i = 0; i < LANES; i++) { mOffsets[i] = other.mOffsets[i]; }
 
@@ -207,20 +213,20 @@ struct PixelController {
           }
         }
 
-        PixelController(const uint8_t *d, int len, CRGB & s, EDitherMode dither = BINARY_DITHER, bool advance=true, uint8_t skip=0) : mData(d), mLen(len), mLenRemaining(len), mScale(s) {
+        PixelController(const uint8_t *d, int len, CRGB & s, EDitherMode dither = BINARY_DITHER, bool advance=true, uint8_t skip=0) : mData(d), mLen(len), mLenRemaining(len), mScale(s), mResidual(NULL) {
             enable_dithering(dither);
             mData += skip;
             mAdvance = (advance) ? 3+skip : 0;
             initOffsets(len);
         }
 
-        PixelController(const CRGB *d, int len, CRGB & s, EDitherMode dither = BINARY_DITHER) : mData((const uint8_t*)d), mLen(len), mLenRemaining(len), mScale(s) {
+        PixelController(const CRGB *d, int len, CRGB & s, EDitherMode dither = BINARY_DITHER) : mData((const uint8_t*)d), mLen(len), mLenRemaining(len), mScale(s), mResidual(NULL) {
             enable_dithering(dither);
             mAdvance = 3;
             initOffsets(len);
         }
 
-        PixelController(const CRGB &d, int len, CRGB & s, EDitherMode dither = BINARY_DITHER) : mData((const uint8_t*)&d), mLen(len), mLenRemaining(len), mScale(s) {
+        PixelController(const CRGB &d, int len, CRGB & s, EDitherMode dither = BINARY_DITHER) : mData((const uint8_t*)&d), mLen(len), mLenRemaining(len), mScale(s), mResidual(NULL) {
             enable_dithering(dither);
             mAdvance = 0;
             initOffsets(len);
@@ -311,20 +317,36 @@ struct PixelController {
         }
 
         // toggle dithering enable
+        // ERROR_DIFFUSION_DITHER starts out as binary dithering, and only switches over
+        // once the controller hands us a residual buffer with enable_error_diffusion()
         void enable_dithering(EDitherMode dither) {
             switch(dither) {
                 case BINARY_DITHER: init_binary_dithering(); break;
+                case ERROR_DIFFUSION_DITHER: init_binary_dithering(); break;
                 default: d[0]=d[1]=d[2]=e[0]=e[1]=e[2]=0; break;
             }
         }
 
+        // Error diffusion (first order sigma-delta) dithering.
+        // 'residual' holds one byte per color channel per pixel, in wire order, and must
+        // live as long as the controller. Each frame, the low byte of value*scale that
+        // scale8 would throw away is kept, and added back in on the next frame, so the
+        // output averages out to the exact scaled value. Unlike binary dithering there's
+        // no fixed pattern, so it holds up at low brightness without visible flicker.
+        // Only the single lane loaders use it, the multi-lane block driver stays on binary.
+        void enable_error_diffusion(uint8_t *residual) {
+            if (residual == NULL) return;
+            mResidual = residual;
+            d[0]=d[1]=d[2]=e[0]=e[1]=e[2]=0;
+        }
+
         __attribute__((always_inline)) inline int size() { return mLen; }
 
         // get the amount to advance the pointer by
         __attribute__((always_inline)) inline int advanceBy() { return mAdvance; }
 
         // advance the data pointer forward, adjust position counter
-         __attribute__((always_inline)) inline void advanceData() { mData += mAdvance; mLenRemaining--;}
+         __attribute__((always_inline)) inline void advanceData() { mData += mAdvance; mLenRemaining--; if(mResidual) { mResidual += 3; } }
 
         // step the dithering forward
          __attribute__((always_inline)) inline void stepDithering() {
@@ -349,8 +371,16 @@ struct PixelController {
         template<int SLOT>  __attribute__((always_inline)) inline static uint8_t scale(PixelController & pc, uint8_t b) { return scale8(b, pc.mScale.raw[RO(SLOT)]); }
         template<int SLOT>  __attribute__((always_inline)) inline static uint8_t scale(PixelController & , uint8_t b, uint8_t scale) { return scale8(b, scale); }
 
+        // scale with the carried residual: same multiply as scale8, the low byte goes back into the residual
+        template<int SLOT>  __attribute__((always_inline)) inline static uint8_t diffuse(PixelController & pc, uint8_t b) {
+            return diffuse8(b, pc.mScale.raw[RO(SLOT)], pc.mResidual[RO(SLOT)]);
+        }
+
         // composite shortcut functions for loading, dithering, and scaling
-        template<int SLOT>  __attribute__((always_inline)) inline static uint8_t loadAndScale(PixelController & pc) { return scale<SLOT>(pc, pc.dither<SLOT>(pc, pc.loadByte<SLOT>(pc))); }
+        template<int SLOT>  __attribute__((always_inline)) inline static uint8_t loadAndScale(PixelController & pc) {
+            if (pc.mResidual) return diffuse<SLOT>(pc, pc.loadByte<SLOT>(pc));
+            return scale<SLOT>(pc, pc.dither<SLOT>(pc, pc.loadByte<SLOT>(pc)));
+        }
         template<int SLOT>  __attribute__((always_inline)) inline static uint8_t loadAndScale(PixelController & pc, int lane) { return scale<SLOT>(pc, pc.dither<SLOT>(pc, pc.loadByte<SLOT>(pc, lane))); }
         template<int SLOT>  __attribute__((always_inline)) inline static uint8_t loadAndScale(PixelController & pc, int lane, uint8_t d, uint8_t scale) { return scale8(pc.dither<SLOT>(pc, pc.loadByte<SLOT>(pc, lane), d), scale); }
         template<int SLOT>  __attribute__((always_inline)) inline static uint8_t loadAndScale(PixelController & pc, int lane, uint8_t scale) { return scale8(pc.loadByte<SLOT>(pc, lane), scale); }
@@ -388,14 +418,38 @@ struct PixelController {
 
 template<EOrder RGB_ORDER, int LANES=1, uint32_t MASK=0xFFFFFFFF> class CPixelLEDController : public CLEDController {
 protected:
+  /// per pixel, per channel carry for ERROR_DIFFUSION_DITHER, allocated on first use
+  uint8_t *m_pResidual;
+  int m_nResidual;
+
   virtual void showPixels(PixelController<RGB_ORDER,LANES,MASK> & pixels) = 0;
 
+  /// hook up the residual buffer if this controller is error diffusing
+  ///@param pixels the pixel controller about to be shown
+  ///@param nLeds the number of leds being written out
+  void enableErrorDiffusion(PixelController<RGB_ORDER, LANES, MASK> & pixels, int nLeds) {
+#if !defined(NO_DITHERING) || (NO_DITHERING != 1)
+    if (LANES != 1 || getDither() != ERROR_DIFFUSION_DITHER) return;
+
+    if (m_nResidual < nLeds * 3) {
+      if (m_pResidual) free(m_pResidual);
+      m_nResidual = 0;
+      m_pResidual = (uint8_t *) malloc(nLeds * 3);
+      if (m_pResidual == NULL) return;
+      m_nResidual = nLeds * 3;
+      for (int i = 0; i < m_nResidual; i++) { m_pResidual[i] = diffuse8_seed(i); }
+    }
+    pixels.enable_error_diffusion(m_pResidual);
+#endif
+  }
+
   /// set all the leds on the controller to a given color
   ///@param data the crgb color to set the leds to
   ///@param nLeds the numner of leds to set to this color
   ///@param scale the rgb scaling value for outputting color
   virtual void showColor(const struct CRGB & data, int nLeds, CRGB scale) {
     PixelController<RGB_ORDER, LANES, MASK> pixels(data, nLeds, scale, getDither());
+    enableErrorDiffusion(pixels, nLeds);
     showPixels(pixels);
   }
 
@@ -405,11 +459,12 @@ protected:
 ///@param scale the rgb scaling to apply to each led before writing it out
   virtual void show(const struct CRGB *data, int nLeds, CRGB scale) {
     PixelController<RGB_ORDER, LANES, MASK> pixels(data, nLeds, scale, getDither());
+    enableErrorDiffusion(pixels, nLeds);
     showPixels(pixels);
   }
 
 public:
-  CPixelLEDController() : CLEDController() {}
+  CPixelLEDController() : CLEDController(), m_pResidual(NULL), m_nResidual(0) {}
 };
 
 
@@ -0,0 +1,33 @@
+#ifndef __INC_DITHER_DIFFUSE_H
+#define __INC_DITHER_DIFFUSE_H
+
+///@file dither_diffuse.h
+/// The arithmetic behind ERROR_DIFFUSION_DITHER, one channel of one pixel at a time.
+/// Nothing platform specific in here, so it builds on a host and can be tested there.
+
+#include <stdint.h>
+
+/// scale b the way scale8 does, and keep the low byte that scale8 would throw away
+/// in residual, to be added in on the next frame. Over frames the output averages to
+/// the full 16 bit product, b * scale / 256.
+///@param b the pixel's channel value
+///@param scale the channel's scale, brightness and correction
+///@param residual the carry for this channel of this pixel, from the last frame
+static inline __attribute__((always_inline)) uint8_t diffuse8(uint8_t b, uint8_t scale, uint8_t & residual) {
+#if (FASTLED_SCALE8_FIXED == 1)
+    uint16_t v = ((uint16_t)b * (1 + (uint16_t)scale)) + residual;
+#else
+    uint16_t v = ((uint16_t)b * (uint16_t)scale) + residual;
+#endif
+    residual = v & 0xFF;
+    return v >> 8;
+}
+
+/// the carry a residual buffer starts with, so pixels at the same level don't all
+/// step on the same frame
+///@param i index into the residual buffer
+static inline uint8_t diffuse8_seed(int i) {
+    return (uint8_t)(i * 159);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#define FASTLED_INTERNAL
+#include "FastLED.h"
+#include "frame_governor.h"
+
+FASTLED_NAMESPACE_BEGIN
+
+// don't bother with the timer for waits shorter than this, just go
+#define FRAME_GOVERNOR_MIN_SLEEP_US 50
+
+CFrameGovernor::CFrameGovernor() :
+	m_bOpen(false), m_Timer(NULL), m_Wake(NULL) {
+}
+
+void CFrameGovernor::timerCallback(void *arg) {
+	CFrameGovernor *pGovernor = (CFrameGovernor *)arg;
+	xSemaphoreGive(pGovernor->m_Wake);
+}
+
+void CFrameGovernor::waitForSlot() {
+	uint32_t wait = nextSlot(esp_timer_get_time());
+
+	if(wait >= FRAME_GOVERNOR_MIN_SLEEP_US) {
+		// FastLED is a global, too early to make these in the constructor
+		if(m_Wake == NULL) {
+			m_Wake = xSemaphoreCreateBinary();
+		}
+		if(m_Timer == NULL && m_Wake) {
+			esp_timer_create_args_t timer_create_args = {
+				.callback = timerCallback,
+				.arg = (void *) this,
+				.dispatch_method = ESP_TIMER_TASK,
+				.name = "frame_governor"
+			};
+			esp_timer_create(&timer_create_args, &m_Timer);
+		}
+
+		// only the timer gives m_Wake, and only after we start it, so one take
+		if(m_Timer && esp_timer_start_once(m_Timer, wait) == ESP_OK) {
+			xSemaphoreTake(m_Wake, portMAX_DELAY);
+		}
+	}
+
+	m_bOpen = true;
+}
+
+void CFrameGovernor::claimSlot() {
+	if(!m_bOpen) {
+		waitForSlot();
+	}
+	m_bOpen = false;
+	markFrame(esp_timer_get_time());
+}
+
+FASTLED_NAMESPACE_END
@@ -0,0 +1,45 @@
+#ifndef __INC_FRAME_GOVERNOR_H
+#define __INC_FRAME_GOVERNOR_H
+
+///@file frame_governor.h
+/// paces frames on fixed deadlines without spinning a core
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "frame_pace.h"
+
+FASTLED_NAMESPACE_BEGIN
+
+/// Frame governor.  Hands out frame slots on a fixed period ( see CFramePace for the
+/// deadline math ), and blocks the calling task until the next slot using a one-shot
+/// esp_timer and a semaphore, so the wait is microsecond accurate without burning the
+/// core (a FreeRTOS tick is 10ms here, too coarse for frame pacing).
+///
+/// The semaphore is the governor's own, so the wait doesn't touch the calling task's
+/// notification value, which the task may be using for something else.
+class CFrameGovernor : public CFramePace {
+	bool m_bOpen;				///< a slot was waited for and no frame has used it yet
+	esp_timer_handle_t m_Timer;
+	SemaphoreHandle_t m_Wake;	///< given by the timer when the slot starts
+
+	static void timerCallback(void *arg);
+
+public:
+	CFrameGovernor();
+
+	/// Block the calling task until the next slot starts, and hold the slot open for
+	/// the next claimSlot().  For render loops that don't show every time around.
+	void waitForSlot();
+
+	/// Called for each frame shown.  Uses the slot waitForSlot() opened, if there is
+	/// one, otherwise waits for the next slot.
+	void claimSlot();
+};
+
+FASTLED_NAMESPACE_END
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __INC_FRAME_PACE_H
+#define __INC_FRAME_PACE_H
+
+///@file frame_pace.h
+/// The arithmetic behind the frame governor: when the next frame slot starts, and
+/// the fps and jitter stats. It's handed the time, and makes no OS calls, so it
+/// builds on a host and can be run there against a fake clock.
+
+#include <stdint.h>
+
+/// stats are exponentially smoothed, new samples weigh 1/2^FRAME_PACE_SMOOTH_SHIFT
+#define FRAME_PACE_SMOOTH_SHIFT 3
+
+/// Frame slots on a fixed period.  If a frame is late by more than a whole period, the
+/// schedule restarts from now instead of running a burst of frames to catch up.
+class CFramePace {
+protected:
+	uint32_t m_nPeriod;			///< microseconds between slots, 0 means don't pace
+	uint64_t m_nNext;			///< start of the next slot, 0 before the first frame
+	uint64_t m_nSlot;			///< start of the slot most recently handed out
+	uint64_t m_nLastFrame;		///< when the last frame went out
+	uint32_t m_nInterval;		///< smoothed time between frames, microseconds
+	uint32_t m_nJitter;			///< smoothed lateness of frames against their slot, microseconds
+
+public:
+	CFramePace() : m_nPeriod(0), m_nNext(0), m_nSlot(0), m_nLastFrame(0), m_nInterval(0), m_nJitter(0) {}
+
+	/// set the time between frames.  0 turns pacing off.
+	void setPeriod(uint32_t micros) {
+		m_nPeriod = micros;
+		// start the schedule over on the next frame
+		m_nNext = 0;
+	}
+	uint32_t getPeriod() const { return m_nPeriod; }
+
+	/// Work out the next slot.  Returns how many microseconds from 'now' it starts, 0 if
+	/// it already has, and moves the schedule on by one period.
+	uint32_t nextSlot(uint64_t now) {
+		if(m_nPeriod == 0) {
+			m_nSlot = now;
+			return 0;
+		}
+
+		// first frame, or we've missed a whole slot: start over from now
+		// rather than rushing frames out to catch up
+		if(m_nNext == 0 || now >= m_nNext + m_nPeriod) {
+			m_nNext = now;
+		}
+
+		uint32_t wait = (m_nNext > now) ? (uint32_t)(m_nNext - now) : 0;
+		m_nSlot = m_nNext;
+		m_nNext += m_nPeriod;
+		return wait;
+	}
+
+	/// start of the slot nextSlot() last handed out
+	uint64_t getSlot() const { return m_nSlot; }
+
+	/// Record that a frame went out at 'now', for the fps and jitter stats
+	void markFrame(uint64_t now) {
+		uint32_t late = (now > m_nSlot) ? (uint32_t)(now - m_nSlot) : 0;
+		if(m_nLastFrame == 0) {
+			m_nJitter = late;
+		} else {
+			uint32_t interval = (uint32_t)(now - m_nLastFrame);
+			if(m_nInterval == 0) {
+				m_nInterval = interval;
+			} else {
+				m_nInterval = m_nInterval - (m_nInterval >> FRAME_PACE_SMOOTH_SHIFT) + (interval >> FRAME_PACE_SMOOTH_SHIFT);
+			}
+			m_nJitter = m_nJitter - (m_nJitter >> FRAME_PACE_SMOOTH_SHIFT) + (late >> FRAME_PACE_SMOOTH_SHIFT);
+		}
+		m_nLastFrame = now;
+	}
+
+	/// frames per second actually achieved
+	uint16_t getFPS() const { return m_nInterval ? (uint16_t)(1000000L / m_nInterval) : 0; }
+
+	/// average microseconds frames go out after their slot starts
+	uint32_t getJitter() const { return m_nJitter; }
+};
+
+#endif
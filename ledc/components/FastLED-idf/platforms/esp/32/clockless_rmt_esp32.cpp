@@ -5,6 +5,7 @@
 
 //static const char *TAG = "FastLED";
 #include "esp_idf_version.h"
+#include "rmt_sched.h"
 
 
 // -- Forward reference
@@ -15,6 +16,10 @@ class ESP32RMTController;
 //    (Usually when the sketch calls addLeds)
 static ESP32RMTController * gControllers[FASTLED_RMT_MAX_CONTROLLERS];
 
+// -- Order the controllers are handed channels in for this show:
+//    longest first. Filled in by showPixels, consumed through gNext.
+static ESP32RMTController * gQueue[FASTLED_RMT_MAX_CONTROLLERS];
+
 // -- Current set of active controllers, indexed by the RMT
 //    channel assigned to them.
 static ESP32RMTController * gOnChannel[FASTLED_RMT_MAX_CHANNELS];
@@ -207,6 +212,7 @@ ESP32RMTController::ESP32RMTController(int DATA_PIN, int T1, int T2, int T3)
     : mPixelData(0), 
       mSize(0), 
       mCur(0), 
+      mBytes(0),
       mWhichHalf(0),
       mBuffer(0),
       mBufferSize(0),
@@ -246,6 +252,7 @@ ESP32RMTController::ESP32RMTController(int DATA_PIN, int T1, int T2, int T3)
 //    the PixelController object until show is called.
 uint32_t * ESP32RMTController::getPixelBuffer(int size_in_bytes)
 {
+    mBytes = size_in_bytes;
     if (mPixelData == 0) {
         mSize = ((size_in_bytes-1) / sizeof(uint32_t)) + 1;
         mPixelData = (uint32_t *) calloc( mSize, sizeof(uint32_t));
@@ -352,6 +359,9 @@ void ESP32RMTController::showPixels()
     if (gNumStarted == gNumControllers) {
         gNext = 0;
 
+        // -- Queue the controllers longest first
+        ESP32RMTController::scheduleLongestFirst();
+
         // -- This Take always succeeds immediately
         xSemaphoreTake(gTX_sem, portMAX_DELAY);
 
@@ -404,13 +414,39 @@ void ESP32RMTController::showPixels()
 
 }
 
+// -- Order the controllers for this show
+//    When there are more controllers than channels, the show takes as
+//    long as the busiest channel. Handing out channels in registration
+//    order can easily leave one long strip starting last, after the
+//    others have finished. Starting the longest strips first, and giving
+//    each freed channel the longest one still waiting (LPT scheduling),
+//    keeps the channels evenly loaded, and is never worse than 4/3 of
+//    the best possible packing. With no more controllers than channels,
+//    everything starts at once and the order doesn't matter.
+//
+//    The length is mBytes, which both the interrupt driven and the
+//    built-in driver paths set each show. See rmt_sched.h.
+void ESP32RMTController::scheduleLongestFirst()
+{
+    int len[FASTLED_RMT_MAX_CONTROLLERS];
+    int order[FASTLED_RMT_MAX_CONTROLLERS];
+
+    for (int i = 0; i < gNumControllers; i++) {
+        len[i] = gControllers[i]->mBytes;
+    }
+    rmt_order_longest_first(len, gNumControllers, order);
+    for (int i = 0; i < gNumControllers; i++) {
+        gQueue[i] = gControllers[order[i]];
+    }
+}
+
 // -- Start up the next controller
 //    This method is static so that it can dispatch to the
 //    appropriate startOnChannel method of the given controller.
 void ESP32RMTController::startNext(int channel)
 {
     if (gNext < gNumControllers) {
-        ESP32RMTController * pController = gControllers[gNext];
+        ESP32RMTController * pController = gQueue[gNext];
         pController->startOnChannel(channel);
         gNext++;
     }
@@ -688,6 +724,7 @@ void ESP32RMTController::initPulseBuffer(int size_in_bytes)
 {
 
     mCurPulse = 0;
+    mBytes = size_in_bytes;
 
     // maybe we already have a buffer of the right size, it's likely
     if (mBuffer && (mBufferSize == size_in_bytes * 8))
@@ -32,7 +32,8 @@
  * first 8 controllers; the interrupt handler starts new controllers
  * asynchronously as previous ones finish. So, for example, it can
  * send the data for 8 controllers simultaneously, but 16 controllers
- * would take approximately twice as much time.
+ * would take approximately twice as much time. Controllers are queued
+ * longest strip first, so a long strip doesn't end up starting last.
  *
  * There is a #define that allows a program to control the total
  * number of channels that the driver is allowed to use. It defaults
@@ -222,6 +223,10 @@ private:
     int            mSize;
     int            mCur;
 
+    // -- Bytes to send this show, either driver. What the channels
+    //    are handed out by.
+    int            mBytes;
+
     // -- RMT memory
     volatile uint32_t * mRMT_mem_ptr;
     volatile uint32_t * mRMT_mem_start;
@@ -254,6 +259,9 @@ public:
     //    This is the main entry point for the pixel controller
     void IRAM_ATTR showPixels();
 
+    // -- Order the queued controllers, longest strip first
+    static void scheduleLongestFirst();
+
     // -- Start up the next controller
     //    This method is static so that it can dispatch to the
     //    appropriate startOnChannel method of the given controller.
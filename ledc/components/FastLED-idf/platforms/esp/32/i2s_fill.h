@@ -0,0 +1,115 @@
+#pragma once
+
+/*
+ * The bit twiddling of the I2S buffer fill, out of clockless_i2s_esp32.h.
+ *
+ * Nothing ESP32 in here, so it builds on a host, where test/ checks it
+ * byte for byte against the old per-channel 8x8 transpositions and times
+ * the two. Everything is forced inline: fillBuffer() runs from IRAM in the
+ * interrupt handler, and so must all of this.
+ */
+
+#include <stdint.h>
+
+#define I2S_FILL_INLINE inline __attribute__((always_inline))
+
+/** One pixel as a row of the transposition: the three color bytes in
+ *  output order, first out in the high byte, low byte zero.
+ */
+static I2S_FILL_INLINE uint32_t i2s_pack_pixel(uint8_t c0, uint8_t c1, uint8_t c2)
+{
+    return ((uint32_t) c0 << 24) | ((uint32_t) c1 << 16) | ((uint32_t) c2 << 8);
+}
+
+// swap the j bit blocks masked by m between rows a and b
+#define I2S_SWAP(a, b, j, m) { uint32_t t = (A[a] ^ (A[b] >> (j))) & (m); A[a] ^= t; A[b] ^= (t << (j)); }
+
+/** Transpose 32x32 bit matrix
+ *  From Hacker's Delight. Bit 31-c of A[r] ends up as bit 31-r of A[c].
+ *  Each pass has its own loop with a constant step, rather than the book's
+ *  one loop with a computed one, so the compiler can unroll them: that's
+ *  between one and a half and three times faster, depending on -Os or -O2,
+ *  and this runs once a pixel row in the interrupt handler.
+ */
+static I2S_FILL_INLINE void i2s_transpose32x32(uint32_t * A)
+{
+    for (int k = 0; k < 16; k++) I2S_SWAP(k, k+16, 16, 0x0000FFFFu)
+    for (int k = 0; k < 32; k += 16) for (int q = k; q < k+8; q++) I2S_SWAP(q, q+8, 8, 0x00FF00FFu)
+    for (int k = 0; k < 32; k += 8) for (int q = k; q < k+4; q++) I2S_SWAP(q, q+4, 4, 0x0F0F0F0Fu)
+    for (int k = 0; k < 32; k += 4) for (int q = k; q < k+2; q++) I2S_SWAP(q, q+2, 2, 0x33333333u)
+    for (int k = 0; k < 32; k += 2) I2S_SWAP(k, k+1, 1, 0x55555555u)
+}
+
+#undef I2S_SWAP
+
+/** Sort n strips by length into byLength, shortest first, so they can
+ *  be retired in order. Returns the longest. There are at most 24, an
+ *  insertion sort is fine. Task context, it needn't be in IRAM.
+ */
+static inline int i2s_sort_by_length(uint8_t * byLength, const int * len, int n)
+{
+    int longest = 0;
+    for (int i = 0; i < n; i++) {
+        if (len[i] > longest) longest = len[i];
+        int j = i;
+        while (j > 0 && len[byLength[j-1]] > len[i]) {
+            byLength[j] = byLength[j-1];
+            j--;
+        }
+        byLength[j] = i;
+    }
+    return longest;
+}
+
+/** Retire the strips that have run out by pixel row cur: from here on
+ *  they read zero, without stepping. nextEnd is the next strip in
+ *  byLength to run out, the new one is returned. Sorted, this is
+ *  usually a single compare.
+ */
+static I2S_FILL_INLINE int i2s_retire_strips(const uint32_t ** src, int * stride, const uint8_t * byLength,
+                                             const int * len, int n, int nextEnd, int cur, const uint32_t * zero)
+{
+    while (nextEnd < n) {
+        int i = byLength[nextEnd];
+        if (len[i] > cur) break;
+        src[i] = zero;
+        stride[i] = 0;
+        nextEnd++;
+    }
+    return nextEnd;
+}
+
+/** Get the current pixel from each of n strips, and step each along.
+ *  They go in reverse strip order starting at row 23, which puts strip
+ *  i at bit i+8 after the transposition. Rows no strip uses are zero.
+ */
+static I2S_FILL_INLINE void i2s_gather_row(uint32_t * rows, const uint32_t ** src, const int * stride, int n)
+{
+    int i = 0;
+    for ( ; i < n; i++) {
+        rows[23-i] = *src[i];
+        src[i] += stride[i];
+    }
+    for ( ; i < 24; i++) {
+        rows[23-i] = 0;
+    }
+    for (i = 24; i < 32; i++) {
+        rows[i] = 0;
+    }
+}
+
+/** Write the transposed rows - row c*8+b is bit 7-b of channel c across
+ *  all the strips - as pulses. Only the pulses that differ between the
+ *  "0" and "1" encodings, the rest of the buffer is set up once.
+ */
+static I2S_FILL_INLINE void i2s_encode_row(volatile uint32_t * buf, const uint32_t * rows, int nrows,
+                                           int pulsesPerBit, int onesForZero, int onesForOne)
+{
+    for (int row = 0; row < nrows; row++) {
+        uint32_t bit = rows[row];
+        volatile uint32_t * pulses = buf + (row * pulsesPerBit);
+        for (int pulse_num = onesForZero; pulse_num < onesForOne; pulse_num++) {
+            pulses[pulse_num] = bit;
+        }
+    }
+}
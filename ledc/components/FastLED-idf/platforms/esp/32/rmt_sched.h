@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * The order the RMT driver hands out channels in, out of
+ * clockless_rmt_esp32.cpp. Nothing ESP32 in here, so test/ can run it
+ * against simulated channels and say how long a show takes.
+ */
+
+/** Fill order[] with the indexes of the n strips, longest first, by
+ *  len[], the bytes each has to send this show.
+ *  Insertion sort, stable, so equal strips keep registration order.
+ *  There are at most FASTLED_RMT_MAX_CONTROLLERS.
+ */
+static inline void rmt_order_longest_first(const int * len, int n, int * order)
+{
+    for (int i = 0; i < n; i++) {
+        int j = i;
+        while (j > 0 && len[order[j-1]] < len[i]) {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = i;
+    }
+}
@@ -0,0 +1,132 @@
+/*
+** Persist-idf
+**
+** Settings that live in NVS, written behind. Every NVS commit erases and
+** writes flash, which stops the cache on both cores while it runs, and
+** someone dragging a slider makes dozens of them a second. Here a change
+** only lands in RAM; it's written once things have been quiet for
+** debounce_ms, or max_delay_ms after the first change if they never are.
+** Everything that changed is written in one commit, and a value that's back
+** where it was in flash isn't written at all.
+**
+** Writes are counted, per key since boot and in total for the life of the
+** flash ( kept in PERSIST_WRITES_KEY ), to see what's wearing it.
+**
+** The logic is in persist.cpp and doesn't know about NVS, it goes through
+** persist_store_t - persist_nvs.cpp is the real one, a desktop can hand it
+** a table in memory.
+**
+** Setters can be on any task, flushing on one other. A set writes the
+** value, then marks the table pending; a flush clears pending before it
+** looks. So a change either makes this flush, or marks the next. Nothing
+** locks, an int32 write is atomic on anything we run on.
+**
+** Copyright Brian Bulkowski, (c) 2020
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// NVS_KEY_NAME_MAX_SIZE, with the null
+#define PERSIST_KEY_MAX 16
+
+// the total writes, for the life of the namespace
+#define PERSIST_WRITES_KEY "persist_wr"
+
+typedef struct {
+  char key[PERSIST_KEY_MAX];
+  volatile int32_t value;
+  int32_t stored;       // what's in flash ( or the default, if nothing is )
+  int32_t flushing;     // what the flush in progress is writing
+  bool present;         // found in flash, or written since
+  uint32_t writes;      // since boot
+} persist_entry_t;
+
+// the backing store. begin and end bracket a load or a flush and can be NULL.
+typedef struct {
+  bool (*begin)(void *ctx, bool write);
+  bool (*get)(void *ctx, const char *key, int32_t *v);     // false if it isn't there
+  bool (*set)(void *ctx, const char *key, int32_t v);
+  bool (*commit)(void *ctx);
+  void (*end)(void *ctx);
+  void *ctx;
+} persist_store_t;
+
+typedef struct {
+  persist_entry_t *entries;
+  int n_entries;
+  int max_entries;
+  uint32_t debounce_ms;
+  uint32_t max_delay_ms;
+  volatile bool pending;
+  volatile uint32_t first_ms;   // first change since the last flush
+  volatile uint32_t last_ms;    // latest change
+  // stats
+  uint32_t sets;                // that changed something
+  uint32_t unchanged;           // sets to the value it already had
+  uint32_t flushes;             // commits
+  uint32_t writes;              // keys written, since boot, PERSIST_WRITES_KEY too
+  uint32_t fails;
+  uint32_t lifetime_writes;     // keys written, ever
+} persist_t;
+
+typedef struct {
+  uint32_t sets;
+  uint32_t unchanged;
+  uint32_t flushes;
+  uint32_t writes;
+  uint32_t fails;
+  uint32_t lifetime_writes;
+  bool pending;
+} persist_stats_t;
+
+void persist_init(persist_t *p, persist_entry_t *entries, int max_entries, uint32_t debounce_ms, uint32_t max_delay_ms);
+
+// a key, and what it is when flash doesn't have it. Returns its index, -1 if
+// the table's full or the key's too long.
+int persist_add(persist_t *p, const char *key, int32_t dflt);
+int persist_find(const persist_t *p, const char *key);
+
+// read everything from the store. Returns how many keys were there.
+int persist_load(persist_t *p, const persist_store_t *store);
+
+int32_t persist_get(const persist_t *p, int idx);
+bool persist_present(const persist_t *p, int idx);
+
+// RAM only, any task
+void persist_set(persist_t *p, int idx, int32_t v, uint32_t now_ms);
+
+// time to flush?
+bool persist_due(const persist_t *p, uint32_t now_ms);
+
+// write what changed in one commit. Returns keys written, -1 if the store failed
+// ( what didn't make it stays changed, and is tried again after debounce_ms ).
+int persist_flush(persist_t *p, const persist_store_t *store, uint32_t now_ms);
+
+// flush if it's due
+int persist_poll(persist_t *p, const persist_store_t *store, uint32_t now_ms);
+
+void persist_stats_get(const persist_t *p, persist_stats_t *st);
+
+/*
+** NVS, see persist_nvs.cpp
+*/
+
+typedef struct {
+  const char *ns;
+  uint32_t handle;      // nvs_handle_t
+} persist_nvs_t;
+
+void persist_nvs_store(persist_store_t *store, persist_nvs_t *nvs, const char *ns);
+
+// how full the NVS partition is, in 32 byte entries
+typedef struct {
+  uint32_t used;
+  uint32_t free;
+  uint32_t total;
+} persist_nvs_usage_t;
+
+bool persist_nvs_usage_get(persist_nvs_usage_t *u);
@@ -0,0 +1,95 @@
+/*
+ * rest_json.h
+ * Small JSON for the REST interface, without the heap.
+ *
+ * The writer formats into a buffer the caller owns. Give it a flush
+ * function and it hands over the buffer each time it fills, so a whole
+ * document streams out through a few hundred bytes of stack.
+ *
+ * The tokenizer works over the request text in place, filling a caller's
+ * array of tokens ( offsets into the text ), jsmn style. Nothing is copied.
+ *
+ * No ESP-IDF in here, it builds anywhere.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// deepest nesting either side handles
+#define JSON_MAX_DEPTH 16
+
+/*
+** writer
+*/
+
+// return false to stop writing ( the socket went away, say )
+typedef bool (*json_flush_fn)(void *ctx, const char *buf, size_t len);
+
+typedef struct {
+  char *buf;
+  size_t buf_len;
+  size_t off;
+  json_flush_fn flush;    // NULL: everything has to fit in buf
+  void *flush_ctx;
+  bool error;             // didn't fit, or flush failed
+  int depth;
+  uint32_t has_items;     // bit per depth: something already written at this level
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t buf_len, json_flush_fn flush, void *flush_ctx);
+
+// key is NULL inside arrays, and for the outermost value
+void json_obj_begin(json_writer_t *w, const char *key);
+void json_obj_end(json_writer_t *w);
+void json_arr_begin(json_writer_t *w, const char *key);
+void json_arr_end(json_writer_t *w);
+void json_int(json_writer_t *w, const char *key, int64_t value);
+void json_bool(json_writer_t *w, const char *key, bool value);
+void json_str(json_writer_t *w, const char *key, const char *value);
+
+// flushes whatever's left. Returns the length still in buf ( 0 if it was all
+// flushed ), or -1 if anything went wrong along the way.
+int json_writer_finish(json_writer_t *w);
+
+/*
+** tokenizer
+*/
+
+typedef enum {
+  JSON_OBJECT,
+  JSON_ARRAY,
+  JSON_STRING,    // start / end exclude the quotes, escapes are left as is
+  JSON_PRIMITIVE  // number, true, false, null
+} json_type_t;
+
+typedef struct {
+  json_type_t type;
+  int start;      // offset of the first character
+  int end;        // offset one past the last
+  int size;       // direct children; an object's keys and values both count
+} json_tok_t;
+
+#define JSON_ERR_NOMEM -1  // more tokens than max_toks
+#define JSON_ERR_INVAL -2  // not JSON
+#define JSON_ERR_PART -3   // ends in the middle
+
+// returns the number of tokens, or a JSON_ERR
+int json_parse(const char *js, size_t len, json_tok_t *toks, int max_toks);
+
+// index of the token after i and everything inside it
+int json_skip(const json_tok_t *toks, int n_toks, int i);
+
+// index of the value for key in the object at obj, or -1
+int json_obj_get(const char *js, const json_tok_t *toks, int n_toks, int obj, const char *key);
+
+bool json_tok_eq(const char *js, const json_tok_t *tok, const char *s);
+bool json_tok_int(const char *js, const json_tok_t *tok, int *value);
+bool json_tok_bool(const char *js, const json_tok_t *tok, bool *value);
+bool json_tok_float(const char *js, const json_tok_t *tok, float *value);
@@ -475,6 +475,7 @@ class WS2812FX {
       setPixelSegment(uint8_t n);
 
     bool
+      render(void),             //service() without the show, true if it drew anything
       reverseMode = false,      //is the entire LED strip reversed?
       gammaCorrectBri = false,
       gammaCorrectCol = true,
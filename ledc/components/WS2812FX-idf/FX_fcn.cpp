@@ -64,9 +64,15 @@ void WS2812FX::init( uint16_t countPixels, CRGB *leds, bool skipFirst)
 }
 
 void WS2812FX::service() {
+  if (render()) show();
+}
+
+// Runs the effects that are due, into _leds, but leaves showing them to the
+// caller - who might have two of these to mix first.
+bool WS2812FX::render() {
   uint32_t nowUp = millis(); // Be aware, millis() rolls over every 49 days
   now = nowUp + timebase;
-  if (nowUp - _lastShow < MIN_SHOW_DELAY) return;
+  if (nowUp - _lastShow < MIN_SHOW_DELAY) return false;
   bool doShow = false;
 
   for(uint8_t i=0; i < MAX_NUM_SEGMENTS; i++)
@@ -94,9 +100,9 @@ void WS2812FX::service() {
   _virtualSegmentLength = 0;
   if(doShow) {
     yield();
-    show();
   }
   _triggered = false;
+  return doShow;
 }
 
 void WS2812FX::setPixelColor(uint16_t n, uint32_t c) {
@@ -16,6 +16,7 @@
 */
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
@@ -25,6 +26,12 @@
 #include "FastLED.h"
 #include "FX.h"
 
+#include "ledc.h"
+#include "ledc_timesync.h"
+#include "ledc_seq.h"
+#include "ledc_cmd_q.h"
+#include "persist.h"
+
 #include "esp_log.h"
 static const char *TAG = "ledc";
 
@@ -43,6 +50,10 @@ extern const TProgmemPalette16 IRAM_ATTR myRedWhiteBluePalette_p;
 #define LED_TYPE    WS2811
 #define COLOR_ORDER RGB
 
+// frame rate the render loop is paced to. WS2812FX won't show more often
+// than MIN_SHOW_DELAY ( 15ms ) anyway
+#define LEDC_FPS 60
+
 CRGB leds[NUM_LEDS];
 
 
@@ -105,29 +116,370 @@ static void ledc_fastfade(void *pvParameters){
 #endif /* 0 */
 
 WS2812FX *g_ws2812fx = 0;
-bool g_ws2812_mode_random = true;
 
-esp_err_t ledc_led_mode_set(int mode) {
-  ESP_LOGI(TAG,"ledc: set mode %d",mode);
+/*
+** Sequencer
+**
+** Two WS2812FX instances, each drawing into its own buffer. Normally one
+** is live and its buffer is copied to leds[] when it draws. During a
+** transition both run, and leds[] is a blend of the two; at the end the
+** incoming one becomes the live one. So leds[] is only ever the output -
+** effects that read back their last frame still see their own pixels.
+**
+** The playlist is handed over under the wire, so it changes between frames.
+** Setting a mode by hand stops it.
+**
+** Until someone picks a mode or a playlist we cycle through all the modes,
+** which is what this used to do without the fades: two presets looping, and
+** each time one comes up it gets the next mode.
+*/
+
+#define LEDC_CYCLE_DURATION_MS 10000
+#define LEDC_CYCLE_TRANSITION_MS 1000
+
+static ledc_seq_t g_seq;
+static bool g_seq_cycle = true;
+static volatile bool g_seq_stop_req = false;
+static ledc_playlist_t g_seq_pending;
+static bool g_seq_pending_set = false;
+static int64_t g_seq_pending_at = 0;    // when to start it, 0 is next frame
+
+static CRGB g_fx_leds[2][NUM_LEDS];
+
+// microseconds to render ( and blend ) a frame, not counting the show
+static uint32_t g_render_us_max = 0;
+static uint32_t g_fade_render_us_max = 0;
+
+/*
+** Saved settings
+**
+** Mode, speed, palette and brightness, as last set for every segment ( or
+** segment 0 ), so a power cut comes back to them instead of cycling. The
+** render task notes them in RAM as it applies them; once they've settled,
+** the write goes to the flash broker, which lands it between frames. One
+** commit for the lot, however long the slider was dragged.
+*/
+
+#define LEDC_PERSIST_DEBOUNCE_MS 2000
+#define LEDC_PERSIST_MAX_DELAY_MS 15000
+
+enum { LEDC_PERSIST_MODE, LEDC_PERSIST_SPEED, LEDC_PERSIST_PALETTE, LEDC_PERSIST_BRIGHTNESS, LEDC_PERSIST_N };
+
+static persist_entry_t g_ledc_persist_entries[LEDC_PERSIST_N];
+static persist_t g_ledc_persist;
+static persist_nvs_t g_ledc_nvs;
+static persist_store_t g_ledc_store;
+static volatile bool g_ledc_persist_queued = false;
+
+static void ledc_persist_init(void) {
+  persist_nvs_store(&g_ledc_store, &g_ledc_nvs, "ledc");
+  persist_init(&g_ledc_persist, g_ledc_persist_entries, LEDC_PERSIST_N, LEDC_PERSIST_DEBOUNCE_MS, LEDC_PERSIST_MAX_DELAY_MS);
+  // in enum order
+  persist_add(&g_ledc_persist, "mode", FX_MODE_STATIC);
+  persist_add(&g_ledc_persist, "speed", DEFAULT_SPEED);
+  persist_add(&g_ledc_persist, "palette", 0);
+  persist_add(&g_ledc_persist, "brightness", 255);
+  int found = persist_load(&g_ledc_persist, &g_ledc_store);
+  ESP_LOGI(TAG,"ledc: %d saved settings",found);
+}
+
+// on the broker task
+static void ledc_persist_flush_op(void *arg) {
+  int n = persist_flush(&g_ledc_persist, &g_ledc_store, esp_timer_get_time() / 1000);
+  if (n > 0) ESP_LOGI(TAG,"ledc: saved %d settings",n);
+  g_ledc_persist_queued = false;
+}
+
+// once a frame, from the render task
+static void ledc_persist_frame(int64_t now) {
+  if (g_ledc_persist_queued || !persist_due(&g_ledc_persist, now / 1000)) return;
+  g_ledc_persist_queued = true;
+  if (ledc_flash_enqueue(ledc_persist_flush_op, NULL) != ESP_OK) g_ledc_persist_queued = false;
+}
+
+const persist_t *ledc_persist_get(void) {
+  return(&g_ledc_persist);
+}
+
+/*
+** Commands to the render task
+**
+** The setters below get called from the httpd task, while blinkWithFx
+** may be in the middle of service() on the other core. Rather than poke
+** the segments directly and tear a frame, they queue a command, and the
+** render task applies everything queued just before it renders the next
+** frame. The queue is a bounded lock-free ring, see ledc_cmd_q.h, and
+** nobody blocks on it: a full queue is an error back to the caller.
+**
+** The time from enqueue to applied is kept, so we can see UI changes
+** land within a frame.
+*/
+
+static ledc_cmd_q_t g_ledc_cmd_q;
+static bool g_ledc_cmd_ready = false;
 
-  if(g_ws2812fx) {
-      WS2812FX::Segment *segments = g_ws2812fx->getSegments();
-      g_ws2812_mode_random = false;
+// microseconds, enqueue to applied
+static uint32_t g_ledc_cmd_latency_last = 0;
+static uint32_t g_ledc_cmd_latency_max = 0;
+static uint32_t g_ledc_cmd_count = 0;
+
+/*
+** A /rest/state PATCH sets several things at once, and they have to land
+** together, in one frame, or not at all. Between ledc_cmd_batch_begin() and
+** ledc_cmd_batch_end() the setters called from that task collect their
+** commands instead of queueing them, and the end pushes them as one batch
+** with one apply time. Followers are only told once it's in. One batch at
+** a time.
+*/
+
+typedef struct {
+  int cmd;
+  int segment;
+  int value;
+} ledc_cmd_announce_t;
+
+static portMUX_TYPE g_ledc_batch_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t g_ledc_batch_task = NULL;
+static ledc_cmd_t g_ledc_batch[LEDC_CMD_QUEUE_LEN];
+static int g_ledc_batch_n = 0;
+static bool g_ledc_batch_over = false;
+static ledc_cmd_announce_t g_ledc_batch_announce[LEDC_CMD_QUEUE_LEN];
+static int g_ledc_batch_n_announce = 0;
+
+static bool ledc_cmd_batching(void) {
+  return(g_ledc_batch_task != NULL && g_ledc_batch_task == xTaskGetCurrentTaskHandle());
+}
+
+esp_err_t ledc_cmd_batch_begin(void) {
+
+  if (!g_ledc_cmd_ready) return(ESP_ERR_INVALID_STATE);
+
+  esp_err_t err = ESP_OK;
+  portENTER_CRITICAL(&g_ledc_batch_mux);
+  if (g_ledc_batch_task) err = ESP_ERR_INVALID_STATE;
+  else g_ledc_batch_task = xTaskGetCurrentTaskHandle();
+  portEXIT_CRITICAL(&g_ledc_batch_mux);
+  if (err != ESP_OK) return(err);
+
+  g_ledc_batch_n = 0;
+  g_ledc_batch_n_announce = 0;
+  g_ledc_batch_over = false;
+  return(ESP_OK);
+}
+
+// push what was collected, or drop it if !commit. ESP_ERR_INVALID_SIZE if it
+// would never fit, ESP_ERR_NO_MEM if it doesn't fit right now.
+esp_err_t ledc_cmd_batch_end(bool commit) {
+
+  if (!ledc_cmd_batching()) return(ESP_ERR_INVALID_STATE);
+
+  esp_err_t err = ESP_OK;
+
+  // the latest any of them asked for, so none of them goes early
+  int64_t at = 0;
+  for (int i = 0; i < g_ledc_batch_n; i++) {
+    if (g_ledc_batch[i].apply_at > at) at = g_ledc_batch[i].apply_at;
+  }
+  for (int i = 0; i < g_ledc_batch_n; i++) g_ledc_batch[i].apply_at = at;
+
+  if (!commit) {
+    ESP_LOGD(TAG,"ledc: batch of %d dropped",g_ledc_batch_n);
+  }
+  else if (g_ledc_batch_over) {
+    ESP_LOGW(TAG,"ledc: batch of more than %d commands, dropping it",LEDC_CMD_QUEUE_LEN);
+    err = ESP_ERR_INVALID_SIZE;
+  }
+  else if (g_ledc_batch_n && !ledc_cmd_q_push(&g_ledc_cmd_q, g_ledc_batch, g_ledc_batch_n)) {
+    ESP_LOGW(TAG,"ledc: command queue full, dropping batch of %d",g_ledc_batch_n);
+    err = ESP_ERR_NO_MEM;
+  }
+
+  if (commit && err == ESP_OK) {
+    for (int i = 0; i < g_ledc_batch_n_announce; i++) {
+      ledc_cmd_announce_t *a = &g_ledc_batch_announce[i];
+      ledc_sync_announce(a->cmd, a->segment, a->value, at);
+    }
+  }
+
+  portENTER_CRITICAL(&g_ledc_batch_mux);
+  g_ledc_batch_task = NULL;
+  portEXIT_CRITICAL(&g_ledc_batch_mux);
+  return(err);
+}
+
+// tell followers, now or when the batch goes in
+static void ledc_cmd_announce(int cmd, int segment, int value, int64_t apply_at) {
+  if (!ledc_cmd_batching()) {
+    ledc_sync_announce(cmd, segment, value, apply_at);
+    return;
+  }
+  if (g_ledc_batch_n_announce >= LEDC_CMD_QUEUE_LEN) return; // the batch is over anyway
+  ledc_cmd_announce_t *a = &g_ledc_batch_announce[g_ledc_batch_n_announce++];
+  a->cmd = cmd;
+  a->segment = segment;
+  a->value = value;
+}
+
+static esp_err_t ledc_cmd_enqueue_at(ledc_cmd_t *cmd, int64_t apply_at) {
+
+  if (!g_ledc_cmd_ready) return(ESP_ERR_INVALID_STATE);
+
+  cmd->enqueue_time = esp_timer_get_time();
+  cmd->apply_at = apply_at;
+  if (ledc_cmd_batching()) {
+    if (g_ledc_batch_n >= LEDC_CMD_QUEUE_LEN) {
+      g_ledc_batch_over = true;
+      return(ESP_ERR_INVALID_SIZE);
+    }
+    g_ledc_batch[g_ledc_batch_n++] = *cmd;
+    return(ESP_OK);
+  }
+  if (!ledc_cmd_q_push(&g_ledc_cmd_q, cmd, 1)) {
+    ESP_LOGW(TAG,"ledc: command queue full, dropping command %d",cmd->type);
+    return(ESP_ERR_NO_MEM);
+  }
+  return(ESP_OK);
+}
+
+static esp_err_t ledc_cmd_enqueue(ledc_cmd_t *cmd) {
+  return(ledc_cmd_enqueue_at(cmd, 0));
+}
+
+// what every segment, or the first, is set to is what comes back after a restart
+static void ledc_cmd_persist(const ledc_cmd_t *cmd) {
+
+  if (cmd->segment != 0 && cmd->segment != LEDC_SEGMENT_ALL) return;
+
+  int key = -1;
+  switch (cmd->type) {
+    case LEDC_CMD_MODE: key = LEDC_PERSIST_MODE; break;
+    case LEDC_CMD_SPEED: key = LEDC_PERSIST_SPEED; break;
+    case LEDC_CMD_PALETTE: key = LEDC_PERSIST_PALETTE; break;
+    case LEDC_CMD_BRIGHTNESS: key = LEDC_PERSIST_BRIGHTNESS; break;
+    default: break;
+  }
+  if (key >= 0) persist_set(&g_ledc_persist, key, cmd->value, esp_timer_get_time() / 1000);
+}
+
+static void ledc_cmd_apply(WS2812FX *fx, ledc_cmd_t *cmd) {
+
+  WS2812FX::Segment *segments = fx->getSegments();
+  uint8_t first = cmd->segment;
+  uint8_t last = cmd->segment;
+  if (cmd->segment == LEDC_SEGMENT_ALL) {
+    first = 0;
+    last = MAX_NUM_SEGMENTS - 1;
+  }
+  else if (cmd->segment >= MAX_NUM_SEGMENTS) {
+    return;
+  }
+
+  switch (cmd->type) {
+    case LEDC_CMD_MODE:
       // mode has a special setter, unlike many other things
-      for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++)
-      {
-        g_ws2812fx->setMode(i, mode);
+      for (uint8_t i = first; i <= last; i++) {
+        fx->setMode(i, cmd->value);
+      }
+      if (cmd->segment == LEDC_SEGMENT_ALL) {
         segments[0].colors[0] = 0xff0000; // red for testing
       }
+      break;
+    case LEDC_CMD_SPEED:
+      for (uint8_t i = first; i <= last; i++) {
+        segments[i].speed = cmd->value;
+      }
+      break;
+    case LEDC_CMD_COLOR:
+      if (cmd->color.slot >= NUM_COLORS) break;
+      for (uint8_t i = first; i <= last; i++) {
+        segments[i].colors[cmd->color.slot] = cmd->color.color;
+      }
+      break;
+    case LEDC_CMD_PALETTE:
+      for (uint8_t i = first; i <= last; i++) {
+        segments[i].palette = cmd->value;
+      }
+      break;
+    case LEDC_CMD_BRIGHTNESS:
+      fx->setBrightness(cmd->value);
+      break;
+    case LEDC_CMD_SEGMENT:
+      // geometry only makes sense one segment at a time
+      if (cmd->segment == LEDC_SEGMENT_ALL) break;
+      fx->setSegment(cmd->segment, cmd->geometry.start, cmd->geometry.stop,
+                     cmd->geometry.grouping, cmd->geometry.spacing);
+      break;
   }
-  return(ESP_OK);
+}
+
+// called by the render task between frames: apply everything that's waiting.
+// A command with a time in the future ( a synced change ) waits for it, and
+// holds up the ones behind it - they stay in order.
+// During a crossfade both instances get them, the incoming one takes over
+// when it's done and has to have them too.
+static void ledc_cmd_drain(WS2812FX *fx, WS2812FX *incoming) {
+
+  ledc_cmd_t cmd;
+
+  while (ledc_cmd_q_peek(&g_ledc_cmd_q, &cmd)) {
+
+    if (cmd.apply_at && cmd.apply_at > esp_timer_get_time()) break;
+    ledc_cmd_q_pop(&g_ledc_cmd_q);
+
+    ledc_cmd_persist(&cmd);
+    ledc_cmd_apply(fx, &cmd);
+    if (incoming) ledc_cmd_apply(incoming, &cmd);
+
+    uint32_t latency = (uint32_t) (esp_timer_get_time() - cmd.enqueue_time);
+    g_ledc_cmd_latency_last = latency;
+    if (latency > g_ledc_cmd_latency_max) g_ledc_cmd_latency_max = latency;
+    g_ledc_cmd_count++;
+
+    ESP_LOGD(TAG,"ledc: applied command %d after %u us",cmd.type,latency);
+  }
+}
+
+void ledc_cmd_stats_get(uint32_t *count, uint32_t *latency_last_us, uint32_t *latency_max_us) {
+  if (count) *count = g_ledc_cmd_count;
+  if (latency_last_us) *latency_last_us = g_ledc_cmd_latency_last;
+  if (latency_max_us) *latency_max_us = g_ledc_cmd_latency_max;
+}
+
+esp_err_t ledc_led_mode_set(int mode) {
+  return(ledc_segment_mode_set(-1, mode));
+}
+
+// a leader in a sync group schedules changes a moment ahead and tells the
+// followers, who schedule the same change with the _at versions
+esp_err_t ledc_segment_mode_set(int segment, int mode) {
+  int64_t at = ledc_sync_apply_time();
+  esp_err_t err = ledc_segment_mode_set_at(segment, mode, at);
+  if (err == ESP_OK) ledc_cmd_announce(LEDC_SYNC_CMD_MODE, segment, mode, at);
+  return(err);
+}
+
+esp_err_t ledc_segment_mode_set_at(int segment, int mode, int64_t apply_at) {
+  if (mode < 0 || mode >= MODE_COUNT) return(ESP_FAIL);
+  ESP_LOGI(TAG,"ledc: set segment %d mode %d",segment,mode);
+
+  g_seq_stop_req = true;
+
+  ledc_cmd_t cmd;
+  cmd.type = LEDC_CMD_MODE;
+  cmd.segment = segment;
+  cmd.value = mode;
+  return(ledc_cmd_enqueue_at(&cmd, apply_at));
+}
+
+int ledc_led_mode_count(void) {
+  return(MODE_COUNT);
 }
 
 // will get the default mode 0
 int ledc_led_mode_get(void) {
   if (!g_ws2812fx) return(-1);
 
-  ESP_LOGI(TAG,"ledc: get mode %d",g_ws2812fx->getMode());
+  ESP_LOGV(TAG,"ledc: get mode %d",g_ws2812fx->getMode());
 
   return(g_ws2812fx->getMode());
 }
@@ -141,57 +493,352 @@ int ledc_led_mode_get(void) {
 #define SPEED_FACTOR 10
 
 esp_err_t ledc_led_speed_set(int speed) {
+  return(ledc_segment_speed_set(-1, speed));
+}
+
+esp_err_t ledc_segment_speed_set(int segment, int speed) {
+  int64_t at = ledc_sync_apply_time();
+  esp_err_t err = ledc_segment_speed_set_at(segment, speed, at);
+  if (err == ESP_OK) ledc_cmd_announce(LEDC_SYNC_CMD_SPEED, segment, speed, at);
+  return(err);
+}
+
+esp_err_t ledc_segment_speed_set_at(int segment, int speed, int64_t apply_at) {
   speed *= SPEED_FACTOR;
-  ESP_LOGI(TAG,"ledc: set speed %d",speed);
-  if(g_ws2812fx) {
-    WS2812FX::Segment *segments = g_ws2812fx->getSegments();
-    for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++)
-    {
-      segments[i].speed = speed;
-    }
-  }
-  return(ESP_OK);
+  ESP_LOGI(TAG,"ledc: set segment %d speed %d",segment,speed);
+
+  ledc_cmd_t cmd;
+  cmd.type = LEDC_CMD_SPEED;
+  cmd.segment = segment;
+  cmd.value = speed;
+  return(ledc_cmd_enqueue_at(&cmd, apply_at));
 }
 
 // will get the default segment, 0
 int ledc_led_speed_get(void) {  
   if (!g_ws2812fx) return(-1);
-  ESP_LOGI(TAG,"ledc: get speed %d",g_ws2812fx->getSpeed());
+  ESP_LOGV(TAG,"ledc: get speed %d",g_ws2812fx->getSpeed());
   return(g_ws2812fx->getSpeed() / SPEED_FACTOR);
 }
 
+esp_err_t ledc_led_color_set(int segment, int slot, uint32_t color) {
+  return(ledc_segment_color_set_at(segment, slot, color, 0));
+}
 
-static void blinkWithFx(void *pvParameters) {
+esp_err_t ledc_segment_color_set_at(int segment, int slot, uint32_t color, int64_t apply_at) {
+  ESP_LOGI(TAG,"ledc: set segment %d color %d to %06x",segment,slot,color);
+
+  ledc_cmd_t cmd;
+  cmd.type = LEDC_CMD_COLOR;
+  cmd.segment = segment;
+  cmd.color.slot = slot;
+  cmd.color.color = color;
+  return(ledc_cmd_enqueue_at(&cmd, apply_at));
+}
 
-  uint16_t mode = FX_MODE_STATIC;
+esp_err_t ledc_led_palette_set(int segment, int palette) {
+  int64_t at = ledc_sync_apply_time();
+  esp_err_t err = ledc_segment_palette_set_at(segment, palette, at);
+  if (err == ESP_OK) ledc_cmd_announce(LEDC_SYNC_CMD_PALETTE, segment, palette, at);
+  return(err);
+}
 
-  WS2812FX ws2812fx;
-  WS2812FX::Segment *segments = ws2812fx.getSegments();
+esp_err_t ledc_segment_palette_set_at(int segment, int palette, int64_t apply_at) {
+  ESP_LOGI(TAG,"ledc: set segment %d palette %d",segment,palette);
 
+  ledc_cmd_t cmd;
+  cmd.type = LEDC_CMD_PALETTE;
+  cmd.segment = segment;
+  cmd.value = palette;
+  return(ledc_cmd_enqueue_at(&cmd, apply_at));
+}
 
-  ws2812fx.init(NUM_LEDS, leds, false); // type was configured before
-  ws2812fx.setBrightness(255);
-  ws2812fx.setMode(0 /*segid*/, mode);
-  segments[0].colors[0] = 0xff0000;
+esp_err_t ledc_led_brightness_set(int brightness) {
+  if (brightness < 0 || brightness > 255) return(ESP_FAIL);
+  ESP_LOGI(TAG,"ledc: set brightness %d",brightness);
 
-  g_ws2812fx = &ws2812fx;
+  ledc_cmd_t cmd;
+  cmd.type = LEDC_CMD_BRIGHTNESS;
+  cmd.segment = LEDC_SEGMENT_ALL;
+  cmd.value = brightness;
+  return(ledc_cmd_enqueue(&cmd));
+}
 
-  // microseconds
-  uint64_t mode_change_time = esp_timer_get_time();
+int ledc_led_brightness_get(void) {
+  if (!g_ws2812fx) return(-1);
+  return(g_ws2812fx->getBrightness());
+}
+
+static_assert(MAX_NUM_SEGMENTS <= LEDC_SEGMENTS_MAX, "LEDC_SEGMENTS_MAX too small");
+
+int ledc_segments_max(void) {
+  return(MAX_NUM_SEGMENTS);
+}
+
+int ledc_led_count(void) {
+  return(NUM_LEDS);
+}
+
+// a copy of the active segments, for reporting. Read from another task while
+// the render task may be changing them, so one can be a frame stale.
+int ledc_segments_get(ledc_segment_info_t *info, int max_info) {
+  if (!g_ws2812fx) return(0);
+
+  WS2812FX::Segment *segments = g_ws2812fx->getSegments();
+  int n = 0;
+  for (int i = 0; i < MAX_NUM_SEGMENTS && n < max_info; i++) {
+    WS2812FX::Segment *seg = &segments[i];
+    if (!seg->isActive()) continue;
+    ledc_segment_info_t *si = &info[n++];
+    si->id = i;
+    si->start = seg->start;
+    si->stop = seg->stop;
+    si->grouping = seg->grouping;
+    si->spacing = seg->spacing;
+    si->mode = seg->mode;
+    si->speed = seg->speed / SPEED_FACTOR;
+    si->palette = seg->palette;
+    for (int c = 0; c < LEDC_SEGMENT_COLORS; c++) {
+      si->colors[c] = seg->colors[c];
+    }
+  }
+  return(n);
+}
+
+// FastLED's estimate of what the strip draws right now
+uint32_t ledc_power_mw_get(void) {
+  return( calculate_unscaled_power_mW(leds, NUM_LEDS) * FastLED.getBrightness() / 256 );
+}
+
+int ledc_fps_get(void) {
+  return(FastLED.getFPS());
+}
+
+// copy of leds[] as RGB bytes, for the preview. Takes the wire, so it's a whole
+// frame, and only holds it for the copy.
+int ledc_frame_snapshot(uint8_t *buf, size_t buf_len) {
+  size_t len = NUM_LEDS * sizeof(CRGB);
+  if (buf_len < len) return(-1);
+  ledc_flash_frame_begin();
+  memcpy(buf, leds, len);
+  ledc_flash_frame_end();
+  return(len);
+}
+
+esp_err_t ledc_led_segment_set(int segment, int start, int stop, int grouping, int spacing) {
+  if (segment < 0 || segment >= MAX_NUM_SEGMENTS) return(ESP_FAIL);
+  if (start < 0 || stop < 0 || start > NUM_LEDS || stop > NUM_LEDS) return(ESP_FAIL);
+  ESP_LOGI(TAG,"ledc: set segment %d to %d-%d",segment,start,stop);
+
+  ledc_cmd_t cmd;
+  cmd.type = LEDC_CMD_SEGMENT;
+  cmd.segment = segment;
+  cmd.geometry.start = start;
+  cmd.geometry.stop = stop;
+  cmd.geometry.grouping = grouping;
+  cmd.geometry.spacing = spacing;
+  return(ledc_cmd_enqueue(&cmd));
+}
+
+
+// a playlist to start, or an empty one to stop. Taken by the render task next frame.
+esp_err_t ledc_playlist_set(const ledc_playlist_t *pl) {
+  if (pl->n_presets < 0 || pl->n_presets > LEDC_PLAYLIST_MAX) return(ESP_FAIL);
+  for (int i = 0; i < pl->n_presets; i++) {
+    const ledc_preset_t *p = &pl->presets[i];
+    if (p->mode >= MODE_COUNT || p->speed > 25 || p->duration_ms == 0) return(ESP_FAIL);
+  }
+  // a leader starts it a moment from now, and so do its followers
+  int64_t at = ledc_sync_apply_time();
+  ledc_flash_frame_begin();
+  g_seq_pending = *pl;
+  g_seq_pending_set = true;
+  g_seq_pending_at = at;
+  ledc_flash_frame_end();
+  if (pl->n_presets > 0) ledc_sync_announce_preset(&pl->presets[0], at);
+  return(ESP_OK);
+}
+
+void ledc_playlist_get(ledc_playlist_t *pl, ledc_seq_status_t *status) {
+  ledc_flash_frame_begin();
+  *pl = g_seq.playlist;
+  if (!g_seq.running && !g_seq_cycle) pl->n_presets = 0;
+  status->running = g_seq.running && !g_seq_cycle;
+  status->cycling = g_seq.running && g_seq_cycle;
+  status->current = g_seq.current;
+  status->fading = ledc_seq_fading(&g_seq);
+  status->render_us_max = g_render_us_max;
+  status->fade_render_us_max = g_fade_render_us_max;
+  ledc_flash_frame_end();
+}
+
+// set up fx to play a preset, on the same segments as from
+static void ledc_preset_apply(WS2812FX *fx, WS2812FX *from, const ledc_preset_t *p) {
+
+  WS2812FX::Segment *src = from->getSegments();
+  WS2812FX::Segment *segments = fx->getSegments();
+
+  if (fx != from) {
+    for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++) {
+      fx->setSegment(i, src[i].start, src[i].stop, src[i].grouping, src[i].spacing);
+    }
+    if (fx->getBrightness() != from->getBrightness()) fx->setBrightness(from->getBrightness());
+  }
+
+  for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++) {
+    if (!segments[i].isActive()) continue;
+    fx->setMode(i, p->mode);
+    segments[i].speed = p->speed * SPEED_FACTOR;
+    segments[i].palette = p->palette;
+    for (int c = 0; c < LEDC_PRESET_COLORS && c < NUM_COLORS; c++) {
+      segments[i].colors[c] = p->colors[c];
+    }
+  }
+}
+
+static void ledc_cycle_start(int64_t now) {
+  ledc_playlist_t pl;
+  memset(&pl, 0, sizeof(pl));
+  pl.n_presets = 2;
+  pl.loop = true;
+  pl.transition_ms = LEDC_CYCLE_TRANSITION_MS;
+  for (int i = 0; i < 2; i++) {
+    pl.presets[i].mode = FX_MODE_STATIC;
+    pl.presets[i].speed = LEDC_PRESET_SPEED_DEFAULT;
+    pl.presets[i].colors[0] = 0xff0000;
+    pl.presets[i].duration_ms = LEDC_CYCLE_DURATION_MS;
+  }
+  ledc_seq_start(&g_seq, &pl, now);
+  g_seq_cycle = true;
+}
+
+// once a frame, holding the wire: playlist changes, and moving through it.
+// Returns the index of the live instance.
+static int ledc_seq_frame(WS2812FX *fx, int live, int64_t now, bool *stale) {
+
+  if (g_seq_stop_req) {
+    g_seq_stop_req = false;
+    ledc_seq_stop(&g_seq);
+    g_seq_cycle = false;
+  }
+
+  if (g_seq_pending_set && now >= g_seq_pending_at) {
+    g_seq_pending_set = false;
+    ledc_seq_stop(&g_seq);
+    g_seq_cycle = false;
+    if (ledc_seq_start(&g_seq, &g_seq_pending, now)) {
+      ESP_LOGI(TAG,"ledc: playlist of %d presets",g_seq_pending.n_presets);
+      ledc_preset_apply(&fx[live], &fx[live], &g_seq.playlist.presets[0]);
+    }
+  }
+
+  switch (ledc_seq_step(&g_seq, now)) {
+    case LEDC_SEQ_BEGIN: {
+      ledc_preset_t *p = &g_seq.playlist.presets[g_seq.next];
+      if (g_seq_cycle) {
+        p->mode = (g_seq.playlist.presets[g_seq.current].mode + 1) % MODE_COUNT;
+      }
+      ESP_LOGI(TAG,"ledc: fading to preset %d mode %d",g_seq.next,p->mode);
+      ledc_preset_apply(&fx[!live], &fx[live], p);
+      // followers don't fade, they change over as the fade here finishes
+      int64_t at = now + g_seq.playlist.transition_ms * 1000LL;
+      int64_t lead = ledc_sync_apply_time();
+      ledc_sync_announce_preset(p, at > lead ? at : lead);
+      break;
+    }
+    case LEDC_SEQ_FINISH:
+      // brightness might have changed on the old one while it faded
+      if (fx[!live].getBrightness() != fx[live].getBrightness()) fx[!live].setBrightness(fx[live].getBrightness());
+      live = !live;
+      g_ws2812fx = &fx[live];
+      *stale = true;
+      break;
+    default:
+      break;
+  }
+  return(live);
+}
+
+static void blinkWithFx(void *pvParameters) {
+
+  // not on the stack, there's two of them
+  static WS2812FX fx[2];
+  int live = 0;
+  bool stale = true;
+
+  for (int i = 0; i < 2; i++) {
+    fx[i].init(NUM_LEDS, g_fx_leds[i], false); // type was configured before
+    fx[i].setBrightness(255);
+    fx[i].setMode(0 /*segid*/, FX_MODE_STATIC);
+    fx[i].getSegments()[0].colors[0] = 0xff0000;
+  }
+
+  g_ws2812fx = &fx[live];
+
+  ledc_seq_init(&g_seq);
+
+  // back to what it was set to, or cycle if it never was
+  if (persist_present(&g_ledc_persist, LEDC_PERSIST_MODE)) {
+    WS2812FX::Segment *seg = fx[live].getSegments();
+    int mode = persist_get(&g_ledc_persist, LEDC_PERSIST_MODE);
+    if (mode >= 0 && mode < MODE_COUNT) fx[live].setMode(0, mode);
+    seg[0].speed = persist_get(&g_ledc_persist, LEDC_PERSIST_SPEED);
+    seg[0].palette = persist_get(&g_ledc_persist, LEDC_PERSIST_PALETTE);
+    g_seq_cycle = false;
+  }
+  else {
+    ledc_cycle_start(esp_timer_get_time());
+  }
+  fx[live].setBrightness(persist_get(&g_ledc_persist, LEDC_PERSIST_BRIGHTNESS));
 
   while (true) {
 
-    if (g_ws2812_mode_random &&
-        (mode_change_time + 10000000L) < esp_timer_get_time() ) {
-      mode += 1;
-      mode %= MODE_COUNT;
-      mode_change_time = esp_timer_get_time();
-      ws2812fx.setMode(0 /*segid*/, mode);
-      printf(" changed mode to %d\n", mode);
+    // sleeps until the next frame slot, service() will use it if it shows
+    FastLED.waitForFrame();
+
+    // flash operations wait until we're out of here
+    ledc_flash_frame_begin();
+
+    int64_t now = esp_timer_get_time();
+    live = ledc_seq_frame(fx, live, now, &stale);
+
+    // apply any changes from other tasks before rendering
+    ledc_cmd_drain(&fx[live], ledc_seq_fading(&g_seq) ? &fx[!live] : NULL);
+    if (ledc_realtime_active()) {
+      // a show controller is streaming into leds[], just push it out
+      if (ledc_realtime_frame_take()) FastLED.show();
+      // and when it's done, put the effect back
+      stale = true;
+    }
+    else {
+      WS2812FX *cur = &fx[live];
+      // on the leader's clock, if we're following one
+      uint32_t timebase = ledc_sync_timebase();
+      cur->timebase = timebase;
+      bool drawn = cur->render();
+
+      if (ledc_seq_fading(&g_seq)) {
+        // both, every frame, the mix moves even if neither effect does
+        WS2812FX *in = &fx[!live];
+        in->timebase = timebase;
+        in->render();
+        ledc_blend((uint8_t *) leds, (const uint8_t *) g_fx_leds[live], (const uint8_t *) g_fx_leds[!live],
+                   sizeof(leds), ledc_seq_mix(&g_seq, now));
+        uint32_t us = (uint32_t) (esp_timer_get_time() - now);
+        if (us > g_fade_render_us_max) g_fade_render_us_max = us;
+        cur->show();
+      }
+      else if (drawn || stale) {
+        memcpy(leds, g_fx_leds[live], sizeof(leds));
+        uint32_t us = (uint32_t) (esp_timer_get_time() - now);
+        if (us > g_render_us_max) g_render_us_max = us;
+        cur->show();
+      }
+      stale = false;
     }
+    ledc_flash_frame_end();
 
-    ws2812fx.service();
-    vTaskDelay(10 / portTICK_PERIOD_MS); /*10ms*/
+    ledc_persist_frame(now);
   }
 };
 
@@ -247,9 +894,22 @@ static void blinkLeds_simple(void *pvParameters){
 esp_err_t ledc_init(void) {
 
   ESP_LOGI(TAG," entering ledc init, call add leds");
+
+  // flash writes get scheduled between frames
+  ledc_flash_init();
+
+  // before the render task, which starts from what was saved
+  ledc_persist_init();
+
+  // changes from other tasks go through here
+  ledc_cmd_q_init(&g_ledc_cmd_q);
+  g_ledc_cmd_ready = true;
   // the WS2811 family uses the RMT driver
   FastLED.addLeds<LED_TYPE, DATA_PIN>(leds, NUM_LEDS);
 
+  // after addLeds, which constrains it to the driver's max
+  FastLED.setMaxRefreshRate(LEDC_FPS);
+
   // this is a good test because it uses the GPIO ports, these are 4 wire not 3 wire
   //FastLED.addLeds<APA102, 13, 15>(leds, NUM_LEDS);
 
@@ -258,6 +918,10 @@ esp_err_t ledc_init(void) {
   // I have a 2A power supply, although it's 12v
   FastLED.setMaxPowerInVoltsAndMilliamps(12,2000);
 
+  // at low brightness ( and once the power limiter kicks in ) binary dither flickers,
+  // error diffusion carries the lost bits per pixel instead
+  FastLED.setDither(ERROR_DIFFUSION_DITHER);
+
   // change the task below to one of the functions above to try different patterns
   ESP_LOGI(TAG,"create task for led action");
 
@@ -265,5 +929,9 @@ esp_err_t ledc_init(void) {
   //xTaskCreatePinnedToCore(&ledc_fastfade, "blinkLeds", 6144/*stacksize*/, NULL/*pvparam*/, 10/*pri*/, NULL/*taskhandle*/, 1/*coreid*/);
   xTaskCreatePinnedToCore(&blinkWithFx, "blinkLeds", 1024*8 /*stacksize*/, NULL/*pvparam*/, 5 /*pri*/, NULL/*taskhandle*/, 0/*coreid*/);
 
+  // show controllers can take over leds[] over the network
+  ledc_realtime_init((uint8_t *) leds, NUM_LEDS);
+  ledc_sync_init();
+
   return(ESP_OK);
 }
@@ -18,6 +18,121 @@ int ledc_led_mode_get(void);
 esp_err_t ledc_led_speed_set(int mode);
 int ledc_led_speed_get(void);
 
+// segment -1 ( or 0xFF ) means all segments
+esp_err_t ledc_led_color_set(int segment, int slot, uint32_t color);
+esp_err_t ledc_led_palette_set(int segment, int palette);
+esp_err_t ledc_led_segment_set(int segment, int start, int stop, int grouping, int spacing);
+
+esp_err_t ledc_led_brightness_set(int brightness);
+int ledc_led_brightness_get(void);
+
+// per segment versions of mode and speed
+esp_err_t ledc_segment_mode_set(int segment, int mode);
+esp_err_t ledc_segment_speed_set(int segment, int speed);
+
+// the same, applied by the render task at a time ( esp_timer microseconds, 0 is now )
+esp_err_t ledc_segment_mode_set_at(int segment, int mode, int64_t apply_at);
+esp_err_t ledc_segment_speed_set_at(int segment, int speed, int64_t apply_at);
+esp_err_t ledc_segment_palette_set_at(int segment, int palette, int64_t apply_at);
+esp_err_t ledc_segment_color_set_at(int segment, int slot, uint32_t color, int64_t apply_at);
+int ledc_led_mode_count(void);
+
+// one segment, as /rest/state reports it
+#define LEDC_SEGMENT_COLORS 3
+typedef struct {
+  int id;
+  int start;
+  int stop;
+  int grouping;
+  int spacing;
+  int mode;
+  int speed;
+  int palette;
+  uint32_t colors[LEDC_SEGMENT_COLORS];
+} ledc_segment_info_t;
+
+// room for every segment WS2812FX has
+#define LEDC_SEGMENTS_MAX 16
+
+int ledc_segments_max(void);
+int ledc_segments_get(ledc_segment_info_t *info, int max_info);
+
+int ledc_led_count(void);
+uint32_t ledc_power_mw_get(void);
+int ledc_fps_get(void);
+int ledc_frame_snapshot(uint8_t *buf, size_t buf_len);
+
+// setters are queued and applied by the render task between frames
+void ledc_cmd_stats_get(uint32_t *count, uint32_t *latency_last_us, uint32_t *latency_max_us);
+// setters between these land in one frame, or none of them do
+esp_err_t ledc_cmd_batch_begin(void);
+esp_err_t ledc_cmd_batch_end(bool commit);
+
+// flash broker: flash writes run between frames, see ledc_flash.cpp
+#include "ledc_flash_q.h"
+esp_err_t ledc_flash_init(void);
+esp_err_t ledc_flash_enqueue(ledc_flash_op_fn fn, void *arg);
+void ledc_flash_frame_begin(void);
+void ledc_flash_frame_end(void);
+void ledc_flash_stats_get(uint32_t *ops, uint32_t *forced, uint32_t *latency_max_us);
+
+// mode, speed, palette and brightness, saved through the broker. See Persist-idf.
+#include "persist.h"
+const persist_t *ledc_persist_get(void);
+
+// realtime pixel streaming ( DDP, E1.31 ), see ledc_realtime.cpp
+// leds is the leds[] array as bytes. Writes into it are done holding the wire.
+#include "ledc_rtpkt.h"
+
+esp_err_t ledc_realtime_init(uint8_t *leds, int n_leds);
+bool ledc_realtime_active(void);
+bool ledc_realtime_frame_take(void);
+void ledc_realtime_stats_get(ledc_realtime_stats_t *stats);
+
+// playlists, see ledc_seq.h. An empty playlist stops it.
+#include "ledc_seq.h"
+
+typedef struct {
+  bool running;
+  bool cycling;               // no playlist, going through every mode
+  int current;
+  bool fading;
+  uint32_t render_us_max;     // one effect
+  uint32_t fade_render_us_max; // two, and the blend
+} ledc_seq_status_t;
+
+esp_err_t ledc_playlist_set(const ledc_playlist_t *pl);
+void ledc_playlist_get(ledc_playlist_t *pl, ledc_seq_status_t *status);
+
+// multi-board sync: a follower's effects run on the leader's clock, and the
+// leader's mode changes happen everywhere at once. See ledc_sync.cpp.
+typedef enum {
+  LEDC_SYNC_OFF = 0,
+  LEDC_SYNC_LEADER = 1,
+  LEDC_SYNC_FOLLOWER = 2
+} ledc_sync_role_t;
+
+typedef struct {
+  int role;
+  bool synced;
+  int64_t offset_us;     // leader clock minus ours, best estimate
+  int64_t applied_us;    // what the effects use now, slewing toward offset_us
+  int64_t rtt_us;        // round trip of the sample the estimate came from
+  uint32_t samples;
+  uint32_t steps;        // times the clock jumped rather than slewed
+  uint32_t cmds;         // changes sent, or received
+  int64_t leader_age_ms; // since the last beacon, -1 if there's no leader
+} ledc_sync_stats_t;
+
+esp_err_t ledc_sync_init(void);
+int ledc_sync_role_get(void);
+esp_err_t ledc_sync_role_set(int role);
+uint32_t ledc_sync_timebase(void);
+int64_t ledc_sync_apply_time(void);
+void ledc_sync_announce(int cmd, int segment, int value, int64_t apply_at);
+void ledc_sync_announce_preset(const ledc_preset_t *p, int64_t apply_at);
+void ledc_sync_stats_get(ledc_sync_stats_t *stats);
+
 esp_err_t webserver_init(void);
 void webserver_destroy();
 
@@ -0,0 +1,89 @@
+/* LEDC command ring
+
+   Copywrite Brian Bulkowski, 2020
+
+   See ledc_cmd_q.h. Kept free of ESP-IDF so it can be hammered from
+   threads on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "ledc_cmd_q.h"
+
+static_assert((LEDC_CMD_QUEUE_LEN & (LEDC_CMD_QUEUE_LEN - 1)) == 0, "LEDC_CMD_QUEUE_LEN must be a power of two");
+
+#define CELL(q, pos) (&(q)->cells[(pos) & (LEDC_CMD_QUEUE_LEN - 1)])
+
+void ledc_cmd_q_init(ledc_cmd_q_t *q) {
+  for (uint32_t i = 0; i < LEDC_CMD_QUEUE_LEN; i++) {
+    q->cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  q->head = 0;
+  q->tail.store(0, std::memory_order_release);
+}
+
+int ledc_cmd_q_space(ledc_cmd_q_t *q) {
+  uint32_t tail = q->tail.load(std::memory_order_relaxed);
+  // count the slots from the tail on that are free this lap
+  uint32_t pos = tail;
+  int space = 0;
+  while (space < LEDC_CMD_QUEUE_LEN && CELL(q, pos)->seq.load(std::memory_order_acquire) == pos) {
+    space++;
+    pos++;
+  }
+  return(space);
+}
+
+bool ledc_cmd_q_push(ledc_cmd_q_t *q, const ledc_cmd_t *cmds, int n) {
+
+  if (n <= 0 || n > LEDC_CMD_QUEUE_LEN) return(false);
+
+  uint32_t pos = q->tail.load(std::memory_order_relaxed);
+  while (true) {
+    // slots are handed back in order, so if the last one the batch needs
+    // is free this lap, so are the ones before it
+    uint32_t last = pos + n - 1;
+    int32_t diff = (int32_t) (CELL(q, last)->seq.load(std::memory_order_acquire) - last);
+    if (diff == 0) {
+      if (q->tail.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) break;
+      // someone else got in first, pos is reloaded
+    }
+    else if (diff < 0) {
+      return(false); // full
+    }
+    else {
+      pos = q->tail.load(std::memory_order_relaxed);
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    ledc_cmd_cell_t *cell = CELL(q, pos + i);
+    cell->cmd = cmds[i];
+    cell->cmd.batch_left = n - 1 - i;
+    cell->seq.store(pos + i + 1, std::memory_order_release);
+  }
+  return(true);
+}
+
+bool ledc_cmd_q_peek(ledc_cmd_q_t *q, ledc_cmd_t *cmd) {
+
+  ledc_cmd_cell_t *cell = CELL(q, q->head);
+  if (cell->seq.load(std::memory_order_acquire) != q->head + 1) return(false);
+
+  // the whole batch, or wait for the producer to finish publishing it
+  uint8_t left = cell->cmd.batch_left;
+  if (left) {
+    uint32_t last = q->head + left;
+    if (CELL(q, last)->seq.load(std::memory_order_acquire) != last + 1) return(false);
+  }
+
+  *cmd = cell->cmd;
+  return(true);
+}
+
+void ledc_cmd_q_pop(ledc_cmd_q_t *q) {
+  ledc_cmd_cell_t *cell = CELL(q, q->head);
+  cell->seq.store(q->head + LEDC_CMD_QUEUE_LEN, std::memory_order_release);
+  q->head++;
+}
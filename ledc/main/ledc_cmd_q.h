@@ -0,0 +1,89 @@
+/*
+ * ledc_cmd_q.h
+ * Commands to the render task: a bounded, lock-free ring that any task can
+ * push to and the render task alone takes from, between frames.
+ * No ESP-IDF in here, it builds anywhere.
+ *
+ * Every slot carries a sequence number ( the bounded queue from Dmitry
+ * Vyukov ). A producer claims slots by moving the tail on with a
+ * compare-and-swap, fills them, then publishes each by bumping its
+ * sequence. The render task reads a slot once it's published and hands it
+ * back by moving its sequence on a lap. Nobody blocks, nobody takes a lock,
+ * a full ring is an error back to the producer.
+ *
+ * Several commands can go in as a batch: all of them or none, and the render
+ * task won't start on a batch until all of it is published, so a batch lands
+ * in one frame.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <atomic>
+
+// a whole /rest/state PATCH goes in as one batch, up to 7 a segment.
+// A power of two.
+#define LEDC_CMD_QUEUE_LEN 128
+
+// segment number meaning "all of them"
+#define LEDC_SEGMENT_ALL 0xFF
+
+typedef enum {
+  LEDC_CMD_MODE,
+  LEDC_CMD_SPEED,
+  LEDC_CMD_COLOR,
+  LEDC_CMD_PALETTE,
+  LEDC_CMD_BRIGHTNESS,
+  LEDC_CMD_SEGMENT
+} ledc_cmd_type_t;
+
+typedef struct {
+  ledc_cmd_type_t type;
+  uint8_t segment;
+  uint8_t batch_left;   // how many more of its batch follow it, set by the push
+  union {
+    int value;
+    struct {
+      uint8_t slot;
+      uint32_t color;
+    } color;
+    struct {
+      uint16_t start;
+      uint16_t stop;
+      uint8_t grouping;
+      uint8_t spacing;
+    } geometry;
+  };
+  int64_t enqueue_time; // microseconds
+  int64_t apply_at;     // microseconds, 0 is as soon as possible
+} ledc_cmd_t;
+
+typedef struct {
+  std::atomic<uint32_t> seq;  // position + 1 when full, position when free for it
+  ledc_cmd_t cmd;
+} ledc_cmd_cell_t;
+
+typedef struct {
+  ledc_cmd_cell_t cells[LEDC_CMD_QUEUE_LEN];
+  std::atomic<uint32_t> tail; // next position to claim, producers share it
+  uint32_t head;              // next position to take, the render task's alone
+} ledc_cmd_q_t;
+
+void ledc_cmd_q_init(ledc_cmd_q_t *q);
+
+// How many more commands fit right now. Only a hint with several producers.
+int ledc_cmd_q_space(ledc_cmd_q_t *q);
+
+// Push n commands as one batch, from any task. All of them go in, or none
+// do and it returns false.
+bool ledc_cmd_q_push(ledc_cmd_q_t *q, const ledc_cmd_t *cmds, int n);
+
+// The render task: the next command, if it and the rest of its batch are
+// in. Stays at the head until ledc_cmd_q_pop().
+bool ledc_cmd_q_peek(ledc_cmd_q_t *q, ledc_cmd_t *cmd);
+void ledc_cmd_q_pop(ledc_cmd_q_t *q);
@@ -0,0 +1,95 @@
+/* LEDC state deltas
+
+   Copywrite Brian Bulkowski, 2020
+
+   Decides what to push to connected browsers, and keeps the list of them.
+   Kept free of ESP-IDF so the coalescing can be run and checked on a
+   desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "ledc_delta.h"
+
+void ledc_delta_init(ledc_delta_t *d) {
+  memset(d, 0, sizeof(ledc_delta_t));
+  d->have_sent = false;
+}
+
+// append ,"name":value - or {"name":value for the first one
+static int delta_append(char *buf, size_t buf_len, int off, const char *name, int64_t value) {
+  if (off < 0 || (size_t) off >= buf_len) return(-1);
+  int n = snprintf(buf + off, buf_len - off, "%s\"%s\":%" PRId64, off ? "," : "{", name, value);
+  if (n < 0 || (size_t) (off + n) >= buf_len) return(-1);
+  return(off + n);
+}
+
+int ledc_delta_build(ledc_delta_t *d, const ledc_state_t *cur, int64_t now,
+                     char *buf, size_t buf_len) {
+
+  bool full = !d->have_sent;
+  const ledc_state_t *sent = &d->sent;
+
+  if (!full && (now - d->last_push) < LEDC_DELTA_MIN_INTERVAL_US) return(0);
+
+  int off = 0;
+  if (full || cur->led_mode != sent->led_mode)
+    off = delta_append(buf, buf_len, off, "led_mode", cur->led_mode);
+  if (full || cur->led_speed != sent->led_speed)
+    off = delta_append(buf, buf_len, off, "led_speed", cur->led_speed);
+  if (full || cur->brightness != sent->brightness)
+    off = delta_append(buf, buf_len, off, "brightness", cur->brightness);
+  if (full || cur->realtime != sent->realtime)
+    off = delta_append(buf, buf_len, off, "realtime", cur->realtime);
+
+  // clocks ride along with anything else, otherwise only on resync
+  bool clock = full || off > 0 || (now - d->last_clock) >= LEDC_DELTA_CLOCK_RESYNC_US;
+  if (clock) {
+    off = delta_append(buf, buf_len, off, "epoch", (int64_t) cur->epoch);
+    off = delta_append(buf, buf_len, off, "uptime", (int64_t) cur->uptime);
+  }
+
+  if (off <= 0) return(0);
+  if ((size_t) off + 1 >= buf_len) return(0);
+  buf[off++] = '}';
+  buf[off] = 0;
+
+  d->sent = *cur;
+  d->have_sent = true;
+  d->last_push = now;
+  if (clock) d->last_clock = now;
+
+  return(off);
+}
+
+void ledc_push_table_init(ledc_push_table_t *t) {
+  for (int i = 0; i < LEDC_PUSH_MAX_CLIENTS; i++) {
+    t->clients[i].fd = -1;
+    t->clients[i].fresh = false;
+  }
+  t->n_clients = 0;
+}
+
+ledc_push_client_t *ledc_push_client_add(ledc_push_table_t *t, int fd) {
+  for (int i = 0; i < LEDC_PUSH_MAX_CLIENTS; i++) {
+    ledc_push_client_t *client = &t->clients[i];
+    if (client->fd >= 0) continue;
+    client->fd = fd;
+    client->fresh = true;
+    t->n_clients++;
+    return(client);
+  }
+  return(NULL);
+}
+
+void ledc_push_client_drop(ledc_push_table_t *t, ledc_push_client_t *client) {
+  if (client->fd < 0) return;
+  client->fd = -1;
+  client->fresh = false;
+  t->n_clients--;
+}
@@ -0,0 +1,71 @@
+/*
+ * ledc_delta.h
+ * What the UI shows, which parts of it changed since we last told the
+ * browsers, and the browsers we tell. No ESP-IDF in here, it builds
+ * anywhere.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// pushes are coalesced: at most one every this long
+#define LEDC_DELTA_MIN_INTERVAL_US (200 * 1000LL)
+
+// the browser ticks the clocks itself, we just correct it now and then
+#define LEDC_DELTA_CLOCK_RESYNC_US (30 * 1000000LL)
+
+typedef struct {
+  int led_mode;
+  int led_speed;
+  int brightness;
+  int realtime;
+  uint64_t epoch;   // seconds
+  uint64_t uptime;  // seconds
+} ledc_state_t;
+
+typedef struct {
+  ledc_state_t sent;     // what the browsers have
+  bool have_sent;
+  int64_t last_push;     // microseconds
+  int64_t last_clock;    // microseconds
+} ledc_delta_t;
+
+void ledc_delta_init(ledc_delta_t *d);
+
+// Writes a JSON object holding only the fields of cur that differ from what
+// was last sent, and remembers cur as sent. Returns the length, or 0 when
+// there's nothing to send yet - nothing changed, or the last push was too
+// recent ( the change stays pending and goes out on a later call ).
+// A freshly initialized ledc_delta_t produces everything: a full snapshot.
+int ledc_delta_build(ledc_delta_t *d, const ledc_state_t *cur, int64_t now,
+                     char *buf, size_t buf_len);
+
+// the most browsers pushed to at once, one websocket each. ledc_server.cpp
+// checks the server has sockets to spare for them.
+#ifndef LEDC_PUSH_MAX_CLIENTS
+#define LEDC_PUSH_MAX_CLIENTS 6
+#endif
+
+typedef struct {
+  int fd;        // -1 is a free slot
+  bool fresh;    // needs the full snapshot
+} ledc_push_client_t;
+
+typedef struct {
+  ledc_push_client_t clients[LEDC_PUSH_MAX_CLIENTS];
+  volatile int n_clients;   // read without the lock, to skip pushing to nobody
+} ledc_push_table_t;
+
+void ledc_push_table_init(ledc_push_table_t *t);
+
+// A new client, wanting the full snapshot. NULL if the table's full.
+ledc_push_client_t *ledc_push_client_add(ledc_push_table_t *t, int fd);
+
+void ledc_push_client_drop(ledc_push_table_t *t, ledc_push_client_t *client);
@@ -0,0 +1,133 @@
+/* LEDC flash broker
+
+   Copywrite Brian Bulkowski, 2020
+
+   Writing to flash ( NVS commits, mostly ) stops the cache on both cores
+   for as long as the erase or write takes. If that lands in the middle of
+   pushing out a frame, the frame glitches. FASTLED_ESP32_FLASH_LOCK goes the
+   other way and holds the flash lock for the whole transmission, which stalls
+   every flash user for most of every frame.
+
+   Instead, anyone who wants to touch flash hands the work to this broker.
+   The render task holds the "wire" mutex while it renders and shows a frame,
+   and the broker task only runs flash work while it holds the same mutex - so
+   flash operations land in the gap between frames, and the next show waits for
+   at most one operation.
+
+   Latency is bounded: the render task only holds the wire for one frame, so
+   the broker gets it within a frame time. If it can't get it within
+   LEDC_FLASH_MAX_LATENCY_US ( render task stuck, say ) the operation runs
+   anyway, accepting a glitch rather than losing the write.
+
+   The queue and that decision are in ledc_flash_q.cpp, which test/ runs
+   against a simulated render loop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+
+#include "esp_log.h"
+static const char *TAG = "ledc_flash";
+
+#include "ledc.h"
+#include "ledc_flash_q.h"
+
+// the queue, and the stats in it, are shared with whoever enqueues
+static ledc_flash_q_t g_flash_q;
+static portMUX_TYPE g_flash_mux = portMUX_INITIALIZER_UNLOCKED;
+// counts the operations in g_flash_q, the broker sleeps on it
+static SemaphoreHandle_t g_flash_pending = NULL;
+static SemaphoreHandle_t g_wire_mutex = NULL;
+
+static void ledc_flash_task(void *pvParameters) {
+
+  ledc_flash_op_t op;
+
+  while (true) {
+
+    if (xSemaphoreTake(g_flash_pending, portMAX_DELAY) != pdTRUE) continue;
+
+    portENTER_CRITICAL(&g_flash_mux);
+    bool have_op = ledc_flash_q_pop(&g_flash_q, &op);
+    portEXIT_CRITICAL(&g_flash_mux);
+    if (!have_op) continue;
+
+    // wait for the gap between frames, but not forever
+    int64_t wait_us = ledc_flash_q_wait_us(&op, esp_timer_get_time());
+    TickType_t wait_ticks = (wait_us / 1000) / portTICK_PERIOD_MS;
+    bool have_wire = ( xSemaphoreTake(g_wire_mutex, wait_ticks) == pdTRUE );
+
+    op.fn(op.arg);
+
+    if (have_wire) xSemaphoreGive(g_wire_mutex);
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&g_flash_mux);
+    ledc_flash_q_done(&g_flash_q, &op, now, have_wire);
+    portEXIT_CRITICAL(&g_flash_mux);
+
+    ESP_LOGD(TAG, "flash op ran after %lld us%s", now - op.enqueue_time, have_wire ? "" : " (forced, no gap)");
+  }
+}
+
+// queue a flash operation. fn runs later, on the broker task, with arg.
+// Fails if the queue is full - callers should treat that like a failed write.
+esp_err_t ledc_flash_enqueue(ledc_flash_op_fn fn, void *arg) {
+
+  if (!g_flash_pending) return(ESP_ERR_INVALID_STATE);
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&g_flash_mux);
+  bool queued = ledc_flash_q_push(&g_flash_q, fn, arg, now);
+  portEXIT_CRITICAL(&g_flash_mux);
+
+  if (!queued) {
+    ESP_LOGW(TAG, "flash queue full, dropping operation");
+    return(ESP_ERR_NO_MEM);
+  }
+  xSemaphoreGive(g_flash_pending);
+  return(ESP_OK);
+}
+
+// the render task brackets each frame with these
+void ledc_flash_frame_begin(void) {
+  if (g_wire_mutex) xSemaphoreTake(g_wire_mutex, portMAX_DELAY);
+}
+
+void ledc_flash_frame_end(void) {
+  if (g_wire_mutex) xSemaphoreGive(g_wire_mutex);
+}
+
+void ledc_flash_stats_get(uint32_t *ops, uint32_t *forced, uint32_t *latency_max_us) {
+  portENTER_CRITICAL(&g_flash_mux);
+  if (ops) *ops = g_flash_q.ops_run;
+  if (forced) *forced = g_flash_q.forced;
+  if (latency_max_us) *latency_max_us = (uint32_t) g_flash_q.latency_max;
+  portEXIT_CRITICAL(&g_flash_mux);
+}
+
+esp_err_t ledc_flash_init(void) {
+
+  ledc_flash_q_init(&g_flash_q);
+  g_wire_mutex = xSemaphoreCreateMutex();
+  g_flash_pending = xSemaphoreCreateCounting(LEDC_FLASH_QUEUE_LEN, 0);
+  if (!g_wire_mutex || !g_flash_pending) {
+    ESP_LOGE(TAG, "could not create flash broker queue or mutex");
+    return(ESP_FAIL);
+  }
+
+  // same core as the render task, so "the gap" is real - lower priority, so it
+  // never preempts a frame that's being rendered
+  xTaskCreatePinnedToCore(&ledc_flash_task, "ledc_flash", 4096 /*stacksize*/, NULL/*pvparam*/, 4 /*pri*/, NULL/*taskhandle*/, 0/*coreid*/);
+
+  return(ESP_OK);
+}
@@ -0,0 +1,58 @@
+/* LEDC flash broker queue
+
+   Copywrite Brian Bulkowski, 2020
+
+   See ledc_flash_q.h. Kept free of ESP-IDF so the broker's scheduling can be
+   run against a simulated render loop on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "ledc_flash_q.h"
+
+void ledc_flash_q_init(ledc_flash_q_t *q) {
+  memset(q, 0, sizeof(ledc_flash_q_t));
+}
+
+bool ledc_flash_q_push(ledc_flash_q_t *q, ledc_flash_op_fn fn, void *arg, int64_t now) {
+
+  if (q->count == LEDC_FLASH_QUEUE_LEN) {
+    q->dropped++;
+    return(false);
+  }
+
+  ledc_flash_op_t *op = &q->ops[(q->head + q->count) % LEDC_FLASH_QUEUE_LEN];
+  op->fn = fn;
+  op->arg = arg;
+  op->enqueue_time = now;
+  q->count++;
+  return(true);
+}
+
+bool ledc_flash_q_pop(ledc_flash_q_t *q, ledc_flash_op_t *op) {
+
+  if (q->count == 0) return(false);
+
+  *op = q->ops[q->head];
+  q->head = (q->head + 1) % LEDC_FLASH_QUEUE_LEN;
+  q->count--;
+  return(true);
+}
+
+int64_t ledc_flash_q_wait_us(const ledc_flash_op_t *op, int64_t now) {
+
+  int64_t waited = now - op->enqueue_time;
+  if (waited >= LEDC_FLASH_MAX_LATENCY_US) return(0);
+  return(LEDC_FLASH_MAX_LATENCY_US - waited);
+}
+
+void ledc_flash_q_done(ledc_flash_q_t *q, const ledc_flash_op_t *op, int64_t now, bool in_gap) {
+
+  int64_t latency = now - op->enqueue_time;
+  if (latency > q->latency_max) q->latency_max = latency;
+  if (!in_gap) q->forced++;
+  q->ops_run++;
+}
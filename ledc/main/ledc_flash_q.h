@@ -0,0 +1,59 @@
+/*
+ * ledc_flash_q.h
+ * The flash broker's queue, and when an operation in it gets to run.
+ * No ESP-IDF in here, it builds anywhere. ledc_flash.cpp wraps it in a
+ * lock, a task and the wire mutex.
+ *
+ * Operations run in the order they were queued. Each one waits for the gap
+ * between frames - the render task not holding the wire - but only until
+ * LEDC_FLASH_MAX_LATENCY_US after it was queued. Then it runs anyway, in
+ * the middle of a frame if it has to: a glitch beats a lost write.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// how many flash operations can be waiting
+#define LEDC_FLASH_QUEUE_LEN 8
+
+// longest an operation waits for a gap before it runs anyway
+#define LEDC_FLASH_MAX_LATENCY_US (100 * 1000)
+
+typedef void (*ledc_flash_op_fn)(void *arg);
+
+typedef struct {
+  ledc_flash_op_fn fn;
+  void *arg;
+  int64_t enqueue_time; // microseconds
+} ledc_flash_op_t;
+
+typedef struct {
+  ledc_flash_op_t ops[LEDC_FLASH_QUEUE_LEN];
+  int head;             // oldest
+  int count;
+  // stats
+  uint32_t ops_run;
+  uint32_t forced;      // ran without a gap
+  uint32_t dropped;     // queue was full
+  int64_t latency_max;  // microseconds, queued to done
+} ledc_flash_q_t;
+
+void ledc_flash_q_init(ledc_flash_q_t *q);
+
+// queue fn(arg) at time now. false if the queue is full, which counts as dropped
+bool ledc_flash_q_push(ledc_flash_q_t *q, ledc_flash_op_fn fn, void *arg, int64_t now);
+
+// take the oldest operation. false if there isn't one
+bool ledc_flash_q_pop(ledc_flash_q_t *q, ledc_flash_op_t *op);
+
+// how much longer, at now, op may wait for a gap. 0 means run it now, gap or not
+int64_t ledc_flash_q_wait_us(const ledc_flash_op_t *op, int64_t now);
+
+// op finished at now. in_gap is whether it had the wire
+void ledc_flash_q_done(ledc_flash_q_t *q, const ledc_flash_op_t *op, int64_t now, bool in_gap);
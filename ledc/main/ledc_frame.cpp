@@ -0,0 +1,184 @@
+/* LEDC frame preview encoding
+
+   Copywrite Brian Bulkowski, 2020
+
+   See ledc_frame.h for the format. Kept free of ESP-IDF so the encoder and
+   decoder can be run against each other on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "ledc_frame.h"
+
+#define RUN_MAX 128
+#define RUN_LITERAL 0x80
+
+// a literal only stops for a zero run this long - shorter ones cost more
+// as a skip than as literal bytes
+#define RUN_SKIP_MIN 3
+
+size_t ledc_frame_max_len(int n_leds) {
+  size_t n = n_leds * 3;
+  return( LEDC_FRAME_HEADER_LEN + n + (n + RUN_MAX - 1) / RUN_MAX );
+}
+
+void ledc_frame_enc_init(ledc_frame_enc_t *enc, uint8_t *prev, int n_leds) {
+  memset(enc, 0, sizeof(ledc_frame_enc_t));
+  enc->prev = prev;
+  enc->n_leds = n_leds;
+  enc->need_key = true;
+}
+
+void ledc_frame_enc_reset(ledc_frame_enc_t *enc) {
+  enc->need_key = true;
+}
+
+static void frame_header(uint8_t *out, uint8_t type, uint16_t seq, int n_leds) {
+  out[0] = type;
+  out[1] = 0;
+  out[2] = seq & 0xFF;
+  out[3] = seq >> 8;
+  out[4] = n_leds & 0xFF;
+  out[5] = (n_leds >> 8) & 0xFF;
+}
+
+// the runs for cur XOR prev, prev NULL being all zeros. Returns the length, 0 if
+// there's nothing to say, -1 if out is too small
+static int frame_runs(const uint8_t *cur, const uint8_t *prev, int n, uint8_t *out, size_t out_len) {
+
+#define X(i) ( prev ? (cur[i] ^ prev[i]) : cur[i] )
+
+  size_t off = 0;
+  int i = 0;
+
+  while (i < n) {
+
+    // unchanged bytes
+    int z = 0;
+    while (i + z < n && X(i + z) == 0) z++;
+    if (i + z == n) break; // nothing more changed
+    while (z > 0) {
+      int run = z < RUN_MAX ? z : RUN_MAX;
+      if (off + 1 > out_len) return(-1);
+      out[off++] = run - 1;
+      i += run;
+      z -= run;
+    }
+
+    // changed bytes, up to the next zero run worth skipping
+    int l = 0;
+    while (i + l < n && l < RUN_MAX) {
+      if (X(i + l) == 0) {
+        int zz = 0;
+        while (i + l + zz < n && zz < RUN_SKIP_MIN && X(i + l + zz) == 0) zz++;
+        if (zz == RUN_SKIP_MIN || i + l + zz == n) break;
+      }
+      l++;
+    }
+    if (off + 1 + l > out_len) return(-1);
+    out[off++] = RUN_LITERAL | (l - 1);
+    for (int j = 0; j < l; j++) out[off++] = X(i + j);
+    i += l;
+  }
+
+#undef X
+
+  return(off);
+}
+
+int ledc_frame_encode_key(const uint8_t *cur, int n_leds, uint16_t seq, uint8_t *out, size_t out_len) {
+
+  if (out_len < LEDC_FRAME_HEADER_LEN) return(-1);
+  frame_header(out, LEDC_FRAME_KEY, seq, n_leds);
+  int len = frame_runs(cur, NULL, n_leds * 3, out + LEDC_FRAME_HEADER_LEN, out_len - LEDC_FRAME_HEADER_LEN);
+  if (len < 0) return(-1);
+  return(LEDC_FRAME_HEADER_LEN + len);
+}
+
+int ledc_frame_encode(ledc_frame_enc_t *enc, const uint8_t *cur, uint8_t *out, size_t out_len) {
+
+  int n = enc->n_leds * 3;
+  bool key = enc->need_key || enc->since_key >= LEDC_FRAME_KEY_INTERVAL;
+  int len;
+
+  if (out_len < LEDC_FRAME_HEADER_LEN) return(-1);
+
+  if (key) {
+    len = ledc_frame_encode_key(cur, enc->n_leds, enc->seq + 1, out, out_len);
+    if (len < 0) return(-1);
+  }
+  else {
+    len = frame_runs(cur, enc->prev, n, out + LEDC_FRAME_HEADER_LEN, out_len - LEDC_FRAME_HEADER_LEN);
+    if (len < 0) return(-1);
+    // same as last time, don't bother
+    if (len == 0) return(0);
+    frame_header(out, LEDC_FRAME_DELTA, enc->seq + 1, enc->n_leds);
+    len += LEDC_FRAME_HEADER_LEN;
+  }
+
+  memcpy(enc->prev, cur, n);
+  enc->seq++;
+  enc->frames++;
+  enc->raw_bytes += n;
+  enc->sent_bytes += len;
+  if (key) {
+    enc->keys++;
+    enc->since_key = 0;
+    enc->need_key = false;
+  }
+  else {
+    enc->since_key++;
+  }
+  return(len);
+}
+
+int ledc_frame_decode(uint8_t *frame, int n_leds, uint16_t *seq, bool *have_key,
+                      const uint8_t *in, size_t in_len) {
+
+  if (in_len < LEDC_FRAME_HEADER_LEN) return(-1);
+
+  uint8_t type = in[0];
+  uint16_t in_seq = in[2] | (in[3] << 8);
+  int in_leds = in[4] | (in[5] << 8);
+  if (in_leds != n_leds) return(-1);
+
+  int n = n_leds * 3;
+
+  if (type == LEDC_FRAME_KEY) {
+    memset(frame, 0, n);
+  }
+  else if (type == LEDC_FRAME_DELTA) {
+    if (!*have_key || in_seq != (uint16_t) (*seq + 1)) {
+      *have_key = false;
+      return(-1);
+    }
+  }
+  else {
+    return(-1);
+  }
+
+  // a bad frame leaves a partial one behind, so insist on a keyframe after
+  *have_key = false;
+
+  size_t off = LEDC_FRAME_HEADER_LEN;
+  int i = 0;
+  while (off < in_len) {
+    uint8_t c = in[off++];
+    int run = (c & ~RUN_LITERAL) + 1;
+    if (i + run > n) return(-1);
+    if (c & RUN_LITERAL) {
+      if (off + run > in_len) return(-1);
+      for (int j = 0; j < run; j++) frame[i + j] ^= in[off + j];
+      off += run;
+    }
+    i += run;
+  }
+
+  *have_key = true;
+  *seq = in_seq;
+  return(0);
+}
@@ -0,0 +1,75 @@
+/*
+ * ledc_frame.h
+ * Compact binary copies of leds[], for the live preview in the browser.
+ * No ESP-IDF in here, it builds anywhere.
+ *
+ * A frame is a 6 byte header, then runs:
+ *
+ *   byte 0    'K' keyframe, or 'D' delta against the frame before it
+ *   byte 1    0, for now
+ *   bytes 2-3 sequence, little endian, one more than the last frame sent
+ *   bytes 4-5 number of leds, little endian
+ *
+ * The body is the frame XOR'd with the one before ( with zeros, for a
+ * keyframe ), run length coded. Each run starts with a byte c:
+ *
+ *   c < 0x80   skip c+1 bytes, they didn't change
+ *   c >= 0x80  (c & 0x7F)+1 bytes follow, XOR them in
+ *
+ * Bytes past the last run didn't change. Effects that only move a few
+ * pixels, or that sit still, come out tiny.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LEDC_FRAME_HEADER_LEN 6
+#define LEDC_FRAME_KEY 'K'
+#define LEDC_FRAME_DELTA 'D'
+
+// a keyframe goes out at least this often, counted in frames sent
+#define LEDC_FRAME_KEY_INTERVAL 50
+
+typedef struct {
+  uint8_t *prev;      // what the browsers have, n_leds * 3 bytes
+  int n_leds;
+  uint16_t seq;
+  bool need_key;
+  int since_key;      // frames sent since the last keyframe
+  // stats
+  uint32_t frames;
+  uint32_t keys;
+  uint32_t raw_bytes;   // what sending every frame whole would have cost
+  uint32_t sent_bytes;
+} ledc_frame_enc_t;
+
+// largest encoded frame for this many leds
+size_t ledc_frame_max_len(int n_leds);
+
+// prev is n_leds * 3 bytes the encoder keeps. The first frame is a keyframe.
+void ledc_frame_enc_init(ledc_frame_enc_t *enc, uint8_t *prev, int n_leds);
+
+// the next frame is a keyframe, say because a browser just showed up
+void ledc_frame_enc_reset(ledc_frame_enc_t *enc);
+
+// Encodes cur ( n_leds * 3 RGB bytes ) against what was last sent, and
+// remembers it as sent. Returns the length; 0 when nothing changed and
+// there's no need to send anything; -1 if out is too small.
+int ledc_frame_encode(ledc_frame_enc_t *enc, const uint8_t *cur, uint8_t *out, size_t out_len);
+
+// a keyframe on its own, for someone who asked for one frame
+int ledc_frame_encode_key(const uint8_t *cur, int n_leds, uint16_t seq, uint8_t *out, size_t out_len);
+
+// The other end. frame is n_leds * 3 bytes, and holds the last frame decoded;
+// *seq is its sequence. A delta that doesn't follow on from *seq can't be
+// applied. Returns 0, or -1 for a frame that's bad or out of order - wait
+// for the next keyframe.
+int ledc_frame_decode(uint8_t *frame, int n_leds, uint16_t *seq, bool *have_key,
+                      const uint8_t *in, size_t in_len);
@@ -0,0 +1,177 @@
+/* LEDC realtime pixel streaming
+
+   Copywrite Brian Bulkowski, 2020
+
+   Lets a show controller on the network ( xLights, a PC, another node ) drive
+   leds[] directly, instead of the built in effects. DDP on port 4048, and
+   E1.31 / sACN on port 5568, both UDP. The packets themselves, and when a
+   frame is whole and can be shown, are in ledc_rtpkt.cpp.
+
+   Packets are parsed in place in the receive buffer and the RGB bytes copied
+   straight into the leds[] slice they cover - no intermediate frame. That
+   happens holding the wire, so it never races a show.
+
+   While packets are arriving we're "live": the render task stops calling
+   WS2812FX service() and shows leds[] each time a whole frame is in. If
+   nothing arrives for LEDC_REALTIME_TIMEOUT_MS, or an E1.31 source says it's
+   terminating, the effects take over again.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+
+#include "lwip/sockets.h"
+
+#include "esp_log.h"
+static const char *TAG = "ledc_realtime";
+
+#include "ledc.h"
+#include "ledc_rtpkt.h"
+
+// effects come back after this long without a packet
+#define LEDC_REALTIME_TIMEOUT_MS 2500
+
+// big enough for a full E1.31 packet, and for a DDP packet of 480 pixels
+#define LEDC_REALTIME_BUF_SZ 1460
+
+// microseconds, time of the last packet that had pixels in it
+static volatile int64_t g_rt_last_packet = 0;
+static volatile bool g_rt_active = false;
+// set when leds[] has a new frame the render task hasn't shown yet
+static volatile bool g_rt_dirty = false;
+
+// parser state, and the stats. Only the realtime task touches it
+static ledc_rt_t g_rt;
+
+static uint8_t g_rt_buf[LEDC_REALTIME_BUF_SZ];
+
+// what a packet meant
+static void ledc_realtime_result(ledc_rt_result_t r) {
+
+  switch (r) {
+    case LEDC_RT_NONE:
+      return;
+    case LEDC_RT_TERMINATED:
+      ESP_LOGI(TAG, "realtime: e1.31 source terminated");
+      g_rt_active = false;
+      return;
+    case LEDC_RT_SHOW:
+      g_rt_dirty = true;
+      // fall through
+    case LEDC_RT_DATA:
+      g_rt_last_packet = esp_timer_get_time();
+      if (!g_rt_active) {
+        ESP_LOGI(TAG, "realtime: going live");
+        g_rt_active = true;
+      }
+      return;
+  }
+}
+
+static int ledc_realtime_socket(uint16_t port) {
+
+  int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s < 0) {
+    ESP_LOGE(TAG, "realtime: could not create socket for port %d", port);
+    return(-1);
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    ESP_LOGE(TAG, "realtime: could not bind port %d", port);
+    close(s);
+    return(-1);
+  }
+  return(s);
+}
+
+static void ledc_realtime_task(void *pvParameters) {
+
+  int ddp_s = ledc_realtime_socket(DDP_PORT);
+  int e131_s = ledc_realtime_socket(E131_PORT);
+  if (ddp_s < 0 && e131_s < 0) {
+    vTaskDelete(NULL);
+    return;
+  }
+  int max_s = ddp_s > e131_s ? ddp_s : e131_s;
+
+  while (true) {
+
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    if (ddp_s >= 0) FD_SET(ddp_s, &rfds);
+    if (e131_s >= 0) FD_SET(e131_s, &rfds);
+
+    // wake up now and then to notice the timeout
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 500000 };
+    int n = select(max_s + 1, &rfds, NULL, NULL, &tv);
+
+    if (n > 0) {
+      if (ddp_s >= 0 && FD_ISSET(ddp_s, &rfds)) {
+        int len = recv(ddp_s, g_rt_buf, sizeof(g_rt_buf), 0);
+        if (len > 0) {
+          ledc_flash_frame_begin();
+          ledc_rt_result_t r = ledc_rt_ddp(&g_rt, g_rt_buf, len);
+          ledc_flash_frame_end();
+          ledc_realtime_result(r);
+        }
+      }
+      if (e131_s >= 0 && FD_ISSET(e131_s, &rfds)) {
+        int len = recv(e131_s, g_rt_buf, sizeof(g_rt_buf), 0);
+        if (len > 0) {
+          ledc_flash_frame_begin();
+          ledc_rt_result_t r = ledc_rt_e131(&g_rt, g_rt_buf, len);
+          ledc_flash_frame_end();
+          ledc_realtime_result(r);
+        }
+      }
+    }
+
+    if (g_rt_active &&
+        (esp_timer_get_time() - g_rt_last_packet) > (LEDC_REALTIME_TIMEOUT_MS * 1000LL)) {
+      ESP_LOGI(TAG, "realtime: no packets for %d ms, back to effects", LEDC_REALTIME_TIMEOUT_MS);
+      g_rt_active = false;
+      ledc_rt_idle(&g_rt);
+    }
+  }
+}
+
+// the render task asks each frame. True means skip the effects.
+bool ledc_realtime_active(void) {
+  return(g_rt_active);
+}
+
+// true if leds[] has changed since the last call; called with the wire held
+bool ledc_realtime_frame_take(void) {
+  if (!g_rt_dirty) return(false);
+  g_rt_dirty = false;
+  return(true);
+}
+
+// a copy made while the realtime task may be writing it, so a count can be one off
+void ledc_realtime_stats_get(ledc_realtime_stats_t *stats) {
+  *stats = g_rt.stats;
+}
+
+esp_err_t ledc_realtime_init(uint8_t *leds, int n_leds) {
+
+  ledc_rt_init(&g_rt, leds, n_leds);
+
+  // other core from the render task, so a burst of packets doesn't cost frames
+  xTaskCreatePinnedToCore(&ledc_realtime_task, "ledc_realtime", 4096 /*stacksize*/, NULL/*pvparam*/, 5 /*pri*/, NULL/*taskhandle*/, 1/*coreid*/);
+
+  return(ESP_OK);
+}
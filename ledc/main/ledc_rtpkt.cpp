@@ -0,0 +1,259 @@
+/* LEDC realtime packets
+
+   Copywrite Brian Bulkowski, 2020
+
+   See ledc_rtpkt.h. Kept free of ESP-IDF so a packet generator on a desktop
+   can drive it over localhost.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "ledc_rtpkt.h"
+
+static const uint8_t e131_acn_id[12] = { 'A','S','C','-','E','1','.','1','7',0,0,0 };
+
+#define BIT_SET(m, i) ((m)[(i) >> 5] |= (1u << ((i) & 31)))
+#define BIT_CLR(m, i) ((m)[(i) >> 5] &= ~(1u << ((i) & 31)))
+#define BIT_GET(m, i) (((m)[(i) >> 5] >> ((i) & 31)) & 1)
+
+static inline uint16_t get_be16(const uint8_t *p) {
+  return( (p[0] << 8) | p[1] );
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+  return( ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] );
+}
+
+void ledc_rt_init(ledc_rt_t *rt, uint8_t *leds, int n_leds) {
+  memset(rt, 0, sizeof(ledc_rt_t));
+  rt->leds = leds;
+  rt->n_leds = n_leds;
+  rt->n_universes = (n_leds + E131_PIXELS_PER_UNIVERSE - 1) / E131_PIXELS_PER_UNIVERSE;
+  if (rt->n_universes > LEDC_E131_UNIVERSES) rt->n_universes = LEDC_E131_UNIVERSES;
+  for (int i = 0; i < LEDC_E131_UNIVERSES; i++) rt->e131_last_seq[i] = -1;
+  ledc_rt_idle(rt);
+}
+
+void ledc_rt_idle(ledc_rt_t *rt) {
+  memset(rt->e131_seen, 0, sizeof(rt->e131_seen));
+  memset(rt->e131_have, 0, sizeof(rt->e131_have));
+  memset(rt->e131_missed, 0, sizeof(rt->e131_missed));
+  for (int i = 0; i < LEDC_E131_UNIVERSES; i++) rt->e131_shown_seq[i] = -1;
+  rt->e131_last = -1;
+  rt->e131_learned = false;
+  rt->e131_sync = 0;
+  rt->e131_pending = false;
+}
+
+// copy bytes into the leds, starting at a byte offset. Clips to the strip.
+static void ledc_rt_copy(ledc_rt_t *rt, uint32_t offset, const uint8_t *data, uint32_t len) {
+
+  uint32_t max = rt->n_leds * 3;
+  if (offset >= max) return;
+  if (len > max - offset) len = max - offset;
+
+  memcpy(rt->leds + offset, data, len);
+
+  rt->stats.bytes += len;
+}
+
+// DDP: sequence 1..15, 0 means the sender doesn't use them
+ledc_rt_result_t ledc_rt_ddp(ledc_rt_t *rt, const uint8_t *pkt, size_t len) {
+
+  rt->stats.packets++;
+
+  if (len < DDP_HEADER_LEN) {
+    rt->stats.bad++;
+    return(LEDC_RT_NONE);
+  }
+
+  uint8_t flags = pkt[0];
+  // nobody asks us anything yet
+  if ((flags & DDP_FLAGS_VER_MASK) != DDP_FLAGS_VER1 || (flags & DDP_FLAGS_QUERY)) {
+    rt->stats.unsupported++;
+    return(LEDC_RT_NONE);
+  }
+
+  // pixels in a format we don't show, or for a device we aren't
+  uint8_t type = pkt[2];
+  uint8_t id = pkt[3];
+  if ((type != DDP_TYPE_RGB8 && type != DDP_TYPE_UNDEFINED) ||
+      (id != DDP_ID_DEFAULT && id != DDP_ID_ALL)) {
+    rt->stats.unsupported++;
+    return(LEDC_RT_NONE);
+  }
+
+  uint8_t seq = pkt[1] & DDP_SEQUENCE_MASK;
+  if (seq && rt->ddp_last_seq) {
+    uint8_t expect = (rt->ddp_last_seq % 15) + 1;
+    if (seq != expect) rt->stats.gaps++;
+  }
+  if (seq) rt->ddp_last_seq = seq;
+
+  uint32_t offset = get_be32(&pkt[4]);
+  uint16_t data_len = get_be16(&pkt[8]);
+
+  size_t header_len = DDP_HEADER_LEN + ((flags & DDP_FLAGS_TIMECODE) ? 4 : 0);
+  if (header_len + data_len > len) {
+    rt->stats.bad++;
+    return(LEDC_RT_NONE);
+  }
+
+  ledc_rt_copy(rt, offset, pkt + header_len, data_len);
+
+  if (flags & DDP_FLAGS_PUSH) {
+    rt->stats.frames++;
+    return(LEDC_RT_SHOW);
+  }
+  return(LEDC_RT_DATA);
+}
+
+// a universe without a sync address is in. Is that a whole frame?
+static ledc_rt_result_t ledc_rt_e131_frame(ledc_rt_t *rt, int u) {
+
+  int words = (rt->n_universes + 31) / 32;
+
+  // not past the last one: the start of a new frame
+  if (rt->e131_last >= 0 && u <= rt->e131_last) {
+
+    // the one before it never finished, or it was the first we saw
+    if (rt->e131_learned) {
+      rt->stats.dropped++;
+      for (int i = 0; i < rt->n_universes; i++) {
+        if (!BIT_GET(rt->e131_seen, i)) continue;
+        if (BIT_GET(rt->e131_have, i)) {
+          rt->e131_missed[i] = 0;
+        }
+        else if (++rt->e131_missed[i] >= LEDC_E131_MISS_MAX) {
+          BIT_CLR(rt->e131_seen, i);
+          rt->e131_missed[i] = 0;
+          rt->e131_shown_seq[i] = -1;
+        }
+      }
+    }
+    memset(rt->e131_have, 0, sizeof(rt->e131_have));
+    rt->e131_learned = true;
+  }
+
+  BIT_SET(rt->e131_seen, u);
+  BIT_SET(rt->e131_have, u);
+  rt->e131_missed[u] = 0;
+  rt->e131_last = u;
+
+  if (!rt->e131_learned || memcmp(rt->e131_have, rt->e131_seen, words * sizeof(uint32_t)) != 0) {
+    return(LEDC_RT_DATA);
+  }
+
+  // Every universe in. A source counts each universe's packets separately
+  // but sends them all each frame, so they've all moved on the same number
+  // since the last frame shown - unless the packets lost fell just so, and
+  // this is the front of one frame and the back of the next.
+  int moved = -1;
+  bool whole = true;
+  for (int i = 0; i < rt->n_universes; i++) {
+    if (!BIT_GET(rt->e131_have, i) || rt->e131_shown_seq[i] < 0) continue;
+    int m = (uint8_t) (rt->e131_last_seq[i] - rt->e131_shown_seq[i]);
+    if (moved < 0) moved = m;
+    else if (m != moved) whole = false;
+  }
+  if (whole) {
+    for (int i = 0; i < rt->n_universes; i++) {
+      if (BIT_GET(rt->e131_have, i)) rt->e131_shown_seq[i] = rt->e131_last_seq[i];
+    }
+  }
+
+  memset(rt->e131_have, 0, sizeof(rt->e131_have));
+  rt->e131_last = -1;
+  if (!whole) {
+    rt->stats.dropped++;
+    return(LEDC_RT_DATA);
+  }
+  rt->stats.frames++;
+  return(LEDC_RT_SHOW);
+}
+
+ledc_rt_result_t ledc_rt_e131(ledc_rt_t *rt, const uint8_t *pkt, size_t len) {
+
+  rt->stats.packets++;
+
+  // root layer: preamble and ACN packet identifier
+  if (len < E131_SYNC_LEN || get_be16(&pkt[0]) != 0x0010 ||
+      memcmp(&pkt[4], e131_acn_id, sizeof(e131_acn_id)) != 0) {
+    rt->stats.bad++;
+    return(LEDC_RT_NONE);
+  }
+
+  uint32_t root_vector = get_be32(&pkt[18]);
+
+  // a sync packet shows what's been waiting for it
+  if (root_vector == E131_VECTOR_ROOT_EXTENDED) {
+    if (get_be32(&pkt[40]) != E131_VECTOR_EXTENDED_SYNC) return(LEDC_RT_NONE);
+    uint16_t sync = get_be16(&pkt[45]);
+    if (!rt->e131_pending || sync != rt->e131_sync) return(LEDC_RT_NONE);
+    rt->e131_pending = false;
+    rt->stats.frames++;
+    return(LEDC_RT_SHOW);
+  }
+
+  if (root_vector != E131_VECTOR_ROOT_DATA || len < E131_HEADER_LEN) {
+    rt->stats.bad++;
+    return(LEDC_RT_NONE);
+  }
+  // framing layer VECTOR_E131_DATA_PACKET, DMP vector
+  if (get_be32(&pkt[40]) != E131_VECTOR_DATA_PACKET || pkt[117] != 0x02) {
+    rt->stats.bad++;
+    return(LEDC_RT_NONE);
+  }
+  // start code 0 is dimmer data. Others ( per channel priority, say ) aren't pixels
+  if (pkt[125] != 0) {
+    rt->stats.unsupported++;
+    return(LEDC_RT_NONE);
+  }
+
+  uint16_t universe = get_be16(&pkt[113]);
+  if (universe < LEDC_E131_UNIVERSE) return(LEDC_RT_NONE);
+  int u = universe - LEDC_E131_UNIVERSE;
+  if (u >= rt->n_universes) return(LEDC_RT_NONE);
+
+  uint8_t options = pkt[112];
+  if (options & E131_OPTION_TERMINATED) {
+    ledc_rt_idle(rt);
+    return(LEDC_RT_TERMINATED);
+  }
+
+  // the spec: a sequence between 1 and 20 behind the last one is out of order, drop it.
+  // anything further is a gap ( or the sender restarted )
+  uint8_t seq = pkt[111];
+  if (rt->e131_last_seq[u] >= 0) {
+    int8_t diff = (int8_t) (seq - (uint8_t) rt->e131_last_seq[u]);
+    if (diff <= 0 && diff > -20) {
+      rt->stats.dropped++;
+      return(LEDC_RT_NONE);
+    }
+    if (diff != 1) rt->stats.gaps++;
+  }
+  rt->e131_last_seq[u] = seq;
+
+  // property count includes the start code
+  uint16_t n_channels = get_be16(&pkt[123]) - 1;
+  if ((size_t) E131_HEADER_LEN + n_channels > len || n_channels > 512) {
+    rt->stats.bad++;
+    return(LEDC_RT_NONE);
+  }
+
+  // the last two channels of a full universe are left over, they don't make a pixel
+  if (n_channels > E131_PIXELS_PER_UNIVERSE * 3) n_channels = E131_PIXELS_PER_UNIVERSE * 3;
+
+  ledc_rt_copy(rt, u * E131_PIXELS_PER_UNIVERSE * 3, pkt + E131_HEADER_LEN, n_channels);
+
+  uint16_t sync = get_be16(&pkt[109]);
+  if (sync) {
+    rt->e131_sync = sync;
+    rt->e131_pending = true;
+    return(LEDC_RT_DATA);
+  }
+  return(ledc_rt_e131_frame(rt, u));
+}
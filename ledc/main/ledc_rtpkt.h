@@ -0,0 +1,122 @@
+/*
+ * ledc_rtpkt.h
+ * DDP and E1.31 packets, parsed in place and copied into leds[].
+ * No ESP-IDF in here, it builds anywhere. ledc_realtime.cpp owns the
+ * sockets, the wire and the timeout; this decides what a packet means.
+ *
+ * DDP ( port 4048 ) - a 10 byte header ( 14 with a timecode ) then pixel
+ *   data, with a byte offset so a frame can be split across packets, and a
+ *   PUSH flag on the last one. We take 8 bit RGB ( or an undefined type,
+ *   which senders use to mean the same ) for the default output device, or
+ *   for all devices; anything else is for someone else.
+ *
+ * E1.31 / sACN ( port 5568 ) - 126 bytes of header, then up to 512 DMX
+ *   channels. 170 pixels per universe, starting at LEDC_E131_UNIVERSE.
+ *   A frame usually spans universes, and showing each as it arrives tears.
+ *   So: if the source gives a synchronization address, a frame shows when
+ *   the sync packet for it comes. If not, it shows once every universe the
+ *   source sends has come in. Sources send a frame's universes in order,
+ *   so one that isn't past the last one in starts a new frame; if the one
+ *   before wasn't complete, a packet was lost and that frame is dropped.
+ *   Lose the right packets and that looks like one whole frame, made of
+ *   two: so every universe must also have moved on the same number of
+ *   sequence numbers since the last frame shown. A universe missed
+ *   LEDC_E131_MISS_MAX frames running has stopped. Nothing shows until the
+ *   first frame boundary, when we know what the source sends.
+ *
+ * Both carry a sequence number. Gaps ( lost packets ) are counted, and
+ * E1.31 packets that arrive out of order are dropped, as the spec asks.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define DDP_PORT 4048
+#define E131_PORT 5568
+
+// DDP header
+#define DDP_HEADER_LEN 10
+#define DDP_FLAGS_VER_MASK 0xC0
+#define DDP_FLAGS_VER1 0x40
+#define DDP_FLAGS_TIMECODE 0x10
+#define DDP_FLAGS_QUERY 0x02
+#define DDP_FLAGS_PUSH 0x01
+#define DDP_SEQUENCE_MASK 0x0F
+// data type: C R TTT SSS, custom, reserved, type, bits per element
+#define DDP_TYPE_UNDEFINED 0x00
+#define DDP_TYPE_RGB8 0x0B
+// destination
+#define DDP_ID_DEFAULT 1
+#define DDP_ID_ALL 255
+
+// E1.31 header
+#define E131_HEADER_LEN 126
+#define E131_SYNC_LEN 49
+#define E131_OPTION_TERMINATED 0x40
+#define E131_VECTOR_ROOT_DATA 0x00000004
+#define E131_VECTOR_ROOT_EXTENDED 0x00000008
+#define E131_VECTOR_DATA_PACKET 0x00000002
+#define E131_VECTOR_EXTENDED_SYNC 0x00000001
+
+// first universe that maps to leds[0]
+#define LEDC_E131_UNIVERSE 1
+#define E131_PIXELS_PER_UNIVERSE 170
+#define LEDC_E131_UNIVERSES 256
+
+// a universe missing from this many frames running has stopped
+#define LEDC_E131_MISS_MAX 8
+
+typedef struct {
+  uint32_t packets;
+  uint32_t frames;
+  uint32_t bytes;
+  uint32_t gaps;        // sequence numbers skipped
+  uint32_t dropped;     // out of order, or a frame that lost a universe
+  uint32_t bad;         // malformed
+  uint32_t unsupported; // someone else's: DDP type or destination, E1.31 start code
+} ledc_realtime_stats_t;
+
+typedef enum {
+  LEDC_RT_NONE,       // nothing for us
+  LEDC_RT_DATA,       // leds[] changed, not a whole frame yet
+  LEDC_RT_SHOW,       // leds[] holds a whole frame, show it
+  LEDC_RT_TERMINATED  // the source is done, back to effects
+} ledc_rt_result_t;
+
+typedef struct {
+  uint8_t *leds;      // 3 bytes a pixel, RGB
+  int n_leds;
+  int n_universes;    // E1.31 universes that cover the strip
+
+  uint8_t ddp_last_seq;
+
+  int16_t e131_last_seq[LEDC_E131_UNIVERSES];   // -1 is none yet
+  // the frame being put together, bitmaps by universe offset
+  uint32_t e131_seen[LEDC_E131_UNIVERSES / 32]; // universes the source sends
+  uint32_t e131_have[LEDC_E131_UNIVERSES / 32]; // ones in so far
+  uint8_t e131_missed[LEDC_E131_UNIVERSES];     // frames running without it
+  int16_t e131_shown_seq[LEDC_E131_UNIVERSES];  // sequence in the last frame shown, -1 none
+  int e131_last;                                // universe offset last in, -1 none this frame
+  bool e131_learned;                            // been round once, e131_seen is whole
+  uint16_t e131_sync;                           // sync address of the frame, 0 none
+  bool e131_pending;                            // data in, waiting on the sync
+
+  ledc_realtime_stats_t stats;
+} ledc_rt_t;
+
+void ledc_rt_init(ledc_rt_t *rt, uint8_t *leds, int n_leds);
+
+// forget any frame half put together, say when the source went quiet
+void ledc_rt_idle(ledc_rt_t *rt);
+
+// One packet each. Copies the pixels it carries into leds, so the caller
+// holds whatever keeps leds from being shown meanwhile.
+ledc_rt_result_t ledc_rt_ddp(ledc_rt_t *rt, const uint8_t *pkt, size_t len);
+ledc_rt_result_t ledc_rt_e131(ledc_rt_t *rt, const uint8_t *pkt, size_t len);
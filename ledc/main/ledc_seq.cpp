@@ -0,0 +1,97 @@
+/* LEDC sequencer
+
+   Copywrite Brian Bulkowski, 2020
+
+   See ledc_seq.h. Kept free of ESP-IDF so the timing and the blend can be
+   checked, and the blend timed, on a desktop.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "ledc_seq.h"
+
+void ledc_seq_init(ledc_seq_t *seq) {
+  memset(seq, 0, sizeof(ledc_seq_t));
+  seq->running = false;
+  seq->next = -1;
+}
+
+bool ledc_seq_start(ledc_seq_t *seq, const ledc_playlist_t *pl, int64_t now) {
+  if (pl->n_presets <= 0 || pl->n_presets > LEDC_PLAYLIST_MAX) return(false);
+  seq->playlist = *pl;
+  seq->running = true;
+  seq->current = 0;
+  seq->next = -1;
+  seq->started = now;
+  return(true);
+}
+
+void ledc_seq_stop(ledc_seq_t *seq) {
+  seq->running = false;
+  seq->next = -1;
+}
+
+bool ledc_seq_fading(const ledc_seq_t *seq) {
+  return(seq->next >= 0);
+}
+
+// a transition can't be longer than the preset it's leaving
+static int64_t seq_fade_us(const ledc_seq_t *seq) {
+  uint32_t ms = seq->playlist.transition_ms;
+  uint32_t dur = seq->playlist.presets[seq->current].duration_ms;
+  if (ms > dur) ms = dur;
+  return( (int64_t) ms * 1000 );
+}
+
+ledc_seq_action_t ledc_seq_step(ledc_seq_t *seq, int64_t now) {
+
+  if (!seq->running) return(LEDC_SEQ_NONE);
+
+  const ledc_playlist_t *pl = &seq->playlist;
+
+  if (seq->next >= 0) {
+    if (now - seq->fade_started < seq_fade_us(seq)) return(LEDC_SEQ_NONE);
+    // the new one's time started when it began fading in
+    seq->current = seq->next;
+    seq->started = seq->fade_started;
+    seq->next = -1;
+    return(LEDC_SEQ_FINISH);
+  }
+
+  int64_t dur = (int64_t) pl->presets[seq->current].duration_ms * 1000;
+  if (now - seq->started < dur - seq_fade_us(seq)) return(LEDC_SEQ_NONE);
+
+  int next = seq->current + 1;
+  if (next >= pl->n_presets) {
+    if (!pl->loop || pl->n_presets == 1) {
+      // the last one stays up
+      seq->running = false;
+      return(LEDC_SEQ_NONE);
+    }
+    next = 0;
+  }
+  seq->next = next;
+  seq->fade_started = now;
+  return(LEDC_SEQ_BEGIN);
+}
+
+int ledc_seq_mix(const ledc_seq_t *seq, int64_t now) {
+  if (seq->next < 0) return(0);
+  int64_t fade = seq_fade_us(seq);
+  if (fade <= 0) return(256);
+  int64_t t = now - seq->fade_started;
+  if (t <= 0) return(0);
+  if (t >= fade) return(256);
+  return( (int) (t * 256 / fade) );
+}
+
+void ledc_blend(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len, int mix) {
+  int inv = 256 - mix;
+  for (size_t i = 0; i < len; i++) {
+    out[i] = (a[i] * inv + b[i] * mix) >> 8;
+  }
+}
@@ -0,0 +1,74 @@
+/*
+ * ledc_seq.h
+ * The sequencer: runs a playlist of presets, crossfading from one to the
+ * next. This part decides when, and mixes pixels; ledc.cpp owns the two
+ * WS2812FX instances that do the rendering. No ESP-IDF in here, it builds
+ * anywhere.
+ *
+ * A preset plays for duration_ms, the last transition_ms of which overlaps
+ * the next one: both render, each into its own buffer, and the strip shows
+ * a per pixel blend that slides from the old to the new.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LEDC_PLAYLIST_MAX 16
+#define LEDC_PRESET_COLORS 3
+// WS2812FX's default, in REST units
+#define LEDC_PRESET_SPEED_DEFAULT 12
+
+typedef struct {
+  uint8_t mode;
+  uint8_t palette;
+  uint8_t speed;        // as the REST interface has it, 0 - 25
+  uint32_t colors[LEDC_PRESET_COLORS];
+  uint32_t duration_ms;
+} ledc_preset_t;
+
+typedef struct {
+  ledc_preset_t presets[LEDC_PLAYLIST_MAX];
+  int n_presets;
+  uint32_t transition_ms;
+  bool loop;
+} ledc_playlist_t;
+
+typedef enum {
+  LEDC_SEQ_NONE,
+  LEDC_SEQ_BEGIN,     // start rendering presets[next] alongside
+  LEDC_SEQ_FINISH     // the transition's done, next is now current
+} ledc_seq_action_t;
+
+typedef struct {
+  ledc_playlist_t playlist;
+  bool running;
+  int current;
+  int next;             // -1 if not transitioning
+  int64_t started;      // microseconds, when current started
+  int64_t fade_started; // microseconds
+} ledc_seq_t;
+
+void ledc_seq_init(ledc_seq_t *seq);
+
+// start a playlist from the top. The caller applies presets[0] itself.
+bool ledc_seq_start(ledc_seq_t *seq, const ledc_playlist_t *pl, int64_t now);
+void ledc_seq_stop(ledc_seq_t *seq);
+
+// once a frame. BEGIN: set up the other renderer with presets[seq->next].
+// FINISH: swap to it.
+ledc_seq_action_t ledc_seq_step(ledc_seq_t *seq, int64_t now);
+
+bool ledc_seq_fading(const ledc_seq_t *seq);
+
+// how far through the transition, 0 ( all old ) to 256 ( all new )
+int ledc_seq_mix(const ledc_seq_t *seq, int64_t now);
+
+// out = a * (256 - mix) + b * mix, byte by byte. out may be a or b.
+void ledc_blend(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len, int mix);
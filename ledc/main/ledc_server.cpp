@@ -28,204 +28,644 @@
 #include "freertos/task.h"
 
 #include "nvs_flash.h"
-#include "cJSON.h"
 
 #include "esp_http_server.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 
 #include "esp_log.h"
 static const char *TAG = "ledc";
 
 #include "ledc.h"
+#include "ledc_delta.h"
+#include "ledc_frame.h"
+#include "rest_router.h"
+
+
+
+/*
+** /rest/state
+**
+** Everything in one document. GET returns it all; PATCH takes any part of
+** it, checks all of it, and only then applies it - a bad value anywhere
+** means nothing changes.
+**
+** { "led_mode":n, "led_speed":n,          ( all segments )
+**   "brightness":0-255,
+**   "segments":[ { "id":n, "mode":n, "speed":n, "palette":n, "colors":[rgb,rgb,rgb],
+**                  "start":n, "stop":n, "grouping":n, "spacing":n } ],
+**   and read only: "mode_count", "power_mw", "fps", "realtime", "uptime", "epoch" }
+*/
 
+static bool state_flush(void *ctx, const char *buf, size_t len) {
+    return( httpd_resp_send_chunk((httpd_req_t *) ctx, buf, len) == ESP_OK );
+}
 
-
-// return the integer value of a json element which is in the root
-// Extensions: get a subitem with cJSON_GetObjectItem(parentCJson,child-string)
-//             set values cJSON_GetObjectItem(format,"frame rate")->valueint=25;
-// deleting the root deletes all the things
-// https://github.com/espressif/esp-idf/tree/master/components/json
-// not sure what happens when we can't get the string, though
-static esp_err_t get_json_value_int(const char *json_str, const char *field, int *val) {
-
-    ESP_LOGV(TAG," getjsonvalueint: json %s field %s",json_str,field);
-    const char *err_loc = 0;
-    cJSON *root = cJSON_ParseWithOpts(json_str, &err_loc, false);
-    ESP_LOGV(TAG," cjson parse: root is %p",root);
-    if (! root) {
-        ESP_LOGV(TAG,"could not parse json, error at postition: %d",(int)(err_loc - json_str) );
-        return(ESP_FAIL);
-    }
-
-    cJSON *field_object = cJSON_GetObjectItem(root,field);
-    if (! field_object) {
-        ESP_LOGD(TAG, " JSON parse could not find %s in %s",field,json_str);
-        cJSON_Delete(root);
-        return(ESP_FAIL);
+static esp_err_t state_get(httpd_req_t *req) {
+
+    ledc_segment_info_t segs[LEDC_SEGMENTS_MAX];
+    int n_segs = ledc_segments_get(segs, LEDC_SEGMENTS_MAX);
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), state_flush, req);
+
+    json_obj_begin(&w, NULL);
+    json_int(&w, "led_mode", ledc_led_mode_get());
+    json_int(&w, "led_speed", ledc_led_speed_get());
+    json_int(&w, "brightness", ledc_led_brightness_get());
+    json_int(&w, "mode_count", ledc_led_mode_count());
+    json_arr_begin(&w, "segments");
+    for (int i = 0; i < n_segs; i++) {
+        ledc_segment_info_t *si = &segs[i];
+        json_obj_begin(&w, NULL);
+        json_int(&w, "id", si->id);
+        json_int(&w, "mode", si->mode);
+        json_int(&w, "speed", si->speed);
+        json_int(&w, "palette", si->palette);
+        json_arr_begin(&w, "colors");
+        for (int c = 0; c < LEDC_SEGMENT_COLORS; c++) json_int(&w, NULL, si->colors[c]);
+        json_arr_end(&w);
+        json_int(&w, "start", si->start);
+        json_int(&w, "stop", si->stop);
+        json_int(&w, "grouping", si->grouping);
+        json_int(&w, "spacing", si->spacing);
+        json_obj_end(&w);
     }
-    if (! cJSON_IsNumber(field_object)) {
-        ESP_LOGD(TAG, " JSON did not find a number %s in %s",field,json_str);
-        cJSON_Delete(root);
+    json_arr_end(&w);
+    json_int(&w, "power_mw", ledc_power_mw_get());
+    json_int(&w, "fps", ledc_fps_get());
+    json_bool(&w, "realtime", ledc_realtime_active());
+    json_int(&w, "uptime", clock() / CLOCKS_PER_SEC);
+    json_int(&w, "epoch", (int64_t) time(NULL));
+    json_obj_end(&w);
+
+    if (json_writer_finish(&w) < 0) {
+        ESP_LOGW(TAG,"rest: state response failed");
         return(ESP_FAIL);
     }
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
 
-    // NB. This library has a strange idea that number is both double and integer.
-    // in this case I want the closest int.
-
-    *val = field_object->valueint;
-    cJSON_Delete(root);
-    return(ESP_OK);
+// an int in the object at obj, if it's there. False if it's there but out of range.
+static bool state_int(const char *js, const json_tok_t *toks, int n_toks, int obj, const char *key, int min, int max, int *val, bool *present) {
+    *present = false;
+    int t = json_obj_get(js, toks, n_toks, obj, key);
+    if (t < 0) return(true);
+    if (!json_tok_int(js, &toks[t], val) || *val < min || *val > max) {
+        ESP_LOGD(TAG,"rest: state %s out of range",key);
+        return(false);
+    }
+    *present = true;
+    return(true);
 }
 
-// rest get calls will come here
-//
+// the most a patch can set: brightness, mode and speed, then for each segment
+// mode, speed, palette, geometry and the colors. It has to fit in one batch.
+static_assert(3 + LEDC_SEGMENTS_MAX * (4 + LEDC_SEGMENT_COLORS) <= LEDC_CMD_QUEUE_LEN, "a state patch doesn't fit the command queue");
 
-esp_err_t rest_uri_handler(httpd_req_t *req) {
+// run through the patch; when apply is false only check it
+static esp_err_t state_patch_walk(const char *js, const json_tok_t *toks, int n_toks, bool apply) {
 
-    ESP_LOGD(TAG," received rest URI request for %s method %d",req->uri,req->method);
+    int val;
+    bool present;
+    esp_err_t err;
 
-    // did I get content?
+    if (toks[0].type != JSON_OBJECT) return(ESP_FAIL);
 
-    char *content = 0;
-    if (req->content_len > 0) {
-        //ESP_LOGD(TAG," content length is: %d",req->content_len);
-        content =(char *)malloc(req->content_len + 1);
-        int sz = httpd_req_recv(req, content, req->content_len);
-        //ESP_LOGD(TAG," content sz is: %d",sz);
-        if (sz != req->content_len) {
-            //ESP_LOGD(TAG," could not retrieve content: %d",sz);
-            httpd_resp_send_500(req);
-            free(content);
-            return(ESP_OK);
-        }
-        content[req->content_len] = 0;
-        //ESP_LOGD(TAG," content is: %s",content);
-    }
-    
-// going to ignore accept headers...
-#if 0
-    // what is the accept string?
-    size_t hdr_value_len = httpd_req_get_hdr_value_len(req, "Accept");
-    if (hdr_value_len) {
-        char *value =(char *)malloc(hdr_value_len+1);
-        httpd_req_get_hdr_value_str(req, "Accept", value, hdr_value_len );
-        ESP_LOGD(TAG," got accept header: %s",value);
-        free(value);
-    }
+    if (!state_int(js, toks, n_toks, 0, "brightness", 0, 255, &val, &present)) return(ESP_FAIL);
+    if (present && apply && (err = ledc_led_brightness_set(val)) != ESP_OK) return(err);
 
-    // what is the Connection string?
-    size_t hdr_value_len = httpd_req_get_hdr_value_len(req, "Connection");
-    if (hdr_value_len) {
-        char *value =(char *)malloc(hdr_value_len+1);
-        httpd_req_get_hdr_value_str(req, "Connection", value, hdr_value_len );
-        ESP_LOGD(TAG," got connection header: %s",value);
-        free(value);
-    }
-#endif
+    if (!state_int(js, toks, n_toks, 0, "led_mode", 0, ledc_led_mode_count() - 1, &val, &present)) return(ESP_FAIL);
+    if (present && apply && (err = ledc_led_mode_set(val)) != ESP_OK) return(err);
 
-    // doing this up here will set it for everything
-    httpd_resp_set_hdr(req,"Connection","close");
+    if (!state_int(js, toks, n_toks, 0, "led_speed", 0, 255 / 10, &val, &present)) return(ESP_FAIL);
+    if (present && apply && (err = ledc_led_speed_set(val)) != ESP_OK) return(err);
 
-    // parse the URI so I can sub-dispatch?
-    const char *last_slash = strrchr(req->uri, '/');
-    last_slash++;
+    int segs = json_obj_get(js, toks, n_toks, 0, "segments");
+    if (segs < 0) return(ESP_OK);
+    if (toks[segs].type != JSON_ARRAY) return(ESP_FAIL);
 
-// need to refactor to not repeat so much
-    if ( strcmp(last_slash, "led_mode") == 0) {
+    ledc_segment_info_t cur[LEDC_SEGMENTS_MAX];
+    int n_cur = ledc_segments_get(cur, LEDC_SEGMENTS_MAX);
 
-        if (req->method == HTTP_GET) {
+    int seg = segs + 1;
+    for (int i = 0; i < toks[segs].size; i++, seg = json_skip(toks, n_toks, seg)) {
 
-            char led_mode_str[20];
-            snprintf(led_mode_str, sizeof(led_mode_str),"%d",ledc_led_mode_get() );
+        if (toks[seg].type != JSON_OBJECT) return(ESP_FAIL);
 
-            ESP_LOGI(TAG,"rest: sending back led mode %s",led_mode_str);
+        int id;
+        if (!state_int(js, toks, n_toks, seg, "id", 0, ledc_segments_max() - 1, &id, &present) || !present) return(ESP_FAIL);
 
-            httpd_resp_set_type(req, "text/plain");
-            httpd_resp_sendstr(req, led_mode_str);
-        }
-        else if (req->method == HTTP_POST) {
+        if (!state_int(js, toks, n_toks, seg, "mode", 0, ledc_led_mode_count() - 1, &val, &present)) return(ESP_FAIL);
+        if (present && apply && (err = ledc_segment_mode_set(id, val)) != ESP_OK) return(err);
 
-            int new_led_mode = 0;
-            if (ESP_OK == get_json_value_int(content, "led_mode",&new_led_mode)) {
-                ESP_LOGI(TAG,"rest: posted, a led mode to set: %d",new_led_mode);
+        if (!state_int(js, toks, n_toks, seg, "speed", 0, 255 / 10, &val, &present)) return(ESP_FAIL);
+        if (present && apply && (err = ledc_segment_speed_set(id, val)) != ESP_OK) return(err);
 
-                ledc_led_mode_set(new_led_mode);
+        if (!state_int(js, toks, n_toks, seg, "palette", 0, 255, &val, &present)) return(ESP_FAIL);
+        if (present && apply && (err = ledc_led_palette_set(id, val)) != ESP_OK) return(err);
 
-                // easiest way to say OK?
-                httpd_resp_sendstr(req,"");
-            }
-            else {
-                ESP_LOGW(TAG," posted, a json with a bad value led mode");
-                httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value");
+        int colors = json_obj_get(js, toks, n_toks, seg, "colors");
+        if (colors >= 0) {
+            if (toks[colors].type != JSON_ARRAY || toks[colors].size > LEDC_SEGMENT_COLORS) return(ESP_FAIL);
+            for (int c = 0; c < toks[colors].size; c++) {
+                if (!json_tok_int(js, &toks[colors + 1 + c], &val) || val < 0 || val > 0xFFFFFF) return(ESP_FAIL);
+                if (apply && (err = ledc_led_color_set(id, c, val)) != ESP_OK) return(err);
             }
         }
 
+        // geometry: anything not given stays as it is
+        ledc_segment_info_t geo = { .id = id, .start = 0, .stop = 0, .grouping = 1, .spacing = 0 };
+        for (int c = 0; c < n_cur; c++) {
+            if (cur[c].id == id) geo = cur[c];
+        }
+        bool any = false;
+        if (!state_int(js, toks, n_toks, seg, "start", 0, ledc_led_count(), &geo.start, &present)) return(ESP_FAIL);
+        any |= present;
+        if (!state_int(js, toks, n_toks, seg, "stop", 0, ledc_led_count(), &geo.stop, &present)) return(ESP_FAIL);
+        any |= present;
+        if (!state_int(js, toks, n_toks, seg, "grouping", 0, 255, &geo.grouping, &present)) return(ESP_FAIL);
+        any |= present;
+        if (!state_int(js, toks, n_toks, seg, "spacing", 0, 255, &geo.spacing, &present)) return(ESP_FAIL);
+        any |= present;
+        if (any && apply && (err = ledc_led_segment_set(id, geo.start, geo.stop, geo.grouping, geo.spacing)) != ESP_OK) return(err);
     }
-    else if ( strcmp(last_slash, "led_speed") == 0) {
+    return(ESP_OK);
+}
 
-        if (req->method == HTTP_GET) {
+static esp_err_t state_patch(httpd_req_t *req, const char *content) {
 
-            char led_speed_str[20];
-            snprintf(led_speed_str, sizeof(led_speed_str),"%d",ledc_led_speed_get() );
+    const json_tok_t *toks;
+    int n_toks = rest_parse(content, &toks);
+    if (n_toks < 0 || state_patch_walk(content, toks, n_toks, false) != ESP_OK) {
+        ESP_LOGW(TAG,"rest: bad state patch");
+        return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value") );
+    }
 
-            ESP_LOGI(TAG,"rest: sending back led speed %s",led_speed_str);
+    // all of it in one frame, or none of it
+    esp_err_t err = ledc_cmd_batch_begin();
+    if (err == ESP_OK) {
+        err = state_patch_walk(content, toks, n_toks, true);
+        esp_err_t end_err = ledc_cmd_batch_end(err == ESP_OK);
+        if (err == ESP_OK) err = end_err;
+    }
+    if (err == ESP_ERR_INVALID_SIZE) {
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        return( httpd_resp_sendstr(req,"too many changes at once") );
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG,"rest: state patch not applied %d %s",err,esp_err_to_name(err));
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return( httpd_resp_sendstr(req,"busy, nothing changed") );
+    }
+    return( httpd_resp_sendstr(req,"") );
+}
 
-            httpd_resp_set_type(req, "text/plain");
-            httpd_resp_sendstr(req, led_speed_str);
-        }
-        else if (req->method == HTTP_POST) {
+static esp_err_t state_handler(httpd_req_t *req, const char *content) {
 
-            int new_led_speed = 0;
-            if (ESP_OK == get_json_value_int(content, "led_speed",&new_led_speed)) {
-                ESP_LOGI(TAG,"rest: posted, a led mode to set: %d",new_led_speed);
+    if (req->method == HTTP_GET) {
+        return( state_get(req) );
+    }
+    else if (req->method == HTTP_PATCH) {
+        return( state_patch(req, content) );
+    }
+    return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"GET or PATCH") );
+}
 
-                ledc_led_speed_set(new_led_speed);
+/*
+** /rest/playlist
+**
+** GET: { "running":b, "cycling":b, "current":n, "fading":b, "transition_ms":n, "loop":b,
+**        "presets":[ { "mode":n, "palette":n, "speed":n, "colors":[rgb,rgb,rgb], "duration_ms":n } ],
+**        "render_us_max":n, "fade_render_us_max":n }
+** POST the same shape to start one ( only presets is needed, the rest has
+** defaults ), or "presets":[] to stop. It has to fit in one request body.
+*/
 
-                // easiest way to say OK?
-                httpd_resp_sendstr(req,"");
-            }
-            else {
-                ESP_LOGW(TAG," posted, a json with a bad value led mode");
-                httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value");
+static esp_err_t playlist_get(httpd_req_t *req) {
+
+    static ledc_playlist_t pl;   // too big for the httpd stack, and only used on the httpd task
+    ledc_seq_status_t st;
+    ledc_playlist_get(&pl, &st);
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), state_flush, req);
+    json_obj_begin(&w, NULL);
+    json_bool(&w, "running", st.running);
+    json_bool(&w, "cycling", st.cycling);
+    json_int(&w, "current", st.current);
+    json_bool(&w, "fading", st.fading);
+    json_int(&w, "transition_ms", pl.transition_ms);
+    json_bool(&w, "loop", pl.loop);
+    json_arr_begin(&w, "presets");
+    for (int i = 0; i < pl.n_presets; i++) {
+        ledc_preset_t *p = &pl.presets[i];
+        json_obj_begin(&w, NULL);
+        json_int(&w, "mode", p->mode);
+        json_int(&w, "palette", p->palette);
+        json_int(&w, "speed", p->speed);
+        json_arr_begin(&w, "colors");
+        for (int c = 0; c < LEDC_PRESET_COLORS; c++) json_int(&w, NULL, p->colors[c]);
+        json_arr_end(&w);
+        json_int(&w, "duration_ms", p->duration_ms);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    json_int(&w, "render_us_max", st.render_us_max);
+    json_int(&w, "fade_render_us_max", st.fade_render_us_max);
+    json_obj_end(&w);
+
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
+
+static esp_err_t playlist_post(httpd_req_t *req, const char *content) {
+
+    static ledc_playlist_t pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.transition_ms = 1000;
+    pl.loop = true;
+
+    const json_tok_t *toks;
+    int n_toks = rest_parse(content, &toks);
+    int val;
+    bool present;
+    bool ok = n_toks > 0 && toks[0].type == JSON_OBJECT;
+
+    if (ok) ok = state_int(content, toks, n_toks, 0, "transition_ms", 0, 60000, &val, &present);
+    if (ok && present) pl.transition_ms = val;
+
+    int t = ok ? json_obj_get(content, toks, n_toks, 0, "loop") : -1;
+    if (t >= 0) ok = json_tok_bool(content, &toks[t], &pl.loop);
+
+    int presets = ok ? json_obj_get(content, toks, n_toks, 0, "presets") : -1;
+    if (presets < 0 || toks[presets].type != JSON_ARRAY || toks[presets].size > LEDC_PLAYLIST_MAX) ok = false;
+
+    int pt = presets + 1;
+    for (int i = 0; ok && i < toks[presets].size; i++, pt = json_skip(toks, n_toks, pt)) {
+
+        ledc_preset_t *p = &pl.presets[pl.n_presets++];
+        p->duration_ms = 10000;
+        p->speed = LEDC_PRESET_SPEED_DEFAULT;
+        p->colors[0] = 0xff0000;
+
+        if (toks[pt].type != JSON_OBJECT) { ok = false; break; }
+
+        ok = state_int(content, toks, n_toks, pt, "mode", 0, ledc_led_mode_count() - 1, &val, &present) && present;
+        if (ok) p->mode = val;
+        if (ok) ok = state_int(content, toks, n_toks, pt, "palette", 0, 255, &val, &present);
+        if (ok && present) p->palette = val;
+        if (ok) ok = state_int(content, toks, n_toks, pt, "speed", 0, 255 / 10, &val, &present);
+        if (ok && present) p->speed = val;
+        if (ok) ok = state_int(content, toks, n_toks, pt, "duration_ms", 1, 24 * 3600 * 1000, &val, &present);
+        if (ok && present) p->duration_ms = val;
+
+        int colors = ok ? json_obj_get(content, toks, n_toks, pt, "colors") : -1;
+        if (colors >= 0) {
+            if (toks[colors].type != JSON_ARRAY || toks[colors].size > LEDC_PRESET_COLORS) { ok = false; break; }
+            for (int c = 0; ok && c < toks[colors].size; c++) {
+                ok = json_tok_int(content, &toks[colors + 1 + c], &val) && val >= 0 && val <= 0xFFFFFF;
+                if (ok) p->colors[c] = val;
             }
         }
     }
-    else if ( strcmp(last_slash, "uptime") == 0) {
 
-        clock_t cl = clock();
-        uint64_t uptime_sec = cl / CLOCKS_PER_SEC;
-        char uptime_str[20];
-        snprintf(uptime_str, sizeof(uptime_str),"%" PRIu64,uptime_sec);
+    if (!ok || ledc_playlist_set(&pl) != ESP_OK) {
+        ESP_LOGW(TAG,"rest: bad playlist");
+        return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value") );
+    }
+    return( httpd_resp_sendstr(req,"") );
+}
+
+static esp_err_t playlist_handler(httpd_req_t *req, const char *content) {
+
+    if (req->method == HTTP_GET) {
+        return( playlist_get(req) );
+    }
+    else if (req->method == HTTP_POST) {
+        return( playlist_post(req, content) );
+    }
+    return( httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"GET or POST") );
+}
 
-        ESP_LOGI(TAG,"rest: sending uptime %s",uptime_str);
+/*
+** Frame preview
+**
+** What's in leds[] right now, so you can see the strip without walking over
+** to it. GET /rest/frame is one keyframe ( see ledc_frame.h ). Websocket
+** clients get a stream: a keyframe, then deltas, at no more than
+** frame_fps a second and only when something changed.
+**
+** The render task only gives up the wire for the copy; encoding and sending
+** happen on the httpd task.
+*/
 
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_sendstr(req, uptime_str);
+// the push timer runs at 10 a second, that's as fast as it goes
+#define LEDC_FRAME_FPS_MAX 10
+#define LEDC_FRAME_FPS_DEFAULT 5
+
+static int g_frame_fps = LEDC_FRAME_FPS_DEFAULT;
+static int64_t g_frame_last = 0;
+static ledc_frame_enc_t g_frame_enc;
+
+// allocated once, only used on the httpd task
+static uint8_t *g_frame_cur = NULL;
+static uint8_t *g_frame_prev = NULL;
+static uint8_t *g_frame_out = NULL;
+static size_t g_frame_out_len = 0;
+
+static esp_err_t frame_init(void) {
+    int n_leds = ledc_led_count();
+    g_frame_out_len = ledc_frame_max_len(n_leds);
+    g_frame_cur = (uint8_t *) malloc(n_leds * 3);
+    g_frame_prev = (uint8_t *) malloc(n_leds * 3);
+    g_frame_out = (uint8_t *) malloc(g_frame_out_len);
+    if (!g_frame_cur || !g_frame_prev || !g_frame_out) {
+        ESP_LOGE(TAG, "frame: could not allocate preview buffers");
+        return(ESP_ERR_NO_MEM);
     }
-    else if ( strcmp(last_slash, "epoch") == 0) {
+    ledc_frame_enc_init(&g_frame_enc, g_frame_prev, n_leds);
+    return(ESP_OK);
+}
 
-        // this might be correct, because we have sntp enabled
-        time_t secs = time(NULL);
-        char secs_str[30];
-        // depending on config, time might be 64 bits, or 32.... play it safe
-        snprintf(secs_str, sizeof(secs_str),"%" PRIu64,(uint64_t) secs);
+static int frame_fps_get(void) {
+    return(g_frame_fps);
+}
 
-        ESP_LOGI(TAG,"rest: sending epoch %s",secs_str);
+static esp_err_t frame_fps_set(int fps) {
+    g_frame_fps = fps;
+    return(ESP_OK);
+}
 
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_sendstr(req, secs_str);
+static esp_err_t frame_handler(httpd_req_t *req, const char *content) {
+
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
     }
 
-    else {
-        ESP_LOGI(TAG,"rest: unknown endpoint: %s",last_slash);
-        httpd_resp_send_404(req);
+    int n = ledc_frame_snapshot(g_frame_cur, ledc_led_count() * 3);
+    int len = n < 0 ? -1 : ledc_frame_encode_key(g_frame_cur, ledc_led_count(), 0, g_frame_out, g_frame_out_len);
+    if (len < 0) return( httpd_resp_send_500(req) );
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return( httpd_resp_send(req, (const char *) g_frame_out, len) );
+}
+
+// the next frame to stream, or 0 if it's not time or nothing changed
+static int frame_next(int64_t now) {
+
+    if (g_frame_fps <= 0) return(0);
+    if (now - g_frame_last < 1000000LL / g_frame_fps) return(0);
+    g_frame_last = now;
+
+    if (ledc_frame_snapshot(g_frame_cur, ledc_led_count() * 3) < 0) return(0);
+    int len = ledc_frame_encode(&g_frame_enc, g_frame_cur, g_frame_out, g_frame_out_len);
+    return(len > 0 ? len : 0);
+}
+
+/*
+** Multi-board sync, see ledc_sync.cpp. sync_role picks off, leader or
+** follower; /rest/sync says how well it's going.
+*/
+
+static const char * const sync_role_names[] = { "off", "leader", "follower", NULL };
+
+static esp_err_t sync_handler(httpd_req_t *req, const char *content) {
+
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
     }
 
-    if (content) free(content);
+    ledc_sync_stats_t st;
+    ledc_sync_stats_get(&st);
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), state_flush, req);
+    json_obj_begin(&w, NULL);
+    json_str(&w, "role", sync_role_names[st.role]);
+    json_bool(&w, "synced", st.synced);
+    json_int(&w, "offset_us", st.offset_us);
+    json_int(&w, "applied_us", st.applied_us);
+    json_int(&w, "rtt_us", st.rtt_us);
+    json_int(&w, "samples", st.samples);
+    json_int(&w, "steps", st.steps);
+    json_int(&w, "cmds", st.cmds);
+    json_int(&w, "leader_age_ms", st.leader_age_ms);
+    json_obj_end(&w);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
 
-    return(ESP_OK);
+/*
+** /rest/persist: the saved settings, how often they've been written, and how
+** full NVS is getting.
+*/
+
+static esp_err_t persist_handler(httpd_req_t *req, const char *content) {
+
+    if (req->method != HTTP_GET) {
+        return( httpd_resp_send_err(req,HTTPD_405_METHOD_NOT_ALLOWED,"read only") );
+    }
+
+    const persist_t *p = ledc_persist_get();
+    persist_stats_t st;
+    persist_stats_get(p, &st);
+
+    httpd_resp_set_type(req, "application/json");
+
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), state_flush, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "sets", st.sets);
+    json_int(&w, "unchanged", st.unchanged);
+    json_int(&w, "flushes", st.flushes);
+    json_int(&w, "writes", st.writes);
+    json_int(&w, "fails", st.fails);
+    json_int(&w, "lifetime_writes", st.lifetime_writes);
+    json_bool(&w, "pending", st.pending);
+    persist_nvs_usage_t u;
+    if (persist_nvs_usage_get(&u)) {
+        json_int(&w, "nvs_used", u.used);
+        json_int(&w, "nvs_free", u.free);
+    }
+    json_arr_begin(&w, "keys");
+    for (int i = 0; i < p->n_entries; i++) {
+        const persist_entry_t *e = &p->entries[i];
+        json_obj_begin(&w, NULL);
+        json_str(&w, "key", e->key);
+        json_int(&w, "value", e->value);
+        json_bool(&w, "saved", e->present);
+        json_int(&w, "writes", e->writes);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    json_obj_end(&w);
+    if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+    return( httpd_resp_send_chunk(req, NULL, 0) );
+}
+
+// speed is stored in a uint8, times 10
+static const rest_route_t rest_routes[] = {
+    REST_ROUTE_INT("led_mode", 0, 255, ledc_led_mode_get, ledc_led_mode_set),
+    REST_ROUTE_INT("led_speed", 0, 25, ledc_led_speed_get, ledc_led_speed_set),
+    REST_ROUTE_INT("brightness", 0, 255, ledc_led_brightness_get, ledc_led_brightness_set),
+    REST_ROUTE_CUSTOM("state", state_handler),
+    REST_ROUTE_CUSTOM("playlist", playlist_handler),
+    REST_ROUTE_CUSTOM("uptime", rest_uptime_handler),
+    REST_ROUTE_CUSTOM("epoch", rest_epoch_handler),
+    REST_ROUTE_CUSTOM("server", rest_server_stats_handler),
+    REST_ROUTE_CUSTOM("frame", frame_handler),
+    REST_ROUTE_INT("frame_fps", 0, LEDC_FRAME_FPS_MAX, frame_fps_get, frame_fps_set),
+    REST_ROUTE_ENUM("sync_role", sync_role_names, ledc_sync_role_get, ledc_sync_role_set),
+    REST_ROUTE_CUSTOM("sync", sync_handler),
+    REST_ROUTE_CUSTOM("persist", persist_handler),
+};
+
+static rest_router_t g_rest_router;
+
+/*
+** Push channel
+**
+** Browsers open a websocket on /ws and we send them JSON objects holding
+** whatever changed, instead of them polling each value every couple of
+** seconds over its own connection. A timer looks at the state now and then,
+** ledc_delta decides what's different and whether it's been long enough
+** since the last push, and that goes to every client. New clients get
+** a full snapshot first. The frame preview rides along as binary messages.
+**
+** The client list is only touched on the httpd task - the websocket handler
+** runs there, and the timer hands the push over with httpd_queue_work.
+**
+** There's room for LEDC_PUSH_MAX_CLIENTS, no more than the server has
+** sockets to spare for websockets. Each push marks the client's socket used, so when the server
+** runs out and purges one, it's an idle keep-alive and not a browser tab.
+*/
+
+static_assert(LEDC_PUSH_MAX_CLIENTS <= REST_WS_MAX_CLIENTS, "the server can't hold that many websockets");
+static_assert(LEDC_PUSH_MAX_CLIENTS >= 5, "room for at least 5 browsers");
+#define LEDC_PUSH_PERIOD_MS 100
+
+static httpd_handle_t g_httpserver = NULL;
+
+static ledc_push_table_t g_push;
+static ledc_delta_t g_push_delta;
+static esp_timer_handle_t g_push_timer = NULL;
+
+static void push_state_get(ledc_state_t *state) {
+    state->led_mode = ledc_led_mode_get();
+    state->led_speed = ledc_led_speed_get();
+    state->brightness = ledc_led_brightness_get();
+    state->realtime = ledc_realtime_active() ? 1 : 0;
+    state->epoch = (uint64_t) time(NULL);
+    state->uptime = clock() / CLOCKS_PER_SEC;
+}
+
+static esp_err_t push_send(int fd, httpd_ws_type_t type, const void *buf, int len) {
+    httpd_ws_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.final = true;
+    frame.type = type;
+    frame.payload = (uint8_t *) buf;
+    frame.len = len;
+    return( httpd_ws_send_frame_async(g_httpserver, fd, &frame) );
 }
 
+static void push_client_drop(ledc_push_client_t *client) {
+    ESP_LOGI(TAG,"push: client %d gone",client->fd);
+    ledc_push_client_drop(&g_push, client);
+}
+
+// runs on the httpd task
+static void push_work(void *arg) {
+
+    ledc_state_t state;
+    push_state_get(&state);
+    char buf[160];
+
+    // what changed, if it's time
+    int len = ledc_delta_build(&g_push_delta, &state, esp_timer_get_time(), buf, sizeof(buf));
+    int frame_len = frame_next(esp_timer_get_time());
+
+    for (int i = 0; i < LEDC_PUSH_MAX_CLIENTS; i++) {
+        ledc_push_client_t *client = &g_push.clients[i];
+        if (client->fd < 0) continue;
+
+        if (httpd_ws_get_fd_info(g_httpserver, client->fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+            push_client_drop(client);
+            continue;
+        }
+        rest_server_keep(g_httpserver, client->fd);
+
+        esp_err_t err = ESP_OK;
+        if (client->fresh) {
+            ledc_delta_t snapshot;
+            ledc_delta_init(&snapshot);
+            char snap_buf[160];
+            int snap_len = ledc_delta_build(&snapshot, &state, esp_timer_get_time(), snap_buf, sizeof(snap_buf));
+            err = push_send(client->fd, HTTPD_WS_TYPE_TEXT, snap_buf, snap_len);
+            client->fresh = false;
+        }
+        else if (len > 0) {
+            err = push_send(client->fd, HTTPD_WS_TYPE_TEXT, buf, len);
+        }
+        if (err == ESP_OK && frame_len > 0) {
+            err = push_send(client->fd, HTTPD_WS_TYPE_BINARY, g_frame_out, frame_len);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGD(TAG,"push: send to %d failed %d %s",client->fd,err,esp_err_to_name(err));
+            push_client_drop(client);
+        }
+    }
+}
+
+static void push_timer_cb(void *arg) {
+    // nobody listening, nothing to do
+    if (g_push.n_clients == 0) return;
+    httpd_queue_work(g_httpserver, push_work, NULL);
+}
+
+esp_err_t ws_uri_handler(httpd_req_t *req) {
+
+    // the GET is the handshake, after that it's frames
+    if (req->method == HTTP_GET) {
+
+        int fd = httpd_req_to_sockfd(req);
+        if (ledc_push_client_add(&g_push, fd) == NULL) {
+            ESP_LOGW(TAG,"push: too many clients, refusing %d",fd);
+            return(ESP_FAIL);
+        }
+        rest_server_keep(g_httpserver, fd);
+        // everyone gets a keyframe, so the new one can start from it
+        ledc_frame_enc_reset(&g_frame_enc);
+        ESP_LOGI(TAG,"push: new client %d",fd);
+        // don't make them wait for the timer
+        httpd_queue_work(g_httpserver, push_work, NULL);
+        return(ESP_OK);
+    }
+
+    // we don't expect anything from the browser, read it and drop it
+    httpd_ws_frame_t frame;
+    uint8_t payload[64];
+    memset(&frame, 0, sizeof(frame));
+    frame.payload = payload;
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, sizeof(payload));
+    rest_server_keep(g_httpserver, httpd_req_to_sockfd(req));
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG,"push: recv frame failed %d %s",err,esp_err_to_name(err));
+    }
+    return(err);
+}
 
 //
 // I have used 'embed files' in the build system to include a small test jpeg
@@ -236,13 +676,15 @@ extern const uint8_t server_index_html_end[] asm("_binary_index_html_end");
 extern const uint8_t server_jquery_min_js_start[] asm("_binary_jquery_min_js_start");
 extern const uint8_t server_jquery_min_js_end[] asm("_binary_jquery_min_js_end");
 
+// gzipped copies and ETags are made by the build, see main/CMakeLists.txt
+#include "static_assets.h"
+
+extern const uint8_t server_index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t server_index_html_gz_end[] asm("_binary_index_html_gz_end");
+
+extern const uint8_t server_jquery_min_js_gz_start[] asm("_binary_jquery_min_js_gz_start");
+extern const uint8_t server_jquery_min_js_gz_end[] asm("_binary_jquery_min_js_gz_end");
 
-typedef struct static_content_s {
-    const char *name;
-    const char *content_type;
-    const uint8_t *buf;
-    ssize_t  buf_len;
-} static_content_t;
 
 // C doesn't in any way have the ability yet to iterate
 // over a defined list without having the size of the list.
@@ -254,26 +696,36 @@ typedef struct static_content_s {
 // I'm going to mandate that "index.html", ie, what you want served out of the
 // root, will always be first
 
-static std::array<static_content_t, 3> static_contents = { {
+static std::array<rest_static_t, 3> static_contents = { {
     {
     "index.html", "text/html", 
-        server_index_html_start, ( server_index_html_end - server_index_html_start)
+        server_index_html_start, ( server_index_html_end - server_index_html_start),
+        server_index_html_gz_start, ( server_index_html_gz_end - server_index_html_gz_start),
+        ETAG_INDEX_HTML, ETAG_INDEX_HTML_GZ
     },    
     {
     "jquery.min.js", "text/javascript", 
-        server_jquery_min_js_start, ( server_jquery_min_js_end - server_jquery_min_js_start)
+        server_jquery_min_js_start, ( server_jquery_min_js_end - server_jquery_min_js_start),
+        server_jquery_min_js_gz_start, ( server_jquery_min_js_gz_end - server_jquery_min_js_gz_start),
+        ETAG_JQUERY_MIN_JS, ETAG_JQUERY_MIN_JS_GZ
     }
 } };
 
 
+// a 304, the gzipped copy or the plain one, see rest_router.h
+static esp_err_t static_send(httpd_req_t *req, const rest_static_t *content) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = rest_static_send(req, content);
+    rest_server_request_done(start);
+    return(err);
+}
+
 esp_err_t static_uri_handler(httpd_req_t *req) {
 
     esp_err_t err;
 
     ESP_LOGD(TAG," received static URI request for %s",req->uri);
 
-    // short lived connections
-    httpd_resp_set_hdr(req,"Connection","close");
     httpd_resp_set_hdr(req,"Cache-Control","max-age=99999");
 
     size_t query_len = httpd_req_get_url_query_len(req);
@@ -299,8 +751,7 @@ esp_err_t static_uri_handler(httpd_req_t *req) {
         for (auto& static_content : static_contents) {
             if (strcmp(static_content.name, query) == 0) {
                 ESP_LOGD(TAG,"static_http: sending %s response",query);
-                httpd_resp_set_type(req, static_content.content_type);
-                httpd_resp_send(req, (const char *) static_content.buf, static_content.buf_len);
+                static_send(req, &static_content);
                 found = true;
                 break;
             }
@@ -325,15 +776,13 @@ esp_err_t root_uri_handler(httpd_req_t *req) {
 
     ESP_LOGI(TAG," received root URI request for %s",req->uri);
 
-    // short lived connections, cache it all
-    httpd_resp_set_hdr(req,"Connection","close");
+    // cache it all
     httpd_resp_set_hdr(req,"Cache-Control","max-age=99999");
 
     // by convention, whatever is 0 will be served out of root
-    static_content_t *root = &static_contents[0];
+    rest_static_t *root = &static_contents[0];
 
-    httpd_resp_set_type(req, root->content_type);
-    httpd_resp_send(req, (const char *) root->buf, root->buf_len);
+    static_send(req, root);
 
     return( ESP_OK );
 }
@@ -355,19 +804,32 @@ httpd_uri_t uri_root {
 httpd_uri_t uri_rest_get {
     .uri = "/rest/*",
     .method = HTTP_GET,
-    .handler = rest_uri_handler,
-    .user_ctx = NULL
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
 };
 
 httpd_uri_t uri_rest_post {
     .uri = "/rest/*",
     .method = HTTP_POST,
-    .handler = rest_uri_handler,
-    .user_ctx = NULL
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
 };
 
+httpd_uri_t uri_rest_patch {
+    .uri = "/rest/*",
+    .method = HTTP_PATCH,
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
+};
+
+httpd_uri_t uri_ws {
+    .uri = "/ws",
+    .method = HTTP_GET,
+    .handler = ws_uri_handler,
+    .user_ctx = NULL,
+    .is_websocket = true
+};
 
-static httpd_handle_t g_httpserver = NULL;
 
 esp_err_t webserver_init(void) {
 
@@ -380,6 +842,8 @@ esp_err_t webserver_init(void) {
     config.server_port = 80;
      // this server does match wildcards if you use a fancier function
     config.uri_match_fn = httpd_uri_match_wildcard;
+    // keep-alive, LRU purge, socket counts
+    rest_server_config(&config);
     // there's a globaluserctx that gets passed on responses
 
     err = httpd_start( &g_httpserver, &config );
@@ -402,6 +866,17 @@ esp_err_t webserver_init(void) {
         return(ESP_FAIL);
     }
 
+    err = frame_init();
+    if (err != ESP_OK) {
+        return(ESP_FAIL);
+    }
+
+    err = rest_router_init(&g_rest_router, rest_routes, sizeof(rest_routes) / sizeof(rest_routes[0]));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "webserver_init: could not build rest routes");
+        return(ESP_FAIL);
+    }
+
     // rest get URI
     err = httpd_register_uri_handler(g_httpserver, &uri_rest_get);
     if (err != ESP_OK) { 
@@ -416,6 +891,30 @@ esp_err_t webserver_init(void) {
         return(ESP_FAIL);
     }
 
+    // rest patch URI
+    err = httpd_register_uri_handler(g_httpserver, &uri_rest_patch);
+    if (err != ESP_OK) { 
+        ESP_LOGW(TAG, "webserver_init: could not register rest patch handler %d %s",err,esp_err_to_name(err)); 
+        return(ESP_FAIL);
+    }
+
+    // push channel
+    err = httpd_register_uri_handler(g_httpserver, &uri_ws);
+    if (err != ESP_OK) { 
+        ESP_LOGW(TAG, "webserver_init: could not register websocket handler %d %s",err,esp_err_to_name(err)); 
+        return(ESP_FAIL);
+    }
+
+    ledc_push_table_init(&g_push);
+    ledc_delta_init(&g_push_delta);
+
+    esp_timer_create_args_t timer_args;
+    memset(&timer_args, 0, sizeof(timer_args));
+    timer_args.callback = push_timer_cb;
+    timer_args.name = "ledc_push";
+    esp_timer_create(&timer_args, &g_push_timer);
+    esp_timer_start_periodic(g_push_timer, LEDC_PUSH_PERIOD_MS * 1000L);
+
     ESP_LOGI(TAG," webserver init success!!!!");
 
     return(ESP_OK);
@@ -423,6 +922,11 @@ esp_err_t webserver_init(void) {
 
 void webserver_destroy(void) {
 
+    if (g_push_timer) {
+        esp_timer_stop(g_push_timer);
+        esp_timer_delete(g_push_timer);
+        g_push_timer = NULL;
+    }
     httpd_stop(g_httpserver);
 
 }
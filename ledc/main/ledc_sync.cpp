@@ -0,0 +1,383 @@
+/* LEDC multi-node sync
+
+   Copywrite Brian Bulkowski, 2020
+
+   Several boards on one facade drift apart within minutes: each one's
+   effects run off its own clock. This keeps a follower's WS2812FX timebase
+   on the leader's clock, and makes mode, speed and palette changes land on
+   the same frame everywhere. The protocol and the arithmetic are in
+   ledc_timesync.cpp; this is the UDP side, one task, one socket.
+
+   The leader broadcasts a beacon every second. A follower takes the first
+   leader it hears, and asks it for the time - four times a second until the
+   filter is full, then once a second. The render task asks for the timebase
+   each frame, which is when the slewing happens.
+
+   When the leader's mode changes, it's queued locally to apply
+   LEDC_SYNC_CMD_LEAD_MS from now, and the same change and time are broadcast.
+   Followers turn the time into their own clock and queue it the same way.
+   The broadcast goes out a few times, followers drop the repeats.
+
+   Followers don't run the leader's playlist. Each preset it moves to goes
+   out as mode, speed, palette and color changes, timed for when its fade
+   finishes. The render task hands those over and the sync task sends them,
+   so the render task never waits on a socket.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+
+#include "lwip/sockets.h"
+
+#include "esp_log.h"
+static const char *TAG = "ledc_sync";
+
+#include "ledc.h"
+#include "ledc_timesync.h"
+
+#define LEDC_SYNC_BEACON_MS 1000
+#define LEDC_SYNC_REQ_FAST_MS 250
+#define LEDC_SYNC_REQ_MS 1000
+
+// no beacon for this long and the leader is gone; we keep its clock until another shows up
+#define LEDC_SYNC_LEADER_TIMEOUT_MS 10000
+
+// how far ahead the leader schedules a change - enough for the broadcast to get there
+#define LEDC_SYNC_CMD_LEAD_MS 150
+#define LEDC_SYNC_CMD_REPEAT 3
+
+static volatile ledc_sync_role_t g_sync_role = LEDC_SYNC_OFF;
+
+// the estimate is read by the render task, written by the sync task
+static portMUX_TYPE g_sync_mux = portMUX_INITIALIZER_UNLOCKED;
+static ledc_timesync_t g_ts;
+
+static int g_sync_s = -1;
+
+// follower
+static struct sockaddr_in g_sync_leader;
+static bool g_sync_have_leader = false;
+static int64_t g_sync_leader_seen = 0;
+static uint16_t g_sync_req_seq = 0;
+static int64_t g_sync_req_t1 = 0;
+static int g_sync_cmd_last = -1;
+
+// leader
+static uint16_t g_sync_cmd_seq = 0;
+// a preset to announce, from the render task; under g_sync_mux
+static ledc_preset_t g_sync_preset;
+static int64_t g_sync_preset_at = 0;     // 0 is nothing waiting
+
+static uint32_t g_sync_cmds = 0;
+
+static void ledc_sync_send(const ledc_sync_pkt_t *pkt, const struct sockaddr_in *to) {
+  uint8_t buf[LEDC_SYNC_PKT_LEN];
+  int len = ledc_sync_pkt_write(pkt, buf, sizeof(buf));
+  if (len < 0 || g_sync_s < 0) return;
+  if (sendto(g_sync_s, buf, len, 0, (const struct sockaddr *) to, sizeof(*to)) < 0) {
+    ESP_LOGD(TAG, "sync: send type %d failed", pkt->type);
+  }
+}
+
+static void ledc_sync_broadcast(const ledc_sync_pkt_t *pkt) {
+  struct sockaddr_in to;
+  memset(&to, 0, sizeof(to));
+  to.sin_family = AF_INET;
+  to.sin_port = htons(LEDC_SYNC_PORT);
+  to.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+  ledc_sync_send(pkt, &to);
+}
+
+static void ledc_sync_reset(void) {
+  portENTER_CRITICAL(&g_sync_mux);
+  ledc_timesync_init(&g_ts);
+  portEXIT_CRITICAL(&g_sync_mux);
+  g_sync_have_leader = false;
+  g_sync_cmd_last = -1;
+}
+
+// a change from the leader, on its clock
+static void ledc_sync_cmd_apply(const ledc_sync_pkt_t *pkt) {
+
+  if (pkt->seq == g_sync_cmd_last) return;
+  g_sync_cmd_last = pkt->seq;
+  g_sync_cmds++;
+
+  int64_t now = esp_timer_get_time();
+  int64_t at = 0;
+  portENTER_CRITICAL(&g_sync_mux);
+  if (g_ts.synced) at = pkt->t3 - ledc_timesync_applied(&g_ts, now);
+  portEXIT_CRITICAL(&g_sync_mux);
+  // a time that's nowhere near now means the clocks aren't right yet - just do it
+  if (at - now > 10 * LEDC_SYNC_CMD_LEAD_MS * 1000LL) at = 0;
+
+  ESP_LOGI(TAG, "sync: cmd %d segment %d value %d in %lld us", pkt->cmd, pkt->segment, pkt->value,
+      at ? at - now : 0);
+
+  switch (pkt->cmd) {
+    case LEDC_SYNC_CMD_MODE:
+      ledc_segment_mode_set_at(pkt->segment, pkt->value, at);
+      break;
+    case LEDC_SYNC_CMD_SPEED:
+      ledc_segment_speed_set_at(pkt->segment, pkt->value, at);
+      break;
+    case LEDC_SYNC_CMD_PALETTE:
+      ledc_segment_palette_set_at(pkt->segment, pkt->value, at);
+      break;
+    case LEDC_SYNC_CMD_COLOR:
+      ledc_segment_color_set_at(pkt->segment, (uint32_t) pkt->value >> 24, pkt->value & 0xFFFFFF, at);
+      break;
+    default:
+      break;
+  }
+}
+
+static void ledc_sync_recv(const uint8_t *buf, int len, const struct sockaddr_in *from, int64_t t_recv) {
+
+  ledc_sync_pkt_t pkt;
+  if (ledc_sync_pkt_read(&pkt, buf, len) < 0) return;
+
+  ledc_sync_role_t role = g_sync_role;
+
+  if (role == LEDC_SYNC_LEADER && pkt.type == LEDC_SYNC_REQ) {
+    ledc_sync_pkt_t resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.type = LEDC_SYNC_RESP;
+    resp.seq = pkt.seq;
+    resp.t1 = pkt.t1;
+    resp.t2 = t_recv;
+    resp.t3 = esp_timer_get_time();
+    ledc_sync_send(&resp, from);
+    return;
+  }
+
+  if (role != LEDC_SYNC_FOLLOWER) return;
+
+  switch (pkt.type) {
+    case LEDC_SYNC_BEACON:
+      if (g_sync_have_leader && from->sin_addr.s_addr != g_sync_leader.sin_addr.s_addr) {
+        // there should be one leader; stay with the one we have unless it's gone quiet
+        if ((t_recv - g_sync_leader_seen) < LEDC_SYNC_LEADER_TIMEOUT_MS * 1000LL) return;
+        ESP_LOGI(TAG, "sync: old leader gone, switching");
+        ledc_sync_reset();
+      }
+      if (!g_sync_have_leader) {
+        ESP_LOGI(TAG, "sync: following %s", inet_ntoa(from->sin_addr));
+        g_sync_leader = *from;
+        g_sync_leader.sin_port = htons(LEDC_SYNC_PORT);
+        g_sync_have_leader = true;
+      }
+      g_sync_leader_seen = t_recv;
+      break;
+
+    case LEDC_SYNC_RESP:
+      // only the answer to the last question, anything else is stale
+      if (pkt.seq != g_sync_req_seq || pkt.t1 != g_sync_req_t1) return;
+      portENTER_CRITICAL(&g_sync_mux);
+      ledc_timesync_sample(&g_ts, pkt.t1, pkt.t2, pkt.t3, t_recv);
+      portEXIT_CRITICAL(&g_sync_mux);
+      g_sync_req_t1 = 0;
+      break;
+
+    case LEDC_SYNC_CMD:
+      if (g_sync_have_leader && from->sin_addr.s_addr == g_sync_leader.sin_addr.s_addr) {
+        ledc_sync_cmd_apply(&pkt);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+static int ledc_sync_socket(void) {
+
+  int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s < 0) {
+    ESP_LOGE(TAG, "sync: could not create socket");
+    return(-1);
+  }
+
+  int on = 1;
+  setsockopt(s, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(LEDC_SYNC_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    ESP_LOGE(TAG, "sync: could not bind port %d", LEDC_SYNC_PORT);
+    close(s);
+    return(-1);
+  }
+  return(s);
+}
+
+static void ledc_sync_task(void *pvParameters) {
+
+  static uint8_t buf[64];
+  int64_t next_send = 0;
+
+  while (true) {
+
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(g_sync_s, &rfds);
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 50000 };
+    int n = select(g_sync_s + 1, &rfds, NULL, NULL, &tv);
+
+    if (n > 0 && FD_ISSET(g_sync_s, &rfds)) {
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      int len = recvfrom(g_sync_s, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+      int64_t t_recv = esp_timer_get_time();
+      if (len > 0) ledc_sync_recv(buf, len, &from, t_recv);
+    }
+
+    ledc_preset_t preset;
+    portENTER_CRITICAL(&g_sync_mux);
+    int64_t preset_at = g_sync_preset_at;
+    if (preset_at) preset = g_sync_preset;
+    g_sync_preset_at = 0;
+    portEXIT_CRITICAL(&g_sync_mux);
+    if (preset_at) {
+      ledc_sync_announce(LEDC_SYNC_CMD_MODE, -1, preset.mode, preset_at);
+      ledc_sync_announce(LEDC_SYNC_CMD_SPEED, -1, preset.speed, preset_at);
+      ledc_sync_announce(LEDC_SYNC_CMD_PALETTE, -1, preset.palette, preset_at);
+      for (int c = 0; c < LEDC_PRESET_COLORS; c++) {
+        ledc_sync_announce(LEDC_SYNC_CMD_COLOR, -1, (c << 24) | (preset.colors[c] & 0xFFFFFF), preset_at);
+      }
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (now < next_send) continue;
+
+    ledc_sync_role_t role = g_sync_role;
+    if (role == LEDC_SYNC_LEADER) {
+      ledc_sync_pkt_t beacon;
+      memset(&beacon, 0, sizeof(beacon));
+      beacon.type = LEDC_SYNC_BEACON;
+      beacon.t3 = now;
+      ledc_sync_broadcast(&beacon);
+      next_send = now + LEDC_SYNC_BEACON_MS * 1000LL;
+    }
+    else if (role == LEDC_SYNC_FOLLOWER && g_sync_have_leader) {
+      ledc_sync_pkt_t req;
+      memset(&req, 0, sizeof(req));
+      req.type = LEDC_SYNC_REQ;
+      req.seq = ++g_sync_req_seq;
+      req.t1 = g_sync_req_t1 = esp_timer_get_time();
+      ledc_sync_send(&req, &g_sync_leader);
+      next_send = now + (g_ts.n_samples < LEDC_SYNC_SAMPLES ? LEDC_SYNC_REQ_FAST_MS : LEDC_SYNC_REQ_MS) * 1000LL;
+    }
+    else {
+      next_send = now + LEDC_SYNC_REQ_FAST_MS * 1000LL;
+    }
+  }
+}
+
+/*
+** the rest of ledc calls these
+*/
+
+// what to add to millis() so the effects run on the leader's clock. The render
+// task calls this every frame.
+uint32_t ledc_sync_timebase(void) {
+
+  if (g_sync_role != LEDC_SYNC_FOLLOWER) return(0);
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&g_sync_mux);
+  int64_t offset = ledc_timesync_applied(&g_ts, now);
+  portEXIT_CRITICAL(&g_sync_mux);
+
+  return( (uint32_t) ((now + offset) / 1000) - (uint32_t) (now / 1000) );
+}
+
+// When to apply a change the leader is about to make: a moment from now, so
+// the followers can hear about it first. 0 means now.
+int64_t ledc_sync_apply_time(void) {
+  if (g_sync_role != LEDC_SYNC_LEADER) return(0);
+  return( esp_timer_get_time() + LEDC_SYNC_CMD_LEAD_MS * 1000LL );
+}
+
+// the leader tells the followers about a change it queued for apply_at
+void ledc_sync_announce(int cmd, int segment, int value, int64_t apply_at) {
+
+  if (g_sync_role != LEDC_SYNC_LEADER || apply_at == 0) return;
+
+  ledc_sync_pkt_t pkt;
+  memset(&pkt, 0, sizeof(pkt));
+  pkt.type = LEDC_SYNC_CMD;
+  pkt.seq = ++g_sync_cmd_seq;
+  pkt.t3 = apply_at;
+  pkt.cmd = cmd;
+  pkt.segment = segment;
+  pkt.value = value;
+  for (int i = 0; i < LEDC_SYNC_CMD_REPEAT; i++) ledc_sync_broadcast(&pkt);
+  g_sync_cmds++;
+}
+
+// The sync task sends it within LEDC_SYNC_CMD_LEAD_MS, so apply_at should
+// be at least ledc_sync_apply_time(). A newer one replaces one not yet sent.
+void ledc_sync_announce_preset(const ledc_preset_t *p, int64_t apply_at) {
+
+  if (g_sync_role != LEDC_SYNC_LEADER || apply_at == 0) return;
+
+  portENTER_CRITICAL(&g_sync_mux);
+  g_sync_preset = *p;
+  g_sync_preset_at = apply_at;
+  portEXIT_CRITICAL(&g_sync_mux);
+}
+
+int ledc_sync_role_get(void) {
+  return(g_sync_role);
+}
+
+esp_err_t ledc_sync_role_set(int role) {
+  if (role < LEDC_SYNC_OFF || role > LEDC_SYNC_FOLLOWER) return(ESP_FAIL);
+  if (role == g_sync_role) return(ESP_OK);
+  ESP_LOGI(TAG, "sync: role %d", role);
+  g_sync_role = (ledc_sync_role_t) role;
+  ledc_sync_reset();
+  return(ESP_OK);
+}
+
+void ledc_sync_stats_get(ledc_sync_stats_t *stats) {
+  memset(stats, 0, sizeof(ledc_sync_stats_t));
+  stats->role = g_sync_role;
+  stats->cmds = g_sync_cmds;
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&g_sync_mux);
+  stats->synced = g_ts.synced;
+  stats->offset_us = g_ts.offset;
+  stats->applied_us = ledc_timesync_applied(&g_ts, now);
+  stats->rtt_us = g_ts.rtt;
+  stats->samples = g_ts.n_total;
+  stats->steps = g_ts.n_steps;
+  portEXIT_CRITICAL(&g_sync_mux);
+  stats->leader_age_ms = g_sync_have_leader ? (now - g_sync_leader_seen) / 1000 : -1;
+}
+
+esp_err_t ledc_sync_init(void) {
+
+  ledc_timesync_init(&g_ts);
+
+  g_sync_s = ledc_sync_socket();
+  if (g_sync_s < 0) return(ESP_FAIL);
+
+  // same core and priority as the realtime receiver, away from the render task
+  xTaskCreatePinnedToCore(&ledc_sync_task, "ledc_sync", 4096 /*stacksize*/, NULL/*pvparam*/, 5 /*pri*/, NULL/*taskhandle*/, 1/*coreid*/);
+
+  return(ESP_OK);
+}
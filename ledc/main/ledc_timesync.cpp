@@ -0,0 +1,134 @@
+/* LEDC time sync
+
+   Copywrite Brian Bulkowski, 2020
+
+   See ledc_timesync.h. Kept free of ESP-IDF so several followers and a
+   leader can be run as processes on one desktop, and the sync error measured.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "ledc_timesync.h"
+
+static const uint8_t sync_magic[4] = { 'L','S','Y','N' };
+#define LEDC_SYNC_VERSION 1
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+  for (int i = 0; i < n; i++) p[i] = (v >> (i * 8)) & 0xFF;
+}
+
+static uint64_t get_le(const uint8_t *p, int n) {
+  uint64_t v = 0;
+  for (int i = 0; i < n; i++) v |= (uint64_t) p[i] << (i * 8);
+  return(v);
+}
+
+int ledc_sync_pkt_write(const ledc_sync_pkt_t *pkt, uint8_t *buf, size_t buf_len) {
+
+  if (buf_len < LEDC_SYNC_PKT_LEN) return(-1);
+
+  memcpy(buf, sync_magic, 4);
+  buf[4] = LEDC_SYNC_VERSION;
+  buf[5] = pkt->type;
+  put_le(&buf[6], pkt->seq, 2);
+  put_le(&buf[8], (uint64_t) pkt->t1, 8);
+  put_le(&buf[16], (uint64_t) pkt->t2, 8);
+  put_le(&buf[24], (uint64_t) pkt->t3, 8);
+  buf[32] = pkt->cmd;
+  buf[33] = (uint8_t) pkt->segment;
+  put_le(&buf[34], (uint32_t) pkt->value, 4);
+  return(LEDC_SYNC_PKT_LEN);
+}
+
+int ledc_sync_pkt_read(ledc_sync_pkt_t *pkt, const uint8_t *buf, size_t len) {
+
+  if (len < LEDC_SYNC_PKT_LEN) return(-1);
+  if (memcmp(buf, sync_magic, 4) != 0 || buf[4] != LEDC_SYNC_VERSION) return(-1);
+  if (buf[5] < LEDC_SYNC_BEACON || buf[5] > LEDC_SYNC_CMD) return(-1);
+
+  pkt->type = buf[5];
+  pkt->seq = get_le(&buf[6], 2);
+  pkt->t1 = (int64_t) get_le(&buf[8], 8);
+  pkt->t2 = (int64_t) get_le(&buf[16], 8);
+  pkt->t3 = (int64_t) get_le(&buf[24], 8);
+  pkt->cmd = buf[32];
+  pkt->segment = (int8_t) buf[33];
+  pkt->value = (int32_t) get_le(&buf[34], 4);
+  return(0);
+}
+
+void ledc_timesync_init(ledc_timesync_t *ts) {
+  memset(ts, 0, sizeof(ledc_timesync_t));
+  ts->synced = false;
+}
+
+bool ledc_timesync_sample(ledc_timesync_t *ts, int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+
+  int64_t rtt = (t4 - t1) - (t3 - t2);
+  if (rtt < 0 || t4 < t1) return(false);
+
+  int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+  // Each sample is within half its round trip of the truth, so two that are
+  // further apart than that and a step can't both be right: the leader's
+  // clock jumped ( it rebooted, at the same address ). What we had is stale,
+  // start the filter again from this one.
+  if (ts->synced) {
+    int64_t d = offset - ts->offset;
+    if (d < 0) d = -d;
+    if (d > LEDC_SYNC_STEP_US + (rtt + ts->rtt) / 2) {
+      ts->n_samples = 0;
+      ts->next = 0;
+      ts->n_resets++;
+    }
+  }
+
+  ledc_sync_sample_t *s = &ts->samples[ts->next];
+  s->offset = offset;
+  s->rtt = rtt;
+  ts->next = (ts->next + 1) % LEDC_SYNC_SAMPLES;
+  if (ts->n_samples < LEDC_SYNC_SAMPLES) ts->n_samples++;
+  ts->n_total++;
+
+  // believe the quickest one we have
+  const ledc_sync_sample_t *best = &ts->samples[0];
+  for (int i = 1; i < ts->n_samples; i++) {
+    if (ts->samples[i].rtt < best->rtt) best = &ts->samples[i];
+  }
+  ts->offset = best->offset;
+  ts->rtt = best->rtt;
+
+  if (!ts->synced) {
+    ts->synced = true;
+    ts->applied = ts->offset;
+    ts->last_slew = t4;
+    ts->n_steps++;
+  }
+  return(true);
+}
+
+int64_t ledc_timesync_applied(ledc_timesync_t *ts, int64_t now) {
+
+  if (!ts->synced) return(0);
+
+  int64_t err = ts->offset - ts->applied;
+  int64_t elapsed = now - ts->last_slew;
+  if (elapsed <= 0) return(ts->applied);
+  ts->last_slew = now;
+
+  if (err > LEDC_SYNC_STEP_US || err < -LEDC_SYNC_STEP_US) {
+    ts->applied = ts->offset;
+    ts->n_steps++;
+    return(ts->applied);
+  }
+
+  int64_t max = elapsed * LEDC_SYNC_SLEW_PER_S / 1000000;
+  if (err > max) err = max;
+  else if (err < -max) err = -max;
+  ts->applied += err;
+  return(ts->applied);
+}
@@ -0,0 +1,113 @@
+/*
+ * ledc_timesync.h
+ * Keeping the effect clocks of several ledc boards together. The packets,
+ * the offset estimate and the slewing - no ESP-IDF in here, it builds
+ * anywhere, so a few copies can be run against each other on a desktop.
+ *
+ * One board is the leader. It broadcasts a beacon now and then so the
+ * followers know where it is, and answers their requests:
+ *
+ *   follower  REQ  t1 ( its clock )          ->  leader
+ *   leader    RESP t1, t2 ( got it ), t3 ( sent reply )  ->  follower, who notes t4
+ *
+ * offset = ((t2 - t1) + (t3 - t4)) / 2 is the leader's clock minus ours, give
+ * or take half the round trip, rtt = (t4 - t1) - (t3 - t2). Like NTP we keep
+ * the last few samples and believe the one with the shortest round trip -
+ * the one least likely to have sat in a queue somewhere.
+ *
+ * The offset in use doesn't jump to each new estimate, it slews toward it, so
+ * effects speed up or slow down a little rather than skip. Only a big error
+ * ( the first sync, a new leader, a leader that rebooted ) steps.
+ *
+ * Mode changes go out as commands with a time to apply them on the leader's
+ * clock, a little in the future, so every board switches on the same frame.
+ *
+ * All times are microseconds. Packets are little endian.
+ *
+ * AS-IS
+ * Copywrite 2020, Brian Bulkowski
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LEDC_SYNC_PORT 4049
+
+// samples in the filter
+#define LEDC_SYNC_SAMPLES 8
+
+// slew at most this much per second of elapsed time - 2%, not something you'd see
+#define LEDC_SYNC_SLEW_PER_S 20000
+// further off than this, just step
+#define LEDC_SYNC_STEP_US 250000
+
+typedef enum {
+  LEDC_SYNC_BEACON = 1,   // leader, broadcast: t = leader clock
+  LEDC_SYNC_REQ = 2,      // follower to leader: t1
+  LEDC_SYNC_RESP = 3,     // leader to follower: t1, t2, t3
+  LEDC_SYNC_CMD = 4       // leader, broadcast: a change and when to make it
+} ledc_sync_type_t;
+
+typedef enum {
+  LEDC_SYNC_CMD_MODE = 1,
+  LEDC_SYNC_CMD_SPEED = 2,
+  LEDC_SYNC_CMD_PALETTE = 3,
+  LEDC_SYNC_CMD_COLOR = 4     // value is slot << 24 | rgb
+} ledc_sync_cmd_type_t;
+
+typedef struct {
+  uint8_t type;       // ledc_sync_type_t
+  uint16_t seq;       // REQ / RESP pairing, CMD de-duplication
+  int64_t t1;
+  int64_t t2;
+  int64_t t3;         // BEACON: leader clock. CMD: apply at, leader clock
+  // CMD only
+  uint8_t cmd;        // ledc_sync_cmd_type_t
+  int8_t segment;     // -1 is all of them
+  int32_t value;
+} ledc_sync_pkt_t;
+
+// magic, version, type, seq, three times, cmd, segment, value
+#define LEDC_SYNC_PKT_LEN (4 + 1 + 1 + 2 + 8 * 3 + 1 + 1 + 4)
+
+// returns the length written, or -1
+int ledc_sync_pkt_write(const ledc_sync_pkt_t *pkt, uint8_t *buf, size_t buf_len);
+// returns 0, or -1 if it isn't one of ours
+int ledc_sync_pkt_read(ledc_sync_pkt_t *pkt, const uint8_t *buf, size_t len);
+
+typedef struct {
+  int64_t offset;
+  int64_t rtt;
+} ledc_sync_sample_t;
+
+typedef struct {
+  ledc_sync_sample_t samples[LEDC_SYNC_SAMPLES];
+  int n_samples;
+  int next;
+  bool synced;
+  int64_t offset;      // best estimate, leader minus local
+  int64_t rtt;         // of the sample it came from
+  int64_t applied;     // what we're using right now, heading for offset
+  int64_t last_slew;   // local time applied was last moved
+  // stats
+  uint32_t n_total;
+  uint32_t n_steps;
+  uint32_t n_resets;   // the leader's clock jumped, the filter started again
+} ledc_timesync_t;
+
+void ledc_timesync_init(ledc_timesync_t *ts);
+
+// a completed exchange. Returns false for one that makes no sense ( negative round trip ).
+bool ledc_timesync_sample(ledc_timesync_t *ts, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+// the offset to use at local time now, slewed toward the estimate. 0 until synced.
+int64_t ledc_timesync_applied(ledc_timesync_t *ts, int64_t now);
+
+// the leader's clock, given ours
+static inline int64_t ledc_timesync_leader_time(ledc_timesync_t *ts, int64_t now) {
+  return( now + ledc_timesync_applied(ts, now) );
+}
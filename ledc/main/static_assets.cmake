@@ -0,0 +1,28 @@
+# Writes static_assets.h, run by main/CMakeLists.txt at build time, once the
+# gzipped copies are made. Every asset gets an ETag from the hash of its
+# bytes, and a gzipped copy one from the hash of its own: the two are sent
+# for the same URL, and a strong validator has to tell them apart.
+#
+#   cmake -DSRC_DIR=.. -DGZ_DIR=.. -DASSETS=a|b -DGZ_ASSETS=a -DOUT=.. -P static_assets.cmake
+#
+# The lists are | separated, a ; wouldn't survive the command line.
+
+cmake_minimum_required(VERSION 3.5)
+
+string(REPLACE "|" ";" ASSETS "${ASSETS}")
+string(REPLACE "|" ";" GZ_ASSETS "${GZ_ASSETS}")
+
+set(content "// generated by main/static_assets.cmake from the embedded files, do not edit\n")
+foreach(asset ${ASSETS})
+    string(MAKE_C_IDENTIFIER ${asset} id)
+    string(TOUPPER ${id} id)
+    file(SHA256 "${SRC_DIR}/${asset}" hash)
+    string(SUBSTRING ${hash} 0 16 hash)
+    string(APPEND content "#define ETAG_${id} \"\\\"${hash}\\\"\"\n")
+    if(asset IN_LIST GZ_ASSETS)
+        file(SHA256 "${GZ_DIR}/${asset}.gz" hash)
+        string(SUBSTRING ${hash} 0 16 hash)
+        string(APPEND content "#define ETAG_${id}_GZ \"\\\"${hash}\\\"\"\n")
+    endif()
+endforeach()
+file(WRITE "${OUT}" "${content}")
@@ -0,0 +1,95 @@
+/* RestRouter-idf server setup and metrics
+
+   Copyright Brian Bulkowski, (c) 2020
+
+   See rest_router.h. Everything here runs on the httpd task - handlers,
+   and the socket open and close callbacks - so the stats need no lock.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+
+#include "lwip/sockets.h"
+
+#include "esp_log.h"
+static const char *TAG = "rest_server";
+
+#include "rest_router.h"
+
+static rest_server_stats_t g_server_stats;
+
+static esp_err_t rest_server_open(httpd_handle_t hd, int sockfd) {
+  g_server_stats.sockets_open++;
+  g_server_stats.sockets_total++;
+  if (g_server_stats.sockets_open > g_server_stats.sockets_peak) {
+    g_server_stats.sockets_peak = g_server_stats.sockets_open;
+  }
+  ESP_LOGD(TAG, "socket %d open, %u open", sockfd, g_server_stats.sockets_open);
+  return(ESP_OK);
+}
+
+// with a close_fn, closing the socket is up to us
+static void rest_server_close(httpd_handle_t hd, int sockfd) {
+  if (g_server_stats.sockets_open) g_server_stats.sockets_open--;
+  ESP_LOGD(TAG, "socket %d closed, %u open", sockfd, g_server_stats.sockets_open);
+  close(sockfd);
+}
+
+void rest_server_config(httpd_config_t *config) {
+  config->max_open_sockets = REST_MAX_OPEN_SOCKETS;
+  config->backlog_conn = REST_BACKLOG;
+  config->lru_purge_enable = true;
+  config->open_fn = rest_server_open;
+  config->close_fn = rest_server_close;
+}
+
+void rest_server_keep(httpd_handle_t hd, int sockfd) {
+  httpd_sess_update_lru_counter(hd, sockfd);
+}
+
+void rest_server_request_done(int64_t start) {
+  uint32_t us = (uint32_t) (esp_timer_get_time() - start);
+  rest_server_stats_t *st = &g_server_stats;
+  if (st->requests == 0) st->response_us_avg = us;
+  else st->response_us_avg = st->response_us_avg - (st->response_us_avg >> 3) + (us >> 3);
+  if (us > st->response_us_max) st->response_us_max = us;
+  st->requests++;
+}
+
+void rest_server_stats_get(rest_server_stats_t *stats) {
+  *stats = g_server_stats;
+}
+
+static bool rest_server_flush(void *ctx, const char *buf, size_t len) {
+  return( httpd_resp_send_chunk((httpd_req_t *) ctx, buf, len) == ESP_OK );
+}
+
+esp_err_t rest_server_stats_handler(httpd_req_t *req, const char *content) {
+
+  rest_server_stats_t st = g_server_stats;
+
+  httpd_resp_set_type(req, "application/json");
+
+  char buf[128];
+  json_writer_t w;
+  json_writer_init(&w, buf, sizeof(buf), rest_server_flush, req);
+  json_obj_begin(&w, NULL);
+  json_int(&w, "requests", st.requests);
+  json_int(&w, "response_us_avg", st.response_us_avg);
+  json_int(&w, "response_us_max", st.response_us_max);
+  json_int(&w, "sockets_open", st.sockets_open);
+  json_int(&w, "sockets_peak", st.sockets_peak);
+  json_int(&w, "sockets_total", st.sockets_total);
+  json_int(&w, "sockets_max", REST_MAX_OPEN_SOCKETS);
+  json_obj_end(&w);
+  if (json_writer_finish(&w) < 0) return(ESP_FAIL);
+  return( httpd_resp_send_chunk(req, NULL, 0) );
+}
@@ -0,0 +1,68 @@
+/* RestRouter-idf static files
+
+   Copyright Brian Bulkowski, (c) 2020
+
+   See rest_router.h.
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_http_server.h"
+#include "esp_err.h"
+
+#include "esp_log.h"
+static const char *TAG = "rest_static";
+
+#include "rest_router.h"
+
+// does request header hdr contain token? Long headers just say no.
+static bool rest_static_hdr_has(httpd_req_t *req, const char *hdr, const char *token) {
+  char value[128];
+  size_t len = httpd_req_get_hdr_value_len(req, hdr);
+  if (len == 0 || len >= sizeof(value)) return(false);
+  if (httpd_req_get_hdr_value_str(req, hdr, value, sizeof(value)) != ESP_OK) return(false);
+  return( strstr(value, token) != NULL );
+}
+
+esp_err_t rest_static_send(httpd_req_t *req, const rest_static_t *content) {
+
+  const uint8_t *buf = content->buf;
+  ssize_t buf_len = content->buf_len;
+  const char *etag = content->etag;
+  bool gz = false;
+  if (content->gz_buf) {
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    gz = rest_static_hdr_has(req, "Accept-Encoding", "gzip");
+    if (gz) {
+      buf = content->gz_buf;
+      buf_len = content->gz_len;
+      etag = content->gz_etag;
+    }
+  }
+
+  httpd_resp_set_hdr(req, "ETag", etag);
+
+  if (rest_static_hdr_has(req, "If-None-Match", etag)) {
+    ESP_LOGD(TAG, "%s not modified", content->name);
+    httpd_resp_set_status(req, "304 Not Modified");
+    return( httpd_resp_send(req, NULL, 0) );
+  }
+
+  if (gz) httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  httpd_resp_set_type(req, content->content_type);
+
+  for (ssize_t off = 0; off < buf_len; off += REST_STATIC_CHUNK) {
+    ssize_t sz = buf_len - off < REST_STATIC_CHUNK ? buf_len - off : REST_STATIC_CHUNK;
+    esp_err_t err = httpd_resp_send_chunk(req, (const char *) buf + off, sz);
+    if (err != ESP_OK) {
+      ESP_LOGD(TAG, "send %s failed %d %s", content->name, err, esp_err_to_name(err));
+      return(err);
+    }
+  }
+  return( httpd_resp_send_chunk(req, NULL, 0) );
+}
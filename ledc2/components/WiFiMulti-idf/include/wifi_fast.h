@@ -0,0 +1,141 @@
+/* WiFiMulti-idf fast reconnect
+
+** Connecting with a scan of every channel takes seconds, and before that
+** the connect task waits for the scan task to have seen something. Most of
+** the time the AP is the one from last time, on the same channel, so that's
+** tried first: straight to its BSSID on its channel, no scan. If that
+** doesn't work WIFI_FAST_DIRECT_MAX times running, it's back to scanning
+** and picking the best, until that gets a new AP to remember.
+**
+** What's remembered - SSID, BSSID, channel, auth mode - is saved once an
+** address comes, through wifi_fast_store_t: RTC memory, which survives
+** deep sleep and resets, and NVS, for a cold boot. Only when it changes.
+**
+** No ESP-IDF in here, it builds anywhere. The radio is reached through
+** wifi_fast_driver_t, so a desktop can drive it with a fake one.
+**
+** Copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WIFI_FAST_SSID_LEN 33       // 32 and a null
+#define WIFI_FAST_PASSWORD_LEN 65
+#define WIFI_FAST_MAGIC 0x57464331  // "WFC1"
+
+// direct attempts in a row that don't get an address before scanning again
+#define WIFI_FAST_DIRECT_MAX 2
+
+// the app adds its APs just after starting, give it this long before
+// deciding the remembered one isn't one of them
+#define WIFI_FAST_REGISTER_US (2LL * 1000 * 1000)
+
+// this is what's kept
+typedef struct {
+    uint32_t magic;
+    uint8_t ssid[WIFI_FAST_SSID_LEN];
+    uint8_t bssid[6];
+    uint8_t channel;
+    int32_t authmode;
+    uint32_t check;             // over the rest, RTC memory is whatever it was on power up
+} wifi_fast_cache_t;
+
+typedef struct {
+    bool (*load)(void *ctx, wifi_fast_cache_t *c);
+    void (*save)(void *ctx, const wifi_fast_cache_t *c);
+    void *ctx;
+} wifi_fast_store_t;
+
+// what to connect to
+typedef struct {
+    uint8_t ssid[WIFI_FAST_SSID_LEN];
+    uint8_t password[WIFI_FAST_PASSWORD_LEN];
+    bool direct;                // bssid and channel are good, don't scan
+    uint8_t bssid[6];
+    uint8_t channel;
+    int32_t authmode;
+} wifi_fast_target_t;
+
+typedef struct {
+    // the password for a registered SSID, false if it isn't one ( any more )
+    bool (*password)(void *ctx, const uint8_t *ssid, uint8_t *password);
+    // the best AP from scanning, false if there isn't one yet
+    bool (*best)(void *ctx, wifi_fast_target_t *t);
+    // set the config and start connecting, 0 if it started
+    int (*connect)(void *ctx, const wifi_fast_target_t *t);
+    void *ctx;
+} wifi_fast_driver_t;
+
+typedef enum {
+    WIFI_FAST_VIA_NONE = 0,
+    WIFI_FAST_VIA_DIRECT = 1,
+    WIFI_FAST_VIA_SCAN = 2
+} wifi_fast_via_t;
+
+// time to an address, from when the link went ( or boot )
+typedef struct {
+    uint32_t n;
+    int64_t last_us;
+    int64_t min_us;
+    int64_t max_us;
+    int64_t sum_us;
+} wifi_fast_time_t;
+
+typedef struct {
+    wifi_fast_cache_t cache;
+    bool cache_valid;
+    int direct_fails;           // in a row
+    wifi_fast_via_t attempt;   // what's in progress
+    wifi_fast_via_t up;        // what got the link that's up
+    int64_t down_us;            // when the link went, -1 if it's up
+    int64_t start_us;
+    wifi_fast_cache_t joined;   // what the attempt got, kept if an address comes
+    bool joined_valid;
+    // stats
+    wifi_fast_time_t t_direct;
+    wifi_fast_time_t t_scan;
+    uint32_t n_direct;
+    uint32_t n_direct_fails;
+    uint32_t n_scan;
+    uint32_t n_saves;
+} wifi_fast_t;
+
+void wifi_fast_init(wifi_fast_t *f, const wifi_fast_store_t *store, int64_t now_us);
+
+// the connect task, when it isn't connected or connecting. Returns what it
+// tried, WIFI_FAST_VIA_NONE if there was nothing to try yet.
+wifi_fast_via_t wifi_fast_step(wifi_fast_t *f, const wifi_fast_driver_t *drv, int64_t now_us);
+
+// hold off scanning, a direct attempt's coming or going on
+bool wifi_fast_scan_hold(const wifi_fast_t *f);
+
+// leaving the AP we're on for a better one: the next try is the scan path,
+// not straight back to it
+void wifi_fast_roam(wifi_fast_t *f);
+
+// the events
+void wifi_fast_connected(wifi_fast_t *f, const uint8_t *ssid, int ssid_len, const uint8_t *bssid,
+    int channel, int authmode);
+void wifi_fast_got_ip(wifi_fast_t *f, const wifi_fast_store_t *store, int64_t now_us);
+void wifi_fast_disconnected(wifi_fast_t *f, int64_t now_us);
+
+void wifi_fast_seal(wifi_fast_cache_t *c);
+bool wifi_fast_cache_check(const wifi_fast_cache_t *c);
+
+const char *wifi_fast_via_name(wifi_fast_via_t k);
+
+#ifdef __cplusplus
+}
+#endif
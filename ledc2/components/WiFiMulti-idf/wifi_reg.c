@@ -0,0 +1,75 @@
+/* WiFiMulti-idf AP registry
+
+** See wifi_reg.h.
+**
+** Portions copyright Brian Bulkowski, (c) 2020
+** brian@bulkowski.org
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+
+#include "wifi_reg.h"
+
+_Static_assert((WIFI_REG_MAX & (WIFI_REG_MAX - 1)) == 0, "WIFI_REG_MAX must be a power of two");
+_Static_assert(WIFI_REG_MAX < 256, "slots are kept in a byte");
+
+#define MASK (WIFI_REG_BUCKETS - 1)
+
+void wifi_reg_init(wifi_reg_t *r) {
+    memset(r, 0, sizeof(wifi_reg_t));
+}
+
+uint32_t wifi_reg_hash(const uint8_t *ssid) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < WIFI_REG_SSID_MAX && ssid[i]; i++) {
+        h ^= ssid[i];
+        h *= 16777619u;
+    }
+    return(h);
+}
+
+// the bucket with this SSID, or the empty one it would go in
+static int probe(wifi_reg_t *r, const uint8_t *ssid, uint32_t h) {
+    int b = h & MASK;
+    r->n_finds++;
+    // never full, there's twice as many buckets as slots
+    while (1) {
+        r->n_probes++;
+        int s = r->bucket[b];
+        if (s == 0) return(b);
+        s--;
+        if (r->hash[s] == h &&
+            strncmp((const char *) r->ssid[s], (const char *) ssid, WIFI_REG_SSID_MAX) == 0) {
+            return(b);
+        }
+        b = (b + 1) & MASK;
+    }
+}
+
+int wifi_reg_find(wifi_reg_t *r, const uint8_t *ssid) {
+    int b = probe(r, ssid, wifi_reg_hash(ssid));
+    return( r->bucket[b] - 1 );
+}
+
+int wifi_reg_add(wifi_reg_t *r, const uint8_t *ssid, bool *added) {
+
+    *added = false;
+    size_t len = strnlen((const char *) ssid, WIFI_REG_SSID_MAX + 1);
+    if (len == 0 || len > WIFI_REG_SSID_MAX) return(-1);
+
+    uint32_t h = wifi_reg_hash(ssid);
+    int b = probe(r, ssid, h);
+    if (r->bucket[b]) return( r->bucket[b] - 1 );
+    if (r->n >= WIFI_REG_MAX) return(-1);
+
+    int s = r->n++;
+    memcpy(r->ssid[s], ssid, len);
+    r->ssid[s][len] = 0;
+    r->hash[s] = h;
+    r->bucket[b] = s + 1;
+    *added = true;
+    return(s);
+}
@@ -28,189 +28,28 @@
 #include "freertos/task.h"
 
 #include "nvs_flash.h"
-#include "cJSON.h"
 
 #include "esp_http_server.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 
 #include "esp_log.h"
 static const char *TAG = "ledc2";
 
 #include "ledc.h"
+#include "rest_router.h"
 
 
 
-// return the integer value of a json element which is in the root
-// Extensions: get a subitem with cJSON_GetObjectItem(parentCJson,child-string)
-//             set values cJSON_GetObjectItem(format,"frame rate")->valueint=25;
-// deleting the root deletes all the things
-// https://github.com/espressif/esp-idf/tree/master/components/json
-// not sure what happens when we can't get the string, though
-static esp_err_t get_json_value_int(const char *json_str, const char *field, int *val) {
-
-    ESP_LOGV(TAG," getjsonvalueint: json %s field %s",json_str,field);
-    const char *err_loc = 0;
-    cJSON *root = cJSON_ParseWithOpts(json_str, &err_loc, false);
-    ESP_LOGV(TAG," cjson parse: root is %p",root);
-    if (! root) {
-        ESP_LOGV(TAG,"could not parse json, error at postition: %d",(int)(err_loc - json_str) );
-        return(ESP_FAIL);
-    }
-
-    cJSON *field_object = cJSON_GetObjectItem(root,field);
-    if (! field_object) {
-        ESP_LOGD(TAG, " JSON parse could not find %s in %s",field,json_str);
-        cJSON_Delete(root);
-        return(ESP_FAIL);
-    }
-    if (! cJSON_IsNumber(field_object)) {
-        ESP_LOGD(TAG, " JSON did not find a number %s in %s",field,json_str);
-        cJSON_Delete(root);
-        return(ESP_FAIL);
-    }
-
-    // NB. This library has a strange idea that number is both double and integer.
-    // in this case I want the closest int.
-
-    *val = field_object->valueint;
-    cJSON_Delete(root);
-    return(ESP_OK);
-}
-
-// rest get calls will come here
-//
-
-esp_err_t rest_uri_handler(httpd_req_t *req) {
-
-    ESP_LOGD(TAG," received rest URI request for %s method %d",req->uri,req->method);
-
-    // did I get content?
-
-    char *content = 0;
-    if (req->content_len > 0) {
-        //ESP_LOGD(TAG," content length is: %d",req->content_len);
-        content =(char *)malloc(req->content_len + 1);
-        int sz = httpd_req_recv(req, content, req->content_len);
-        //ESP_LOGD(TAG," content sz is: %d",sz);
-        if (sz != req->content_len) {
-            //ESP_LOGD(TAG," could not retrieve content: %d",sz);
-            httpd_resp_send_500(req);
-            free(content);
-            return(ESP_OK);
-        }
-        content[req->content_len] = 0;
-        //ESP_LOGD(TAG," content is: %s",content);
-    }
-    
-// going to ignore accept headers...
-#if 0
-    // what is the accept string?
-    size_t hdr_value_len = httpd_req_get_hdr_value_len(req, "Accept");
-    if (hdr_value_len) {
-        char *value =(char *)malloc(hdr_value_len+1);
-        httpd_req_get_hdr_value_str(req, "Accept", value, hdr_value_len );
-        ESP_LOGD(TAG," got accept header: %s",value);
-        free(value);
-    }
-
-    // what is the Connection string?
-    size_t hdr_value_len = httpd_req_get_hdr_value_len(req, "Connection");
-    if (hdr_value_len) {
-        char *value =(char *)malloc(hdr_value_len+1);
-        httpd_req_get_hdr_value_str(req, "Connection", value, hdr_value_len );
-        ESP_LOGD(TAG," got connection header: %s",value);
-        free(value);
-    }
-#endif
-
-    // doing this up here will set it for everything
-    httpd_resp_set_hdr(req,"Connection","close");
-
-    // parse the URI so I can sub-dispatch?
-    const char *last_slash = strrchr(req->uri, '/');
-    last_slash++;
-
-// maintained as example
-#if 0
-    if ( strcmp(last_slash, "fan_pct") == 0) {
-
-        if (req->method == HTTP_GET) {
-
-            char fan_pct_str[20];
-            snprintf(fan_pct_str, sizeof(fan_pct_str),"%d",fanc_percentage_get() );
-
-            ESP_LOGI(TAG,"rest: sending fan percentage %s",fan_pct_str);
-
-            httpd_resp_set_type(req, "text/plain");
-            httpd_resp_sendstr(req, fan_pct_str);
-        }
-        else if (req->method == HTTP_POST) {
-
-            int new_fan_pct = 0;
-            if (ESP_OK == get_json_value_int(content, "fan_pct",&new_fan_pct)) {
-                ESP_LOGI(TAG,"rest: posted, a fan pct to set: %d",new_fan_pct);
-
-                fanc_percentage_set(new_fan_pct);
-
-                // easiest way to say OK?
-                httpd_resp_sendstr(req,"");
-            }
-            else {
-                ESP_LOGW(TAG," posted, a json with a bad value fan pct");
-                httpd_resp_send_err(req,HTTPD_400_BAD_REQUEST,"illegal value");
-            }
-        }
-
-    }
-    else if ( strcmp(last_slash, "fan_speed") == 0) {
-
-        if (req->method == HTTP_GET) {
-
-            char fan_speed_str[20];
-            snprintf(fan_speed_str, sizeof(fan_speed_str),"%.1f",fanc_speed_get() );
-
-            ESP_LOGI(TAG,"rest: sending fan speed %s",fan_speed_str);
-
-            httpd_resp_set_type(req, "text/plain");
-            httpd_resp_sendstr(req, fan_speed_str);
-        }
-    }
-#endif /* 0 */
-    if ( strcmp(last_slash, "uptime") == 0) {
-
-        clock_t cl = clock();
-        uint64_t uptime_sec = cl / CLOCKS_PER_SEC;
-        char uptime_str[20];
-        snprintf(uptime_str, sizeof(uptime_str),"%" PRIu64,uptime_sec);
-
-        ESP_LOGI(TAG,"rest: sending uptime %s",uptime_str);
-
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_sendstr(req, uptime_str);
-    }
-    else if ( strcmp(last_slash, "epoch") == 0) {
-
-        // this might be correct, because we have sntp enabled
-        time_t secs = time(NULL);
-        char secs_str[30];
-        // depending on config, time might be 64 bits, or 32.... play it safe
-        snprintf(secs_str, sizeof(secs_str),"%" PRIu64,(uint64_t) secs);
-
-        ESP_LOGI(TAG,"rest: sending epoch %s",secs_str);
-
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_sendstr(req, secs_str);
-    }
-
-    else {
-        ESP_LOGI(TAG,"rest: unknown endpoint: %s",last_slash);
-        httpd_resp_send_404(req);
-    }
-
-    if (content) free(content);
+// rest calls come here, through the router
+// nothing of its own to set yet
+static const rest_route_t rest_routes[] = {
+    REST_ROUTE_CUSTOM("uptime", rest_uptime_handler),
+    REST_ROUTE_CUSTOM("epoch", rest_epoch_handler),
+    REST_ROUTE_CUSTOM("server", rest_server_stats_handler),
+};
 
-    return(ESP_OK);
-}
+static rest_router_t g_rest_router;
 
 
 //
@@ -258,8 +97,7 @@ esp_err_t static_uri_handler(httpd_req_t *req) {
 
     ESP_LOGI(TAG," received static URI request for %s",req->uri);
 
-    // short lived connections - rather key as we have so few
-    httpd_resp_set_hdr(req,"Connection","close");
+    int64_t start = esp_timer_get_time();
 
     // normally, we would put the cache high, but we're doing a test to see the effects of flashreads
     //httpd_resp_set_hdr(req,"Cache-Control","max-age=99999");
@@ -308,6 +146,7 @@ esp_err_t static_uri_handler(httpd_req_t *req) {
         httpd_resp_sendstr(req, "static server expecting query string");
     }
 
+    rest_server_request_done(start);
     return( ESP_OK );
 }
 
@@ -315,8 +154,8 @@ esp_err_t root_uri_handler(httpd_req_t *req) {
 
     ESP_LOGI(TAG," received root URI request for %s",req->uri);
 
-    // short lived connections
-    httpd_resp_set_hdr(req,"Connection","close");
+    int64_t start = esp_timer_get_time();
+
     httpd_resp_set_hdr(req,"Cache-Control","max-age=99999");
 
     // by convention, whatever is 0 will be served out of root
@@ -325,6 +164,7 @@ esp_err_t root_uri_handler(httpd_req_t *req) {
     httpd_resp_set_type(req, root->content_type);
     httpd_resp_send(req, (const char *) root->buf, root->buf_len);
 
+    rest_server_request_done(start);
     return( ESP_OK );
 }
 
@@ -345,15 +185,15 @@ httpd_uri_t uri_root {
 httpd_uri_t uri_rest_get {
     .uri = "/rest/*",
     .method = HTTP_GET,
-    .handler = rest_uri_handler,
-    .user_ctx = NULL
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
 };
 
 httpd_uri_t uri_rest_post {
     .uri = "/rest/*",
     .method = HTTP_POST,
-    .handler = rest_uri_handler,
-    .user_ctx = NULL
+    .handler = rest_router_handler,
+    .user_ctx = &g_rest_router
 };
 
 
@@ -370,6 +210,8 @@ esp_err_t webserver_init(void) {
     config.server_port = 80;
      // this server does match wildcards if you use a fancier function
     config.uri_match_fn = httpd_uri_match_wildcard;
+    // keep-alive, LRU purge, socket counts
+    rest_server_config(&config);
     // there's a globaluserctx that gets passed on responses
 
 
@@ -393,6 +235,12 @@ esp_err_t webserver_init(void) {
         return(ESP_FAIL);
     }
 
+    err = rest_router_init(&g_rest_router, rest_routes, sizeof(rest_routes) / sizeof(rest_routes[0]));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "webserver_init: could not build rest routes");
+        return(ESP_FAIL);
+    }
+
     // rest get URI
     err = httpd_register_uri_handler(g_httpserver, &uri_rest_get);
     if (err != ESP_OK) { 
@@ -0,0 +1,160 @@
+// Calibration and stalls ( fanc_cal.cpp ), through the control task's loop
+// ( fanc_ctrl.cpp ) against two simulated fans: they keep turning down to
+// 20% duty but only start from rest above 35%, the curve bends, they lag
+// 0.7s and the tach is 1% noisy. The sweep finds the curve and the bottom,
+// and with the table the slider is linear in speed. A fan at rest set low
+// gets one kick and runs; a seized one gets its kicks, goes to fault, and
+// comes back when it's freed. RPM mode on the calibrated fan, and a fan
+// without a tach that can't be calibrated.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#include "fanc_ctrl.h"
+
+struct fan_t {
+  double rpm = 0;
+  bool turning = false;
+  bool seized = false;
+  int duty = 0;
+  int staged = 0;
+};
+
+static fan_t g_fans[2];
+static fanc_ctrl_t g_ctrl;
+static int64_t g_ms = 1000;
+
+// where it settles at a duty, once it's turning
+static double fan_ss(int duty)
+{
+  if (duty < 200) return 0;
+  return 300 + 2400.0 * pow((duty - 200) / 800.0, 0.6);
+}
+
+static void fan_run(fan_t &f, double dt)
+{
+  if (f.seized) {
+    f.rpm = 0;
+    f.turning = false;
+    return;
+  }
+  if (!f.turning && f.duty >= 350) f.turning = true;
+  if (f.turning && f.duty < 200) f.turning = false;
+  double want = f.turning ? fan_ss(f.duty) : 0;
+  f.rpm += (want - f.rpm) * (1 - exp(-dt / 0.7));
+}
+
+static int hw_rpm_get(void *ctx, int i)
+{
+  if (g_fans[i].rpm < 30) return 0;
+  return (int) (g_fans[i].rpm * (1 + ((rand() % 200) - 100) / 10000.0));
+}
+
+static void hw_duty_set(void *ctx, int i, int permille) { g_fans[i].staged = permille; }
+
+static void hw_duty_commit(void *ctx)
+{
+  for (int i = 0; i < 2; i++) g_fans[i].duty = g_fans[i].staged;
+}
+
+static const fanc_hw_t g_hw = { hw_rpm_get, hw_duty_set, hw_duty_commit, 0 };
+
+static void run(double secs)
+{
+  for (int k = 0; k < secs * 1000 / g_ctrl.period_ms; k++) {
+    for (int i = 0; i < 2; i++) fan_run(g_fans[i], g_ctrl.period_ms / 1000.0);
+    fanc_ctrl_step(&g_ctrl, &g_hw, g_ms);
+    g_ms += g_ctrl.period_ms;
+  }
+}
+
+int main()
+{
+  srand(46);
+  fanc_ctrl_init(&g_ctrl, 2, 250);
+  fanc_fan_t *f = &g_ctrl.fans[0];
+  fan_t &fan = g_fans[0];
+  f->has_tach = true;
+  g_ctrl.fans[1].has_tach = true;
+
+  f->set.percentage = 100;
+  run(5);
+
+  // without a table 15% is in the dead zone: it stops, and gets kicked
+  f->set.percentage = 15;
+  run(6);
+  printf("uncalibrated, 15%%: stopped, %u kicks\n", f->stall.n_kicks);
+  assert(f->stall.n_kicks > 0);
+
+  f->cal_request = true;
+  int64_t t0 = g_ms;
+  while (f->cal.state != FANC_CAL_DONE && f->cal.state != FANC_CAL_FAILED && g_ms - t0 < 600000) run(1);
+  printf("calibration %s in %.0fs, min_duty %d:\n", fanc_cal_state_name(f->cal.state), (g_ms - t0) / 1000.0, f->lut.min_duty);
+  assert(f->cal.state == FANC_CAL_DONE && f->lut.valid && fanc_cal_lut_check(&f->lut));
+  // it stops between 200 and 150, so 200 is the last step still turning
+  assert(f->lut.min_duty == 200);
+  double worst = 0;
+  for (int i = 0; i < FANC_CAL_POINTS; i++) {
+    int d = i * FANC_CAL_STEP;
+    double truth = d >= 200 ? fan_ss(d) : 0;
+    if (d >= 200) worst = fmax(worst, fabs(f->lut.rpm[i] - truth) / truth);
+    printf("  %4d %5d RPM ( %5.0f )\n", d, f->lut.rpm[i], truth);
+  }
+  assert(worst < 0.02);
+
+  // the slider is linear in speed now
+  double top = f->lut.rpm[FANC_CAL_POINTS - 1];
+  worst = 0;
+  for (int p = 30; p <= 100; p += 10) {
+    f->set.percentage = p;
+    run(6);
+    double err = fabs(fan.rpm - top * p / 100) / top * 100;
+    if (err > worst) worst = err;
+  }
+  printf("30%% to 100%% in speed: off by %.1f%% of the top at worst\n", worst);
+  assert(worst < 4);
+
+  // at rest and set low: the duty holds a turning fan but won't start it, one kick does
+  f->set.percentage = 0;
+  run(6);
+  assert(fan.rpm < 50);
+  uint32_t kicks = f->stall.n_kicks;
+  f->set.percentage = 20;
+  run(8);
+  printf("from rest at 20%%: %u kick, duty %d, %.0f RPM\n", f->stall.n_kicks - kicks, fan.duty, fan.rpm);
+  assert(fan.rpm > 300 && f->stall.n_kicks - kicks == 1 && f->stall.state == FANC_STALL_OK);
+
+  // seized: FANC_KICK_MAX kicks and a fault, then retried once it's free.
+  // Turning long enough first that the kicks before don't count.
+  run(FANC_KICK_RESET_MS / 1000);
+  kicks = f->stall.n_kicks;
+  fan.seized = true;
+  run(20);
+  printf("seized: %u kicks, then %s\n", f->stall.n_kicks - kicks, fanc_stall_state_name(f->stall.state));
+  assert(f->stall.state == FANC_STALL_FAULT && f->stall.n_faults == 1);
+  assert(f->stall.n_kicks - kicks == FANC_KICK_MAX);
+  fan.seized = false;
+  run(FANC_FAULT_RETRY_MS / 1000 + 10);
+  printf("freed: %s, %.0f RPM\n", fanc_stall_state_name(f->stall.state), fan.rpm);
+  assert(f->stall.state == FANC_STALL_OK && fan.rpm > 300);
+
+  // holding a speed on the calibrated fan
+  f->set.mode = FANC_MODE_RPM;
+  f->set.rpm_target = 1200;
+  run(20);
+  printf("RPM mode: 1200 holds at %.0f", fan.rpm);
+  assert(fabs(fan.rpm - 1200) < 40);
+  f->set.rpm_target = 800;
+  run(20);
+  printf(", 800 at %.0f\n", fan.rpm);
+  assert(fabs(fan.rpm - 800) < 40);
+
+  // no tach, nothing to sweep against
+  g_ctrl.fans[1].has_tach = false;
+  g_ctrl.fans[1].cal_request = true;
+  run(1);
+  assert(g_ctrl.fans[1].cal.state == FANC_CAL_FAILED);
+  return 0;
+}
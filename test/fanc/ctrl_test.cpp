@@ -0,0 +1,272 @@
+// The control loop for a table of fans ( fanc_ctrl.cpp ) against a mock
+// fanc_hw_t: FANC_FANS_MAX simulated fans, three open loop - one without a
+// tach - two holding RPM, two holding a temperature that the whole table's
+// airflow cools, and one with a tach that's seized for the first 20s. The
+// mock checks every call: at most one duty_commit a step, and only if
+// something was staged; a fan staged at most once, only with a duty that's
+// different from the one it has, and only the fans whose duty changed.
+//
+// The loops settle, the seized fan is kicked and runs once it's freed, and a
+// table at rest stages nothing. Then fanc_ctrl_apply between steps: open
+// fans go out at once, in one commit, and closed loop fans, a fan just
+// switched back to open, one sweeping and one being kicked are left for the
+// step.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "fanc_ctrl.h"
+
+#define PERIOD_MS 250
+
+struct fan_t {
+  double rpm = 0;
+  double top = 3000;
+  bool seized = false;
+  int duty = -1;          // committed
+  int staged = -1;        // -1 none
+};
+
+static fan_t g_fans[FANC_FANS_MAX];
+static fanc_ctrl_t C;
+static int64_t g_ms;
+static double g_temp = 25000;
+
+// this step's calls
+static int g_commits;
+static int g_sets;
+static uint32_t g_staged_mask;
+
+static int hw_rpm_get(void *ctx, int i)
+{
+  assert(i >= 0 && i < C.n_fans);
+  return (int) g_fans[i].rpm;
+}
+
+static void hw_duty_set(void *ctx, int i, int permille)
+{
+  assert(i >= 0 && i < C.n_fans);
+  assert(permille >= 0 && permille <= FANC_PID_OUT_MAX);
+  // once a fan a commit, and only a change
+  assert(!(g_staged_mask & (1u << i)));
+  assert(permille != g_fans[i].duty);
+  g_fans[i].staged = permille;
+  g_staged_mask |= 1u << i;
+  g_sets++;
+}
+
+static void hw_duty_commit(void *ctx)
+{
+  assert(g_staged_mask != 0);
+  for (int i = 0; i < FANC_FANS_MAX; i++) {
+    if (!(g_staged_mask & (1u << i))) continue;
+    g_fans[i].duty = g_fans[i].staged;
+    g_fans[i].staged = -1;
+  }
+  g_staged_mask = 0;
+  g_commits++;
+}
+
+static const fanc_hw_t g_hw = { hw_rpm_get, hw_duty_set, hw_duty_commit, 0 };
+
+// the fans spin toward their duty, with a lag; the temperature follows the airflow
+static void sim_run(double dt)
+{
+  double air = 0;
+  for (int i = 0; i < C.n_fans; i++) {
+    fan_t &f = g_fans[i];
+    double want = f.seized || f.duty <= 0 ? 0 : f.top * f.duty / FANC_PID_OUT_MAX;
+    f.rpm += (want - f.rpm) * (1 - exp(-dt / 0.7));
+    air += f.rpm;
+  }
+  double want = 25000 + 150000 * 1500 / (1500 + air);
+  g_temp += (want - g_temp) * (1 - exp(-dt / 5.0));
+}
+
+// the calls, and the fans that changed, match
+static void check_calls(const int *before)
+{
+  assert(g_commits <= 1);
+  assert(g_commits == (g_sets > 0));
+  assert(g_staged_mask == 0);
+  int changed = 0;
+  for (int i = 0; i < C.n_fans; i++) {
+    if (C.fans[i].duty != before[i]) {
+      changed++;
+      assert(g_fans[i].duty == C.fans[i].duty);
+    }
+  }
+  assert(changed == g_sets);
+}
+
+static void calls_begin(int *before)
+{
+  g_commits = g_sets = 0;
+  for (int i = 0; i < C.n_fans; i++) before[i] = C.fans[i].duty;
+}
+
+static int step()
+{
+  int before[FANC_FANS_MAX];
+  calls_begin(before);
+  fanc_ctrl_temp_set(&C, (int) g_temp, (uint32_t) g_ms);
+  fanc_ctrl_step(&C, &g_hw, g_ms);
+  check_calls(before);
+  g_ms += PERIOD_MS;
+  sim_run(PERIOD_MS / 1000.0);
+  return g_sets;
+}
+
+static uint32_t apply(uint32_t fans, int *sets)
+{
+  int before[FANC_FANS_MAX];
+  calls_begin(before);
+  uint32_t done = fanc_ctrl_apply(&C, &g_hw, fans);
+  check_calls(before);
+  *sets = g_sets;
+  return done;
+}
+
+static void setup()
+{
+  fanc_ctrl_init(&C, FANC_FANS_MAX + 3, PERIOD_MS);
+  assert(C.n_fans == FANC_FANS_MAX);
+  for (int i = 0; i < FANC_FANS_MAX; i++) g_fans[i] = fan_t();
+  g_temp = 25000;
+  g_ms = 1000;
+
+  const int pct[3] = { 30, 60, 100 };
+  for (int i = 0; i < 3; i++) {
+    C.fans[i].set.mode = FANC_MODE_OPEN;
+    C.fans[i].set.percentage = pct[i];
+    C.fans[i].has_tach = i != 2;
+  }
+  C.fans[3].set.mode = FANC_MODE_RPM;
+  C.fans[3].set.rpm_target = 1200;
+  C.fans[4].set.mode = FANC_MODE_RPM;
+  C.fans[4].set.rpm_target = 2000;
+  C.fans[5].set.mode = FANC_MODE_TEMP;
+  C.fans[5].set.temp_target = 40000;
+  C.fans[6].set.mode = FANC_MODE_TEMP;
+  C.fans[6].set.temp_target = 40000;
+  C.fans[7].set.mode = FANC_MODE_OPEN;
+  C.fans[7].set.percentage = 50;
+  for (int i = 3; i < FANC_FANS_MAX; i++) C.fans[i].has_tach = true;
+  g_fans[7].seized = true;
+}
+
+static void mixed()
+{
+  setup();
+  int steps = 0, commits = 0, sets = 0;
+  bool kicked = false;
+  for (; g_ms < 120 * 1000; steps++) {
+    if (g_ms >= 20000) g_fans[7].seized = false;
+    int n = step();
+    sets += n;
+    commits += n > 0;
+    if (C.fans[7].stall.state == FANC_STALL_KICK) kicked = true;
+  }
+  printf("%d fans, open/RPM/temp, %d steps: %d commits, %d duties staged of %d\n",
+    C.n_fans, steps, commits, sets, steps * C.n_fans);
+  printf("  rpm %d/%d and %d/%d, temperature %.1fC for 40.0, the temp fans at %d and %d permille\n",
+    C.fans[3].measured, C.fans[3].set.rpm_target, C.fans[4].measured, C.fans[4].set.rpm_target,
+    g_temp / 1000, C.fans[5].duty, C.fans[6].duty);
+  printf("  the seized fan: %u kicks, %u faults, at %d rpm once freed\n",
+    C.fans[7].stall.n_kicks, C.fans[7].stall.n_faults, (int) g_fans[7].rpm);
+  assert(C.n_commits == (uint32_t) commits && C.n_duty_sets == (uint32_t) sets && C.n_steps == (uint32_t) steps);
+
+  // open loop are where they were put
+  assert(g_fans[0].duty == 300 && g_fans[1].duty == 600 && g_fans[2].duty == 1000);
+  // the loops hold
+  assert(abs(C.fans[3].measured - 1200) < 60 && abs(C.fans[4].measured - 2000) < 100);
+  assert(fabs(g_temp - 40000) < 1000);
+  // kicked while seized, turning at its duty after
+  assert(kicked && C.fans[7].stall.n_kicks >= 1);
+  assert(C.fans[7].stall.state == FANC_STALL_OK && g_fans[7].duty == 500 && g_fans[7].rpm > 1000);
+
+  // only the open ones: once they're out, nothing more goes to the hardware
+  for (int i = 3; i < 7; i++) {
+    C.fans[i].set.mode = FANC_MODE_OPEN;
+    C.fans[i].set.percentage = 40;
+  }
+  for (int k = 0; k < 3; k++) step();
+  uint32_t c0 = C.n_commits, s0 = C.n_duty_sets;
+  for (int k = 0; k < 40; k++) assert(step() == 0);
+  assert(C.n_commits == c0 && C.n_duty_sets == s0);
+  printf("  all open and settled, 40 steps: %u commits, %u duties staged\n", C.n_commits - c0, C.n_duty_sets - s0);
+}
+
+static void applied()
+{
+  setup();
+  g_fans[7].seized = false;
+  // running, turning
+  for (int k = 0; k < 40; k++) step();
+  int sets;
+
+  // open fans, several at once, go out now in one commit
+  C.fans[0].set.percentage = 70;
+  C.fans[1].set.percentage = 20;
+  uint32_t done = apply(0x3, &sets);
+  assert(done == 0x3 && sets == 2 && g_commits == 1);
+  assert(g_fans[0].duty == 700 && g_fans[1].duty == 200);
+
+  // nothing changed, nothing goes out, still done
+  done = apply(0x3, &sets);
+  assert(done == 0x3 && sets == 0 && g_commits == 0);
+
+  // closed loop: the step does those
+  C.fans[3].set.rpm_target = 1800;
+  C.fans[5].set.temp_target = 35000;
+  done = apply(1u << 3 | 1u << 5, &sets);
+  assert(done == 0 && sets == 0);
+
+  // just switched to open: the loop has to see the mode change first
+  C.fans[4].set.mode = FANC_MODE_OPEN;
+  C.fans[4].set.percentage = 90;
+  done = apply(1u << 4, &sets);
+  assert(done == 0 && sets == 0);
+  step();
+  assert(g_fans[4].duty == 900);
+  C.fans[4].set.percentage = 10;
+  assert(apply(1u << 4, &sets) == 1u << 4 && sets == 1 && g_fans[4].duty == 100);
+
+  // a sweep asked for, and running
+  C.fans[0].cal_request = true;
+  C.fans[0].set.percentage = 30;
+  assert(apply(1u << 0, &sets) == 0 && sets == 0);
+  step();
+  assert(C.fans[0].cal.state == FANC_CAL_RUNNING);
+  int sweep_duty = g_fans[0].duty;
+  assert(apply(1u << 0, &sets) == 0 && sets == 0 && g_fans[0].duty == sweep_duty);
+  C.fans[0].cal_cancel = true;
+  assert(apply(1u << 0, &sets) == 0);
+  step();
+  assert(C.fans[0].cal.state != FANC_CAL_RUNNING && g_fans[0].duty == 300);
+
+  // being kicked
+  g_fans[7].seized = true;
+  int64_t until = g_ms + 10000;
+  while (C.fans[7].stall.state != FANC_STALL_KICK && g_ms < until) step();
+  assert(C.fans[7].stall.state == FANC_STALL_KICK && g_fans[7].duty == FANC_PID_OUT_MAX);
+  C.fans[7].set.percentage = 20;
+  assert(apply(1u << 7, &sets) == 0 && sets == 0 && g_fans[7].duty == FANC_PID_OUT_MAX);
+
+  // all of them at once: the open ones that can, one commit
+  C.fans[1].set.percentage = 55;
+  C.fans[2].set.percentage = 65;
+  done = apply(0xFF, &sets);
+  assert(done == (1u << 0 | 1u << 1 | 1u << 2 | 1u << 4) && sets == 2 && g_commits == 1);
+  printf("apply: open fans at once in one commit; closed loop, newly open, sweeping and kicked left to the step\n");
+}
+
+int main()
+{
+  mixed();
+  applied();
+  return 0;
+}
@@ -0,0 +1,166 @@
+// The speed history ( fanc_hist.cpp ). Three minutes of noisy samples, and
+// every 10s and 1m rollup checked against the samples worked out the long
+// way; raw comes back newest first. A gap the task missed goes in as empty
+// buckets, a speed past the top saturates, and a reader the writer has
+// lapped stops rather than hand back new points as old. Two days fill and
+// wrap both tiers. Then how long an add and a day's query take.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <chrono>
+#include <vector>
+
+#include "fanc_hist.h"
+
+static fanc_hist_t h;
+
+// mrps as the history keeps it
+static uint16_t q(int mrps)
+{
+  return (uint16_t) ((((uint64_t) mrps << FANC_HIST_FRAC_BITS) + 500) / 1000);
+}
+
+static void rollups()
+{
+  fanc_hist_init(&h);
+  std::vector<int> v;
+  std::vector<int64_t> ts;
+  srand(1);
+  int64_t t = 0;
+  for (int i = 0; i < 720; i++, t += FANC_HIST_RAW_MS) {
+    int m = 20000 + (rand() % 2000) - 1000;
+    v.push_back(m);
+    ts.push_back(t);
+    fanc_hist_add(&h, m, t);
+  }
+  // the last 10s and minute are still open
+  assert(fanc_hist_len(&h, FANC_HIST_RAW) == FANC_HIST_RAW_N);
+  assert(fanc_hist_len(&h, FANC_HIST_10S) == 17);
+  assert(fanc_hist_len(&h, FANC_HIST_1M) == 2);
+
+  fanc_hist_cursor_t c;
+  fanc_hist_roll_t p;
+  for (int res = FANC_HIST_10S; res <= FANC_HIST_1M; res++) {
+    uint32_t per = fanc_hist_period_ms(res);
+    int nb = fanc_hist_len(&h, res);
+    int k = 0;
+    fanc_hist_cursor(&c, &h, res, 0);
+    while (fanc_hist_next(&c, &p)) {
+      int b = nb - 1 - k;
+      uint32_t sum = 0, n = 0;
+      uint16_t mn = 0xFFFF, mx = 0;
+      for (size_t i = 0; i < v.size(); i++) {
+        if (ts[i] / per != b) continue;
+        uint16_t x = q(v[i]);
+        sum += x;
+        n++;
+        if (x < mn) mn = x;
+        if (x > mx) mx = x;
+      }
+      assert(n > 0);
+      assert(p.min == mn && p.max == mx && p.avg == (sum + n / 2) / n);
+      k++;
+    }
+    assert(k == nb);
+  }
+
+  fanc_hist_cursor(&c, &h, FANC_HIST_RAW, 5);
+  int k = 0;
+  while (fanc_hist_next(&c, &p)) {
+    assert(p.min == p.avg && p.avg == p.max && p.avg == q(v[v.size() - 1 - k]));
+    k++;
+  }
+  assert(k == 5);
+  printf("rollups: 17 10s and 2 1m buckets match the samples, raw newest first\n");
+
+  // 35s the task didn't run: the 10s buckets it missed are empty, the newest too
+  uint32_t before = fanc_hist_len(&h, FANC_HIST_10S);
+  t += 35000;
+  fanc_hist_add(&h, 10000, t);
+  int empties = 0, newest_empty = -1, idx = 0;
+  fanc_hist_cursor(&c, &h, FANC_HIST_10S, 0);
+  while (fanc_hist_next(&c, &p)) {
+    if (fanc_hist_empty(&p)) {
+      empties++;
+      if (newest_empty < 0) newest_empty = idx;
+    }
+    idx++;
+  }
+  printf("gap of 35s: 10s buckets %u -> %d, %u empty\n", before, fanc_hist_len(&h, FANC_HIST_10S), h.n_fill);
+  assert(empties == 3 && newest_empty == 0);
+
+  assert(fanc_hist_q_rpm(q(20000)) == 1200);
+  assert(fanc_hist_q_rpm(q(333333)) >= 19995);
+
+  // past 511 rps
+  t += FANC_HIST_RAW_MS;
+  fanc_hist_add(&h, 10000000, t);
+  fanc_hist_cursor(&c, &h, FANC_HIST_RAW, 1);
+  assert(fanc_hist_next(&c, &p) && p.avg == FANC_HIST_Q_MAX);
+
+  // a reader lapped by 100 adds gets the 140 that were still there
+  fanc_hist_cursor(&c, &h, FANC_HIST_RAW, 0);
+  for (int i = 0; i < 100; i++) {
+    t += FANC_HIST_RAW_MS;
+    fanc_hist_add(&h, 5000, t);
+  }
+  k = 0;
+  while (fanc_hist_next(&c, &p)) k++;
+  printf("raw reader lapped by 100 adds: read %d of %d\n", k, FANC_HIST_RAW_N);
+  assert(k == FANC_HIST_RAW_N - 100);
+}
+
+static void two_days()
+{
+  fanc_hist_init(&h);
+  int64_t t = 0;
+  for (int i = 0; i < 2 * 24 * 3600 * (1000 / FANC_HIST_RAW_MS); i++, t += FANC_HIST_RAW_MS) {
+    fanc_hist_add(&h, 20000 + (i % 7) * 10, t);
+  }
+  assert(fanc_hist_len(&h, FANC_HIST_1M) == FANC_HIST_1M_N && fanc_hist_len(&h, FANC_HIST_10S) == FANC_HIST_10S_N);
+  fanc_hist_cursor_t c;
+  fanc_hist_roll_t p;
+  fanc_hist_cursor(&c, &h, FANC_HIST_1M, 0);
+  int k = 0;
+  while (fanc_hist_next(&c, &p)) {
+    assert(!fanc_hist_empty(&p));
+    k++;
+  }
+  assert(k == FANC_HIST_1M_N);
+  printf("two days: both tiers full and wrapped, %zu bytes\n", sizeof(fanc_hist_t));
+  assert(sizeof(fanc_hist_t) < 16384);
+}
+
+static void timing()
+{
+  fanc_hist_init(&h);
+  int64_t t = 0;
+  const int adds = 10000000;
+  auto a = std::chrono::steady_clock::now();
+  for (int i = 0; i < adds; i++, t += FANC_HIST_RAW_MS) fanc_hist_add(&h, 20000 + (i & 1023), t);
+  auto b = std::chrono::steady_clock::now();
+  double add_ns = std::chrono::duration<double, std::nano>(b - a).count() / adds;
+
+  volatile uint32_t sink = 0;
+  const int queries = 2000;
+  fanc_hist_cursor_t c;
+  fanc_hist_roll_t p;
+  a = std::chrono::steady_clock::now();
+  for (int r = 0; r < queries; r++) {
+    fanc_hist_cursor(&c, &h, FANC_HIST_1M, 0);
+    while (fanc_hist_next(&c, &p)) sink += p.avg;
+  }
+  b = std::chrono::steady_clock::now();
+  double query_ns = std::chrono::duration<double, std::nano>(b - a).count() / queries;
+  printf("on this host: an add %.1f ns, a day at 1m ( %d points ) %.1f us\n", add_ns, FANC_HIST_1M_N, query_ns / 1000);
+}
+
+int main()
+{
+  rollups();
+  two_days();
+  timing();
+  return 0;
+}
@@ -0,0 +1,253 @@
+// The fan loop ( fanc_pid.cpp ). What the controller promises on its own: the
+// output moves no more than slew a step, a setpoint change doesn't kick the
+// derivative, a reset picks up without a bump, the integral doesn't wind up
+// while the output's pinned, and reverse acting turns it around. Then
+// closed against two simulated plants, as fanc_task runs it every 250ms:
+// a fan with a dead zone and lag read through the tach estimator, auto-tuned
+// and stepped about, loaded down and driven into a limit; and a heatsink
+// whose temperature falls with airflow, held, stepped and loaded.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#include "fanc_pid.h"
+#include "fanc_rpm.h"
+
+#define PERIOD 250
+
+// ----- the controller on its own
+
+static void controller()
+{
+  fanc_pid_gains_t g = { 2 * FANC_PID_ONE, FANC_PID_ONE, FANC_PID_ONE / 2 };
+  fanc_pid_t pid;
+
+  // slew: the first step after a reset is free, from then on out_max / slew steps to the top
+  fanc_pid_init(&pid, &g, PERIOD, false);
+  pid.slew = 100;
+  fanc_pid_reset(&pid, 0);
+  int32_t prev = fanc_pid_step(&pid, 0, 0);
+  for (int i = 0; i < 5; i++) {
+    int32_t out = fanc_pid_step(&pid, 1000, 0);
+    assert(out - prev == 100);
+    prev = out;
+  }
+
+  // a setpoint step with the measurement still: only p moves, d sees nothing
+  fanc_pid_init(&pid, &g, PERIOD, false);
+  fanc_pid_reset(&pid, 500);
+  assert(fanc_pid_step(&pid, 100, 100) == 500);
+  assert(fanc_pid_step(&pid, 100, 100) == 500);
+  int32_t out = fanc_pid_step(&pid, 150, 100);
+  // kp * 50, and a quarter second of ki * 50
+  assert(out == 500 + 100 + 13);
+  // the measurement moving is what d answers
+  fanc_pid_init(&pid, &g, PERIOD, false);
+  fanc_pid_reset(&pid, 500);
+  fanc_pid_step(&pid, 100, 100);
+  out = fanc_pid_step(&pid, 100, 104);
+  assert(out < 500 - 8);
+
+  // bumpless: reset to an output, no error, it stays
+  fanc_pid_init(&pid, &g, PERIOD, false);
+  fanc_pid_reset(&pid, 420);
+  for (int i = 0; i < 10; i++) assert(fanc_pid_step(&pid, 2000, 2000) == 420);
+
+  // windup: a minute pinned at the top asking for more, then the error turns
+  // over and the output leaves the limit at once
+  fanc_pid_init(&pid, &g, PERIOD, false);
+  fanc_pid_reset(&pid, 500);
+  for (int i = 0; i < 240; i++) fanc_pid_step(&pid, 3000, 1000);
+  assert(pid.out == FANC_PID_OUT_MAX);
+  assert(pid.integ <= (int64_t) FANC_PID_OUT_MAX * FANC_PID_ONE);
+  fanc_pid_step(&pid, 3000, 3050);
+  out = fanc_pid_step(&pid, 3000, 3050);
+  assert(out < FANC_PID_OUT_MAX);
+
+  // reverse acting: over the setpoint is more output
+  fanc_pid_init(&pid, &g, PERIOD, true);
+  fanc_pid_reset(&pid, 500);
+  fanc_pid_step(&pid, 45000, 45000);
+  assert(fanc_pid_step(&pid, 45000, 45100) > 500);
+  fanc_pid_init(&pid, &g, PERIOD, true);
+  fanc_pid_reset(&pid, 500);
+  fanc_pid_step(&pid, 45000, 45000);
+  assert(fanc_pid_step(&pid, 45000, 44900) < 500);
+
+  // a tune that never sees the process move gives up, and no gains
+  fanc_tune_t tune;
+  fanc_tune_start(&tune, 1500, 300, 700, 30, false, 0, 10000);
+  for (int64_t now = 0; tune.state == FANC_TUNE_RUNNING; now += PERIOD) fanc_tune_step(&tune, 1000, now);
+  assert(tune.state == FANC_TUNE_FAILED && !fanc_tune_gains(&tune, &g));
+
+  printf("controller: slew, no derivative kick, bumpless, no windup, reverse, tune timeout\n");
+}
+
+// ----- a fan: dead below 15%, then a curve to 3000 RPM, lag 1.2s, read by the tach estimator
+
+struct fan_t {
+  double rpm = 0;
+  double load = 1.0;
+  double phase = 0;
+};
+
+static fanc_rpm_t g_est;
+static double g_us = 0;
+
+static double fan_ss(double duty, double load)
+{
+  if (duty < 150) return 0;
+  return load * (450 + 2550 * pow((duty - 150) / 850.0, 0.8));
+}
+
+static void fan_run(fan_t &f, int duty, double ms)
+{
+  for (double s = 0; s < ms; s += 1) {
+    f.rpm += (fan_ss(duty, f.load) - f.rpm) * (0.001 / 1.2);
+    double inc = f.rpm / 60.0 * 2 * 0.001;     // pulses a ms
+    f.phase += inc;
+    g_us += 1000;
+    if (f.phase >= 1) {
+      f.phase -= 1;
+      double edge = g_us - f.phase / inc * 1000;
+      fanc_rpm_edge(&g_est, (int64_t) (edge + (rand() % 200 - 100)));
+    }
+  }
+}
+
+struct step_t {
+  double settle_ms;     // last time more than 2% off
+  double overshoot;     // percent of the step
+};
+
+static step_t fan_step(fan_t &f, fanc_pid_t &pid, int sp, int from, double ms)
+{
+  double peak = 0, trough = 1e9, last_off = 0;
+  for (double t = 0; t < ms; t += PERIOD) {
+    int meas = fanc_rpm_get(&g_est, (int64_t) g_us);
+    fan_run(f, fanc_pid_step(&pid, sp, meas), PERIOD);
+    if (f.rpm > peak) peak = f.rpm;
+    if (f.rpm < trough) trough = f.rpm;
+    if (fabs(f.rpm - sp) > sp * 0.02) last_off = t + PERIOD;
+  }
+  double os = sp > from ? (peak - sp) / (sp - from) : (sp - trough) / (from - sp);
+  return { last_off, os > 0 ? os * 100 : 0 };
+}
+
+static void rpm_loop()
+{
+  srand(42);
+  fanc_rpm_init(&g_est, 2);
+  fan_t f;
+
+  // spin up open loop, tune around 1500
+  fan_run(f, 500, 3000);
+  fanc_tune_t tune;
+  int64_t now = 0;
+  fanc_tune_start(&tune, 1500, 300, 700, 30, false, now, 120000);
+  while (tune.state == FANC_TUNE_RUNNING) {
+    fan_run(f, fanc_tune_step(&tune, fanc_rpm_get(&g_est, (int64_t) g_us), now), PERIOD);
+    now += PERIOD;
+  }
+  fanc_pid_gains_t g;
+  assert(fanc_tune_gains(&tune, &g));
+  printf("fan: tuned in %llds, ku %.4f tu %dms, kp %.4f ki %.4f/s\n",
+    (long long) now / 1000, tune.ku / 65536.0, tune.tu_ms, g.kp / 65536.0, g.ki / 65536.0);
+  assert(now < 30000);
+
+  fanc_pid_t pid;
+  fanc_pid_init(&pid, &g, PERIOD, false);
+  pid.slew = 100;
+  fanc_pid_reset(&pid, 500);
+
+  // picking up where the tune left it
+  step_t s = fan_step(f, pid, 1500, 1500, 15000);
+  printf("  hold 1500 RPM after the tune: within 2%% after %.0f ms\n", s.settle_ms);
+  assert(s.settle_ms <= 5000);
+
+  const int sps[] = { 2500, 900, 2000, 1200 };
+  int from = 1500;
+  for (int sp : sps) {
+    s = fan_step(f, pid, sp, from, 15000);
+    printf("  %4d -> %4d RPM: within 2%% after %5.0f ms, overshoot %4.1f%%\n", from, sp, s.settle_ms, s.overshoot);
+    assert(s.settle_ms <= 8000 && s.overshoot < 10);
+    from = sp;
+  }
+
+  // a fifth of the airflow blocked
+  f.load = 0.8;
+  s = fan_step(f, pid, 1200, 1200, 15000);
+  printf("  load -20%% at 1200: back within 2%% after %.0f ms\n", s.settle_ms);
+  assert(s.settle_ms <= 5000);
+
+  // asking for more than it has, then back
+  f.load = 1.0;
+  fan_step(f, pid, 3500, 1200, 10000);
+  assert(pid.out == FANC_PID_OUT_MAX && pid.integ <= (int64_t) FANC_PID_OUT_MAX * FANC_PID_ONE);
+  int top = (int) f.rpm;
+  s = fan_step(f, pid, 1500, top, 15000);
+  printf("  pinned at %d, then 1500: within 2%% after %.0f ms, undershoot %.1f%%\n", top, s.settle_ms, s.overshoot);
+  assert(s.settle_ms <= 8000 && s.overshoot < 15);
+}
+
+// ----- a heatsink: 25C ambient, resistance falls with airflow, tau 20s; airflow follows duty, lag 1.5s
+
+static double g_temp = 60, g_flow = 0;
+
+static void sink_run(int duty, double ms, double watts)
+{
+  for (int i = 0; i < ms; i++) {
+    double flow_ss = duty < 150 ? 0 : (duty - 150) / 850.0;
+    g_flow += (flow_ss - g_flow) * 0.001 / 1.5;
+    double t_ss = 25 + watts * 2.0 / (1 + 4 * g_flow);
+    g_temp += (t_ss - g_temp) * 0.001 / 20;
+  }
+}
+
+static void temp_loop()
+{
+  sink_run(500, 120000, 30);
+  fanc_tune_t tune;
+  int64_t now = 0;
+  fanc_tune_start(&tune, 45000, 350, 650, 100, true, now, 900000);
+  while (tune.state == FANC_TUNE_RUNNING) {
+    sink_run(fanc_tune_step(&tune, (int) (g_temp * 1000), now), PERIOD, 30);
+    now += PERIOD;
+  }
+  fanc_pid_gains_t g;
+  assert(fanc_tune_gains(&tune, &g));
+  printf("heatsink: tuned in %llds, ku %.4f tu %dms\n", (long long) now / 1000, tune.ku / 65536.0, tune.tu_ms);
+
+  fanc_pid_t pid;
+  fanc_pid_init(&pid, &g, PERIOD, true);
+  pid.slew = 100;
+  fanc_pid_reset(&pid, 500);
+
+  // ten minutes each: hold 45C, step to 40C, then 30W to 34W
+  struct { int sp; double watts; const char *what; } phases[] = {
+    { 45000, 30, "hold 45C" }, { 40000, 30, "step to 40C" }, { 40000, 34, "30W to 34W at 40C" },
+  };
+  for (auto &ph : phases) {
+    double last_off = 0, worst = 0;
+    for (int s = 0; s < 4 * 600; s++) {
+      sink_run(fanc_pid_step(&pid, ph.sp, (int) (g_temp * 1000)), PERIOD, ph.watts);
+      double err = fabs(g_temp * 1000 - ph.sp);
+      if (err > 250) last_off = (s + 1) * PERIOD;
+      // past the first minute, how far it wanders
+      if (s >= 4 * 60 && err > worst) worst = err;
+    }
+    printf("  %-18s within 0.25C after %4.0f s, then within %.2fC\n", ph.what, last_off / 1000, worst / 1000);
+    assert(last_off <= 60000 && worst <= 250);
+  }
+}
+
+int main()
+{
+  controller();
+  rpm_loop();
+  temp_loop();
+  return 0;
+}
@@ -0,0 +1,172 @@
+// The tach estimator ( fanc_rpm.cpp ), replayed against a simulated fan.
+// A clean pulse train reads exact. Then a noisy one, the way a real tach
+// line looks: 3% jitter, missed edges, ringing right after an edge and the
+// odd spurious edge halfway between, through steps from 600 to 2400 to 300
+// RPM and then a stop. How soon a step shows, how often and for how long the
+// reading is off once it has, and how soon a stop reads 0 - against counting
+// pulses for half a second, which is what we'd have otherwise.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+
+#include "fanc_rpm.h"
+
+static void clean()
+{
+  const int speeds[] = { 200, 300, 600, 1200, 2400, 3000, 6000, 12000 };
+  for (int rpm : speeds) {
+    fanc_rpm_t r;
+    fanc_rpm_init(&r, 2);
+    double period = 60e6 / (rpm * 2);
+    for (int i = 0; i < 20; i++) assert(fanc_rpm_edge(&r, (int64_t) llround(i * period)));
+    int64_t last = (int64_t) llround(19 * period);
+    int got = fanc_rpm_get(&r, last + 1);
+    assert(abs(got - rpm) <= 1);
+    assert(abs(fanc_rpm_mrps_get(&r, last + 1) - rpm * 1000 / 60) <= 20);
+  }
+  // glitches are dropped, and nothing at all reads 0
+  fanc_rpm_t r;
+  fanc_rpm_init(&r, 2);
+  assert(fanc_rpm_get(&r, 0) == 0);
+  fanc_rpm_edge(&r, 1000);
+  assert(!fanc_rpm_edge(&r, 1010) && r.n_glitches == 1);
+  assert(fanc_rpm_get(&r, 2000) == 0);
+  printf("clean: 200 to 12000 RPM within 1 RPM, glitches dropped\n");
+}
+
+// the fan: target speed at t, steps every 2s
+static double target(double t)
+{
+  if (t < 2e6) return 600;
+  if (t < 4e6) return 2400;
+  if (t < 6e6) return 300;
+  return 0;
+}
+
+struct result_t {
+  double settle_ms[2];   // first reading within 5% after each step
+  double stop_ms;        // and after the stop, the first 0
+  long steady, off;      // samples once settled, and how many of them off by more than 5%
+  double longest_off;    // longest run of those, in periods of the fan
+  double count_settle_ms[2];
+  double count_err;      // worst steady error counting pulses
+};
+
+static result_t replay(unsigned seed)
+{
+  srand(seed);
+  result_t res = {};
+  for (int i = 0; i < 2; i++) res.settle_ms[i] = res.count_settle_ms[i] = -1;
+  res.stop_ms = -1;
+
+  fanc_rpm_t r;
+  fanc_rpm_init(&r, 2);
+
+  // pulse counting: edges in the last 500ms window, read at the end of it
+  const int64_t WINDOW = 500000;
+  int window_count = 0, count_rpm = 0;
+  int64_t window_end = WINDOW;
+
+  double t = 0;
+  double off_since = -1;
+  const double steps[3] = { 2e6, 4e6, 6e6 };
+
+  while (t < 8e6) {
+    double rpm = target(t);
+    double dt = rpm > 0 ? 60e6 / (rpm * 2) : 1e5;
+    dt *= 1.0 + ((rand() % 2001) - 1000) / 1000.0 * 0.03;
+    double tn = t + dt;
+
+    // read it every 10ms until the next edge
+    for (int64_t c = (int64_t) t; c < (int64_t) tn; c += 10000) {
+      while (c >= window_end) {
+        count_rpm = window_count * 60 * 1000000LL / (2 * WINDOW);
+        window_count = 0;
+        window_end += WINDOW;
+      }
+      int est = fanc_rpm_get(&r, c);
+      double tg = target(c);
+      int step = c < 2e6 ? -1 : c < 4e6 ? 0 : c < 6e6 ? 1 : 2;
+      double since = step >= 0 ? c - steps[step] : c;
+      if (tg > 0) {
+        bool close = fabs(est - tg) <= tg * 0.05;
+        if (step >= 0 && res.settle_ms[step] < 0 && close) res.settle_ms[step] = since / 1000;
+        if (step >= 0 && res.count_settle_ms[step] < 0 && fabs(count_rpm - tg) <= tg * 0.05) res.count_settle_ms[step] = since / 1000;
+        // settled: from 5 periods of the new speed after the step
+        if (since <= 5 * 60e6 / (tg * 2)) off_since = -1;
+        else {
+          res.steady++;
+          if (!close) {
+            res.off++;
+            if (off_since < 0) off_since = c;
+            res.longest_off = std::max(res.longest_off, (c - off_since) / (60e6 / (tg * 2)));
+          }
+          else {
+            off_since = -1;
+          }
+          if (since > WINDOW * 2) res.count_err = std::max(res.count_err, fabs(count_rpm - tg) / tg);
+        }
+      }
+      else if (res.stop_ms < 0 && est == 0) {
+        res.stop_ms = since / 1000;
+      }
+    }
+    t = tn;
+    if (rpm <= 0) continue;
+    if (rand() % 100 < 3) continue;                                                 // missed
+    fanc_rpm_edge(&r, (int64_t) t);
+    window_count++;
+    if (rand() % 100 < 3) fanc_rpm_edge(&r, (int64_t) t + 5 + rand() % 200);       // ringing
+    if (rand() % 100 < 2) { fanc_rpm_edge(&r, (int64_t) (t + dt * 0.5)); window_count++; } // spurious
+  }
+  return res;
+}
+
+int main()
+{
+  clean();
+
+  const int seeds = 200;
+  double settle_max[2] = { 0 }, settle_sum[2] = { 0 }, count_settle_max[2] = { 0 };
+  double stop_max = 0, longest_off = 0, count_err = 0;
+  long steady = 0, off = 0;
+  for (int s = 1; s <= seeds; s++) {
+    result_t res = replay(s);
+    for (int i = 0; i < 2; i++) {
+      assert(res.settle_ms[i] >= 0);
+      settle_max[i] = std::max(settle_max[i], res.settle_ms[i]);
+      settle_sum[i] += res.settle_ms[i];
+      count_settle_max[i] = std::max(count_settle_max[i], res.count_settle_ms[i]);
+    }
+    assert(res.stop_ms >= 0);
+    stop_max = std::max(stop_max, res.stop_ms);
+    longest_off = std::max(longest_off, res.longest_off);
+    steady += res.steady;
+    off += res.off;
+    count_err = std::max(count_err, res.count_err);
+  }
+
+  printf("%d noisy replays, 3%% jitter, 3%% missed, 3%% ringing, 2%% spurious edges:\n", seeds);
+  printf("  600 -> 2400 RPM shows in %5.0f ms avg %5.0f ms worst, counting pulses %4.0f ms worst\n",
+    settle_sum[0] / seeds, settle_max[0], count_settle_max[0]);
+  printf("  2400 -> 300 RPM shows in %5.0f ms avg %5.0f ms worst, counting pulses %4.0f ms worst\n",
+    settle_sum[1] / seeds, settle_max[1], count_settle_max[1]);
+  printf("  once settled, off by more than 5%%: %.2f%% of the time, for at most %.1f periods; counting pulses is off by up to %.1f%%\n",
+    100.0 * off / steady, longest_off, 100 * count_err);
+  printf("  a stop reads 0 after %.0f ms at worst\n", stop_max);
+
+  // an edge at the old speed, then a few at the new. Speeding up a spurious
+  // edge can't be told from the real thing for a moment, slowing down the gap
+  // is read as it grows. Off once settled: a few spurious edges together
+  // outvote the median, for no more than its length.
+  assert(settle_max[0] <= 50 + 8 * 12.5 && settle_sum[1] / seeds <= 150 && settle_max[1] <= 7 * 100);
+  assert(settle_sum[0] / seeds < count_settle_max[0] / 10 && settle_sum[1] / seeds < count_settle_max[1] / 5);
+  assert(off * 100 < steady);
+  assert(longest_off <= FANC_RPM_MEDIAN + 1);
+  assert(stop_max <= FANC_RPM_STALL_US / 1000 + 2 * 100);
+  return 0;
+}
@@ -0,0 +1,131 @@
+// When the fan task does what ( fanc_sched.cpp ), run as the task runs it:
+// a timer tick every 250ms with a little jitter, setters coming in at random
+// between, the task sleeping on notifications and on fanc_sched_wait_us()
+// rounded up to the RTOS tick, duties out through fanc_ctrl. The IDF's rule
+// is checked at every commit: no duty goes out on a channel while its fade
+// is running, and every fade is over FANC_SCHED_GUARD_MS before the next
+// tick. Then how long a change takes to go out - open loop right away, a
+// closed loop at the next tick - against the old fixed 250ms loop, where
+// everything waited for the next period.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "fanc_sched.h"
+#include "fanc_ctrl.h"
+
+#define PERIOD_US 250000
+#define RTOS_TICK_US 10000
+
+static fanc_sched_t S;
+static fanc_ctrl_t C;
+static int64_t g_now;
+static int64_t g_fade_end[FANC_FANS_MAX];
+static uint32_t g_staged;
+static uint32_t g_fades;
+
+static int hw_rpm_get(void *ctx, int fan) { return 1000; }
+static void hw_duty_set(void *ctx, int fan, int permille) { g_staged |= 1u << fan; }
+
+static void hw_duty_commit(void *ctx)
+{
+  for (int i = 0; i < FANC_FANS_MAX; i++) {
+    if (!(g_staged & (1u << i))) continue;
+    // ledc_set_duty would block here
+    assert(g_fade_end[i] <= g_now);
+    int ms = fanc_sched_fade_ms(&S, i, g_now);
+    g_fade_end[i] = g_now + ms * 1000;
+    if (ms > 0) {
+      g_fades++;
+      assert(g_fade_end[i] <= S.next_tick_us - FANC_SCHED_GUARD_MS * 1000);
+    }
+  }
+  g_staged = 0;
+}
+
+static const fanc_hw_t g_hw = { hw_rpm_get, hw_duty_set, hw_duty_commit, 0 };
+
+// n_fans, fan 1 holding RPM if there is one. gap_us() is the time to the next set.
+static void simulate(int n_fans, int64_t until_us, int64_t (*gap_us)(), int *n_sets)
+{
+  for (int i = 0; i < FANC_FANS_MAX; i++) g_fade_end[i] = 0;
+  fanc_ctrl_init(&C, n_fans, PERIOD_US / 1000);
+  if (n_fans > 1) {
+    C.fans[1].set.mode = FANC_MODE_RPM;
+    C.fans[1].set.rpm_target = 1000;
+  }
+  fanc_sched_init(&S, PERIOD_US / 1000, 0);
+  g_now = 0;
+  fanc_ctrl_step(&C, &g_hw, 0);
+
+  int64_t tick_at = PERIOD_US, wake_at = -1, set_at = 5000;
+  *n_sets = 0;
+  while (g_now < until_us) {
+    int64_t t = tick_at;
+    if (wake_at >= 0 && wake_at < t) t = wake_at;
+    if (set_at < t) t = set_at;
+    g_now = t;
+
+    uint32_t bits = 0;
+    if (g_now == set_at) {
+      int fan = rand() % n_fans;
+      if (fan == 0) C.fans[0].set.percentage = rand() % 101;
+      else C.fans[1].set.rpm_target = 500 + rand() % 1000;
+      fanc_sched_request(&S, fan, g_now);
+      bits |= 1u << fan;
+      (*n_sets)++;
+      set_at = g_now + gap_us();
+      // the notification takes a moment to wake the task
+      g_now += 50;
+    }
+    if (g_now >= tick_at) {
+      bits |= FANC_SCHED_TICK;
+      tick_at += PERIOD_US + (rand() % 200 - 100);
+    }
+
+    fanc_sched_due_t d;
+    fanc_sched_wake(&S, bits, g_now, &d);
+    if (d.apply) {
+      uint32_t done = fanc_ctrl_apply(&C, &g_hw, d.apply);
+      fanc_sched_done(&S, done, g_now);
+      fanc_sched_hold(&S, d.apply & ~done);
+    }
+    if (d.tick) {
+      fanc_ctrl_step(&C, &g_hw, g_now / 1000);
+      fanc_sched_done(&S, S.pending, g_now);
+    }
+    int64_t w = fanc_sched_wait_us(&S, g_now);
+    wake_at = w < 0 ? -1 : g_now + ((w + RTOS_TICK_US - 1) / RTOS_TICK_US) * RTOS_TICK_US;
+  }
+}
+
+// bursts of slider drags, and quiet
+static int64_t gap_mixed() { return rand() % 2 ? rand() % 30000 + 1 : rand() % 600000 + 1000; }
+static int64_t gap_steady() { return rand() % 400000 + 1; }
+
+int main()
+{
+  srand(47);
+  int n_sets;
+
+  // ten minutes of an open fan and one holding RPM, both being changed
+  simulate(2, 600LL * 1000000, gap_mixed, &n_sets);
+  printf("open and RPM fans, 10 minutes: %d sets, %u ticks, %u fades, %u waited for one\n",
+    n_sets, S.n_ticks, g_fades, S.n_deferred);
+  printf("  set to out %lld us avg, %lld us worst, tick %lld us late at worst\n",
+    (long long) (S.lat_sum_us / S.n_applied), (long long) S.lat_max_us, (long long) S.tick_late_max_us);
+  assert(S.n_ticks >= 2399 && S.n_applied > 0);
+  // a closed loop change waits a period at most, and a tick that's a little late
+  assert(S.lat_max_us <= PERIOD_US + 1000);
+
+  // open loop only: nothing waits for a tick, only for a fade
+  simulate(1, 500LL * 1000000, gap_steady, &n_sets);
+  long long avg = S.lat_sum_us / S.n_applied;
+  printf("open fan only: %d sets, set to out %lld us avg, %lld us worst, the fixed loop was 125000 avg, 250000 worst\n",
+    n_sets, avg, (long long) S.lat_max_us);
+  assert(S.lat_max_us <= FANC_SCHED_FADE_MS * 1000 + RTOS_TICK_US);
+  assert(avg < PERIOD_US / 2 / 4);
+  return 0;
+}
@@ -0,0 +1,81 @@
+// ERROR_DIFFUSION_DITHER: over frames, each channel's output averages to the
+// 16 bit product value * scale / 256, never more than one step off it at any
+// point, and each frame is one of the two outputs either side of it.
+// Then how long a strip takes, against the 400Hz budget.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <chrono>
+
+#include "dither_diffuse.h"
+
+// scale8 as FastLED has it, FASTLED_SCALE8_FIXED
+static uint8_t scale8(uint8_t b, uint8_t s) { return ((uint16_t) b * (1 + (uint16_t) s)) >> 8; }
+
+int main() {
+
+  // every value at every scale, from a few starting carries
+  const int N = 256;
+  const int seeds[] = { 0, 1, 3, 4, 255 };
+  for (int si = 0; si < 5; si++) {
+    for (int b = 0; b < 256; b++) {
+      for (int s = 0; s < 256; s++) {
+        uint8_t r = diffuse8_seed(seeds[si]);
+        int32_t target = b * (1 + s);             // 16 bit, in 1/256ths of an output step
+        int32_t sum = 0;
+        for (int k = 1; k <= N; k++) {
+          uint8_t o = diffuse8(b, s, r);
+          assert(o == target >> 8 || o == (target >> 8) + 1);
+          sum += o;
+          int32_t err = sum * 256 - k * target;
+          assert(err > -256 && err < 256);
+        }
+      }
+    }
+  }
+  printf("all values at all scales: average within one step of value*scale/256, every prefix of %d frames\n", N);
+
+  // where it matters, the night time levels. Average over a second at 60fps.
+  const int levels[][2] = { { 3, 80 }, { 10, 80 }, { 40, 20 }, { 200, 3 } };
+  for (int i = 0; i < 4; i++) {
+    int b = levels[i][0], s = levels[i][1];
+    uint8_t r = diffuse8_seed(0);
+    int sum = 0;
+    for (int k = 0; k < 60; k++) sum += diffuse8(b, s, r);
+    double want = b * (1 + s) / 256.0;
+    printf("  value %3d scale %3d: want %.3f, scale8 %d, diffused %.3f\n", b, s, want, scale8(b, s), sum / 60.0);
+    assert(abs(sum * 256 - 60 * b * (1 + s)) < 256);
+  }
+
+  // the starting carries are staggered: at half a step, neighbours alternate
+  {
+    uint8_t r[300 * 3];
+    int up = 0;
+    for (int i = 0; i < 300 * 3; i++) {
+      r[i] = diffuse8_seed(i);
+      up += diffuse8(1, 127, r[i]);          // 128/256
+    }
+    printf("half a step, first frame: %d of %d channels up\n", up, 300 * 3);
+    assert(up > 300 && up < 600);
+  }
+
+  // a frame of 300 pixels, as the loader does it
+  {
+    static uint8_t leds[300 * 3], r[300 * 3];
+    for (int i = 0; i < 300 * 3; i++) { leds[i] = rand(); r[i] = diffuse8_seed(i); }
+    const int frames = 20000;
+    volatile uint32_t sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) {
+      uint32_t x = 0;
+      for (int i = 0; i < 300 * 3; i++) x += diffuse8(leds[i], 80, r[i]);
+      sink += x;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / frames;
+    printf("300 pixels: %.0f ns a frame on this host, 400Hz is 2500000 ns\n", ns);
+  }
+
+  return 0;
+}
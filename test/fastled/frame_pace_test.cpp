@@ -0,0 +1,110 @@
+// The frame governor's deadline math ( frame_pace.h ) against a fake clock: a
+// render loop that waits out each slot, wakes a little late the way a timer
+// does, and takes a varying time to render and show. Slots stay on the
+// period, a frame that's a bit late keeps the phase, a long stall restarts
+// the schedule rather than bursting frames out to catch up, and the fps and
+// jitter stats settle on what actually happened.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "frame_pace.h"
+
+struct fake_clock_t {
+  uint64_t now = 1000000;
+};
+
+// one trip round the render loop: wait for the slot, show, render the next
+static uint64_t frame(CFramePace & p, fake_clock_t & c, uint32_t wake_late, uint32_t work)
+{
+  uint32_t wait = p.nextSlot(c.now);
+  if (wait) c.now += wait + wake_late;
+  uint64_t shown = c.now;
+  p.markFrame(shown);
+  c.now += work;
+  return shown;
+}
+
+int main()
+{
+  srand(30);
+
+  // 60fps, rendering takes 2 to 12ms, the timer wakes up to 30us late
+  {
+    CFramePace p; fake_clock_t c;
+    p.setPeriod(16667);
+    uint64_t first = 0, last = 0;
+    for (int i = 0; i < 600; i++) {
+      uint64_t t = frame(p, c, rand() % 30, 2000 + rand() % 10000);
+      uint64_t slot = p.getSlot();
+      if (i == 0) first = slot;
+      assert(slot == first + (uint64_t) i * 16667);
+      assert(t >= slot && t < slot + 30);
+      last = t;
+    }
+    printf("60fps, 2-12ms renders: %d fps, jitter %u us, 600 frames in %.3f s\n",
+      p.getFPS(), p.getJitter(), (last - first) / 1e6);
+    assert(p.getFPS() == 59 || p.getFPS() == 60);
+    assert(p.getJitter() < 30);
+  }
+
+  // a frame 5ms late keeps the phase: the next one goes straight out, the
+  // one after is back on the grid
+  {
+    CFramePace p; fake_clock_t c;
+    p.setPeriod(16667);
+    for (int i = 0; i < 10; i++) frame(p, c, 0, 5000);
+    uint64_t grid = p.getSlot();
+    frame(p, c, 0, 16667 + 5000);
+    uint64_t late = frame(p, c, 0, 5000);
+    assert(late == grid + 2 * 16667 + 5000);
+    frame(p, c, 0, 5000);
+    assert(p.getSlot() == grid + 3 * 16667);
+    printf("5ms late: back on the grid the frame after\n");
+  }
+
+  // a 200ms stall: the schedule restarts, no burst of frames to catch up
+  {
+    CFramePace p; fake_clock_t c;
+    p.setPeriod(16667);
+    for (int i = 0; i < 10; i++) frame(p, c, 0, 3000);
+    frame(p, c, 0, 200000);
+    uint64_t prev = frame(p, c, 0, 3000);
+    uint32_t closest = UINT32_MAX;
+    for (int i = 0; i < 10; i++) {
+      uint64_t t = frame(p, c, 0, 3000);
+      if (t - prev < closest) closest = t - prev;
+      prev = t;
+    }
+    printf("200ms stall: closest frames after it %u us apart\n", closest);
+    assert(closest == 16667);
+  }
+
+  // changing the rate: fps follows within a few dozen frames
+  {
+    CFramePace p; fake_clock_t c;
+    p.setPeriod(16667);
+    for (int i = 0; i < 100; i++) frame(p, c, 0, 3000);
+    p.setPeriod(10000);
+    int n = 0;
+    while (p.getFPS() < 99 && n < 1000) { frame(p, c, 0, 3000); n++; }
+    printf("60 to 100 fps: measured within %d frames\n", n);
+    assert(n < 50);
+  }
+
+  // period 0 doesn't pace
+  {
+    CFramePace p; fake_clock_t c;
+    p.setPeriod(0);
+    for (int i = 0; i < 100; i++) assert(p.nextSlot(c.now + i * 7) == 0);
+    uint64_t t0 = c.now;
+    for (int i = 0; i < 100; i++) frame(p, c, 0, 1000);
+    assert(c.now - t0 == 100 * 1000);
+    assert(p.getFPS() == 1000 && p.getJitter() == 0);
+  }
+  printf("period 0: no waits\n");
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+// The I2S fill: packed pixel words and one 32x32 transposition ( i2s_fill.h )
+// against the per-channel 8x8 transpositions it replaced, which scaled each
+// pixel in the interrupt handler. The two must write the same DMA buffers,
+// byte for byte, for strips of mixed lengths, which retire as they run out.
+// Then both are timed at 24 strips of 300.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+#include <vector>
+
+#include "i2s_fill.h"
+
+#define NUM_COLOR_CHANNELS 3
+
+static uint8_t scale8(uint8_t b, uint8_t s) { return ((uint16_t) b * (1 + (uint16_t) s)) >> 8; }
+
+struct strip_t {
+  std::vector<uint8_t> rgb;   // 3 a pixel, as the app left it
+  int len;
+};
+
+struct wire_t {
+  int pulsesPerBit, onesForZero, onesForOne;
+};
+
+// ---- the old fill, as it was in clockless_i2s_esp32.h
+
+static void transpose8rS32(uint8_t * A, int m, int n, uint8_t * B)
+{
+  uint32_t x, y, t;
+  x = (A[0]<<24)   | (A[m]<<16)   | (A[2*m]<<8) | A[3*m];
+  y = (A[4*m]<<24) | (A[5*m]<<16) | (A[6*m]<<8) | A[7*m];
+  t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+  t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+  t = (x ^ (x >>14)) & 0x0000CCCC;  x = x ^ t ^ (t <<14);
+  t = (y ^ (y >>14)) & 0x0000CCCC;  y = y ^ t ^ (t <<14);
+  t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+  y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+  x = t;
+  B[0]=x>>24;    B[n]=x>>16;    B[2*n]=x>>8;  B[3*n]=x;
+  B[4*n]=y>>24;  B[5*n]=y>>16;  B[6*n]=y>>8;  B[7*n]=y;
+}
+
+static void transpose32(uint8_t * pixels, uint8_t * bits)
+{
+  transpose8rS32(& pixels[0],  1, 4, & bits[0]);
+  transpose8rS32(& pixels[8],  1, 4, & bits[1]);
+  transpose8rS32(& pixels[16], 1, 4, & bits[2]);
+}
+
+struct old_fill_t {
+  const strip_t *strips;
+  int n;
+  uint8_t scale;
+  int cur;
+  uint8_t row[NUM_COLOR_CHANNELS][32];
+  uint8_t bits[NUM_COLOR_CHANNELS][8][4];
+};
+
+// one pixel row into buf, false when every strip's done
+static bool old_fill(old_fill_t & f, const wire_t & w, volatile uint32_t * buf)
+{
+  uint32_t has_data_mask = 0;
+  for (int i = 0; i < f.n; i++) {
+    int bit_index = 23-i;
+    const strip_t & s = f.strips[i];
+    if (f.cur < s.len) {
+      f.row[0][bit_index] = scale8(s.rgb[f.cur * 3 + 0], f.scale);
+      f.row[1][bit_index] = scale8(s.rgb[f.cur * 3 + 1], f.scale);
+      f.row[2][bit_index] = scale8(s.rgb[f.cur * 3 + 2], f.scale);
+      has_data_mask |= (1 << (i+8));
+    }
+  }
+  if (has_data_mask == 0) return false;
+  for (int channel = 0; channel < NUM_COLOR_CHANNELS; channel++) {
+    transpose32(f.row[channel], f.bits[channel][0]);
+    for (int bitnum = 0; bitnum < 8; bitnum++) {
+      uint8_t * row = (uint8_t *) (f.bits[channel][bitnum]);
+      uint32_t bit = (row[0] << 24) | (row[1] << 16) | (row[2] << 8) | row[3];
+      for (int pulse_num = w.onesForZero; pulse_num < w.onesForOne; pulse_num++) {
+        buf[bitnum*w.pulsesPerBit+channel*8*w.pulsesPerBit+pulse_num] = has_data_mask & bit;
+      }
+    }
+  }
+  f.cur++;
+  return true;
+}
+
+// ---- the new fill, as clockless_i2s_esp32.h has it now
+
+struct new_fill_t {
+  int n;
+  std::vector<std::vector<uint32_t>> data;    // loadPixelData()'s buffers
+  std::vector<int> len;
+  const uint32_t * src[24];
+  int stride[24];
+  uint8_t byLength[24];
+  int nextEnd, cur, maxPixels;
+  uint32_t rows[32];
+};
+
+static const uint32_t zeroPixel = 0;
+
+// loadPixelData(), in task context
+static void new_load(new_fill_t & f, const strip_t * strips, int n, uint8_t scale)
+{
+  f.n = n;
+  f.data.resize(n);
+  f.len.resize(n);
+  for (int i = 0; i < n; i++) {
+    f.len[i] = strips[i].len;
+    f.data[i].resize(strips[i].len);
+    const uint8_t * p = strips[i].rgb.data();
+    for (int j = 0; j < strips[i].len; j++, p += 3) {
+      f.data[i][j] = i2s_pack_pixel(scale8(p[0], scale), scale8(p[1], scale), scale8(p[2], scale));
+    }
+  }
+}
+
+// prepareSources()
+static void new_prepare(new_fill_t & f)
+{
+  for (int i = 0; i < f.n; i++) {
+    f.src[i] = f.data[i].data();
+    f.stride[i] = 1;
+  }
+  f.maxPixels = i2s_sort_by_length(f.byLength, f.len.data(), f.n);
+  f.nextEnd = 0;
+  f.cur = 0;
+}
+
+// fillBuffer()
+static bool new_fill(new_fill_t & f, const wire_t & w, volatile uint32_t * buf)
+{
+  if (f.cur >= f.maxPixels) return false;
+  f.nextEnd = i2s_retire_strips(f.src, f.stride, f.byLength, f.len.data(), f.n, f.nextEnd, f.cur, &zeroPixel);
+  i2s_gather_row(f.rows, f.src, f.stride, f.n);
+  i2s_transpose32x32(f.rows);
+  i2s_encode_row(buf, f.rows, 8 * NUM_COLOR_CHANNELS, w.pulsesPerBit, w.onesForZero, w.onesForOne);
+  f.cur++;
+  return true;
+}
+
+static std::vector<strip_t> make_strips(int n, int len, bool skewed)
+{
+  std::vector<strip_t> s(n);
+  for (int i = 0; i < n; i++) {
+    s[i].len = skewed ? 1 + rand() % len : len;
+    s[i].rgb.resize(s[i].len * 3);
+    for (auto & b : s[i].rgb) b = rand();
+  }
+  return s;
+}
+
+int main()
+{
+  srand(27);
+  const wire_t wires[] = { { 3, 1, 2 }, { 10, 3, 7 }, { 4, 1, 3 } };
+
+  // ---- byte for byte, whole frames
+  int frames = 0;
+  for (int trial = 0; trial < 60; trial++) {
+    int n = 1 + trial % 24;
+    const wire_t & w = wires[trial % 3];
+    std::vector<strip_t> strips = make_strips(n, 80, trial % 2 == 0);
+    uint8_t scale = rand();
+    int words = 32 * NUM_COLOR_CHANNELS * w.pulsesPerBit;
+    std::vector<uint32_t> a(words), b(words);
+
+    old_fill_t of; memset(&of, 0, sizeof of);
+    of.strips = strips.data(); of.n = n; of.scale = scale;
+    new_fill_t nf;
+    new_load(nf, strips.data(), n, scale);
+    new_prepare(nf);
+
+    while (1) {
+      bool ao = old_fill(of, w, a.data());
+      bool bo = new_fill(nf, w, b.data());
+      assert(ao == bo);
+      if (!ao) break;
+      assert(memcmp(a.data(), b.data(), words * sizeof(uint32_t)) == 0);
+    }
+    frames++;
+  }
+  printf("same DMA buffers, byte for byte: %d frames, 1 to 24 strips, even and skewed lengths\n", frames);
+
+  // ---- timed, 24 X 300
+  {
+    const wire_t w = { 3, 1, 2 };
+    std::vector<strip_t> strips = make_strips(24, 300, false);
+    std::vector<uint32_t> buf(32 * NUM_COLOR_CHANNELS * w.pulsesPerBit);
+    const int N = 400;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < N; k++) {
+      old_fill_t of; memset(&of, 0, sizeof of);
+      of.strips = strips.data(); of.n = 24; of.scale = 200;
+      while (old_fill(of, w, buf.data())) ;
+    }
+    double old_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / N;
+
+    new_fill_t nf;
+    t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < N; k++) new_load(nf, strips.data(), 24, 200);
+    double load_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / N;
+
+    t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < N; k++) {
+      new_prepare(nf);
+      while (new_fill(nf, w, buf.data())) ;
+    }
+    double new_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / N;
+
+    printf("24 strips X 300, a frame on this host:\n");
+    printf("  old, all in the interrupt:  %7.1f us, %.3f us a row\n", old_us, old_us / 300);
+    printf("  new, in the interrupt:      %7.1f us, %.3f us a row ( %.1fx )\n", new_us, new_us / 300, old_us / new_us);
+    printf("  new, loadPixelData up front %7.1f us\n", load_us);
+    printf("  the wire: 30 us a row, 9000 us a frame, 60fps is 16667 us\n");
+  }
+
+  return 0;
+}
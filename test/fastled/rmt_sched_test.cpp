@@ -0,0 +1,139 @@
+// RMT channel scheduling: more strips than channels, each freed channel
+// takes the next strip in the queue, as doneOnChannel()/startNext() do.
+// How long a show takes ( the makespan ) with the queue in registration
+// order, against longest first ( rmt_sched.h ), for a few strip mixes.
+// Longest first is held to its bound, 4/3 of the best possible, which is
+// found by brute force on small cases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include "rmt_sched.h"
+
+// a WS2812 byte, 8 bits of 1.25us
+#define US_PER_BYTE 10
+
+// when the last strip's done, channels taking the queue in order
+static long makespan(const std::vector<int> & bytes, const int * order, int channels)
+{
+  std::vector<long> free_at(channels, 0);
+  for (size_t i = 0; i < bytes.size(); i++) {
+    auto ch = std::min_element(free_at.begin(), free_at.end());
+    *ch += (long) bytes[order[i]] * US_PER_BYTE;
+  }
+  return *std::max_element(free_at.begin(), free_at.end());
+}
+
+static long registration(const std::vector<int> & bytes, int channels)
+{
+  std::vector<int> order(bytes.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  return makespan(bytes, order.data(), channels);
+}
+
+static long longest_first(const std::vector<int> & bytes, int channels)
+{
+  std::vector<int> order(bytes.size());
+  rmt_order_longest_first(bytes.data(), bytes.size(), order.data());
+  for (size_t i = 1; i < order.size(); i++) {
+    assert(bytes[order[i-1]] >= bytes[order[i]]);
+    // stable
+    if (bytes[order[i-1]] == bytes[order[i]]) assert(order[i-1] < order[i]);
+  }
+  return makespan(bytes, order.data(), channels);
+}
+
+// the best any assignment of strips to channels can do
+static long best(const std::vector<int> & bytes, int channels)
+{
+  int n = bytes.size();
+  long total = 1;
+  for (int i = 0; i < n; i++) total *= channels;
+  long b = -1;
+  std::vector<long> load(channels);
+  for (long a = 0; a < total; a++) {
+    std::fill(load.begin(), load.end(), 0);
+    long x = a;
+    for (int i = 0; i < n; i++, x /= channels) load[x % channels] += (long) bytes[i] * US_PER_BYTE;
+    long m = *std::max_element(load.begin(), load.end());
+    if (b < 0 || m < b) b = m;
+  }
+  return b;
+}
+
+static void report(const char * name, const std::vector<int> & bytes, int channels)
+{
+  long sum = 0, longest = 0;
+  for (int b : bytes) { sum += (long) b * US_PER_BYTE; longest = std::max(longest, (long) b * US_PER_BYTE); }
+  long lower = std::max(longest, (sum + channels - 1) / channels);
+  long r = registration(bytes, channels), l = longest_first(bytes, channels);
+  printf("  %-40s %2zu strips %d channels: registration %6ld us, longest first %6ld us, no better than %6ld us\n",
+    name, bytes.size(), channels, r, l, lower);
+  assert(l >= lower);
+}
+
+int main()
+{
+  srand(28);
+
+  printf("makespan, WS2812:\n");
+  {
+    // the long ones registered last
+    std::vector<int> b(14, 30 * 3);
+    b.push_back(300 * 3); b.push_back(300 * 3);
+    report("14 X 30 then 2 X 300", b, 8);
+    report("14 X 30 then 2 X 300", b, 4);
+  }
+  {
+    std::vector<int> b;
+    for (int i = 0; i < 12; i++) b.push_back((i % 3 == 2 ? 240 : 60) * 3);
+    report("every third strip 240, the rest 60", b, 8);
+    report("every third strip 240, the rest 60", b, 4);
+  }
+  {
+    std::vector<int> b(16, 150 * 3);
+    report("16 X 150", b, 8);
+  }
+  {
+    std::vector<int> b;
+    for (int i = 0; i < 9; i++) b.push_back(300 * 3);
+    report("9 X 300", b, 8);
+  }
+
+  // random mixes: on average, and the worst, against the lower bound
+  for (int channels = 4; channels <= 8; channels += 4) {
+    double rs = 0, ls = 0, rw = 0, lw = 0;
+    const int trials = 2000;
+    for (int t = 0; t < trials; t++) {
+      int n = channels + 1 + rand() % 24;
+      std::vector<int> b(n);
+      long sum = 0, longest = 0;
+      for (int & x : b) { x = (10 + rand() % 300) * 3; sum += (long) x * US_PER_BYTE; longest = std::max(longest, (long) x * US_PER_BYTE); }
+      double lower = std::max(longest, (sum + channels - 1) / channels);
+      double r = registration(b, channels) / lower, l = longest_first(b, channels) / lower;
+      rs += r; ls += l; rw = std::max(rw, r); lw = std::max(lw, l);
+    }
+    printf("  %d random mixes, %d channels, over the lower bound: registration %.3f avg %.3f worst, longest first %.3f avg %.3f worst\n",
+      trials, channels, rs / trials, rw, ls / trials, lw);
+    assert(ls < rs);
+  }
+
+  // small enough to know the best: longest first is within 4/3 of it
+  double worst = 0;
+  for (int t = 0; t < 300; t++) {
+    int channels = 2 + rand() % 3;
+    int n = channels + 1 + rand() % (channels == 4 ? 5 : 7);
+    std::vector<int> b(n);
+    for (int & x : b) x = (10 + rand() % 300) * 3;
+    double o = best(b, channels);
+    double l = longest_first(b, channels);
+    assert(l * 3 <= o * 4);
+    worst = std::max(worst, l / o);
+  }
+  printf("  300 small cases against the best: longest first at worst %.3f of it\n", worst);
+
+  return 0;
+}
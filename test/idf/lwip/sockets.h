@@ -0,0 +1,4 @@
+#pragma once
+// lwip's BSD sockets are the host's
+#include <sys/socket.h>
+#include <unistd.h>
@@ -0,0 +1,201 @@
+// The render task's command ring ( ledc_cmd_q.cpp ), hammered from threads.
+// Producers push numbered commands, alone and in batches, as fast as they
+// can; one consumer drains "frames" the way blinkWithFx does. Nothing is lost
+// or repeated, each producer's commands come out in order, and a batch always
+// comes out whole in one drain. Then at a 400Hz frame rate, how long from
+// enqueue to applied.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "ledc_cmd_q.h"
+
+static int64_t now_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ledc_cmd_t mk(int producer, int n)
+{
+  ledc_cmd_t c = {};
+  c.type = LEDC_CMD_SPEED;
+  c.segment = producer;
+  c.value = n;
+  return c;
+}
+
+static void single_thread()
+{
+  static ledc_cmd_q_t q;
+  ledc_cmd_q_init(&q);
+  ledc_cmd_t c;
+
+  assert(!ledc_cmd_q_peek(&q, &c));
+  assert(ledc_cmd_q_space(&q) == LEDC_CMD_QUEUE_LEN);
+
+  // fill it one at a time, then it's full
+  int in = 0, out = 0;
+  while (true) {
+    ledc_cmd_t x = mk(0, in);
+    if (!ledc_cmd_q_push(&q, &x, 1)) break;
+    in++;
+  }
+  assert(in == LEDC_CMD_QUEUE_LEN && ledc_cmd_q_space(&q) == 0);
+
+  // a batch bigger than the space goes in not at all
+  for (int k = 0; k < 3; k++) { assert(ledc_cmd_q_peek(&q, &c) && c.value == out++); ledc_cmd_q_pop(&q); }
+  assert(ledc_cmd_q_space(&q) == 3);
+  ledc_cmd_t b[5];
+  for (int i = 0; i < 5; i++) b[i] = mk(0, in + i);
+  assert(!ledc_cmd_q_push(&q, b, 5));
+  assert(ledc_cmd_q_space(&q) == 3);
+  assert(ledc_cmd_q_push(&q, b, 3));
+  in += 3;
+  assert(ledc_cmd_q_space(&q) == 0);
+
+  // round the ring a few times, batches of all sizes
+  for (int round = 0; round < 200; round++) {
+    while (ledc_cmd_q_peek(&q, &c)) { assert(c.value == out++); ledc_cmd_q_pop(&q); }
+    int n = 1 + round % LEDC_CMD_QUEUE_LEN;
+    ledc_cmd_t bb[LEDC_CMD_QUEUE_LEN];
+    for (int i = 0; i < n; i++) bb[i] = mk(0, in + i);
+    assert(ledc_cmd_q_push(&q, bb, n));
+    in += n;
+    for (int i = 0; i < n; i++) {
+      assert(ledc_cmd_q_peek(&q, &c));
+      assert(c.batch_left == n - 1 - i);
+      assert(c.value == out++);
+      ledc_cmd_q_pop(&q);
+    }
+  }
+  assert(!ledc_cmd_q_push(&q, b, 0) && !ledc_cmd_q_push(&q, b, LEDC_CMD_QUEUE_LEN + 1));
+
+  // the biggest /rest/state PATCH, 3 + 10 segments of 7, behind some singles:
+  // refused whole while it doesn't fit, then in as one
+  const int patch = 3 + 10 * 7;
+  int singles = LEDC_CMD_QUEUE_LEN - patch + 5;
+  for (int i = 0; i < singles; i++) { ledc_cmd_t x = mk(0, in++); assert(ledc_cmd_q_push(&q, &x, 1)); }
+  ledc_cmd_t pb[patch];
+  for (int i = 0; i < patch; i++) pb[i] = mk(0, in + i);
+  assert(!ledc_cmd_q_push(&q, pb, patch));
+  assert(ledc_cmd_q_space(&q) == LEDC_CMD_QUEUE_LEN - singles);
+  for (int k = 0; k < singles; k++) { assert(ledc_cmd_q_peek(&q, &c) && c.value == out++ && c.batch_left == 0); ledc_cmd_q_pop(&q); }
+  assert(ledc_cmd_q_push(&q, pb, patch));
+  in += patch;
+  for (int i = 0; i < patch; i++) {
+    assert(ledc_cmd_q_peek(&q, &c) && c.value == out++ && c.batch_left == patch - 1 - i);
+    ledc_cmd_q_pop(&q);
+  }
+  assert(!ledc_cmd_q_peek(&q, &c));
+  printf("single thread: fills at %d, batches all or nothing, in order round the ring, a %d command PATCH whole\n", LEDC_CMD_QUEUE_LEN, patch);
+}
+
+static void stress(int producers, int per_producer)
+{
+  static ledc_cmd_q_t q;
+  ledc_cmd_q_init(&q);
+  std::atomic<int> done(0);
+  std::atomic<long> full(0);
+
+  std::vector<std::thread> th;
+  for (int p = 0; p < producers; p++) {
+    th.emplace_back([&, p]() {
+      unsigned seed = p + 1;
+      int n = 0;
+      while (n < per_producer) {
+        int batch = std::min(1 + (int)(rand_r(&seed) % 6), per_producer - n);
+        ledc_cmd_t b[8];
+        for (int i = 0; i < batch; i++) b[i] = mk(p, n + i);
+        while (!ledc_cmd_q_push(&q, b, batch)) { full++; std::this_thread::yield(); }
+        n += batch;
+      }
+      done++;
+    });
+  }
+
+  std::vector<int> next(producers, 0);
+  long got = 0, drains = 0, batches = 0;
+  while (true) {
+    bool finished = (done.load() == producers);
+    ledc_cmd_t c;
+    int owed = 0;   // rest of a batch, must come out in this drain
+    while (ledc_cmd_q_peek(&q, &c)) {
+      ledc_cmd_q_pop(&q);
+      assert(c.segment < producers);
+      assert(c.value == next[c.segment]);
+      next[c.segment]++;
+      got++;
+      if (owed) { owed--; assert(c.batch_left == owed); }
+      else if (c.batch_left) { owed = c.batch_left; batches++; }
+    }
+    assert(owed == 0);
+    drains++;
+    // between frames the render task sleeps, which lets the producers run
+    // even on one core
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+    if (finished && !ledc_cmd_q_peek(&q, &c)) break;
+  }
+  for (auto & t : th) t.join();
+  assert(got == (long) producers * per_producer);
+  for (int p = 0; p < producers; p++) assert(next[p] == per_producer);
+  printf("%d producers X %d: all %ld out, in order, %ld batches whole, %ld drains, %ld pushes found it full\n",
+    producers, per_producer, got, batches, drains, full.load());
+}
+
+// the render loop at 400Hz, producers pushing now and then: enqueue to applied
+static void latency()
+{
+  static ledc_cmd_q_t q;
+  ledc_cmd_q_init(&q);
+  std::atomic<bool> stop(false);
+  const int period = 2500;
+
+  std::vector<std::thread> th;
+  for (int p = 0; p < 3; p++) {
+    th.emplace_back([&, p]() {
+      int n = 0;
+      while (!stop) {
+        ledc_cmd_t c = mk(p, n++);
+        c.enqueue_time = now_us();
+        while (!ledc_cmd_q_push(&q, &c, 1) && !stop) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::microseconds(300 + p * 200));
+      }
+    });
+  }
+
+  std::vector<int64_t> lat;
+  int64_t next_frame = now_us();
+  for (int f = 0; f < 400; f++) {
+    ledc_cmd_t c;
+    while (ledc_cmd_q_peek(&q, &c)) {
+      ledc_cmd_q_pop(&q);
+      lat.push_back(now_us() - c.enqueue_time);
+    }
+    next_frame += period;
+    std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::microseconds(next_frame)));
+  }
+  stop = true;
+  for (auto & t : th) t.join();
+
+  std::sort(lat.begin(), lat.end());
+  printf("400Hz drain, %zu commands: enqueue to applied median %lld us, 99%% %lld us, worst %lld us ( a frame is %d us )\n",
+    lat.size(), (long long) lat[lat.size() / 2], (long long) lat[lat.size() * 99 / 100], (long long) lat.back(), period);
+}
+
+int main()
+{
+  single_thread();
+  stress(1, 200000);
+  stress(4, 50000);
+  stress(8, 25000);
+  latency();
+  return 0;
+}
@@ -0,0 +1,140 @@
+// The push channel's decisions ( ledc_delta.cpp ), stepped the way the
+// server's timer steps them, every LEDC_PUSH_PERIOD_MS. A first push is the
+// whole state. A slider dragged for a few seconds, a change every 20ms,
+// goes out at most once a LEDC_DELTA_MIN_INTERVAL_US, and the last value
+// always gets there. A state that only has its clocks ticking sends nothing
+// until the clock resync, every LEDC_DELTA_CLOCK_RESYNC_US. Then the client
+// table: it holds LEDC_PUSH_MAX_CLIENTS, refuses the next, and a dropped
+// slot is reused.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ledc_delta.h"
+
+// as ledc_server.cpp has it
+#define PERIOD_US (100 * 1000LL)
+
+static ledc_delta_t d;
+static ledc_state_t cur;
+static char buf[160];
+
+static void tick_clocks(int64_t now)
+{
+  cur.uptime = now / 1000000;
+  cur.epoch = 1600000000 + cur.uptime;
+}
+
+static void first()
+{
+  ledc_delta_init(&d);
+  memset(&cur, 0, sizeof(cur));
+  cur.led_mode = 3;
+  cur.led_speed = 40;
+  cur.brightness = 128;
+  tick_clocks(0);
+  int len = ledc_delta_build(&d, &cur, 0, buf, sizeof(buf));
+  printf("first push, everything: %s\n", buf);
+  assert(len > 0 && len == (int) strlen(buf));
+  assert(strstr(buf, "\"led_mode\":3") && strstr(buf, "\"led_speed\":40") && strstr(buf, "\"brightness\":128"));
+  assert(strstr(buf, "\"realtime\":0") && strstr(buf, "\"epoch\"") && strstr(buf, "\"uptime\""));
+
+  // too small a buffer isn't half an object
+  ledc_delta_t small;
+  ledc_delta_init(&small);
+  char tiny[20];
+  assert(ledc_delta_build(&small, &cur, 0, tiny, sizeof(tiny)) == 0);
+}
+
+static void burst()
+{
+  // a brightness slider dragged for 3s, a new value every 20ms
+  int64_t now = 1000000, last_push = -1, min_gap = INT64_MAX;
+  int pushes = 0, changes = 0;
+  int64_t next_change = now;
+  const int64_t drag_end = now + 3000000;
+  for (; now < drag_end + 1000000; now += PERIOD_US) {
+    while (next_change <= now && next_change < drag_end) {
+      cur.brightness = 10 + changes % 240;
+      changes++;
+      next_change += 20000;
+    }
+    tick_clocks(now);
+    int len = ledc_delta_build(&d, &cur, now, buf, sizeof(buf));
+    if (len == 0) continue;
+    assert(strstr(buf, "\"brightness\""));
+    assert(!strstr(buf, "\"led_mode\"") && !strstr(buf, "\"led_speed\""));
+    if (last_push >= 0 && now - last_push < min_gap) min_gap = now - last_push;
+    last_push = now;
+    pushes++;
+  }
+  printf("slider dragged for 3s: %d changes, %d pushes, %lld ms apart at least\n",
+    changes, pushes, (long long) (min_gap / 1000));
+  assert(min_gap >= LEDC_DELTA_MIN_INTERVAL_US);
+  assert(pushes <= 3000000 / LEDC_DELTA_MIN_INTERVAL_US + 1);
+  // the browsers end up with the last value
+  assert(d.sent.brightness == cur.brightness);
+}
+
+static void quiet()
+{
+  // nothing but the clocks for two minutes
+  int64_t start = d.last_push, now = start;
+  int pushes = 0;
+  int64_t first_resync = -1;
+  for (now += PERIOD_US; now < start + 120 * 1000000LL; now += PERIOD_US) {
+    tick_clocks(now);
+    int len = ledc_delta_build(&d, &cur, now, buf, sizeof(buf));
+    if (len == 0) continue;
+    // only the clocks
+    assert(strstr(buf, "\"epoch\"") && strstr(buf, "\"uptime\"") && !strstr(buf, "\"brightness\""));
+    if (first_resync < 0) first_resync = now - start;
+    pushes++;
+  }
+  printf("two minutes unchanged: %d pushes, clocks only, the first after %llds\n",
+    pushes, (long long) (first_resync / 1000000));
+  // at 30, 60 and 90s
+  assert(pushes == 3);
+  assert(first_resync >= LEDC_DELTA_CLOCK_RESYNC_US && first_resync < LEDC_DELTA_CLOCK_RESYNC_US + PERIOD_US);
+
+  // a change pushes within the window, the clocks ride along
+  cur.led_mode = 7;
+  now += LEDC_DELTA_MIN_INTERVAL_US;
+  tick_clocks(now);
+  assert(ledc_delta_build(&d, &cur, now, buf, sizeof(buf)) > 0);
+  assert(strstr(buf, "\"led_mode\":7") && strstr(buf, "\"epoch\""));
+}
+
+static void clients()
+{
+  ledc_push_table_t t;
+  ledc_push_table_init(&t);
+  ledc_push_client_t *c[LEDC_PUSH_MAX_CLIENTS];
+  for (int i = 0; i < LEDC_PUSH_MAX_CLIENTS; i++) {
+    c[i] = ledc_push_client_add(&t, 50 + i);
+    assert(c[i] && c[i]->fd == 50 + i && c[i]->fresh);
+  }
+  assert(t.n_clients == LEDC_PUSH_MAX_CLIENTS);
+  assert(ledc_push_client_add(&t, 99) == NULL && t.n_clients == LEDC_PUSH_MAX_CLIENTS);
+
+  // a dropped one, twice, only counts once, and its slot is the next one used
+  ledc_push_client_drop(&t, c[2]);
+  ledc_push_client_drop(&t, c[2]);
+  assert(t.n_clients == LEDC_PUSH_MAX_CLIENTS - 1);
+  ledc_push_client_t *n = ledc_push_client_add(&t, 99);
+  assert(n == c[2] && n->fd == 99 && n->fresh);
+  assert(t.n_clients == LEDC_PUSH_MAX_CLIENTS);
+  printf("client table: %d held, the next refused, a dropped slot reused\n", LEDC_PUSH_MAX_CLIENTS);
+}
+
+int main()
+{
+  first();
+  burst();
+  quiet();
+  clients();
+  return 0;
+}
@@ -0,0 +1,212 @@
+// The flash broker ( ledc_flash_q.cpp ) against a simulated render loop, one
+// microsecond at a time. The render task takes the wire for each frame; the
+// broker takes operations off the queue in order and runs each one when it
+// gets the wire, or when it has waited out its latency, whichever's first.
+// A flash operation with the wire pushes the next frame back.
+//
+// Checks: operations run in order, none without the wire while the render
+// loop is healthy, a frame is never held up by more than one operation, a
+// stuck render task costs an operation LEDC_FLASH_MAX_LATENCY_US and no more,
+// and a full queue drops what doesn't fit.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+#include "ledc_flash_q.h"
+
+struct sim_t {
+  // render loop
+  int64_t period, busy;
+  int64_t stuck_at = -1, stuck_for = 0;   // one frame that holds the wire this long
+  // flash
+  std::vector<int64_t> arrivals;          // when each operation is queued
+  std::vector<int64_t> duration;          // and how long it takes
+  // results
+  std::vector<int> ran;                   // in the order they ran
+  std::vector<int64_t> latency;
+  std::vector<bool> in_gap;
+  int64_t frame_delay_max = 0;
+  int frames = 0;
+};
+
+static int g_running_arg = -1;
+static void op_fn(void *arg) { g_running_arg = (int)(intptr_t) arg; }
+
+enum { WIRE_FREE, WIRE_RENDER, WIRE_BROKER };
+
+static ledc_flash_q_t run(sim_t & s, int64_t until)
+{
+  ledc_flash_q_t q;
+  ledc_flash_q_init(&q);
+
+  int wire = WIRE_FREE;
+  int64_t next_frame = 0, render_done = 0;
+  bool stuck_done = false;
+
+  enum { IDLE, WAITING, RUNNING } broker = IDLE;
+  ledc_flash_op_t op = {};
+  int64_t deadline = 0, op_done = 0;
+  bool have_wire = false;
+  size_t arrived = 0;
+
+  for (int64_t now = 0; now < until; now++) {
+
+    // producers
+    while (arrived < s.arrivals.size() && s.arrivals[arrived] <= now) {
+      ledc_flash_q_push(&q, op_fn, (void *)(intptr_t) arrived, now);
+      arrived++;
+    }
+
+    // broker done with an operation. It gives the wire back first: the render
+    // task is higher priority, if it's waiting on the wire it gets it
+    if (broker == RUNNING && now >= op_done) {
+      if (have_wire) wire = WIRE_FREE;
+      ledc_flash_q_done(&q, &op, now, have_wire);
+      s.ran.push_back(g_running_arg);
+      s.latency.push_back(now - op.enqueue_time);
+      s.in_gap.push_back(have_wire);
+      broker = IDLE;
+    }
+
+    // render task: done with a frame, or starting one
+    if (wire == WIRE_RENDER && now >= render_done) wire = WIRE_FREE;
+    if (wire == WIRE_FREE && now >= next_frame) {
+      wire = WIRE_RENDER;
+      int64_t busy = s.busy;
+      if (!stuck_done && s.stuck_at >= 0 && now >= s.stuck_at) { busy = s.stuck_for; stuck_done = true; }
+      // how long it waited on the wire, from when it wanted it
+      s.frame_delay_max = std::max(s.frame_delay_max, now - std::max(next_frame, render_done));
+      render_done = now + busy;
+      next_frame += s.period;
+      s.frames++;
+    }
+
+    // broker task, starting an operation
+    if (broker == IDLE && ledc_flash_q_pop(&q, &op)) {
+      deadline = now + ledc_flash_q_wait_us(&op, now);
+      broker = WAITING;
+    }
+    if (broker == WAITING) {
+      have_wire = (wire == WIRE_FREE);
+      if (have_wire || now >= deadline) {
+        if (have_wire) wire = WIRE_BROKER;
+        op.fn(op.arg);
+        op_done = now + s.duration[g_running_arg];
+        broker = RUNNING;
+      }
+    }
+  }
+  return q;
+}
+
+static void in_order(const sim_t & s)
+{
+  for (size_t i = 1; i < s.ran.size(); i++) assert(s.ran[i] > s.ran[i-1]);
+}
+
+int main()
+{
+  srand(29);
+
+  // the latency budget itself
+  {
+    ledc_flash_op_t op = { op_fn, NULL, 1000 };
+    assert(ledc_flash_q_wait_us(&op, 1000) == LEDC_FLASH_MAX_LATENCY_US);
+    assert(ledc_flash_q_wait_us(&op, 1000 + 40000) == LEDC_FLASH_MAX_LATENCY_US - 40000);
+    assert(ledc_flash_q_wait_us(&op, 1000 + LEDC_FLASH_MAX_LATENCY_US) == 0);
+    assert(ledc_flash_q_wait_us(&op, 1000 + 5 * LEDC_FLASH_MAX_LATENCY_US) == 0);
+  }
+
+  // the ring: fills, drops past full, comes out in order across the wrap
+  {
+    ledc_flash_q_t q;
+    ledc_flash_q_init(&q);
+    ledc_flash_op_t op;
+    int next_in = 0, next_out = 0;
+    for (int round = 0; round < 5; round++) {
+      while (ledc_flash_q_push(&q, op_fn, (void *)(intptr_t) next_in, next_in)) next_in++;
+      assert(q.count == LEDC_FLASH_QUEUE_LEN);
+      for (int k = 0; k < 3 + round; k++) {
+        assert(ledc_flash_q_pop(&q, &op));
+        assert((int)(intptr_t) op.arg == next_out && op.enqueue_time == next_out);
+        next_out++;
+      }
+    }
+    while (ledc_flash_q_pop(&q, &op)) assert((int)(intptr_t) op.arg == next_out++);
+    assert(next_out == next_in);
+    assert(q.dropped == 5);
+  }
+
+  printf("render loop, one frame every period, holding the wire for busy:\n");
+
+  // 60fps, 300 WS2812 ( 9ms on the wire, and rendering ). NVS writes of 1 to
+  // 5ms, the odd 30ms sector erase, arriving at random
+  {
+    sim_t s;
+    s.period = 16667; s.busy = 10000;
+    int64_t t = 0;
+    while (t < 5000000) {
+      t += 1000 + rand() % 200000;
+      s.arrivals.push_back(t);
+      s.duration.push_back(rand() % 20 == 0 ? 30000 : 1000 + rand() % 4000);
+    }
+    ledc_flash_q_t q = run(s, 5500000);
+    in_order(s);
+    assert(s.ran.size() == s.arrivals.size());
+    assert(q.forced == 0 && q.dropped == 0);
+    assert(s.frame_delay_max <= 30000);
+    printf("  60fps, busy 10ms: %zu ops, %u forced, worst %.1f ms queued to done, worst frame pushed back %.1f ms ( longest op 30 ms )\n",
+      s.ran.size(), q.forced, q.latency_max / 1000.0, s.frame_delay_max / 1000.0);
+  }
+
+  // the same, flat out: 400Hz, 2.5ms frames with 0.3ms between them. Short
+  // writes still fit, one each gap
+  {
+    sim_t s;
+    s.period = 2500; s.busy = 2200;
+    for (int i = 0; i < 200; i++) { s.arrivals.push_back(i * 10000 + rand() % 5000); s.duration.push_back(200 + rand() % 2000); }
+    ledc_flash_q_t q = run(s, 2500000);
+    in_order(s);
+    assert(s.ran.size() == s.arrivals.size());
+    assert(q.forced == 0);
+    assert(s.frame_delay_max <= 2200);
+    printf("  400Hz, busy 2.2ms: %zu ops, %u forced, worst %.1f ms queued to done, worst frame pushed back %.1f ms\n",
+      s.ran.size(), q.forced, q.latency_max / 1000.0, s.frame_delay_max / 1000.0);
+  }
+
+  // a burst: everyone saves at once. The queue takes 8, the rest are dropped
+  {
+    sim_t s;
+    s.period = 16667; s.busy = 10000;
+    for (int i = 0; i < 12; i++) { s.arrivals.push_back(50000); s.duration.push_back(2000); }
+    ledc_flash_q_t q = run(s, 500000);
+    in_order(s);
+    assert(s.ran.size() == LEDC_FLASH_QUEUE_LEN && q.dropped == 12 - LEDC_FLASH_QUEUE_LEN);
+    assert(q.forced == 0);
+    printf("  burst of 12: %zu ran, %u dropped, worst %.1f ms queued to done\n", s.ran.size(), q.dropped, q.latency_max / 1000.0);
+  }
+
+  // the render task gets stuck holding the wire for a second. What's queued
+  // runs anyway, LEDC_FLASH_MAX_LATENCY_US after it was queued
+  {
+    sim_t s;
+    s.period = 16667; s.busy = 10000;
+    s.stuck_at = 200000; s.stuck_for = 1000000;
+    for (int i = 0; i < 4; i++) { s.arrivals.push_back(300000 + i * 150000); s.duration.push_back(3000); }
+    ledc_flash_q_t q = run(s, 2000000);
+    in_order(s);
+    assert(s.ran.size() == 4);
+    assert(q.forced == 4);
+    for (size_t i = 0; i < s.ran.size(); i++) {
+      assert(!s.in_gap[i]);
+      assert(s.latency[i] >= LEDC_FLASH_MAX_LATENCY_US && s.latency[i] <= LEDC_FLASH_MAX_LATENCY_US + 3000);
+    }
+    printf("  render stuck 1s: %zu ops, %u forced, worst %.1f ms queued to done\n", s.ran.size(), q.forced, q.latency_max / 1000.0);
+  }
+
+  return 0;
+}
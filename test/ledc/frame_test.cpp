@@ -0,0 +1,205 @@
+// The live preview frames ( ledc_frame.cpp ): every frame the encoder sends
+// decodes back to exactly the leds[] it was given, for effects the way they
+// move - a scanner dot, a rainbow, a static color, twinkles, a chase - and
+// for random frames of every length up to 300 leds, which must fit in
+// ledc_frame_max_len(). Deltas out of order, for another strip, or cut short
+// are refused and the decoder waits for a keyframe. Then how much smaller
+// than raw the stream is, and how long a frame takes to encode.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "ledc_frame.h"
+
+#define N 300
+
+static void effect(int e, int t, uint8_t * f)
+{
+  for (int i = 0; i < N; i++) {
+    uint8_t * p = f + i * 3;
+    switch (e) {
+      case 0: p[0] = p[1] = p[2] = (i == t % N) ? 255 : 0; break;
+      case 1: { int h = (i * 4 + t * 3) & 255; p[0] = h; p[1] = 255 - h; p[2] = (h * 2) & 255; break; }
+      case 2: p[0] = 10; p[1] = 20; p[2] = 30; break;
+      case 3:
+        if (rand() % 20 == 0) { p[0] = rand(); p[1] = rand(); p[2] = rand(); }
+        else { p[0] = p[0] * 7 / 8; p[1] = p[1] * 7 / 8; p[2] = p[2] * 7 / 8; }
+        break;
+      case 4: { int on = ((i / 10) + (t / 5)) % 2; p[0] = on ? 255 : 0; p[1] = 0; p[2] = on ? 128 : 0; break; }
+    }
+  }
+}
+
+static void effects()
+{
+  static uint8_t prev[N * 3], cur[N * 3], dec[N * 3];
+  std::vector<uint8_t> out(ledc_frame_max_len(N));
+  const char * names[] = { "scanner", "rainbow", "static", "twinkle", "chase" };
+
+  printf("300 leds, 500 frames, a browser joining at frame 200:\n");
+  for (int e = 0; e < 5; e++) {
+    ledc_frame_enc_t enc;
+    ledc_frame_enc_init(&enc, prev, N);
+    memset(cur, 0, sizeof cur);
+    memset(dec, 0xAA, sizeof dec);
+    uint16_t seq = 0;
+    bool have_key = false;
+    int skipped = 0;
+    for (int t = 0; t < 500; t++) {
+      effect(e, t, cur);
+      if (t == 200) ledc_frame_enc_reset(&enc);
+      int len = ledc_frame_encode(&enc, cur, out.data(), out.size());
+      assert(len >= 0);
+      if (len == 0) { skipped++; assert(memcmp(dec, cur, sizeof cur) == 0); continue; }
+      if (t == 0 || t == 200) assert(out[0] == LEDC_FRAME_KEY);
+      assert(ledc_frame_decode(dec, N, &seq, &have_key, out.data(), len) == 0 && have_key);
+      assert(memcmp(dec, cur, sizeof cur) == 0);
+    }
+    // at least one every LEDC_FRAME_KEY_INTERVAL sent, and one for the join
+    assert(enc.keys >= 1 + (enc.frames - 1) / (LEDC_FRAME_KEY_INTERVAL + 1));
+    // against sending all 500 whole
+    printf("  %-8s %3u sent %2u keyframes %3d unchanged, %5.1f%% of raw\n",
+      names[e], enc.frames, enc.keys, skipped, 100.0 * enc.sent_bytes / (500 * sizeof cur));
+  }
+}
+
+static void random_frames()
+{
+  srand(38);
+  size_t worst = 0;
+  int frames = 0;
+  for (int iter = 0; iter < 3000; iter++) {
+    int n_leds = 1 + rand() % N;
+    int n = n_leds * 3;
+    std::vector<uint8_t> prev(n), cur(n), dec(n);
+    std::vector<uint8_t> out(ledc_frame_max_len(n_leds));
+    ledc_frame_enc_t enc;
+    ledc_frame_enc_init(&enc, prev.data(), n_leds);
+    uint16_t seq = 0;
+    bool have_key = false;
+    for (int f = 0; f < 60; f++) {
+      int mode = rand() % 4;
+      for (int i = 0; i < n; i++) {
+        if (mode == 0) cur[i] = rand();
+        else if (mode == 1) { if (rand() % 5 == 0) cur[i] = rand(); }
+        else if (mode == 2) { if (i % 4 == 0) cur[i] ^= 1 + rand() % 255; }
+        else { if (rand() % 2) cur[i] ^= 1 + rand() % 255; }
+      }
+      int len = ledc_frame_encode(&enc, cur.data(), out.data(), out.size());
+      assert(len >= 0);
+      if (len == 0) continue;
+      worst = std::max(worst, (size_t) len * 1000 / (LEDC_FRAME_HEADER_LEN + n));
+      assert(ledc_frame_decode(dec.data(), n_leds, &seq, &have_key, out.data(), len) == 0);
+      assert(dec == cur);
+      frames++;
+    }
+  }
+  printf("random: %d frames of 1 to %d leds decoded exactly, all within ledc_frame_max_len, the worst %.1f%% of raw\n",
+    frames, N, worst / 10.0);
+
+  // too small a buffer is an error, not an overrun
+  static uint8_t prev[N * 3], cur[N * 3];
+  for (int i = 0; i < N * 3; i++) cur[i] = 1 + rand() % 255;
+  ledc_frame_enc_t enc;
+  ledc_frame_enc_init(&enc, prev, N);
+  std::vector<uint8_t> out(ledc_frame_max_len(N));
+  assert(ledc_frame_encode(&enc, cur, out.data(), out.size() - 1) == -1);
+  assert(ledc_frame_encode(&enc, cur, out.data(), out.size()) == (int) out.size());
+}
+
+static void refused()
+{
+  static uint8_t prev[N * 3], cur[N * 3], dec[N * 3];
+  std::vector<uint8_t> key(ledc_frame_max_len(N)), d1(key.size()), d2(key.size());
+  ledc_frame_enc_t enc;
+  ledc_frame_enc_init(&enc, prev, N);
+  for (int i = 0; i < N * 3; i++) cur[i] = rand();
+  int kl = ledc_frame_encode(&enc, cur, key.data(), key.size());
+  cur[5] ^= 0x40;
+  int l1 = ledc_frame_encode(&enc, cur, d1.data(), d1.size());
+  cur[700] ^= 0x01;
+  int l2 = ledc_frame_encode(&enc, cur, d2.data(), d2.size());
+  assert(key[0] == LEDC_FRAME_KEY && d1[0] == LEDC_FRAME_DELTA && d2[0] == LEDC_FRAME_DELTA);
+
+  uint16_t seq = 0;
+  bool have_key = false;
+
+  // a delta before any keyframe
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, d1.data(), l1) == -1 && !have_key);
+  // another strip's frame
+  assert(ledc_frame_decode(dec, N - 1, &seq, &have_key, key.data(), kl) == -1);
+  // not a frame
+  uint8_t junk[8] = { 'X', 0, 1, 0, N & 0xFF, N >> 8, 0x80, 1 };
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, junk, sizeof junk) == -1);
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, key.data(), LEDC_FRAME_HEADER_LEN - 1) == -1);
+
+  // a skipped delta: the next one is refused, until a keyframe
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, key.data(), kl) == 0 && have_key);
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, d2.data(), l2) == -1 && !have_key);
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, d1.data(), l1) == -1);
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, key.data(), kl) == 0);
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, d1.data(), l1) == 0);
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, d2.data(), l2) == 0);
+  assert(memcmp(dec, cur, sizeof cur) == 0);
+
+  // cut short inside a run: refused, and a keyframe wanted. A cut between
+  // runs can't be told from a frame whose last bytes didn't change.
+  int cut_refused = 0;
+  for (int l = LEDC_FRAME_HEADER_LEN; l < kl; l++) {
+    uint16_t s = seq;
+    bool k = true;
+    if (ledc_frame_decode(dec, N, &s, &k, key.data(), l) == -1) { assert(!k); cut_refused++; }
+  }
+  // a run that runs past the end of the strip
+  std::vector<uint8_t> over(key.begin(), key.begin() + LEDC_FRAME_HEADER_LEN);
+  for (int i = 0; i < (N * 3) / 128 + 1; i++) over.push_back(0x7F);
+  over.push_back(0x80);
+  over.push_back(1);
+  have_key = true;
+  assert(ledc_frame_decode(dec, N, &seq, &have_key, over.data(), over.size()) == -1 && !have_key);
+
+  printf("refused: deltas before a keyframe and after a gap, other strips, junk, %d of %d cuts, runs past the end\n",
+    cut_refused, kl - LEDC_FRAME_HEADER_LEN);
+}
+
+static void timing()
+{
+  static uint8_t prev[N * 3], cur[N * 3], dec[N * 3];
+  std::vector<uint8_t> out(ledc_frame_max_len(N));
+  const int frames = 20000;
+  // the least and the most that changes
+  for (int e = 0; e < 2; e++) {
+    ledc_frame_enc_t enc;
+    ledc_frame_enc_init(&enc, prev, N);
+    uint16_t seq = 0;
+    bool have_key = false;
+    double enc_ns = 0, dec_ns = 0;
+    for (int t = 0; t < frames; t++) {
+      effect(e, t, cur);
+      auto t0 = std::chrono::steady_clock::now();
+      int len = ledc_frame_encode(&enc, cur, out.data(), out.size());
+      auto t1 = std::chrono::steady_clock::now();
+      if (len > 0) ledc_frame_decode(dec, N, &seq, &have_key, out.data(), len);
+      auto t2 = std::chrono::steady_clock::now();
+      enc_ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+      dec_ns += std::chrono::duration<double, std::nano>(t2 - t1).count();
+    }
+    printf("%s, 300 leds on this host: encode %.0f ns, decode %.0f ns a frame\n",
+      e == 0 ? "scanner" : "rainbow", enc_ns / frames, dec_ns / frames);
+  }
+}
+
+int main()
+{
+  effects();
+  random_frames();
+  refused();
+  timing();
+  return 0;
+}
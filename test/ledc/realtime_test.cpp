@@ -0,0 +1,378 @@
+// DDP and E1.31 ( ledc_rtpkt.cpp ) from a packet generator: frames of 600
+// pixels where every byte says which frame it's from, so a frame shown half
+// old and half new is easy to spot.
+//
+// Straight into the parser: split DDP frames show on PUSH only; E1.31 frames
+// across four universes show once all four are in, or on the sync packet,
+// never torn, with packets lost at random; DDP for other types or devices is
+// turned away. Then over UDP on localhost, a generator thread sending to the
+// receiver the way a show controller would, and the parse time per packet.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ledc_rtpkt.h"
+
+#define N_LEDS 600
+
+typedef std::vector<uint8_t> pkt_t;
+
+// every byte of frame f: the frame number, then the position, so it's also
+// in the right place
+static uint8_t pattern(int f, int i) { return (uint8_t)(f * 31 + i); }
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+// ---- the generator
+
+static pkt_t ddp(int f, uint32_t offset, int len, bool push, uint8_t seq, uint8_t type = DDP_TYPE_RGB8, uint8_t id = DDP_ID_DEFAULT)
+{
+  pkt_t p(DDP_HEADER_LEN + len);
+  p[0] = DDP_FLAGS_VER1 | (push ? DDP_FLAGS_PUSH : 0);
+  p[1] = seq;
+  p[2] = type;
+  p[3] = id;
+  put32(&p[4], offset);
+  put16(&p[8], len);
+  for (int i = 0; i < len; i++) p[DDP_HEADER_LEN + i] = pattern(f, offset + i);
+  return p;
+}
+
+static void root(pkt_t & p, uint32_t vector)
+{
+  put16(&p[0], 0x0010);
+  memcpy(&p[4], "ASC-E1.17\0\0\0", 12);
+  put32(&p[18], vector);
+  memset(&p[22], 0x42, 16);   // CID
+}
+
+static pkt_t e131(int f, int universe, uint8_t seq, uint16_t sync = 0, int channels = E131_PIXELS_PER_UNIVERSE * 3)
+{
+  pkt_t p(E131_HEADER_LEN + channels);
+  root(p, E131_VECTOR_ROOT_DATA);
+  put32(&p[40], E131_VECTOR_DATA_PACKET);
+  strcpy((char *) &p[44], "test");
+  p[108] = 100;
+  put16(&p[109], sync);
+  p[111] = seq;
+  put16(&p[113], universe);
+  p[117] = 0x02;
+  p[118] = 0xa1;
+  put16(&p[121], 1);
+  put16(&p[123], channels + 1);
+  int base = (universe - LEDC_E131_UNIVERSE) * E131_PIXELS_PER_UNIVERSE * 3;
+  for (int i = 0; i < channels; i++) p[E131_HEADER_LEN + i] = pattern(f, base + i);
+  return p;
+}
+
+static pkt_t e131_sync(uint16_t sync, uint8_t seq)
+{
+  pkt_t p(E131_SYNC_LEN);
+  root(p, E131_VECTOR_ROOT_EXTENDED);
+  put32(&p[40], E131_VECTOR_EXTENDED_SYNC);
+  p[44] = seq;
+  put16(&p[45], sync);
+  return p;
+}
+
+// universes a frame of N_LEDS needs
+static const int UNIVERSES = (N_LEDS + E131_PIXELS_PER_UNIVERSE - 1) / E131_PIXELS_PER_UNIVERSE;
+
+static int channels_of(int u)
+{
+  int left = N_LEDS * 3 - (u - LEDC_E131_UNIVERSE) * E131_PIXELS_PER_UNIVERSE * 3;
+  return left < E131_PIXELS_PER_UNIVERSE * 3 ? left : E131_PIXELS_PER_UNIVERSE * 3;
+}
+
+// ---- checking what's shown
+
+// which frame leds holds, or -1 if it's torn
+static int frame_of(const uint8_t *leds, int hint)
+{
+  for (int f = hint; f >= 0 && f > hint - 64; f--) {
+    bool all = true;
+    for (int i = 0; i < N_LEDS * 3 && all; i++) all = (leds[i] == pattern(f, i));
+    if (all) return f;
+  }
+  return -1;
+}
+
+static void test_ddp()
+{
+  static uint8_t leds[N_LEDS * 3];
+  ledc_rt_t rt;
+  ledc_rt_init(&rt, leds, N_LEDS);
+
+  // a frame in three packets, PUSH on the last
+  uint8_t seq = 0;
+  for (int f = 0; f < 50; f++) {
+    for (int k = 0; k < 3; k++) {
+      seq = (seq % 15) + 1;
+      pkt_t p = ddp(f, k * 600, 600, k == 2, seq);
+      ledc_rt_result_t r = ledc_rt_ddp(&rt, p.data(), p.size());
+      assert(r == (k == 2 ? LEDC_RT_SHOW : LEDC_RT_DATA));
+    }
+    assert(frame_of(leds, f) == f);
+  }
+  assert(rt.stats.frames == 50 && rt.stats.gaps == 0);
+
+  // the same with a timecode, and with the undefined type senders use for RGB
+  {
+    pkt_t p = ddp(50, 0, N_LEDS * 3, true, 0, DDP_TYPE_UNDEFINED, DDP_ID_ALL);
+    p[0] |= DDP_FLAGS_TIMECODE;
+    p.insert(p.begin() + DDP_HEADER_LEN, 4, 0);
+    assert(ledc_rt_ddp(&rt, p.data(), p.size()) == LEDC_RT_SHOW);
+    assert(frame_of(leds, 50) == 50);
+  }
+
+  // not for us: RGBW, 16 bit, custom, another device, the config and status ids, a query
+  uint8_t before[N_LEDS * 3];
+  memcpy(before, leds, sizeof(before));
+  const uint8_t types[] = { 0x1B, 0x0C, 0x8B, 0x03 };
+  for (uint8_t t : types) {
+    pkt_t p = ddp(51, 0, 300, true, 0, t);
+    assert(ledc_rt_ddp(&rt, p.data(), p.size()) == LEDC_RT_NONE);
+  }
+  const uint8_t ids[] = { 0, 2, 246, 250, 251, 254 };
+  for (uint8_t id : ids) {
+    pkt_t p = ddp(51, 0, 300, true, 0, DDP_TYPE_RGB8, id);
+    assert(ledc_rt_ddp(&rt, p.data(), p.size()) == LEDC_RT_NONE);
+  }
+  {
+    pkt_t p = ddp(51, 0, 300, true, 0);
+    p[0] |= DDP_FLAGS_QUERY;
+    assert(ledc_rt_ddp(&rt, p.data(), p.size()) == LEDC_RT_NONE);
+  }
+  assert(memcmp(before, leds, sizeof(before)) == 0);
+  assert(rt.stats.unsupported == 11);
+
+  // short, or saying it's longer than it is
+  {
+    pkt_t p = ddp(51, 0, 300, true, 0);
+    assert(ledc_rt_ddp(&rt, p.data(), 5) == LEDC_RT_NONE);
+    assert(ledc_rt_ddp(&rt, p.data(), p.size() - 1) == LEDC_RT_NONE);
+    assert(rt.stats.bad == 2);
+  }
+  // past the end is clipped
+  {
+    pkt_t p = ddp(52, N_LEDS * 3 - 30, 300, true, 0);
+    assert(ledc_rt_ddp(&rt, p.data(), p.size()) == LEDC_RT_SHOW);
+    for (int i = 0; i < 30; i++) assert(leds[N_LEDS * 3 - 30 + i] == pattern(52, N_LEDS * 3 - 30 + i));
+  }
+  // a lost packet is a gap
+  {
+    ledc_rt_t r2;
+    ledc_rt_init(&r2, leds, N_LEDS);
+    pkt_t a = ddp(0, 0, 3, true, 4), b = ddp(0, 0, 3, true, 6);
+    ledc_rt_ddp(&r2, a.data(), a.size());
+    ledc_rt_ddp(&r2, b.data(), b.size());
+    assert(r2.stats.gaps == 1);
+  }
+  printf("DDP: split frames show on PUSH, 11 packets for other types or devices turned away, bad ones counted\n");
+}
+
+// E1.31 with no sync address, losing packets at random
+static void test_e131(int loss_pct)
+{
+  static uint8_t leds[N_LEDS * 3];
+  ledc_rt_t rt;
+  ledc_rt_init(&rt, leds, N_LEDS);
+  uint8_t seq[UNIVERSES] = {};
+  int shows = 0, whole = 0, last = -1;
+
+  for (int f = 0; f < 2000; f++) {
+    bool all_sent = true;
+    for (int u = LEDC_E131_UNIVERSE; u < LEDC_E131_UNIVERSE + UNIVERSES; u++) {
+      pkt_t p = e131(f, u, ++seq[u - LEDC_E131_UNIVERSE], 0, channels_of(u));
+      if (rand() % 100 < loss_pct) { all_sent = false; continue; }
+      ledc_rt_result_t r = ledc_rt_e131(&rt, p.data(), p.size());
+      if (r == LEDC_RT_SHOW) {
+        int g = frame_of(leds, f);
+        assert(g == f);        // whole, and this frame
+        assert(g > last);
+        last = g;
+        shows++;
+      }
+      else assert(r == LEDC_RT_DATA);
+    }
+    if (all_sent) whole++;
+  }
+  printf("E1.31, %d universes, %2d%% lost: %d of %d frames sent whole were shown, none torn, %u dropped\n",
+    UNIVERSES, loss_pct, shows, whole, rt.stats.dropped);
+  // the first frame teaches it what the source sends
+  assert(shows >= whole - 1 - (int) rt.stats.dropped);
+  if (loss_pct == 0) assert(shows == whole - 1 && rt.stats.dropped == 0);
+}
+
+// a source that stops sending a universe: after LEDC_E131_MISS_MAX frames
+// the rest show without it
+static void test_e131_shrink()
+{
+  static uint8_t leds[N_LEDS * 3];
+  ledc_rt_t rt;
+  ledc_rt_init(&rt, leds, N_LEDS);
+  uint8_t seq[UNIVERSES] = {};
+  int first_show = -1;
+  for (int f = 0; f < 20; f++) {
+    for (int u = LEDC_E131_UNIVERSE; u < LEDC_E131_UNIVERSE + UNIVERSES; u++) {
+      if (f >= 5 && u == LEDC_E131_UNIVERSE + UNIVERSES - 1) continue;
+      pkt_t p = e131(f, u, ++seq[u - LEDC_E131_UNIVERSE], 0, channels_of(u));
+      if (ledc_rt_e131(&rt, p.data(), p.size()) == LEDC_RT_SHOW && f >= 5 && first_show < 0) first_show = f;
+    }
+  }
+  printf("E1.31, last universe stops: showing again %d frames later\n", first_show - 5);
+  assert(first_show >= 5 && first_show <= 5 + LEDC_E131_MISS_MAX + 1);
+}
+
+// with a sync address, nothing shows until the sync packet
+static void test_e131_sync()
+{
+  static uint8_t leds[N_LEDS * 3];
+  ledc_rt_t rt;
+  ledc_rt_init(&rt, leds, N_LEDS);
+  uint8_t seq[UNIVERSES] = {}, sseq = 0;
+  for (int f = 0; f < 100; f++) {
+    for (int u = LEDC_E131_UNIVERSE; u < LEDC_E131_UNIVERSE + UNIVERSES; u++) {
+      pkt_t p = e131(f, u, ++seq[u - LEDC_E131_UNIVERSE], 7000, channels_of(u));
+      assert(ledc_rt_e131(&rt, p.data(), p.size()) == LEDC_RT_DATA);
+    }
+    pkt_t other = e131_sync(7001, ++sseq);
+    assert(ledc_rt_e131(&rt, other.data(), other.size()) == LEDC_RT_NONE);
+    pkt_t s = e131_sync(7000, ++sseq);
+    assert(ledc_rt_e131(&rt, s.data(), s.size()) == LEDC_RT_SHOW);
+    assert(frame_of(leds, f) == f);
+    // a second sync with nothing new doesn't show again
+    assert(ledc_rt_e131(&rt, s.data(), s.size()) == LEDC_RT_NONE);
+  }
+  printf("E1.31 with sync: 100 frames, each shown on its sync packet\n");
+
+  // out of order is dropped, terminate stops
+  pkt_t a = e131(0, 1, 10), b = e131(0, 1, 9);
+  assert(ledc_rt_e131(&rt, a.data(), a.size()) != LEDC_RT_NONE);
+  uint32_t dropped = rt.stats.dropped;
+  assert(ledc_rt_e131(&rt, b.data(), b.size()) == LEDC_RT_NONE && rt.stats.dropped == dropped + 1);
+  pkt_t t = e131(0, 1, 11);
+  t[112] |= E131_OPTION_TERMINATED;
+  assert(ledc_rt_e131(&rt, t.data(), t.size()) == LEDC_RT_TERMINATED);
+  // a per channel priority packet isn't pixels
+  pkt_t pr = e131(0, 1, 12);
+  pr[125] = 0xdd;
+  assert(ledc_rt_e131(&rt, pr.data(), pr.size()) == LEDC_RT_NONE && rt.stats.unsupported == 1);
+}
+
+// ---- over localhost
+
+static int udp_socket(uint16_t *port)
+{
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  assert(s >= 0);
+  int sz = 4 << 20;
+  setsockopt(s, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+  struct sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = 0;
+  assert(bind(s, (struct sockaddr *) &a, sizeof(a)) == 0);
+  socklen_t l = sizeof(a);
+  getsockname(s, (struct sockaddr *) &a, &l);
+  *port = ntohs(a.sin_port);
+  struct timeval tv = { 0, 200000 };
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return s;
+}
+
+static void over_udp(bool use_ddp, int frames, int fps)
+{
+  uint16_t port;
+  int rs = udp_socket(&port);
+
+  std::thread gen([=]() {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port = htons(port);
+    uint8_t seq[UNIVERSES] = {}, dseq = 0;
+    auto next = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) {
+      if (use_ddp) {
+        // 480 pixels a packet, the most that fits in 1460 bytes
+        for (int off = 0; off < N_LEDS * 3; off += 1440) {
+          int len = std::min(1440, N_LEDS * 3 - off);
+          dseq = (dseq % 15) + 1;
+          pkt_t p = ddp(f, off, len, off + len == N_LEDS * 3, dseq);
+          sendto(s, p.data(), p.size(), 0, (struct sockaddr *) &to, sizeof(to));
+        }
+      }
+      else {
+        for (int u = LEDC_E131_UNIVERSE; u < LEDC_E131_UNIVERSE + UNIVERSES; u++) {
+          pkt_t p = e131(f, u, ++seq[u - LEDC_E131_UNIVERSE], 0, channels_of(u));
+          sendto(s, p.data(), p.size(), 0, (struct sockaddr *) &to, sizeof(to));
+        }
+      }
+      if (fps) {
+        next += std::chrono::microseconds(1000000 / fps);
+        std::this_thread::sleep_until(next);
+      }
+    }
+    close(s);
+  });
+
+  static uint8_t leds[N_LEDS * 3];
+  static uint8_t buf[1460];
+  ledc_rt_t rt;
+  ledc_rt_init(&rt, leds, N_LEDS);
+  int shows = 0, torn = 0, hint = 0;
+  double parse_ns = 0;
+  while (true) {
+    ssize_t n = recv(rs, buf, sizeof(buf), 0);
+    if (n <= 0) break;
+    auto t0 = std::chrono::steady_clock::now();
+    ledc_rt_result_t r = use_ddp ? ledc_rt_ddp(&rt, buf, n) : ledc_rt_e131(&rt, buf, n);
+    parse_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    if (r == LEDC_RT_SHOW) {
+      int g = frame_of(leds, hint + 1);
+      if (g < 0) torn++; else hint = g;
+      shows++;
+    }
+  }
+  gen.join();
+  close(rs);
+  char rate[16];
+  if (fps) snprintf(rate, sizeof(rate), "%dfps", fps); else snprintf(rate, sizeof(rate), "full speed");
+  printf("  %-5s %4d frames at %s: %u packets, %d shown, %d torn, %u gaps, %.0f ns a packet to parse\n",
+    use_ddp ? "DDP" : "E1.31", frames, rate,
+    rt.stats.packets, shows, torn, rt.stats.gaps, parse_ns / rt.stats.packets);
+  assert(torn == 0);
+  assert(rt.stats.packets > 0);
+}
+
+int main()
+{
+  srand(32);
+  test_ddp();
+  test_e131(0);
+  test_e131(2);
+  test_e131(10);
+  test_e131(30);
+  test_e131_shrink();
+  test_e131_sync();
+
+  printf("over UDP on localhost, %d pixels:\n", N_LEDS);
+  over_udp(true, 80, 40);
+  over_udp(false, 80, 40);
+  over_udp(true, 5000, 0);
+  over_udp(false, 5000, 0);
+  return 0;
+}
@@ -0,0 +1,285 @@
+// The sequencer ( ledc_seq.cpp ), stepped once a frame the way ledc.cpp's
+// render task does. A looping playlist of three, one of them shorter than
+// the transition: each BEGIN lands a transition before the end of the
+// preset, the FINISH a transition later, the mix only goes up in between,
+// and it comes back round to the first. A one preset playlist, looping,
+// never fades to itself, and one that doesn't loop stays on its last.
+//
+// Then ledc_blend: a at mix 0, b at mix 256, in between in between, and
+// out may be either. And what a fade costs a frame at 600 LEDs: two renders
+// and the blend, next to one render and the copy. WS2812FX needs FastLED's
+// ESP32 platform, so the renders are stand-ins of about the same per pixel
+// work - a rainbow, and a sine wave across a color.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+
+#include "ledc_seq.h"
+
+// 60fps
+#define FRAME_US 16667LL
+
+typedef struct {
+  int begins, finishes;
+  int order[32];         // the presets as they came on
+  int n_order;
+  int64_t begin_at[32];  // since the one fading out started fading in
+} run_t;
+
+static ledc_playlist_t playlist(int n, const uint32_t *dur, uint32_t transition_ms, bool loop)
+{
+  ledc_playlist_t pl;
+  memset(&pl, 0, sizeof(pl));
+  pl.n_presets = n;
+  pl.transition_ms = transition_ms;
+  pl.loop = loop;
+  for (int i = 0; i < n; i++) {
+    pl.presets[i].mode = 10 + i;
+    pl.presets[i].speed = LEDC_PRESET_SPEED_DEFAULT;
+    pl.presets[i].duration_ms = dur[i];
+  }
+  return pl;
+}
+
+// frame by frame for us, checking as it goes
+static run_t run(ledc_seq_t *seq, int64_t us)
+{
+  run_t r;
+  memset(&r, 0, sizeof(r));
+  r.order[r.n_order++] = seq->current;
+  int64_t on_since = seq->started;
+  int last_mix = 0;
+  const int64_t end = seq->started + us;
+  for (int64_t now = seq->started; now < end && seq->running; now += FRAME_US) {
+    int was = seq->current;
+    ledc_seq_action_t a = ledc_seq_step(seq, now);
+    if (a == LEDC_SEQ_BEGIN) {
+      assert(ledc_seq_fading(seq) && seq->current == was && seq->next != was);
+      r.begin_at[r.begins++] = now - on_since;
+      last_mix = 0;
+    }
+    else if (a == LEDC_SEQ_FINISH) {
+      assert(!ledc_seq_fading(seq) && seq->current != was);
+      // its time started when it began fading in
+      assert(seq->started <= now && now - seq->started < (int64_t) seq->playlist.transition_ms * 1000 + FRAME_US);
+      on_since = seq->started;
+      if (r.n_order < 32) r.order[r.n_order++] = seq->current;
+      r.finishes++;
+    }
+    int mix = ledc_seq_mix(seq, now);
+    if (ledc_seq_fading(seq)) {
+      assert(mix >= last_mix && mix <= 256);
+      last_mix = mix;
+    }
+    else assert(mix == 0);
+  }
+  return r;
+}
+
+static void looping()
+{
+  // the last is shorter than the transition, it fades for all of its 200ms
+  const uint32_t dur[3] = { 1000, 2000, 200 };
+  ledc_playlist_t pl = playlist(3, dur, 300, true);
+  ledc_seq_t seq;
+  ledc_seq_init(&seq);
+  assert(!ledc_seq_fading(&seq) && ledc_seq_step(&seq, 0) == LEDC_SEQ_NONE);
+  assert(ledc_seq_start(&seq, &pl, 1000000));
+  assert(seq.running && seq.current == 0 && !ledc_seq_fading(&seq));
+
+  // three times round
+  const int64_t cycle = (1000 + 2000 + 200) * 1000LL;
+  run_t r = run(&seq, 3 * cycle);
+  printf("looping 1000/2000/200ms, 300ms transitions, 3 rounds: %d fades, on at", r.begins);
+  for (int i = 0; i < r.begins; i++) printf(" %lld", (long long) (r.begin_at[i] / 1000));
+  printf(" ms\n");
+  assert(seq.running);
+  assert(r.begins >= 8 && r.finishes >= 8);
+  for (int i = 0; i < r.n_order; i++) assert(r.order[i] == i % 3);
+  for (int i = 0; i < r.begins; i++) {
+    // a transition before the end, clamped to the preset, within a frame. A
+    // preset's time includes its fade in, so one shorter than that goes as
+    // soon as it's in.
+    uint32_t d = dur[i % 3], prev = dur[(i + 2) % 3];
+    int64_t want = (int64_t) (d - (d < 300 ? d : 300)) * 1000;
+    int64_t fade_in = i == 0 ? 0 : (int64_t) (prev < 300 ? prev : 300) * 1000;
+    if (want < fade_in) want = fade_in;
+    assert(r.begin_at[i] >= want && r.begin_at[i] < want + 2 * FRAME_US);
+  }
+
+  // the mix through one fade, 1 -> 2 at 300ms and 2 -> 0 at 200ms
+  ledc_seq_t s2;
+  ledc_seq_init(&s2);
+  ledc_seq_start(&s2, &pl, 0);
+  int64_t now = 0;
+  while (ledc_seq_step(&s2, now) != LEDC_SEQ_BEGIN) now += 1000;
+  assert(ledc_seq_mix(&s2, now) == 0);
+  assert(ledc_seq_mix(&s2, now + 150000) == 128);
+  assert(ledc_seq_mix(&s2, now + 300000) == 256);
+  assert(ledc_seq_step(&s2, now + 299000) == LEDC_SEQ_NONE);
+  assert(ledc_seq_step(&s2, now + 300000) == LEDC_SEQ_FINISH && s2.current == 1);
+  while (ledc_seq_step(&s2, now) != LEDC_SEQ_BEGIN) now += 1000;
+  assert(ledc_seq_step(&s2, now + 300000) == LEDC_SEQ_FINISH && s2.current == 2);
+  now += 300000;
+  // 2 is shorter than the transition: it begins fading out at once, over its 200ms
+  assert(ledc_seq_step(&s2, now) == LEDC_SEQ_BEGIN && s2.next == 0);
+  assert(ledc_seq_mix(&s2, now + 100000) == 128);
+  assert(ledc_seq_step(&s2, now + 199000) == LEDC_SEQ_NONE);
+  assert(ledc_seq_step(&s2, now + 200000) == LEDC_SEQ_FINISH && s2.current == 0);
+}
+
+static void single()
+{
+  // one preset, looping: it stays up, nothing to fade to
+  const uint32_t dur[1] = { 500 };
+  ledc_playlist_t pl = playlist(1, dur, 300, true);
+  ledc_seq_t seq;
+  ledc_seq_init(&seq);
+  assert(ledc_seq_start(&seq, &pl, 0));
+  run_t r = run(&seq, 5000000);
+  assert(r.begins == 0 && r.finishes == 0);
+  assert(!seq.running && seq.current == 0 && !ledc_seq_fading(&seq));
+
+  // two, not looping, end on the second
+  const uint32_t dur2[2] = { 500, 500 };
+  pl = playlist(2, dur2, 100, false);
+  assert(ledc_seq_start(&seq, &pl, 0));
+  r = run(&seq, 5000000);
+  assert(r.begins == 1 && r.finishes == 1 && !seq.running && seq.current == 1);
+
+  // none, or too many
+  pl.n_presets = 0;
+  assert(!ledc_seq_start(&seq, &pl, 0));
+  pl.n_presets = LEDC_PLAYLIST_MAX + 1;
+  assert(!ledc_seq_start(&seq, &pl, 0));
+  printf("one preset looping stays up, a playlist that doesn't loop ends on its last\n");
+}
+
+// ---- the blend
+
+#define NUM_LEDS 600
+#define LEN (NUM_LEDS * 3)
+
+static uint8_t A[LEN], B[LEN], OUT[LEN];
+
+static void blend()
+{
+  for (int i = 0; i < LEN; i++) {
+    A[i] = (i * 37) & 0xFF;
+    B[i] = 255 - ((i * 11) & 0xFF);
+  }
+  ledc_blend(OUT, A, B, LEN, 0);
+  assert(memcmp(OUT, A, LEN) == 0);
+  ledc_blend(OUT, A, B, LEN, 256);
+  assert(memcmp(OUT, B, LEN) == 0);
+  for (int mix = 1; mix < 256; mix += 17) {
+    ledc_blend(OUT, A, B, LEN, mix);
+    for (int i = 0; i < LEN; i++) {
+      int lo = A[i] < B[i] ? A[i] : B[i], hi = A[i] < B[i] ? B[i] : A[i];
+      assert(OUT[i] >= lo && OUT[i] <= hi);
+    }
+  }
+  ledc_blend(OUT, A, B, LEN, 128);
+  assert(OUT[1] == (A[1] + B[1]) / 2);
+
+  // in place, either side
+  uint8_t x[LEN];
+  memcpy(x, A, LEN);
+  ledc_blend(x, x, B, LEN, 100);
+  ledc_blend(OUT, A, B, LEN, 100);
+  assert(memcmp(x, OUT, LEN) == 0);
+  memcpy(x, B, LEN);
+  ledc_blend(x, A, x, LEN, 100);
+  assert(memcmp(x, OUT, LEN) == 0);
+}
+
+// stand-ins for a WS2812FX effect's render
+
+static uint8_t sin8(uint8_t t)
+{
+  // a triangle through a parabola, close to FastLED's
+  int x = t & 0x7F;
+  int y = x * (128 - x) >> 4;
+  y = y > 255 ? 255 : y;
+  return t & 0x80 ? 128 - (y >> 1) : 128 + (y >> 1);
+}
+
+static void render_rainbow(uint8_t *leds, uint32_t now)
+{
+  for (int i = 0; i < NUM_LEDS; i++) {
+    uint8_t h = (i * 256 / NUM_LEDS + (now >> 4)) & 0xFF;
+    uint8_t sec = h / 43, f = (h - sec * 43) * 6;
+    uint8_t r, g, b;
+    switch (sec) {
+      case 0: r = 255; g = f; b = 0; break;
+      case 1: r = 255 - f; g = 255; b = 0; break;
+      case 2: r = 0; g = 255; b = f; break;
+      case 3: r = 0; g = 255 - f; b = 255; break;
+      case 4: r = f; g = 0; b = 255; break;
+      default: r = 255; g = 0; b = 255 - f; break;
+    }
+    leds[i * 3] = r;
+    leds[i * 3 + 1] = g;
+    leds[i * 3 + 2] = b;
+  }
+}
+
+static void render_wave(uint8_t *leds, uint32_t now)
+{
+  for (int i = 0; i < NUM_LEDS; i++) {
+    uint8_t v = sin8((i * 8 + (now >> 2)) & 0xFF);
+    leds[i * 3] = (0xFF * (v + 1)) >> 8;
+    leds[i * 3 + 1] = (0x80 * (v + 1)) >> 8;
+    leds[i * 3 + 2] = 0;
+  }
+}
+
+static void timing()
+{
+  const int frames = 20000;
+  volatile uint32_t sink = 0;
+
+  auto a = std::chrono::steady_clock::now();
+  for (int f = 0; f < frames; f++) {
+    render_rainbow(A, f * 16);
+    memcpy(OUT, A, LEN);
+    sink += OUT[f % LEN];
+  }
+  auto b = std::chrono::steady_clock::now();
+  double one_ns = std::chrono::duration<double, std::nano>(b - a).count() / frames;
+
+  a = std::chrono::steady_clock::now();
+  for (int f = 0; f < frames; f++) {
+    render_rainbow(A, f * 16);
+    render_wave(B, f * 16);
+    ledc_blend(OUT, A, B, LEN, f & 0xFF);
+    sink += OUT[f % LEN];
+  }
+  b = std::chrono::steady_clock::now();
+  double fade_ns = std::chrono::duration<double, std::nano>(b - a).count() / frames;
+
+  a = std::chrono::steady_clock::now();
+  for (int f = 0; f < frames; f++) {
+    ledc_blend(OUT, A, B, LEN, f & 0xFF);
+    sink += OUT[f % LEN];
+  }
+  b = std::chrono::steady_clock::now();
+  double blend_ns = std::chrono::duration<double, std::nano>(b - a).count() / frames;
+
+  printf("a frame at %d LEDs, on this host: one render and the copy %.1f us; fading, two renders and the blend %.1f us, of which the blend %.1f us ( %.2f ns a LED )\n",
+    NUM_LEDS, one_ns / 1000, fade_ns / 1000, blend_ns / 1000, blend_ns / NUM_LEDS);
+  (void) sink;
+}
+
+int main()
+{
+  looping();
+  single();
+  blend();
+  timing();
+  return 0;
+}
@@ -0,0 +1,386 @@
+// The multi-board sync ( ledc_timesync.cpp ) as separate processes on
+// localhost: a leader and several followers, forked, exchanging real 'LSYN'
+// packets over UDP the way ledc_sync.cpp's task does - beacons, then a
+// request four times a second until the filter is full, once a second after.
+// Every board has its own fake clock, seconds apart and drifting by a
+// different ppm, and the packets sit in a queue for a random while on the
+// way out and the way back.
+//
+// The followers know the leader's clock as a function of real time, so each
+// frame they measure what they'd render against: the leader's time they
+// estimate minus the leader's time it really is. Checked: the first answer
+// steps the clock, the applied offset never moves faster than
+// LEDC_SYNC_SLEW_PER_S otherwise, a 60ms jump of the leader's clock is slewed
+// out and not stepped, a 2s jump ( the leader rebooted ) is stepped within a
+// few requests, and the error once settled.
+//
+// Clocks run SPEED times faster than real time so this takes seconds;
+// everything printed is in board time.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ledc_timesync.h"
+
+#define SPEED 4
+#define FOLLOWERS 4
+
+// as ledc_sync.cpp has them
+#define BEACON_US 1000000LL
+#define REQ_FAST_US 250000LL
+#define REQ_US 1000000LL
+
+#define FRAME_US 10000LL
+
+// each way, a packet waits up to this long, and the leader takes up to PROC_US to answer
+#define QUEUE_US 10000
+#define PROC_US 2000
+
+// on the leader's clock, board time from the start
+#define SMALL_JUMP_AT 5000000LL
+#define SMALL_JUMP 60000LL
+#define BIG_JUMP_AT 18000000LL
+#define BIG_JUMP -2000000LL
+#define END_AT 22000000LL
+
+// close enough to call it synced: under a frame at 60fps
+#define SETTLED_US 16000
+
+typedef struct {
+  int64_t skew;
+  int ppm;
+} fake_clock_t;
+
+static const fake_clock_t leader_clk = { 1000000000LL, 30 };
+static const fake_clock_t follower_clk[FOLLOWERS] = {
+  { 3200000LL, 120 }, { -1700000LL, -80 }, { 100000LL, 35 }, { 40000000LL, -150 }
+};
+
+static struct timespec g_start;
+
+// board time since the start, the same for every process
+static int64_t board_us()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  int64_t real = (t.tv_sec - g_start.tv_sec) * 1000000LL + (t.tv_nsec - g_start.tv_nsec) / 1000;
+  return real * SPEED;
+}
+
+static int64_t clock_at(const fake_clock_t *c, int64_t b)
+{
+  return c->skew + b + b * c->ppm / 1000000;
+}
+
+static int64_t leader_at(int64_t b)
+{
+  int64_t t = clock_at(&leader_clk, b);
+  if (b >= SMALL_JUMP_AT) t += SMALL_JUMP;
+  if (b >= BIG_JUMP_AT) t += BIG_JUMP;
+  return t;
+}
+
+static void board_sleep(int64_t us)
+{
+  if (us > 0) usleep(us / SPEED);
+}
+
+static int udp_socket(uint16_t *port)
+{
+  int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  assert(s >= 0);
+  struct sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(s, (struct sockaddr *) &a, sizeof(a)) == 0);
+  socklen_t l = sizeof(a);
+  getsockname(s, (struct sockaddr *) &a, &l);
+  *port = ntohs(a.sin_port);
+  return s;
+}
+
+static void send_to(int s, uint16_t port, const ledc_sync_pkt_t *pkt)
+{
+  uint8_t buf[LEDC_SYNC_PKT_LEN];
+  int len = ledc_sync_pkt_write(pkt, buf, sizeof(buf));
+  assert(len == LEDC_SYNC_PKT_LEN);
+  struct sockaddr_in to;
+  memset(&to, 0, sizeof(to));
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sendto(s, buf, len, 0, (struct sockaddr *) &to, sizeof(to));
+}
+
+// waits up to us of board time for a packet; returns its length, 0 for none
+static int recv_wait(int s, int64_t us, uint8_t *buf, size_t buf_len, uint16_t *from_port)
+{
+  struct pollfd p = { s, POLLIN, 0 };
+  int ms = (int) (us / SPEED / 1000);
+  if (poll(&p, 1, ms < 0 ? 0 : ms) <= 0) return 0;
+  struct sockaddr_in from;
+  socklen_t l = sizeof(from);
+  int len = recvfrom(s, buf, buf_len, 0, (struct sockaddr *) &from, &l);
+  *from_port = ntohs(from.sin_port);
+  return len < 0 ? 0 : len;
+}
+
+// ---- leader
+
+static void leader(int s, const uint16_t *ports)
+{
+  unsigned seed = 1;
+  int64_t next_beacon = 0;
+  uint8_t buf[64];
+  while (board_us() < END_AT) {
+    int64_t b = board_us();
+    if (b >= next_beacon) {
+      // a broadcast, one copy to each
+      ledc_sync_pkt_t beacon;
+      memset(&beacon, 0, sizeof(beacon));
+      beacon.type = LEDC_SYNC_BEACON;
+      beacon.t3 = leader_at(b);
+      for (int i = 0; i < FOLLOWERS; i++) send_to(s, ports[i], &beacon);
+      next_beacon = b + BEACON_US;
+    }
+    uint16_t from;
+    int len = recv_wait(s, next_beacon - b, buf, sizeof(buf), &from);
+    if (len == 0) continue;
+    int64_t t2 = leader_at(board_us());
+    ledc_sync_pkt_t pkt;
+    if (ledc_sync_pkt_read(&pkt, buf, len) < 0 || pkt.type != LEDC_SYNC_REQ) continue;
+    board_sleep(rand_r(&seed) % PROC_US);
+    ledc_sync_pkt_t resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.type = LEDC_SYNC_RESP;
+    resp.seq = pkt.seq;
+    resp.t1 = pkt.t1;
+    resp.t2 = t2;
+    resp.t3 = leader_at(board_us());
+    board_sleep(rand_r(&seed) % QUEUE_US);
+    send_to(s, from, &resp);
+  }
+}
+
+// ---- followers
+
+typedef struct {
+  int idx;
+  uint32_t samples;
+  uint32_t steps_first;      // after the first answer
+  uint32_t steps_small;      // up to the big jump
+  uint32_t steps_end;
+  uint32_t resets;
+  int64_t first_synced;      // board time the first answer stepped the clock
+  int64_t max_slew;          // fastest the applied offset moved without a step, us per s
+  int64_t settled_err[3];    // worst |error| before the small jump, before the big one, at the end
+  int64_t small_recover;     // after the small jump, until within SETTLED_US and staying there
+  int64_t big_recover;
+  int64_t small_peak;        // worst |error| after the small jump
+} result_t;
+
+static void follower(int idx, int s, uint16_t leader_port, int out)
+{
+  const fake_clock_t *clk = &follower_clk[idx];
+  unsigned seed = 100 + idx;
+  ledc_timesync_t ts;
+  ledc_timesync_init(&ts);
+  result_t r;
+  memset(&r, 0, sizeof(r));
+  r.idx = idx;
+  r.first_synced = -1;
+  r.small_recover = r.big_recover = -1;
+
+  bool have_leader = false;
+  uint16_t seq = 0;
+  int64_t req_t1 = 0, next_req = 0, next_frame = 0;
+  int64_t last_applied = 0, last_frame = 0;
+  uint32_t last_steps = 0;
+  uint8_t buf[64];
+
+  while (board_us() < END_AT) {
+    int64_t b = board_us();
+
+    // a frame: what the render task would see
+    if (b >= next_frame) {
+      int64_t local = clock_at(clk, b);
+      int64_t applied = ledc_timesync_applied(&ts, local);
+      if (ts.synced && ts.n_steps == last_steps && last_frame) {
+        int64_t moved = applied - last_applied;
+        if (moved < 0) moved = -moved;
+        int64_t el = local - last_frame;
+        if (el > 0 && moved * 1000000 / el > r.max_slew) r.max_slew = moved * 1000000 / el;
+      }
+      last_steps = ts.n_steps;
+      last_applied = applied;
+      last_frame = local;
+      if (ts.synced) {
+        int64_t err = local + applied - leader_at(b);
+        if (err < 0) err = -err;
+        int phase = b < SMALL_JUMP_AT ? 0 : b < BIG_JUMP_AT ? 1 : 2;
+        // the last 2s of each phase is "settled"
+        int64_t phase_end = phase == 0 ? SMALL_JUMP_AT : phase == 1 ? BIG_JUMP_AT : END_AT;
+        if (b >= phase_end - 2000000 && err > r.settled_err[phase]) r.settled_err[phase] = err;
+        if (phase == 1 && err > r.small_peak) r.small_peak = err;
+        int64_t *rec = phase == 1 ? &r.small_recover : phase == 2 ? &r.big_recover : 0;
+        int64_t since = b - (phase == 1 ? SMALL_JUMP_AT : BIG_JUMP_AT);
+        if (rec) {
+          if (err > SETTLED_US) *rec = -1;
+          else if (*rec < 0) *rec = since;
+        }
+      }
+      if (b < BIG_JUMP_AT) r.steps_small = ts.n_steps;
+      next_frame = b + FRAME_US;
+    }
+
+    if (have_leader && b >= next_req) {
+      ledc_sync_pkt_t req;
+      memset(&req, 0, sizeof(req));
+      req.type = LEDC_SYNC_REQ;
+      req.seq = ++seq;
+      req.t1 = req_t1 = clock_at(clk, board_us());
+      board_sleep(rand_r(&seed) % QUEUE_US);
+      send_to(s, leader_port, &req);
+      next_req = b + (ts.n_samples < LEDC_SYNC_SAMPLES ? REQ_FAST_US : REQ_US);
+    }
+
+    int64_t wait = next_frame - board_us();
+    if (have_leader && next_req - board_us() < wait) wait = next_req - board_us();
+    uint16_t from;
+    int len = recv_wait(s, wait, buf, sizeof(buf), &from);
+    if (len == 0) continue;
+    int64_t t_recv = clock_at(clk, board_us());
+    ledc_sync_pkt_t pkt;
+    if (ledc_sync_pkt_read(&pkt, buf, len) < 0) continue;
+    if (pkt.type == LEDC_SYNC_BEACON) {
+      have_leader = true;
+    }
+    else if (pkt.type == LEDC_SYNC_RESP && pkt.seq == seq && pkt.t1 == req_t1) {
+      bool was = ts.synced;
+      if (ledc_timesync_sample(&ts, pkt.t1, pkt.t2, pkt.t3, t_recv)) r.samples++;
+      if (!was && ts.synced) {
+        r.steps_first = ts.n_steps;
+        r.first_synced = board_us();
+      }
+      req_t1 = 0;
+    }
+  }
+  r.steps_end = ts.n_steps;
+  r.resets = ts.n_resets;
+  assert(write(out, &r, sizeof(r)) == sizeof(r));
+}
+
+// ---- the packets themselves
+
+static void packets()
+{
+  ledc_sync_pkt_t a, b;
+  memset(&a, 0, sizeof(a));
+  a.type = LEDC_SYNC_CMD;
+  a.seq = 0xBEEF;
+  a.t1 = -5;
+  a.t2 = 1LL << 40;
+  a.t3 = 0x0123456789ABCDEFLL;
+  a.cmd = LEDC_SYNC_CMD_COLOR;
+  a.segment = -1;
+  a.value = (2 << 24) | 0xFF8000;
+  uint8_t buf[LEDC_SYNC_PKT_LEN];
+  assert(ledc_sync_pkt_write(&a, buf, sizeof(buf) - 1) == -1);
+  assert(ledc_sync_pkt_write(&a, buf, sizeof(buf)) == LEDC_SYNC_PKT_LEN);
+  assert(memcmp(buf, "LSYN", 4) == 0);
+  assert(ledc_sync_pkt_read(&b, buf, sizeof(buf)) == 0);
+  assert(b.type == a.type && b.seq == a.seq && b.t1 == a.t1 && b.t2 == a.t2 && b.t3 == a.t3);
+  assert(b.cmd == a.cmd && b.segment == a.segment && b.value == a.value);
+  assert(ledc_sync_pkt_read(&b, buf, sizeof(buf) - 1) == -1);
+  buf[5] = 9;
+  assert(ledc_sync_pkt_read(&b, buf, sizeof(buf)) == -1);
+  buf[5] = LEDC_SYNC_CMD;
+  buf[0] = 'X';
+  assert(ledc_sync_pkt_read(&b, buf, sizeof(buf)) == -1);
+}
+
+int main()
+{
+  packets();
+
+  int leader_s;
+  uint16_t leader_port, ports[FOLLOWERS];
+  int follower_s[FOLLOWERS];
+  leader_s = udp_socket(&leader_port);
+  for (int i = 0; i < FOLLOWERS; i++) follower_s[i] = udp_socket(&ports[i]);
+  int out[2];
+  assert(pipe(out) == 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &g_start);
+  fflush(stdout);
+  pid_t pids[FOLLOWERS + 1];
+  for (int i = 0; i <= FOLLOWERS; i++) {
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+      close(out[0]);
+      if (i == FOLLOWERS) leader(leader_s, ports);
+      else follower(i, follower_s[i], leader_port, out[1]);
+      _exit(0);
+    }
+    pids[i] = p;
+  }
+  close(out[1]);
+
+  result_t res[FOLLOWERS];
+  int got = 0;
+  result_t r;
+  while (read(out[0], &r, sizeof(r)) == (ssize_t) sizeof(r)) res[got++] = r;
+  for (int i = 0; i <= FOLLOWERS; i++) {
+    int st;
+    waitpid(pids[i], &st, 0);
+    assert(WIFEXITED(st) && WEXITSTATUS(st) == 0);
+  }
+  assert(got == FOLLOWERS);
+
+  printf("a leader and %d followers on localhost, clocks %dx, replies queued up to %dms each way\n",
+    FOLLOWERS, SPEED, QUEUE_US / 1000);
+  printf("  follower   skew     ppm  samples  synced  max slew   settled error us     +60ms: peak  back  -2s: back  steps  resets\n");
+  printf("                                       at   us/s      start small   end      us      ms       ms\n");
+  for (int i = 0; i < FOLLOWERS; i++) {
+    const result_t *x = &res[i];
+    const fake_clock_t *c = &follower_clk[x->idx];
+    printf("  %8d %7.1fs %5d %8u %6lldms %7lld %7lld %5lld %5lld %9lld %6lld %9lld %6u %6u\n",
+      x->idx, c->skew / 1e6, c->ppm, x->samples, (long long) (x->first_synced / 1000),
+      (long long) x->max_slew, (long long) x->settled_err[0], (long long) x->settled_err[1],
+      (long long) x->settled_err[2], (long long) x->small_peak,
+      (long long) (x->small_recover / 1000), (long long) (x->big_recover / 1000),
+      x->steps_end, x->resets);
+  }
+
+  for (int i = 0; i < FOLLOWERS; i++) {
+    const result_t *x = &res[i];
+    // the first answer steps, within a beacon and a request of starting
+    assert(x->steps_first == 1 && x->first_synced >= 0 && x->first_synced < BEACON_US + REQ_FAST_US + 2 * QUEUE_US);
+    // slewing is never faster than the limit ( a frame's rounding aside )
+    assert(x->max_slew <= LEDC_SYNC_SLEW_PER_S + LEDC_SYNC_SLEW_PER_S / 10);
+    // 60ms is slewed, not stepped, and gone by the end of the phase
+    assert(x->steps_small == 1);
+    // ( the error before the jump can be up to SETTLED_US either way )
+    assert(x->small_peak > SMALL_JUMP - SETTLED_US);
+    assert(x->small_recover >= (SMALL_JUMP - 2 * SETTLED_US) * 1000000 / LEDC_SYNC_SLEW_PER_S);
+    assert(x->small_recover >= 0 && x->small_recover < BIG_JUMP_AT - SMALL_JUMP_AT - 2000000);
+    // 2s is stepped once, within a few requests, the filter started again
+    assert(x->steps_end == 2 && x->resets == 1);
+    assert(x->big_recover >= 0 && x->big_recover < 3 * REQ_US);
+    for (int p = 0; p < 3; p++) assert(x->settled_err[p] < SETTLED_US);
+  }
+  return 0;
+}
@@ -0,0 +1,182 @@
+// Write-behind settings ( Persist-idf persist.cpp ) against a store in memory.
+// A slider dragged for five seconds is one commit once it's quiet, one that
+// never stops is written every max_delay_ms, a value dragged away and back
+// isn't written, and a set that changes nothing doesn't go pending. A store
+// that fails is tried again after debounce_ms; one that won't open isn't
+// closed. The ms clock wraps. The lifetime count is every key the store
+// took, itself included, and a reload picks it up.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <map>
+#include <string>
+
+#include "persist.h"
+
+// ----- a store in memory, counting what it's asked to do
+
+struct mem_t {
+  std::map<std::string, int32_t> kv, pend;
+  int commits = 0, sets = 0, opens = 0, closes = 0;
+  bool fail_set = false, fail_open = false;
+  bool open = false;
+};
+
+static bool mem_begin(void *c, bool write)
+{
+  mem_t *m = (mem_t *) c;
+  if (m->fail_open) return false;
+  assert(!m->open);
+  m->open = true;
+  m->opens++;
+  return true;
+}
+
+static bool mem_get(void *c, const char *k, int32_t *v)
+{
+  mem_t *m = (mem_t *) c;
+  assert(m->open);
+  auto it = m->kv.find(k);
+  if (it == m->kv.end()) return false;
+  *v = it->second;
+  return true;
+}
+
+static bool mem_set(void *c, const char *k, int32_t v)
+{
+  mem_t *m = (mem_t *) c;
+  assert(m->open);
+  if (m->fail_set) return false;
+  m->pend[k] = v;
+  m->sets++;
+  return true;
+}
+
+static bool mem_commit(void *c)
+{
+  mem_t *m = (mem_t *) c;
+  for (auto &p : m->pend) m->kv[p.first] = p.second;
+  m->pend.clear();
+  m->commits++;
+  return true;
+}
+
+static void mem_end(void *c)
+{
+  mem_t *m = (mem_t *) c;
+  // only what begin opened
+  assert(m->open);
+  m->pend.clear();
+  m->open = false;
+  m->closes++;
+}
+
+int main()
+{
+  mem_t m;
+  persist_store_t st = { mem_begin, mem_get, mem_set, mem_commit, mem_end, &m };
+  persist_entry_t ents[8];
+  persist_t p;
+  persist_init(&p, ents, 8, 2000, 10000);
+  int mode = persist_add(&p, "mode", 0);
+  int speed = persist_add(&p, "speed", 10);
+  int pal = persist_add(&p, "pal", 0);
+  assert(persist_add(&p, "waytoolongkeyname", 0) == -1);
+
+  m.kv["speed"] = 7;
+  assert(persist_load(&p, &st) == 1);
+  assert(persist_get(&p, speed) == 7 && persist_present(&p, speed) && !persist_present(&p, mode));
+
+  // a slider dragged for 5s at 20 a second, then two more keys: one commit, once it's quiet
+  uint32_t t = 1000;
+  int flushes = 0;
+  for (int i = 0; i < 100; i++, t += 50) {
+    persist_set(&p, speed, i % 20, t);
+    if (persist_poll(&p, &st, t) > 0) flushes++;
+  }
+  assert(flushes == 0);
+  persist_set(&p, mode, 5, t);
+  persist_set(&p, pal, 3, t);
+  for (int i = 0; i < 100; i++, t += 50) {
+    if (persist_poll(&p, &st, t) > 0) flushes++;
+  }
+  printf("drag: 102 sets, %d commit, %d keys written\n", m.commits, m.sets);
+  // three settings and the count
+  assert(flushes == 1 && m.commits == 1 && m.sets == 4);
+  assert(m.kv["speed"] == 19 && m.kv["mode"] == 5 && m.kv["pal"] == 3);
+  assert(m.kv[PERSIST_WRITES_KEY] == 4);
+
+  // never quiet: max_delay_ms caps it
+  int c0 = m.commits;
+  for (int i = 0; i < 400; i++, t += 50) {
+    persist_set(&p, speed, i % 2, t);
+    persist_poll(&p, &st, t);
+  }
+  printf("dragged 20s without a stop: %d commits\n", m.commits - c0);
+  assert(m.commits - c0 >= 1 && m.commits - c0 <= 2);
+
+  // away and back: nothing to write, the store isn't even opened
+  for (int i = 0; i < 100; i++, t += 50) persist_poll(&p, &st, t);
+  c0 = m.commits;
+  int opens = m.opens;
+  int32_t cur = persist_get(&p, speed);
+  persist_set(&p, speed, cur + 1, t);
+  persist_set(&p, speed, cur, t + 10);
+  for (int i = 0; i < 100; i++, t += 50) persist_poll(&p, &st, t);
+  assert(m.commits == c0 && m.opens == opens);
+
+  // a set to what it is doesn't go pending
+  persist_set(&p, speed, cur, t);
+  assert(!p.pending);
+
+  // a store that fails a write: tried again once it's been quiet, not every poll
+  m.fail_set = true;
+  persist_set(&p, pal, 9, t);
+  int failed = 0;
+  for (int i = 0; i < 60; i++, t += 50) {
+    if (persist_poll(&p, &st, t) < 0) failed++;
+  }
+  m.fail_set = false;
+  for (int i = 0; i < 60; i++, t += 50) persist_poll(&p, &st, t);
+  printf("store failing 3s: %d tries, then pal=%d\n", failed, m.kv["pal"]);
+  assert(failed >= 1 && failed <= 2 && m.kv["pal"] == 9);
+
+  // one that won't open: nothing to close, and the change waits
+  m.fail_open = true;
+  int closes = m.closes;
+  persist_set(&p, pal, 11, t);
+  assert(persist_flush(&p, &st, t) == -1);
+  assert(m.closes == closes && p.pending);
+  m.fail_open = false;
+  t += 2000;
+  assert(persist_poll(&p, &st, t) == 1 && m.kv["pal"] == 11);
+  assert(m.opens == m.closes);
+
+  // across the wrap of the ms clock
+  t = 0xFFFFFF00u;
+  persist_set(&p, mode, 6, t);
+  assert(!persist_due(&p, t + 100));
+  assert(persist_due(&p, t + 2100));
+  persist_flush(&p, &st, t + 2100);
+  assert(m.kv["mode"] == 6);
+
+  // the lifetime count is every key the store took, itself included
+  persist_stats_t ss;
+  persist_stats_get(&p, &ss);
+  printf("stats: sets %u unchanged %u flushes %u writes %u fails %u lifetime %u\n",
+    ss.sets, ss.unchanged, ss.flushes, ss.writes, ss.fails, ss.lifetime_writes);
+  assert((int) ss.lifetime_writes == m.sets);
+  assert((int32_t) ss.lifetime_writes == m.kv[PERSIST_WRITES_KEY]);
+  assert(ss.writes == ss.lifetime_writes);
+
+  // and a reload picks it up
+  persist_t p2;
+  persist_entry_t e2[8];
+  persist_init(&p2, e2, 8, 2000, 10000);
+  persist_add(&p2, "mode", 0);
+  persist_load(&p2, &st);
+  assert(p2.lifetime_writes == ss.lifetime_writes && persist_get(&p2, 0) == 6);
+  return 0;
+}
@@ -0,0 +1,700 @@
+// A load generator against a stand-in for the ESP32's server, to find where
+// dashboards stop getting their answers. The stand-in is a single task like
+// esp_http_server's, on real sockets on localhost, configured by
+// rest_server_config() ( RestRouter-idf rest_server.cpp ) - max_open_sockets,
+// the backlog, LRU purge and the socket callbacks - and serving with the same
+// handlers as the apps: rest_router for /rest/, rest_static_send for the
+// page and jquery, rest_server_stats_handler. Each request costs what the
+// ESP32 might take, see COST_, which are a model and not a measurement.
+//
+// Two kinds of dashboard, more of them each step:
+//   polling, like fanc's page: load it, then every 2s four GETs at once,
+//     each on its own keep-alive connection as a browser would
+//   pushed to, like ledc's: load the page, hold a websocket that gets a
+//     push every 100ms, and POST a change every 2s
+// A keep-alive connection the server purged is retried once on a new one,
+// as browsers do. Counted: answers later than the 2s poll, none within
+// REQ_TIMEOUT_US, retries that failed too, and websockets lost or refused.
+//
+// Time runs SCALE times faster than the device's so the sweep takes
+// seconds; everything printed is in device time.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rest_router.h"
+
+#define SCALE 10
+
+// what a request costs the ESP32: the handler and lwIP, a new connection's
+// accept and setup, and sending at about 500KB/s. A model.
+#define COST_REQUEST_US 4000
+#define COST_ACCEPT_US 8000
+#define COST_BYTE_NS 2000
+
+#define POLL_US (2 * 1000000LL)
+#define PUSH_US (100 * 1000LL)
+#define REQ_TIMEOUT_US (10 * 1000000LL)
+#define STEP_US (12 * 1000000LL)
+
+static int64_t host_now_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// device time
+static int64_t now_us() { return host_now_us() * SCALE; }
+static void sleep_us(int64_t us) { if (us > 0) std::this_thread::sleep_for(std::chrono::microseconds(us / SCALE)); }
+
+const char *esp_err_to_name(esp_err_t code) { return "err"; }
+int64_t esp_timer_get_time(void) { return now_us(); }
+
+// ---- the stand-in httpd: one task, select() over the sockets
+
+struct sess_t {
+  int fd;
+  uint32_t lru;
+  bool push;
+  std::string in;
+};
+
+static httpd_config_t g_cfg;
+static int g_listen_fd, g_port;
+static std::vector<sess_t> g_sess;
+static uint32_t g_lru;
+static std::atomic<bool> g_srv_stop;
+static std::atomic<uint32_t> g_purged, g_push_purged, g_accepts;
+
+static sess_t *sess_find(int fd)
+{
+  for (auto &s : g_sess) if (s.fd == fd) return &s;
+  return NULL;
+}
+
+static int push_count()
+{
+  int n = 0;
+  for (auto &s : g_sess) n += s.push;
+  return n;
+}
+
+esp_err_t httpd_sess_update_lru_counter(httpd_handle_t handle, int sockfd)
+{
+  sess_t *s = sess_find(sockfd);
+  if (!s) return ESP_ERR_NOT_FOUND;
+  s->lru = ++g_lru;
+  return ESP_OK;
+}
+
+static void sess_close(int fd)
+{
+  for (size_t i = 0; i < g_sess.size(); i++) {
+    if (g_sess[i].fd != fd) continue;
+    g_sess.erase(g_sess.begin() + i);
+    g_cfg.close_fn(NULL, fd);
+    return;
+  }
+}
+
+static void srv_accept()
+{
+  int fd = accept(g_listen_fd, NULL, NULL);
+  if (fd < 0) return;
+  if ((int) g_sess.size() >= g_cfg.max_open_sockets) {
+    // lru_purge_enable: the least recently used goes
+    sess_t *lru = &g_sess[0];
+    for (auto &s : g_sess) if (s.lru < lru->lru) lru = &s;
+    g_purged++;
+    if (lru->push) g_push_purged++;
+    sess_close(lru->fd);
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  g_sess.push_back({ fd, ++g_lru, false, "" });
+  g_accepts++;
+  if (g_cfg.open_fn(NULL, fd) != ESP_OK) sess_close(fd);
+  sleep_us(COST_ACCEPT_US);
+}
+
+// the request being handled, and its response
+static struct {
+  sess_t *s;
+  std::map<std::string, std::string> hdrs;   // lower case names
+  std::string body;
+  size_t body_off;
+  std::string status, type, resp_hdrs;
+  bool started;
+  size_t out;
+} g_r;
+
+static esp_err_t out(const std::string &d)
+{
+  const char *p = d.data();
+  size_t left = d.size();
+  while (left > 0) {
+    ssize_t n = send(g_r.s->fd, p, left, MSG_NOSIGNAL);
+    if (n <= 0) return ESP_FAIL;
+    p += n;
+    left -= n;
+  }
+  g_r.out += d.size();
+  return ESP_OK;
+}
+
+static std::string head(const char *framing)
+{
+  std::string h = "HTTP/1.1 " + g_r.status + "\r\nContent-Type: " + g_r.type + "\r\n" + g_r.resp_hdrs + framing + "\r\n";
+  g_r.started = true;
+  return h;
+}
+
+static std::string lower(std::string s)
+{
+  for (auto &c : s) c = tolower(c);
+  return s;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+  auto h = g_r.hdrs.find(lower(field));
+  return h == g_r.hdrs.end() ? 0 : h->second.size();
+}
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+  auto h = g_r.hdrs.find(lower(field));
+  if (h == g_r.hdrs.end()) return ESP_ERR_NOT_FOUND;
+  if (h->second.size() >= val_size) return ESP_ERR_INVALID_SIZE;
+  strcpy(val, h->second.c_str());
+  return ESP_OK;
+}
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+  size_t n = std::min(buf_len, g_r.body.size() - g_r.body_off);
+  memcpy(buf, g_r.body.data() + g_r.body_off, n);
+  g_r.body_off += n;
+  return n;
+}
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) { g_r.status = status; return ESP_OK; }
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) { g_r.type = type; return ESP_OK; }
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+  g_r.resp_hdrs += std::string(field) + ": " + value + "\r\n";
+  return ESP_OK;
+}
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+  std::string body(buf ? buf : "", buf ? buf_len : 0);
+  return out(head(("Content-Length: " + std::to_string(body.size()) + "\r\n").c_str()) + body);
+}
+esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str) { return httpd_resp_send(r, str, str ? strlen(str) : 0); }
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+  std::string d = g_r.started ? "" : head("Transfer-Encoding: chunked\r\n");
+  char len[16];
+  snprintf(len, sizeof(len), "%zx\r\n", buf ? (size_t) buf_len : 0);
+  d += len;
+  if (buf) d.append(buf, buf_len);
+  d += "\r\n";
+  return out(d);
+}
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+  static const std::map<int, const char *> st = {
+    { HTTPD_400_BAD_REQUEST, "400 Bad Request" }, { HTTPD_404_NOT_FOUND, "404 Not Found" },
+    { HTTPD_405_METHOD_NOT_ALLOWED, "405 Method Not Allowed" } };
+  auto s = st.find(error);
+  g_r.status = s == st.end() ? "500 Internal Server Error" : s->second;
+  g_r.type = "text/plain";
+  return httpd_resp_sendstr(req, msg);
+}
+esp_err_t httpd_resp_send_404(httpd_req_t *r) { return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, "not found"); }
+esp_err_t httpd_resp_send_500(httpd_req_t *r) { return httpd_resp_send_err(r, HTTPD_500_INTERNAL_SERVER_ERROR, "server error"); }
+
+// ---- the app's side: fanc's endpoints and assets
+
+static int g_fan_pct = 40;
+static int fan_pct_get(void) { return g_fan_pct; }
+static esp_err_t fan_pct_set(int v) { g_fan_pct = v; return ESP_OK; }
+static int fan_rpm_get(void) { return 1200 + g_fan_pct; }
+
+static const rest_route_t routes[] = {
+  REST_ROUTE_INT("fan_pct", 0, 100, fan_pct_get, fan_pct_set),
+  REST_ROUTE_INT("fan_rpm", 0, 0, fan_rpm_get, NULL),
+  REST_ROUTE_CUSTOM("epoch", rest_epoch_handler),
+  REST_ROUTE_CUSTOM("uptime", rest_uptime_handler),
+  REST_ROUTE_CUSTOM("stats", rest_server_stats_handler),
+};
+static rest_router_t g_router;
+
+// the sizes of fanc's, plain and gzipped; the bytes don't matter here
+static std::string g_index(4569, 'i'), g_index_gz(1685, 'I'), g_jquery(89476, 'j'), g_jquery_gz(30752, 'J');
+static rest_static_t g_assets[2];
+
+static esp_err_t static_handler(httpd_req_t *req, const rest_static_t *content)
+{
+  httpd_resp_set_hdr(req, "Cache-Control", "max-age=99999");
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = rest_static_send(req, content);
+  rest_server_request_done(start);
+  return err;
+}
+
+// the websocket handshake, as far as sockets go: held open and pushed to
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+  if (push_count() >= REST_WS_MAX_CLIENTS) return ESP_FAIL;
+  g_r.s->push = true;
+  rest_server_keep(NULL, g_r.s->fd);
+  return out("HTTP/1.1 101 Switching Protocols\r\n\r\n");
+}
+
+static esp_err_t dispatch(httpd_req_t *req)
+{
+  std::string uri = req->uri;
+  if (uri.compare(0, 6, "/rest/") == 0) {
+    req->user_ctx = &g_router;
+    return rest_router_handler(req);
+  }
+  if (uri == "/") return static_handler(req, &g_assets[0]);
+  if (uri == "/static?jquery.min.js") return static_handler(req, &g_assets[1]);
+  if (uri == "/ws") return ws_handler(req);
+  return httpd_resp_send_404(req);
+}
+
+// a whole request in s->in? Handle it. false when the session's gone.
+static bool srv_request(sess_t *s)
+{
+  size_t end = s->in.find("\r\n\r\n");
+  if (end == std::string::npos) return true;
+  std::string h = s->in.substr(0, end);
+  size_t clen = 0;
+  g_r.hdrs.clear();
+  size_t line = h.find("\r\n");
+  std::string req_line = h.substr(0, line);
+  while (line != std::string::npos) {
+    size_t next = h.find("\r\n", line + 2);
+    std::string l = h.substr(line + 2, next == std::string::npos ? std::string::npos : next - line - 2);
+    size_t colon = l.find(':');
+    if (colon != std::string::npos) {
+      std::string v = l.substr(colon + 1);
+      v.erase(0, v.find_first_not_of(' '));
+      g_r.hdrs[lower(l.substr(0, colon))] = v;
+      if (lower(l.substr(0, colon)) == "content-length") clen = atoi(v.c_str());
+    }
+    line = next;
+  }
+  if (s->in.size() < end + 4 + clen) return true;
+
+  static httpd_req_t req;
+  memset(&req, 0, sizeof(req));
+  size_t sp1 = req_line.find(' '), sp2 = req_line.find(' ', sp1 + 1);
+  req.method = req_line.compare(0, sp1, "POST") == 0 ? HTTP_POST : HTTP_GET;
+  snprintf(req.uri, sizeof(req.uri), "%s", req_line.substr(sp1 + 1, sp2 - sp1 - 1).c_str());
+  req.content_len = clen;
+  g_r.s = s;
+  g_r.body = s->in.substr(end + 4, clen);
+  g_r.body_off = 0;
+  g_r.status = "200 OK";
+  g_r.type = "text/html";
+  g_r.resp_hdrs.clear();
+  g_r.started = false;
+  g_r.out = 0;
+  s->in.erase(0, end + 4 + clen);
+  s->lru = ++g_lru;
+
+  int fd = s->fd;
+  esp_err_t err = dispatch(&req);
+  sleep_us(COST_REQUEST_US + (int64_t) g_r.out * COST_BYTE_NS / 1000);
+  // a handler that fails has the socket closed
+  if (err != ESP_OK) {
+    sess_close(fd);
+    return false;
+  }
+  return true;
+}
+
+static void srv_task()
+{
+  int64_t next_push = now_us() + PUSH_US;
+  while (!g_srv_stop) {
+    std::vector<pollfd> p;
+    p.push_back({ g_listen_fd, POLLIN, 0 });
+    for (auto &s : g_sess) p.push_back({ s.fd, POLLIN, 0 });
+    int64_t wait = std::max<int64_t>(0, next_push - now_us()) / SCALE / 1000;
+    poll(p.data(), p.size(), (int) wait + 1);
+
+    if (now_us() >= next_push) {
+      next_push += PUSH_US;
+      for (auto &s : g_sess) {
+        if (!s.push) continue;
+        send(s.fd, "p", 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        rest_server_keep(NULL, s.fd);
+      }
+    }
+    for (size_t i = 1; i < p.size(); i++) {
+      if (!(p[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+      sess_t *s = sess_find(p[i].fd);
+      if (!s) continue;
+      char buf[2048];
+      ssize_t n = recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        sess_close(s->fd);
+        continue;
+      }
+      if (n < 0 || s->push) continue;
+      s->in.append(buf, n);
+      srv_request(s);
+    }
+    if (p[0].revents & POLLIN) srv_accept();
+  }
+  while (!g_sess.empty()) sess_close(g_sess[0].fd);
+}
+
+static void srv_start()
+{
+  httpd_config_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  rest_server_config(&cfg);
+  assert(cfg.lru_purge_enable && cfg.max_open_sockets > 0);
+  g_cfg = cfg;
+
+  g_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(g_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(g_listen_fd, (sockaddr *) &a, sizeof(a)) == 0);
+  assert(listen(g_listen_fd, cfg.backlog_conn) == 0);
+  socklen_t alen = sizeof(a);
+  getsockname(g_listen_fd, (sockaddr *) &a, &alen);
+  g_port = ntohs(a.sin_port);
+
+  rest_router_init(&g_router, routes, sizeof(routes) / sizeof(routes[0]));
+  g_assets[0] = { "index.html", "text/html", (const uint8_t *) g_index.data(), (ssize_t) g_index.size(),
+    (const uint8_t *) g_index_gz.data(), (ssize_t) g_index_gz.size(), "\"index\"", "\"index-gz\"" };
+  g_assets[1] = { "jquery.min.js", "text/javascript", (const uint8_t *) g_jquery.data(), (ssize_t) g_jquery.size(),
+    (const uint8_t *) g_jquery_gz.data(), (ssize_t) g_jquery_gz.size(), "\"jquery\"", "\"jquery-gz\"" };
+}
+
+// ---- the browsers
+
+struct stats_t {
+  std::mutex lock;
+  std::vector<int64_t> lat;
+  int late, timeouts, failed, retries, push_lost, push_refused;
+};
+
+static stats_t g_st;
+static std::atomic<bool> g_cli_stop;
+
+struct conn_t {
+  int fd = -1;
+  std::string in;
+};
+
+static void conn_close(conn_t &c)
+{
+  if (c.fd >= 0) close(c.fd);
+  c.fd = -1;
+  c.in.clear();
+}
+
+static bool conn_open(conn_t &c)
+{
+  c.fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  a.sin_port = htons(g_port);
+  if (connect(c.fd, (sockaddr *) &a, sizeof(a)) != 0) {
+    conn_close(c);
+    return false;
+  }
+  return true;
+}
+
+// more bytes into c.in by the deadline. 0 closed, -1 timed out
+static int conn_fill(conn_t &c, int64_t deadline)
+{
+  int64_t left = deadline - now_us();
+  if (left <= 0) return -1;
+  pollfd p = { c.fd, POLLIN, 0 };
+  if (poll(&p, 1, (int) (left / SCALE / 1000) + 1) == 0) return -1;
+  char buf[16384];
+  ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+  if (n <= 0) return 0;
+  c.in.append(buf, n);
+  return 1;
+}
+
+enum { REQ_OK, REQ_CLOSED, REQ_TIMEOUT };
+
+// one request and its whole response: Content-Length or chunked
+static int conn_request(conn_t &c, const std::string &req, int64_t deadline, std::string *status)
+{
+  if (send(c.fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t) req.size()) return REQ_CLOSED;
+  size_t end;
+  while ((end = c.in.find("\r\n\r\n")) == std::string::npos) {
+    int r = conn_fill(c, deadline);
+    if (r <= 0) return r < 0 ? REQ_TIMEOUT : REQ_CLOSED;
+  }
+  std::string h = lower(c.in.substr(0, end));
+  *status = c.in.substr(9, 3);
+  c.in.erase(0, end + 4);
+  if (*status == "101") return REQ_OK;
+  size_t cl = h.find("content-length: ");
+  if (cl != std::string::npos) {
+    size_t n = atoi(h.c_str() + cl + 16);
+    while (c.in.size() < n) {
+      int r = conn_fill(c, deadline);
+      if (r <= 0) return r < 0 ? REQ_TIMEOUT : REQ_CLOSED;
+    }
+    c.in.erase(0, n);
+    return REQ_OK;
+  }
+  while (1) {
+    size_t le;
+    while ((le = c.in.find("\r\n")) == std::string::npos) {
+      int r = conn_fill(c, deadline);
+      if (r <= 0) return r < 0 ? REQ_TIMEOUT : REQ_CLOSED;
+    }
+    size_t n = strtoul(c.in.c_str(), NULL, 16);
+    while (c.in.size() < le + 2 + n + 2) {
+      int r = conn_fill(c, deadline);
+      if (r <= 0) return r < 0 ? REQ_TIMEOUT : REQ_CLOSED;
+    }
+    c.in.erase(0, le + 2 + n + 2);
+    if (n == 0) return REQ_OK;
+  }
+}
+
+// as a browser does it: a kept connection that turns out closed is
+// retried once on a new one
+static void browser_request(conn_t &c, const char *method, const char *path, const char *body)
+{
+  std::string req = std::string(method) + " " + path + " HTTP/1.1\r\nHost: esp32\r\nAccept-Encoding: gzip, deflate\r\n";
+  if (body) req += "Content-Type: application/json\r\nContent-Length: " + std::to_string(strlen(body)) + "\r\n\r\n" + body;
+  else req += "\r\n";
+
+  int64_t start = now_us(), deadline = start + REQ_TIMEOUT_US;
+  std::string status;
+  int r = REQ_CLOSED;
+  bool retried = false;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused = c.fd >= 0;
+    if (!reused && !conn_open(c)) break;
+    r = conn_request(c, req, deadline, &status);
+    if (r == REQ_OK || r == REQ_TIMEOUT) break;
+    conn_close(c);
+    if (!reused) break;
+    retried = true;
+  }
+  int64_t lat = now_us() - start;
+
+  std::lock_guard<std::mutex> l(g_st.lock);
+  g_st.retries += retried;
+  if (r == REQ_OK && status[0] == '2') {
+    g_st.lat.push_back(lat);
+    if (lat > POLL_US) g_st.late++;
+  }
+  else if (r == REQ_TIMEOUT) {
+    g_st.timeouts++;
+    conn_close(c);
+  }
+  else {
+    g_st.failed++;
+  }
+}
+
+static void wait_until(int64_t t)
+{
+  while (!g_cli_stop && now_us() < t) sleep_us(std::min<int64_t>(t - now_us(), 50000));
+}
+
+static const char *g_polls[] = { "/rest/fan_pct", "/rest/fan_rpm", "/rest/epoch", "/rest/uptime" };
+
+// one of a polling dashboard's four connections
+static void poller(int k, int64_t t0)
+{
+  conn_t c;
+  wait_until(t0);
+  if (k == 0) browser_request(c, "GET", "/", NULL);
+  if (k == 1) browser_request(c, "GET", "/static?jquery.min.js", NULL);
+  for (int64_t t = t0 + POLL_US / 4; !g_cli_stop; t += POLL_US) {
+    wait_until(t);
+    if (g_cli_stop) break;
+    browser_request(c, "GET", g_polls[k], NULL);
+  }
+  conn_close(c);
+}
+
+static void pushed(int64_t t0)
+{
+  conn_t c;
+  wait_until(t0);
+  if (!conn_open(c)) return;
+  std::string status;
+  int r = conn_request(c, "GET /ws HTTP/1.1\r\nHost: esp32\r\nUpgrade: websocket\r\n\r\n", now_us() + REQ_TIMEOUT_US, &status);
+  if (r != REQ_OK || status != "101") {
+    std::lock_guard<std::mutex> l(g_st.lock);
+    g_st.push_refused++;
+    conn_close(c);
+    return;
+  }
+  while (!g_cli_stop) {
+    if (conn_fill(c, now_us() + 200000) == 0) {
+      std::lock_guard<std::mutex> l(g_st.lock);
+      if (!g_cli_stop) g_st.push_lost++;
+      break;
+    }
+    c.in.clear();
+  }
+  conn_close(c);
+}
+
+// the pushed-to page's other connection: the assets, then a change now and then
+static void pusher_rest(int k, int64_t t0)
+{
+  conn_t c;
+  wait_until(t0);
+  browser_request(c, "GET", k == 0 ? "/" : "/static?jquery.min.js", NULL);
+  if (k == 0) {
+    for (int64_t t = t0 + POLL_US; !g_cli_stop; t += POLL_US) {
+      wait_until(t);
+      if (g_cli_stop) break;
+      char body[32];
+      snprintf(body, sizeof(body), "{\"fan_pct\":%d}", (int) (t / 1000) % 101);
+      browser_request(c, "POST", "/rest/fan_pct", body);
+    }
+  }
+  wait_until(INT64_MAX);
+  conn_close(c);
+}
+
+struct step_t {
+  int n;
+  double served;     // requests a second
+  int64_t p50, p99;
+  int late, timeouts, failed, retries, push_lost, push_refused;
+  uint32_t purged, push_purged, accepts, peak;
+  bool ok;
+};
+
+static step_t step(int n, bool push)
+{
+  {
+    std::lock_guard<std::mutex> l(g_st.lock);
+    g_st.lat.clear();
+    g_st.late = g_st.timeouts = g_st.failed = g_st.retries = g_st.push_lost = g_st.push_refused = 0;
+  }
+  g_purged = g_push_purged = g_accepts = 0;
+  g_cli_stop = false;
+  rest_server_stats_t s0;
+  rest_server_stats_get(&s0);
+
+  std::mt19937 rng(n * 2 + push);
+  std::vector<std::thread> th;
+  int64_t t0 = now_us();
+  for (int d = 0; d < n; d++) {
+    // already open, or being opened, at any point in a poll period
+    int64_t start = t0 + (int64_t) (rng() % POLL_US);
+    if (push) {
+      th.emplace_back(pushed, start);
+      for (int k = 0; k < 2; k++) th.emplace_back(pusher_rest, k, start);
+    }
+    else {
+      for (int k = 0; k < 4; k++) th.emplace_back(poller, k, start);
+    }
+  }
+  wait_until(t0 + STEP_US);
+  g_cli_stop = true;
+  for (auto &t : th) t.join();
+  int64_t secs = STEP_US / 1000000;
+
+  rest_server_stats_t s1;
+  rest_server_stats_get(&s1);
+  step_t r;
+  std::lock_guard<std::mutex> l(g_st.lock);
+  std::sort(g_st.lat.begin(), g_st.lat.end());
+  r.n = n;
+  r.served = (double) g_st.lat.size() / secs;
+  r.p50 = g_st.lat.empty() ? 0 : g_st.lat[g_st.lat.size() / 2];
+  r.p99 = g_st.lat.empty() ? 0 : g_st.lat[g_st.lat.size() * 99 / 100];
+  r.late = g_st.late;
+  r.timeouts = g_st.timeouts;
+  r.failed = g_st.failed;
+  r.retries = g_st.retries;
+  r.push_lost = g_st.push_lost;
+  r.push_refused = g_st.push_refused;
+  r.purged = g_purged;
+  r.push_purged = g_push_purged;
+  r.accepts = g_accepts;
+  r.peak = s1.sockets_peak;
+  r.ok = r.timeouts == 0 && r.failed == 0 && r.late == 0 && r.push_lost == 0 && r.push_refused == 0;
+  // let the server see the sockets close before the next step
+  sleep_us(500000);
+  return r;
+}
+
+static int sweep(bool push, int max)
+{
+  printf("%s, %ds each, max_open_sockets %d, backlog %d, at most %d websockets:\n",
+    push ? "dashboards with a websocket, a POST every 2s" : "polling dashboards, four GETs every 2s",
+    (int) (STEP_US / 1000000), g_cfg.max_open_sockets, g_cfg.backlog_conn, REST_WS_MAX_CLIENTS);
+  printf("  dash  req/s   p50 ms  p99 ms  late  timeout  failed  retried  purged  accepts  ws lost  ws refused\n");
+  int knee = 0;
+  for (int n = 1; n <= max; n++) {
+    step_t r = step(n, push);
+    printf("  %4d  %5.1f  %7.1f %7.1f  %4d  %7d  %6d  %7d  %6u  %7u  %7d  %10d\n",
+      r.n, r.served, r.p50 / 1000.0, r.p99 / 1000.0, r.late, r.timeouts, r.failed, r.retries,
+      r.purged, r.accepts, r.push_lost, r.push_refused);
+    if (!r.ok && knee == 0) knee = n;
+  }
+  if (knee) printf("  first trouble at %d dashboards\n", knee);
+  else printf("  no trouble up to %d dashboards\n", max);
+  return knee ? knee : max + 1;
+}
+
+int main()
+{
+  srv_start();
+  std::thread srv(srv_task);
+
+  int poll_knee = sweep(false, 10);
+  int push_knee = sweep(true, REST_WS_MAX_CLIENTS + 2);
+
+  g_srv_stop = true;
+  srv.join();
+  close(g_listen_fd);
+
+  // the target: five dashboards of either kind with every answer in time
+  assert(poll_knee > 5);
+  assert(push_knee > 5);
+  // past the websocket budget they're refused, not purged
+  assert(push_knee == REST_WS_MAX_CLIENTS + 1);
+  return 0;
+}
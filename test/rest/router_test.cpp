@@ -0,0 +1,336 @@
+// RestRouter-idf against a fake esp_http_server: a table of routes, the
+// requests a browser would send, and what goes back. Lookup by name, GET
+// and POST of each type with their ranges, the errors, bodies that arrive
+// in pieces. Then rest_json, the writer through a small buffer and the
+// tokenizer on good and bad text. Last, how long a lookup takes against
+// the strcmp chain the router replaced.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "rest_router.h"
+
+// ---- the fake server: one request in, what was sent back out
+
+struct resp_t {
+  std::string status;   // "200 OK" unless set
+  std::string type;
+  std::string body;
+  int err;              // httpd_resp_send_err code, or -1
+};
+
+static resp_t g_resp;
+static std::string g_body;          // the request body, handed out by httpd_req_recv
+static size_t g_body_off;
+static std::vector<int> g_recv_plan; // sizes for successive recv calls, 0 a timeout, -1 a failure
+static size_t g_recv_step;
+static int g_requests_done;
+
+const char *esp_err_to_name(esp_err_t code) { return "err"; }
+int64_t esp_timer_get_time(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+void rest_server_request_done(int64_t start) { g_requests_done++; }
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+  size_t n = buf_len;
+  if (g_recv_step < g_recv_plan.size()) {
+    int p = g_recv_plan[g_recv_step++];
+    if (p == 0) return HTTPD_SOCK_ERR_TIMEOUT;
+    if (p < 0) return HTTPD_SOCK_ERR_FAIL;
+    if ((size_t) p < n) n = p;
+  }
+  if (n > g_body.size() - g_body_off) n = g_body.size() - g_body_off;
+  memcpy(buf, g_body.data() + g_body_off, n);
+  g_body_off += n;
+  return n;
+}
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) { g_resp.status = status; return ESP_OK; }
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) { g_resp.type = type; return ESP_OK; }
+esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str) { g_resp.body += str; return ESP_OK; }
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg) {
+  g_resp.err = error;
+  g_resp.body = msg;
+  return ESP_FAIL;
+}
+esp_err_t httpd_resp_send_404(httpd_req_t *r) { return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, "not found"); }
+esp_err_t httpd_resp_send_500(httpd_req_t *r) { return httpd_resp_send_err(r, HTTPD_500_INTERNAL_SERVER_ERROR, "server error"); }
+
+static esp_err_t request(rest_router_t *router, int method, const char *uri, const char *body = NULL,
+                         std::vector<int> plan = {})
+{
+  static httpd_req_t req;
+  memset(&req, 0, sizeof req);
+  strcpy(req.uri, uri);
+  req.method = method;
+  req.user_ctx = router;
+  g_body = body ? body : "";
+  req.content_len = g_body.size();
+  g_body_off = 0;
+  g_recv_plan = plan;
+  g_recv_step = 0;
+  g_resp = { "200 OK", "", "", -1 };
+  return rest_router_handler(&req);
+}
+
+static bool ok(const char *body) { return g_resp.err < 0 && g_resp.status == "200 OK" && g_resp.body == body; }
+
+// ---- the app's side
+
+static int g_brightness = 10, g_on = 1, g_mode = 0;
+static float g_temp = 21.5f;
+static std::string g_custom;
+
+static int brightness_get(void) { return g_brightness; }
+static esp_err_t brightness_set(int v) { g_brightness = v; return ESP_OK; }
+static int on_get(void) { return g_on; }
+static esp_err_t on_set(int v) { g_on = v; return ESP_OK; }
+static const char * const modes[] = { "off", "auto", "manual", NULL };
+static int mode_get(void) { return g_mode; }
+static esp_err_t mode_set(int v) { g_mode = v; return v == 2 ? ESP_FAIL : ESP_OK; }   // the app refuses manual
+static float temp_get(void) { return g_temp; }
+static esp_err_t temp_set(float v) { g_temp = v; return ESP_OK; }
+static int count_get(void) { return 42; }
+static esp_err_t custom(httpd_req_t *req, const char *content) {
+  g_custom = content ? content : "(none)";
+  return httpd_resp_sendstr(req, "custom");
+}
+
+static const rest_route_t routes[] = {
+  REST_ROUTE_INT("brightness", 0, 255, brightness_get, brightness_set),
+  REST_ROUTE_BOOL("on", on_get, on_set),
+  REST_ROUTE_ENUM("mode", modes, mode_get, mode_set),
+  REST_ROUTE_FLOAT("temp", 1, temp_get, temp_set),
+  REST_ROUTE_INT("count", 0, 0, count_get, NULL),
+  REST_ROUTE_CUSTOM("custom", custom),
+  REST_ROUTE_CUSTOM("uptime", rest_uptime_handler),
+};
+
+static void router()
+{
+  static rest_router_t r;
+  assert(rest_router_init(&r, routes, sizeof(routes) / sizeof(routes[0])) == ESP_OK);
+
+  // the table: every name, nothing else
+  for (auto & route : routes) assert(rest_router_find(&r, route.name) == &route);
+  assert(!rest_router_find(&r, "") && !rest_router_find(&r, "bright") && !rest_router_find(&r, "brightnesss"));
+
+  static rest_router_t bad;
+  const rest_route_t twice[] = { routes[0], routes[1], routes[0] };
+  assert(rest_router_init(&bad, twice, 3) != ESP_OK);
+  std::vector<rest_route_t> many(REST_ROUTES_MAX + 1, routes[0]);
+  std::vector<std::string> names(many.size());
+  for (size_t i = 0; i < many.size(); i++) { names[i] = "r" + std::to_string(i); many[i].name = names[i].c_str(); }
+  assert(rest_router_init(&bad, many.data(), REST_ROUTES_MAX + 1) != ESP_OK);
+  assert(rest_router_init(&bad, many.data(), REST_ROUTES_MAX) == ESP_OK);
+  for (int i = 0; i < REST_ROUTES_MAX; i++) assert(rest_router_find(&bad, names[i].c_str()) == &many[i]);
+  assert(!rest_router_find(&bad, names[REST_ROUTES_MAX].c_str()));
+
+  // GET, each type as text
+  request(&r, HTTP_GET, "/rest/brightness");       assert(ok("10") && g_resp.type == "text/plain");
+  request(&r, HTTP_GET, "/rest/on");               assert(ok("true"));
+  request(&r, HTTP_GET, "/rest/mode");             assert(ok("off"));
+  request(&r, HTTP_GET, "/rest/temp");             assert(ok("21.5"));
+  request(&r, HTTP_GET, "/rest/count?x=1");        assert(ok("42"));
+  request(&r, HTTP_GET, "/rest/nope");             assert(g_resp.err == HTTPD_404_NOT_FOUND);
+  request(&r, HTTP_GET, "/rest/a_name_much_longer_than_any_route_is"); assert(g_resp.err == HTTPD_404_NOT_FOUND);
+  g_mode = 7;
+  request(&r, HTTP_GET, "/rest/mode");             assert(g_resp.err == HTTPD_500_INTERNAL_SERVER_ERROR);
+  g_mode = 0;
+
+  // POST, in range and not
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":200}"); assert(ok("") && g_brightness == 200);
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":256}"); assert(g_resp.err == HTTPD_400_BAD_REQUEST && g_brightness == 200);
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":-1}");  assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":1.5}"); assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":\"9\"}"); assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  request(&r, HTTP_POST, "/rest/brightness", "{\"other\":9}");        assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":9");    assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  request(&r, HTTP_POST, "/rest/brightness");                         assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  assert(g_brightness == 200);
+
+  request(&r, HTTP_POST, "/rest/on", "{\"on\":false}"); assert(ok("") && g_on == 0);
+  request(&r, HTTP_POST, "/rest/on", "{\"on\":1}");     assert(ok("") && g_on == 1);
+  request(&r, HTTP_POST, "/rest/on", "{\"on\":2}");     assert(g_resp.err == HTTPD_400_BAD_REQUEST && g_on == 1);
+
+  request(&r, HTTP_POST, "/rest/mode", "{\"mode\":\"auto\"}"); assert(ok("") && g_mode == 1);
+  request(&r, HTTP_POST, "/rest/mode", "{\"mode\":0}");        assert(ok("") && g_mode == 0);
+  request(&r, HTTP_POST, "/rest/mode", "{\"mode\":3}");        assert(g_resp.err == HTTPD_400_BAD_REQUEST && g_mode == 0);
+  request(&r, HTTP_POST, "/rest/mode", "{\"mode\":\"Auto\"}"); assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+  // the setter says no, so does the response
+  request(&r, HTTP_POST, "/rest/mode", "{\"mode\":\"manual\"}"); assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+
+  request(&r, HTTP_POST, "/rest/temp", "{\"temp\":-3.25}"); assert(ok("") && g_temp == -3.25f);
+  request(&r, HTTP_POST, "/rest/temp", "{\"temp\":\"x\"}"); assert(g_resp.err == HTTPD_400_BAD_REQUEST);
+
+  request(&r, HTTP_POST, "/rest/count", "{\"count\":0}");   assert(g_resp.err == HTTPD_405_METHOD_NOT_ALLOWED);
+  request(&r, HTTP_PUT, "/rest/brightness", "{\"brightness\":1}"); assert(g_resp.err == HTTPD_405_METHOD_NOT_ALLOWED);
+
+  // custom handlers get the body, or NULL
+  request(&r, HTTP_PATCH, "/rest/custom", "{\"a\":[1,2]}"); assert(ok("custom") && g_custom == "{\"a\":[1,2]}");
+  request(&r, HTTP_GET, "/rest/custom");                    assert(ok("custom") && g_custom == "(none)");
+  request(&r, HTTP_GET, "/rest/uptime");                    assert(g_resp.err < 0 && g_resp.body.size() > 0);
+
+  // the body: in pieces and with timeouts, at the limit, over it, and a dropped socket
+  request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":  77}", { 3, 0, 1, 0, 0, 5, 100 });
+  assert(ok("") && g_brightness == 77 && g_recv_step == 7);
+  std::string big = "{\"brightness\":" + std::string(REST_CONTENT_MAX - 17, ' ') + "33}";
+  assert(big.size() == REST_CONTENT_MAX);
+  request(&r, HTTP_POST, "/rest/brightness", big.c_str()); assert(ok("") && g_brightness == 33);
+  big.insert(1, " ");
+  assert(request(&r, HTTP_POST, "/rest/brightness", big.c_str()) == ESP_FAIL);
+  assert(g_resp.status == "413 Payload Too Large" && g_body_off == 0 && g_brightness == 33);
+  assert(request(&r, HTTP_POST, "/rest/brightness", "{\"brightness\":1}", { 4, -1 }) == ESP_FAIL);
+  assert(g_resp.err == HTTPD_500_INTERNAL_SERVER_ERROR && g_brightness == 33);
+
+  printf("router: %d routes and a full table of %d found by name, GET and POST of each type, ranges, 404 405 413 500, bodies in pieces, %d requests timed\n",
+    (int) (sizeof(routes) / sizeof(routes[0])), REST_ROUTES_MAX, g_requests_done);
+}
+
+// ---- rest_json
+
+static bool collect(void *ctx, const char *buf, size_t len)
+{
+  ((std::string *) ctx)->append(buf, len);
+  return true;
+}
+
+static bool refuse(void *ctx, const char *buf, size_t len) { return false; }
+
+static void write_doc(json_writer_t *w)
+{
+  json_obj_begin(w, NULL);
+  json_int(w, "a", -9000000000LL);
+  json_bool(w, "b", true);
+  json_str(w, "s", "q\"\\\n\x01");
+  json_arr_begin(w, "l");
+  for (int i = 0; i < 3; i++) {
+    json_obj_begin(w, NULL);
+    json_int(w, "i", i);
+    json_arr_begin(w, "e");
+    json_arr_end(w);
+    json_obj_end(w);
+  }
+  json_arr_end(w);
+  json_obj_end(w);
+}
+
+static void json()
+{
+  const char *want = "{\"a\":-9000000000,\"b\":true,\"s\":\"q\\\"\\\\\\u000a\\u0001\",\"l\":[{\"i\":0,\"e\":[]},{\"i\":1,\"e\":[]},{\"i\":2,\"e\":[]}]}";
+
+  // all in one buffer
+  char buf[256];
+  json_writer_t w;
+  json_writer_init(&w, buf, sizeof(buf), NULL, NULL);
+  write_doc(&w);
+  int len = json_writer_finish(&w);
+  assert(len == (int) strlen(want) && memcmp(buf, want, len) == 0);
+
+  // through every buffer size down to one byte, the same
+  for (size_t sz = 1; sz < 64; sz++) {
+    std::string out;
+    json_writer_init(&w, buf, sz, collect, &out);
+    write_doc(&w);
+    assert(json_writer_finish(&w) == 0 && out == want);
+  }
+
+  // doesn't fit, or the flush fails, or it isn't closed
+  json_writer_init(&w, buf, 16, NULL, NULL);
+  write_doc(&w);
+  assert(json_writer_finish(&w) == -1);
+  json_writer_init(&w, buf, 16, refuse, NULL);
+  write_doc(&w);
+  assert(json_writer_finish(&w) == -1);
+  json_writer_init(&w, buf, sizeof(buf), NULL, NULL);
+  json_obj_begin(&w, NULL);
+  assert(json_writer_finish(&w) == -1);
+
+  // what it wrote parses back
+  json_tok_t toks[64];
+  int n = json_parse(want, strlen(want), toks, 64);
+  assert(n > 0 && toks[0].type == JSON_OBJECT && toks[0].size == 8);
+  int v;
+  bool b;
+  assert(json_tok_int(want, &toks[json_obj_get(want, toks, n, 0, "a")], &v) == false);   // past int32
+  assert(json_tok_bool(want, &toks[json_obj_get(want, toks, n, 0, "b")], &b) && b);
+  int l = json_obj_get(want, toks, n, 0, "l");
+  assert(toks[l].type == JSON_ARRAY && toks[l].size == 3);
+  int e = l + 1;
+  for (int i = 0; i < 3; i++, e = json_skip(toks, n, e)) {
+    assert(json_tok_int(want, &toks[json_obj_get(want, toks, n, e, "i")], &v) && v == i);
+  }
+  assert(e == n && json_obj_get(want, toks, n, 0, "i") == -1 && json_obj_get(want, toks, n, l, "i") == -1);
+
+  // good
+  const char *good[] = { "{}", "[]", " { \"a\" : [ 1 , { } , \"x\" ] } ", "7", "\"s\"", "[[[[]]]]", "{\"k\":null}" };
+  for (auto s : good) assert(json_parse(s, strlen(s), toks, 64) > 0);
+  // not JSON
+  const char *inval[] = { "{,}", "[1,]", "{\"a\"}", "{\"a\":}", "{1:2}", "[1 2]", "{}x", "]", "[}", "{\"a\"::1}", "[\"\x01\"]", "[@]" };
+  for (auto s : inval) assert(json_parse(s, strlen(s), toks, 64) == JSON_ERR_INVAL);
+  // ends in the middle
+  const char *part[] = { "", "{", "[1,", "{\"a\":1", "\"abc" };
+  for (auto s : part) assert(json_parse(s, strlen(s), toks, 64) == JSON_ERR_PART);
+  // too many tokens, too deep
+  assert(json_parse("[1,2,3]", 7, toks, 3) == JSON_ERR_NOMEM);
+  std::string deep = std::string(JSON_MAX_DEPTH + 1, '[') + std::string(JSON_MAX_DEPTH + 1, ']');
+  assert(json_parse(deep.c_str(), deep.size(), toks, 64) == JSON_ERR_NOMEM);
+
+  // numbers
+  const char *nums = "[0,-0,2147483647,-2147483647,2147483648,1e3,-,01.5,3.5]";
+  n = json_parse(nums, strlen(nums), toks, 64);
+  assert(n == 10);
+  const int want_ok[] = { 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+  for (int i = 0; i < 9; i++) assert(json_tok_int(nums, &toks[1 + i], &v) == (bool) want_ok[i]);
+  float f;
+  assert(json_tok_float(nums, &toks[6], &f) && f == 1000.0f);
+  assert(json_tok_float(nums, &toks[9], &f) && f == 3.5f);
+  assert(!json_tok_float(nums, &toks[7], &f));
+
+  printf("rest_json: the writer the same through buffers of 1 to 63 bytes, errors when it can't finish; the tokenizer on %d good, %d bad and %d partial texts\n",
+    (int) (sizeof(good) / sizeof(good[0])), (int) (sizeof(inval) / sizeof(inval[0])), (int) (sizeof(part) / sizeof(part[0])));
+}
+
+// ---- lookup, against the chain of strcmp it replaced
+
+static void timing()
+{
+  // ledc's routes
+  static const char *names[] = { "uptime", "epoch", "led_mode", "led_speed", "led_brightness", "led_palette",
+    "led_color", "segments", "state", "playlist", "frame", "power", "fps", "cmd_stats", "server", "flash",
+    "realtime", "sync", "sync_role", "wifi" };
+  const int n = sizeof(names) / sizeof(names[0]);
+  std::vector<rest_route_t> table(n, routes[4]);
+  for (int i = 0; i < n; i++) table[i].name = names[i];
+  static rest_router_t r;
+  assert(rest_router_init(&r, table.data(), n) == ESP_OK);
+
+  const int N = 2000000;
+  volatile uintptr_t sink = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int k = 0; k < N; k++) sink += (uintptr_t) rest_router_find(&r, names[k % n]);
+  double hash_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / N;
+
+  t0 = std::chrono::steady_clock::now();
+  for (int k = 0; k < N; k++) {
+    const char *want = names[k % n];
+    for (int i = 0; i < n; i++) if (strcmp(table[i].name, want) == 0) { sink += i; break; }
+  }
+  double chain_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / N;
+
+  printf("lookup over %d routes on this host: hashed %.1f ns, strcmp chain %.1f ns\n", n, hash_ns, chain_ns);
+}
+
+int main()
+{
+  router();
+  json();
+  timing();
+  return 0;
+}
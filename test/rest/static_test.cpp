@@ -0,0 +1,155 @@
+// Static files ( RestRouter-idf rest_static.cpp ) against a fake
+// esp_http_server: a page with a gzipped copy and an image without one,
+// asked for the ways browsers and caches ask. Plain or gzipped by
+// Accept-Encoding, each with its own ETag and Vary when there's a choice.
+// A 304 only when If-None-Match names the copy that would be sent: a cache
+// holding the plain copy that revalidates with gzip on gets the gzipped
+// body, not a 304. Bodies go out in REST_STATIC_CHUNK pieces and a failed
+// send stops there; a header too long to read counts as not there.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "rest_router.h"
+
+// ---- the fake server: request headers in, what was sent back out
+
+struct resp_t {
+  std::string status;   // "200 OK" unless set
+  std::string type;
+  std::map<std::string, std::string> hdrs;
+  std::string body;
+  std::vector<size_t> chunks;
+  bool done;            // the empty chunk, or httpd_resp_send
+};
+
+static resp_t g_resp;
+static std::map<std::string, std::string> g_req_hdrs;
+static int g_fail_chunk;    // the send that fails, -1 none
+
+const char *esp_err_to_name(esp_err_t code) { return "err"; }
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+  auto h = g_req_hdrs.find(field);
+  return h == g_req_hdrs.end() ? 0 : h->second.size();
+}
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+  auto h = g_req_hdrs.find(field);
+  if (h == g_req_hdrs.end()) return ESP_ERR_NOT_FOUND;
+  if (h->second.size() >= val_size) return ESP_ERR_INVALID_SIZE;
+  strcpy(val, h->second.c_str());
+  return ESP_OK;
+}
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) { g_resp.hdrs[field] = value; return ESP_OK; }
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) { g_resp.status = status; return ESP_OK; }
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) { g_resp.type = type; return ESP_OK; }
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  g_resp.body.append(buf ? buf : "", buf ? buf_len : 0);
+  g_resp.done = true;
+  return ESP_OK;
+}
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  if (g_fail_chunk == (int) g_resp.chunks.size()) return ESP_FAIL;
+  if (buf == NULL) {
+    g_resp.done = true;
+    return ESP_OK;
+  }
+  g_resp.chunks.push_back(buf_len);
+  g_resp.body.append(buf, buf_len);
+  return ESP_OK;
+}
+
+static esp_err_t request(const rest_static_t *content, std::map<std::string, std::string> hdrs, int fail_chunk = -1)
+{
+  static httpd_req_t req;
+  memset(&req, 0, sizeof req);
+  req.method = HTTP_GET;
+  g_req_hdrs = hdrs;
+  g_fail_chunk = fail_chunk;
+  g_resp = resp_t();
+  g_resp.status = "200 OK";
+  return rest_static_send(&req, content);
+}
+
+static bool has(const char *hdr) { return g_resp.hdrs.count(hdr) > 0; }
+static const std::string &hdr(const char *h) { return g_resp.hdrs[h]; }
+
+// ---- the app's side
+
+static std::string g_page, g_page_gz, g_image;
+
+static const char *ETAG_PAGE = "\"1111111111111111\"";
+static const char *ETAG_PAGE_GZ = "\"2222222222222222\"";
+static const char *ETAG_IMAGE = "\"3333333333333333\"";
+
+int main()
+{
+  for (int i = 0; i < 10000; i++) g_page += (char) ('a' + i % 26);
+  for (int i = 0; i < 2500; i++) g_page_gz += (char) (i * 7);
+  for (int i = 0; i < 4096; i++) g_image += (char) (i * 13);
+
+  const rest_static_t page = { "index.html", "text/html",
+    (const uint8_t *) g_page.data(), (ssize_t) g_page.size(),
+    (const uint8_t *) g_page_gz.data(), (ssize_t) g_page_gz.size(),
+    ETAG_PAGE, ETAG_PAGE_GZ };
+  const rest_static_t image = { "cheese.jpg", "image/jpg",
+    (const uint8_t *) g_image.data(), (ssize_t) g_image.size(), NULL, 0, ETAG_IMAGE, NULL };
+
+  const char *gzip = "gzip, deflate, br";
+
+  // plain, in pieces
+  assert(request(&page, {}) == ESP_OK);
+  assert(g_resp.status == "200 OK" && g_resp.type == "text/html" && g_resp.done);
+  assert(g_resp.body == g_page && hdr("ETag") == ETAG_PAGE && !has("Content-Encoding"));
+  assert(hdr("Vary") == "Accept-Encoding");
+  assert(g_resp.chunks.size() == 3 && g_resp.chunks[0] == REST_STATIC_CHUNK && g_resp.chunks[2] == 10000 - 2 * REST_STATIC_CHUNK);
+  printf("plain: %zu bytes in %zu chunks, ETag %s\n", g_resp.body.size(), g_resp.chunks.size(), hdr("ETag").c_str());
+
+  // gzipped, its own ETag
+  assert(request(&page, { { "Accept-Encoding", gzip } }) == ESP_OK);
+  assert(g_resp.status == "200 OK" && g_resp.body == g_page_gz && g_resp.done);
+  assert(hdr("Content-Encoding") == "gzip" && hdr("ETag") == ETAG_PAGE_GZ && hdr("Vary") == "Accept-Encoding");
+  printf("gzip: %zu bytes, ETag %s\n", g_resp.body.size(), hdr("ETag").c_str());
+
+  // revalidating the copy it would get: 304, nothing else
+  assert(request(&page, { { "Accept-Encoding", gzip }, { "If-None-Match", ETAG_PAGE_GZ } }) == ESP_OK);
+  assert(g_resp.status == "304 Not Modified" && g_resp.body.empty() && g_resp.done);
+  assert(hdr("ETag") == ETAG_PAGE_GZ && !has("Content-Encoding"));
+  assert(request(&page, { { "If-None-Match", ETAG_PAGE } }) == ESP_OK);
+  assert(g_resp.status == "304 Not Modified" && g_resp.body.empty() && hdr("ETag") == ETAG_PAGE);
+  // one of a list, or weak from a proxy
+  std::string list = std::string("\"0000000000000000\", W/") + ETAG_PAGE_GZ;
+  assert(request(&page, { { "Accept-Encoding", gzip }, { "If-None-Match", list } }) == ESP_OK);
+  assert(g_resp.status == "304 Not Modified");
+
+  // holding the other copy: the one it asked for, whole
+  assert(request(&page, { { "Accept-Encoding", gzip }, { "If-None-Match", ETAG_PAGE } }) == ESP_OK);
+  assert(g_resp.status == "200 OK" && g_resp.body == g_page_gz && hdr("ETag") == ETAG_PAGE_GZ);
+  assert(request(&page, { { "If-None-Match", ETAG_PAGE_GZ } }) == ESP_OK);
+  assert(g_resp.status == "200 OK" && g_resp.body == g_page && hdr("ETag") == ETAG_PAGE);
+  printf("revalidating: 304 for the copy held, the other copy in full when encodings differ\n");
+
+  // nothing to choose between: no Vary, and gzip doesn't matter
+  assert(request(&image, { { "Accept-Encoding", gzip } }) == ESP_OK);
+  assert(g_resp.body == g_image && !has("Vary") && !has("Content-Encoding") && hdr("ETag") == ETAG_IMAGE);
+  assert(g_resp.chunks.size() == 1 && g_resp.type == "image/jpg");
+  assert(request(&image, { { "Accept-Encoding", gzip }, { "If-None-Match", ETAG_IMAGE } }) == ESP_OK);
+  assert(g_resp.status == "304 Not Modified");
+
+  // the socket gives out on the second piece
+  assert(request(&page, {}, 1) == ESP_FAIL);
+  assert(g_resp.chunks.size() == 1 && !g_resp.done);
+
+  // too long to read is as good as not sent
+  std::string long_inm(200, ' ');
+  long_inm += ETAG_PAGE;
+  assert(request(&page, { { "If-None-Match", long_inm } }) == ESP_OK);
+  assert(g_resp.status == "200 OK" && g_resp.body == g_page);
+  printf("no choice of encoding: no Vary; a failed send stops; a header too long is ignored\n");
+  return 0;
+}
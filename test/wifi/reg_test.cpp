@@ -0,0 +1,144 @@
+// The AP registry ( WiFiMulti-idf wifi_reg.c ). Empty, too long and a full
+// 32 byte SSID, the radio's 32 bytes with no null after, the same SSID twice,
+// filling every slot and one past, and names that only start the same. Then
+// a scan of WIFI_REG_MAX records, a third of them ours, looked up against a
+// full registry, next to the way it was done before: the records copied to
+// the heap and each walked down a linked list of the APs. malloc is counted,
+// the registry shouldn't call it.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <chrono>
+
+#include "wifi_reg.h"
+
+// glibc's own, so every malloc in the program comes through here
+extern "C" void *__libc_malloc(size_t n);
+
+static unsigned long g_mallocs;
+
+extern "C" void *malloc(size_t n)
+{
+  g_mallocs++;
+  return __libc_malloc(n);
+}
+
+#define U(s) ((const uint8_t *) (s))
+
+// the old way
+struct node_t {
+  node_t *next;
+  uint8_t ssid[WIFI_REG_SSID_LEN];
+};
+
+static node_t *g_head;
+
+static node_t *old_find(const uint8_t *ssid)
+{
+  for (node_t *c = g_head; c; c = c->next) {
+    if (strcmp((const char *) c->ssid, (const char *) ssid) == 0) return c;
+  }
+  return 0;
+}
+
+// about the size of a wifi_ap_record_t
+struct rec_t {
+  uint8_t ssid[WIFI_REG_SSID_LEN];
+  int8_t rssi;
+  uint8_t pad[46];
+};
+
+static wifi_reg_t r;
+
+static void basics()
+{
+  bool added;
+  char name[40];
+  wifi_reg_init(&r);
+  assert(wifi_reg_find(&r, U("x")) == -1);
+  assert(wifi_reg_add(&r, U(""), &added) == -1);
+  assert(wifi_reg_add(&r, U("123456789012345678901234567890123"), &added) == -1);
+  assert(wifi_reg_add(&r, U("12345678901234567890123456789012"), &added) == 0 && added);
+
+  // the radio's 32 bytes, no null after
+  uint8_t raw[40];
+  memcpy(raw, "12345678901234567890123456789012", 32);
+  memset(raw + 32, 'Z', 8);
+  assert(wifi_reg_find(&r, raw) == 0);
+  assert(wifi_reg_add(&r, U("12345678901234567890123456789012"), &added) == 0 && !added);
+
+  for (int i = 1; i < WIFI_REG_MAX; i++) {
+    sprintf(name, "ap-%d", i);
+    assert(wifi_reg_add(&r, U(name), &added) == i && added);
+  }
+  assert(wifi_reg_add(&r, U("one-too-many"), &added) == -1);
+  for (int i = 1; i < WIFI_REG_MAX; i++) {
+    sprintf(name, "ap-%d", i);
+    assert(wifi_reg_find(&r, U(name)) == i);
+    assert(strcmp((const char *) r.ssid[i], name) == 0);
+  }
+  assert(wifi_reg_find(&r, U("ap-")) == -1 && wifi_reg_find(&r, U("ap-1x")) == -1);
+
+  int coll = 0;
+  for (int i = 0; i < WIFI_REG_MAX; i++) {
+    for (int j = i + 1; j < WIFI_REG_MAX; j++) {
+      if ((r.hash[i] & (WIFI_REG_BUCKETS - 1)) == (r.hash[j] & (WIFI_REG_BUCKETS - 1))) coll++;
+    }
+  }
+  printf("full registry of %d: %d share a bucket, all found\n", WIFI_REG_MAX, coll);
+}
+
+static void timing()
+{
+  static rec_t scan[WIFI_REG_MAX];
+  for (int i = 0; i < WIFI_REG_MAX; i++) {
+    if (i % 3 == 0) sprintf((char *) scan[i].ssid, "ap-%d", 1 + i);
+    else sprintf((char *) scan[i].ssid, "neighbour-%d-%s", i, i % 2 ? "5G" : "guest");
+  }
+  for (int i = WIFI_REG_MAX - 1; i >= 0; i--) {
+    node_t *n = (node_t *) calloc(1, sizeof(*n));
+    strcpy((char *) n->ssid, (const char *) r.ssid[i]);
+    n->next = g_head;
+    g_head = n;
+  }
+
+  const int scans = 200000;
+  volatile long hits = 0;
+  unsigned long m0 = g_mallocs;
+  auto a = std::chrono::steady_clock::now();
+  for (int k = 0; k < scans; k++) {
+    rec_t *l = (rec_t *) malloc(sizeof(scan));
+    memcpy(l, scan, sizeof(scan));
+    for (int i = 0; i < WIFI_REG_MAX; i++) hits += old_find(l[i].ssid) != 0;
+    free(l);
+  }
+  auto b = std::chrono::steady_clock::now();
+  double old_ns = std::chrono::duration<double, std::nano>(b - a).count() / scans;
+  unsigned long old_m = g_mallocs - m0;
+
+  static rec_t buf[WIFI_REG_MAX];
+  uint32_t f0 = r.n_finds, p0 = r.n_probes;
+  m0 = g_mallocs;
+  a = std::chrono::steady_clock::now();
+  for (int k = 0; k < scans; k++) {
+    memcpy(buf, scan, sizeof(scan));
+    for (int i = 0; i < WIFI_REG_MAX; i++) hits += wifi_reg_find(&r, buf[i].ssid) >= 0;
+  }
+  b = std::chrono::steady_clock::now();
+  double new_ns = std::chrono::duration<double, std::nano>(b - a).count() / scans;
+  unsigned long new_m = g_mallocs - m0;
+
+  printf("a scan of %d records against %d APs, on this host: the list %.0f ns, %lu mallocs; the registry %.0f ns, %lu mallocs, %.2f probes a lookup\n",
+    WIFI_REG_MAX, WIFI_REG_MAX, old_ns, old_m, new_ns, new_m, (double) (r.n_probes - p0) / (r.n_finds - f0));
+  assert(old_m == (unsigned long) scans && new_m == 0);
+}
+
+int main()
+{
+  basics();
+  timing();
+  return 0;
+}
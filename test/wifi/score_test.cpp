@@ -0,0 +1,221 @@
+// AP scoring and roaming ( WiFiMulti-idf wifi_score.c ) through traces, next
+// to the pick it replaced: most successes * 2 - fails, then the last RSSI.
+// Two APs a dB apart with noisy scans, reconnecting now and then: how often
+// the choice flips. The strong AP with a wrong password for an hour: how
+// soon it's chosen again once fixed ( the old pick held the fails forever ).
+// Walking from one AP to the other: one roam, and how long the radio's away
+// from the AP scanning, a short active scan against a passive one. Two weak
+// APs a dB apart for an hour: it stays put.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#include "wifi_score.h"
+
+#define S(x) ((int64_t) (x) * 1000000)
+
+// the IDF's passive dwell, and the channels a scan covers
+#define PASSIVE_MS 360
+#define CHANNELS 13
+
+struct ap_t {
+  wifi_score_t sc;
+  int succ, fail, last_rssi;
+};
+
+// about N(0,1)
+static double noise()
+{
+  double u = 0;
+  for (int i = 0; i < 12; i++) u += rand() / (double) RAND_MAX;
+  return u - 6;
+}
+
+static int pick_old(ap_t *a, int n)
+{
+  int r = -1;
+  for (int i = 0; i < n; i++) {
+    if (r < 0) { r = i; continue; }
+    int cf = a[i].succ * 2 - a[i].fail, rf = a[r].succ * 2 - a[r].fail;
+    if (cf > rf) { r = i; continue; }
+    if (a[i].last_rssi > a[r].last_rssi) r = i;
+  }
+  return r;
+}
+
+static int pick_new(ap_t *a, int n, int64_t now)
+{
+  int r = -1;
+  int32_t rs = 0;
+  for (int i = 0; i < n; i++) {
+    int32_t s = wifi_score_get(&a[i].sc, now);
+    if (r < 0 || s > rs) { r = i; rs = s; }
+  }
+  return r;
+}
+
+static void scan(ap_t *a, int n, const double *mean, double sd, int64_t now)
+{
+  for (int i = 0; i < n; i++) {
+    int x = (int) lround(mean[i] + sd * noise());
+    a[i].last_rssi = x;
+    wifi_score_rssi(&a[i].sc, x, now);
+  }
+}
+
+static void init(ap_t *a, int n)
+{
+  for (int i = 0; i < n; i++) {
+    a[i] = ap_t();
+    wifi_score_init(&a[i].sc);
+  }
+}
+
+static void near_tie()
+{
+  ap_t a[2];
+  init(a, 2);
+  double mean[2] = { -65, -66 };
+  int old_prev = -1, new_prev = -1, old_flips = 0, new_flips = 0, drops = 0;
+  for (int64_t t = 1; t < 4 * 3600; t++) {
+    int64_t now = S(t);
+    if (t % 5 == 0) scan(a, 2, mean, 4, now);
+    if (t > 20 && rand() % 120 == 0) {
+      drops++;
+      int o = pick_old(a, 2), n = pick_new(a, 2, now);
+      if (old_prev >= 0 && o != old_prev) old_flips++;
+      if (new_prev >= 0 && n != new_prev) new_flips++;
+      old_prev = o;
+      new_prev = n;
+      wifi_score_success(&a[n].sc, now);
+    }
+  }
+  printf("two APs a dB apart, noisy, 4 hours: %d reconnects, the old pick changed AP %d times, this %d\n",
+    drops, old_flips, new_flips);
+  assert(new_flips < old_flips);
+}
+
+static void bad_password()
+{
+  ap_t a[2];
+  init(a, 2);
+  double mean[2] = { -50, -72 };
+  int64_t back = -1;
+  int bad = 0, tries = 0;
+  for (int64_t t = 1; t < 3 * 3600; t++) {
+    int64_t now = S(t);
+    if (t % 5 == 0) scan(a, 2, mean, 2, now);
+    if (t % 60 != 0) continue;
+    bool fixed = t > 3600;
+    if (!fixed) tries++;
+    int n = pick_new(a, 2, now);
+    if (n == 0 && !fixed) {
+      bad++;
+      wifi_score_fail(&a[0].sc, WIFI_SCORE_AUTH, now);
+    }
+    else {
+      wifi_score_success(&a[n].sc, now);
+      wifi_score_fail(&a[n].sc, WIFI_SCORE_LEFT, now);
+    }
+    if (fixed && n == 0 && back < 0) back = t - 3600;
+  }
+
+  // the old pick, on its own history: fails never go away
+  ap_t o[2];
+  init(o, 2);
+  o[0].last_rssi = -50;
+  o[1].last_rssi = -72;
+  int64_t old_back = -1;
+  for (int64_t t = 60; t < 3 * 3600; t += 60) {
+    bool fixed = t > 3600;
+    int p = pick_old(o, 2);
+    if (p == 0 && !fixed) o[0].fail++;
+    else o[p].succ++;
+    if (fixed && p == 0 && old_back < 0) old_back = t - 3600;
+  }
+  printf("wrong password on the strong AP for an hour: tried it %d of %d times, back on it %llds after the fix, the old pick %s\n",
+    bad, tries, (long long) back, old_back < 0 ? "never in 2 hours" : "came back");
+  assert(back >= 0 && back < 20 * 60);
+  assert(bad < tries / 4);
+}
+
+static void walk()
+{
+  ap_t a[2];
+  init(a, 2);
+  wifi_roam_t r = {};
+  int cur = 0, roams = 0, scans = 0;
+  int64_t first = -1;
+  wifi_roam_reset(&r, S(1));
+  wifi_score_success(&a[0].sc, S(1));
+  // five minutes at A, five walking, five at B
+  const int64_t secs = 900;
+  for (int64_t t = 1; t < secs; t++) {
+    int64_t now = S(t);
+    double f = t < 300 ? 0 : t > 600 ? 1 : (t - 300) / 300.0;
+    double mean[2] = { -55 - 30 * f, -85 + 30 * f };
+    wifi_roam_rssi(&r, (int) lround(mean[cur] + 3 * noise()));
+    if (!wifi_roam_scan_due(&r, now)) continue;
+    wifi_roam_scanned(&r, now);
+    scans++;
+    scan(a, 2, mean, 3, now);
+    int32_t cs = r.rssi + wifi_score_history(&a[cur].sc, now);
+    if (wifi_roam_check(&r, cs, true, wifi_score_get(&a[1 - cur].sc, now), now)) {
+      roams++;
+      if (first < 0) first = t;
+      cur = 1 - cur;
+      wifi_roam_reset(&r, now);
+      wifi_score_success(&a[cur].sc, now);
+    }
+  }
+  double fa = (first - 300) / 300.0;
+  printf("walking from A to B: %d roam, at %llds, A at %.0f dBm and B at %.0f\n",
+    roams, (long long) first, -55 - 30 * fa, -85 + 30 * fa);
+  assert(roams == 1 && cur == 1);
+
+  // every roaming scan has the radio away from the AP for all of it, one every WIFI_ROAM_SCAN_US while weak
+  double active = CHANNELS * WIFI_ROAM_SCAN_MAX_MS / 1000.0;
+  double passive = CHANNELS * PASSIVE_MS / 1000.0;
+  double every = WIFI_ROAM_SCAN_US / 1e6;
+  printf("  %d roaming scans, each away from the AP up to %.2fs, %.1f%% of the time while weak; passive %.2fs, %.1f%%\n",
+    scans, active, 100 * active / every, passive, 100 * passive / every);
+  assert(active / every < 0.05);
+}
+
+static void two_weak()
+{
+  ap_t a[2];
+  init(a, 2);
+  wifi_roam_t r = {};
+  int cur = 0, roams = 0;
+  wifi_roam_reset(&r, S(1));
+  double mean[2] = { -78, -77 };
+  for (int64_t t = 1; t < 3600; t++) {
+    int64_t now = S(t);
+    wifi_roam_rssi(&r, (int) lround(mean[cur] + 4 * noise()));
+    if (!wifi_roam_scan_due(&r, now)) continue;
+    wifi_roam_scanned(&r, now);
+    scan(a, 2, mean, 4, now);
+    int32_t cs = r.rssi + wifi_score_history(&a[cur].sc, now);
+    if (wifi_roam_check(&r, cs, true, wifi_score_get(&a[1 - cur].sc, now), now)) {
+      roams++;
+      cur = 1 - cur;
+      wifi_roam_reset(&r, now);
+    }
+  }
+  printf("two weak APs a dB apart, an hour: %d roams\n", roams);
+  assert(roams <= 1);
+}
+
+int main()
+{
+  srand(7);
+  near_tie();
+  bad_password();
+  walk();
+  two_weak();
+  return 0;
+}